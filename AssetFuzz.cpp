@@ -0,0 +1,158 @@
+//
+// AssetFuzz.cpp
+//
+//    Fuzz target for the OBJ and BMP loaders, which see files pushed over
+//    the network. The loaders read from a path, so every input is written
+//    to a file first and then parsed as both. A model must come back with
+//    a buffer for its faces and a texture within MAX_TEXTURE_SIZE, or be
+//    rejected with no faces and no pixels. A violation aborts, and the
+//    sanitizers catch reads past the file.
+//
+//    Seeds are in Fuzz/Asset. Built with ASSET_FUZZ_STANDALONE the target
+//    has a main of its own that checks the files it is given instead:
+//    .obj and .bmp files whose names start with "bad-" must be rejected
+//    by their loader and all others accepted.
+//
+//    Usage: ghost-asset-fuzz [libFuzzer options] corpus...
+//           ghost-asset-fuzz-replay file...
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AssetLoader.h"
+#include "Memory.h"
+
+static void Fail(const char* pWhat, const char* pPath)
+{
+   fprintf(stderr, "AssetFuzz: %s: %s\n", pWhat, pPath);
+   abort();
+}
+
+///
+// Parse a file as a model.
+// \return 1 if it was accepted.
+//
+static int CheckOBJ(const char* pPath)
+{
+   unsigned int nFaces = 0;
+   int nAttributes = 0;
+   float* pVertexBuffer = ParseOBJ(pPath, nFaces, nAttributes);
+
+   if (pVertexBuffer == 0)
+      Fail("model has no buffer", pPath);
+
+   MemoryRelease(MEMORY_HEAP, (uintptr_t) pVertexBuffer);
+   delete[] pVertexBuffer;
+
+   return nFaces != 0;
+}
+
+///
+// Decode a file as a texture.
+// \return 1 if it was accepted.
+//
+static int CheckBMP(const char* pPath)
+{
+   int nWidth = -1;
+   int nHeight = -1;
+   unsigned char* pData = DecodeBMP(pPath, &nWidth, &nHeight);
+
+   if (pData == 0)
+   {
+      if (nWidth != 0 || nHeight != 0)
+         Fail("rejected texture has a size", pPath);
+
+      return 0;
+   }
+
+   if (nWidth <= 0 || nWidth > MAX_TEXTURE_SIZE ||
+       nHeight <= 0 || nHeight > MAX_TEXTURE_SIZE)
+   {
+      Fail("texture size out of range", pPath);
+   }
+
+   MemoryRelease(MEMORY_HEAP, (uintptr_t) pData);
+   delete[] pData;
+
+   return 1;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t nSize)
+{
+   // Pushed assets are much larger, but the loaders' limits are all hit
+   // well before this
+   if (nSize > (1 << 20))
+      return 0;
+
+   static char arPath[64];
+
+   if (arPath[0] == '\0')
+   {
+      SetAssetLoaderVerbose(0);
+      snprintf(arPath, sizeof(arPath), "/tmp/ghost-asset-fuzz-%d", (int) getpid());
+   }
+
+   FILE* pFile = fopen(arPath, "wb");
+
+   if (pFile == 0)
+      Fail("could not write the input", arPath);
+
+   fwrite(pData, 1, nSize, pFile);
+   fclose(pFile);
+
+   CheckOBJ(arPath);
+   CheckBMP(arPath);
+
+   unlink(arPath);
+   return 0;
+}
+
+#ifdef ASSET_FUZZ_STANDALONE
+
+int main(int argc, char *argv[])
+{
+   int nFailed = 0;
+
+   if (argc < 2)
+   {
+      printf("Usage: %s file...\n", argv[0]);
+      return 0;
+   }
+
+   SetAssetLoaderVerbose(0);
+
+   for (int i = 1; i < argc; i++)
+   {
+      const char* pName = strrchr(argv[i], '/');
+      const char* pExtension = strrchr(argv[i], '.');
+      int bExpected = 0;
+      int bAccepted = 0;
+
+      pName = (pName != 0) ? pName + 1 : argv[i];
+      bExpected = strncmp(pName, "bad-", 4) != 0;
+
+      if (pExtension != 0 && strcmp(pExtension, ".obj") == 0)
+         bAccepted = CheckOBJ(argv[i]);
+      else if (pExtension != 0 && strcmp(pExtension, ".bmp") == 0)
+         bAccepted = CheckBMP(argv[i]);
+      else
+      {
+         printf("Not an .obj or .bmp: %s\n", argv[i]);
+         return 1;
+      }
+
+      if (bAccepted != bExpected)
+      {
+         printf("%s: %s\n", argv[i], bAccepted ? "accepted" : "rejected");
+         nFailed++;
+      }
+   }
+
+   printf("Ran %d inputs, %d failed\n", argc - 1, nFailed);
+   return nFailed != 0;
+}
+
+#endif // ASSET_FUZZ_STANDALONE
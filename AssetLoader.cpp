@@ -0,0 +1,525 @@
+//
+// AssetLoader.cpp
+//
+//    The OBJ and BMP loaders. Files are read whole into a buffer per
+//    thread that grows to the largest file seen, so the size of a model
+//    is only limited by memory and models can load off the render
+//    thread.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AssetLoader.h"
+#include "Memory.h"
+#include "Profiler.h"
+#include "Trace.h"
+
+static thread_local char* s_pFileBuffer = 0;
+static thread_local long s_nFileBufferSize = 0;
+static int s_bVerbose = 1;
+
+void SetAssetLoaderVerbose(int bVerbose)
+{
+	s_bVerbose = bVerbose;
+}
+
+char* ReadAsset(const char* pFileName, long* pSize)
+{
+	FILE* pFile = 0;
+	long  nFileSize = 0;
+
+	ScopedTrace trace("ReadAsset");
+
+	*pSize = 0;
+
+	// Open the requested file.
+	pFile = fopen(pFileName, "rb");
+
+	// Check if file was found
+	if (pFile == 0)
+	{
+		printf("Asset could not be opened: %s\n", pFileName);
+		return 0;
+	}
+
+	// Check the file size.
+	fseek(pFile, 0, SEEK_END);
+	nFileSize = ftell(pFile);
+	fseek(pFile, 0, SEEK_SET);
+
+	// Grow the buffer to fit, with room for the terminator
+	if (nFileSize + 1 > s_nFileBufferSize)
+	{
+		ScopedMemoryAsset asset("file buffer");
+
+		MemoryRelease(MEMORY_HEAP, (uintptr_t) s_pFileBuffer);
+		delete[] s_pFileBuffer;
+
+		s_nFileBufferSize = nFileSize + 1;
+		s_pFileBuffer = new char[s_nFileBufferSize];
+		MemoryTrack(MEMORY_HEAP, (uintptr_t) s_pFileBuffer, s_nFileBufferSize);
+	}
+
+	// Read from file and store in character buffer.
+	if (fread(s_pFileBuffer, 1, nFileSize, pFile) != (size_t) nFileSize)
+	{
+		printf("Asset could not be read: %s\n", pFileName);
+		fclose(pFile);
+		return 0;
+	}
+
+	s_pFileBuffer[nFileSize] = '\0';
+	trace.SetBytes(nFileSize);
+
+	// Close file, it is no longer needed.
+	fclose(pFile);
+
+	*pSize = nFileSize;
+	return s_pFileBuffer;
+}
+
+void GetCounts(const char* pBuffer,
+	int& nNumVerts,
+	int& nNumUVs,
+	int& nNumNormals,
+	int& nNumFaces)
+{
+	const char* pNewLine = 0;
+	const char* pStr = 0;
+
+	nNumVerts = 0;
+	nNumFaces = 0;
+	nNumNormals = 0;
+	nNumUVs = 0;
+
+	ScopedTrace trace("GetCounts");
+
+	pStr = pBuffer;
+
+	while (1)
+	{
+		// Find the next newline
+		pNewLine = strchr(pStr, '\n');
+
+		// If a null pointer was returned, that means
+		// a null terminator was hit.
+		if (pNewLine == 0)
+		{
+			break;
+		}
+
+		// Parse the beginning of each line to count
+		// the total number of vertices/UVs/normals/faces.
+		if (pStr[0] == 'v' &&
+			pStr[1] == ' ')
+		{
+			nNumVerts++;
+		}
+		else if (pStr[0] == 'v' &&
+			pStr[1] == 't')
+		{
+			nNumUVs++;
+		}
+		else if (pStr[0] == 'v' &&
+			pStr[1] == 'n')
+		{
+			nNumNormals++;
+		}
+		else if (pStr[0] == 'f')
+		{
+			nNumFaces++;
+		}
+
+		// Now move the pointer to the next line.
+		pStr = pNewLine + 1;
+	}
+
+	if (s_bVerbose)
+		printf("Face Count: %d\n", nNumFaces);
+}
+
+void GenerateVertexBuffer(int nNumFaces,
+	float* pVertices,
+	float* pUVs,
+	float* pNormals,
+	int*   pFaces,
+	float* pVB)
+{
+	ScopedTrace trace("GenerateVertexBuffer");
+
+	if (pVB != 0)
+	{
+		//Add vertex data for each face	
+		for (int i = 0; i < nNumFaces; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				const int* pIndices = &pFaces[i * 9 + j * 3];
+				float* pDst = &pVB[i * 24 + j * 8];
+
+				pDst[0] = pVertices[(pIndices[0] - 1) * 3 + 0];
+				pDst[1] = pVertices[(pIndices[0] - 1) * 3 + 1];
+				pDst[2] = pVertices[(pIndices[0] - 1) * 3 + 2];
+
+				// Faces without texcoords or normals get zeros
+				if (pIndices[1] > 0)
+				{
+					pDst[3] = pUVs[(pIndices[1] - 1) * 2 + 0];
+					pDst[4] = pUVs[(pIndices[1] - 1) * 2 + 1];
+				}
+				else
+				{
+					pDst[3] = 0.0f;
+					pDst[4] = 0.0f;
+				}
+
+				if (pIndices[2] > 0)
+				{
+					pDst[5] = pNormals[(pIndices[2] - 1) * 3 + 0];
+					pDst[6] = pNormals[(pIndices[2] - 1) * 3 + 1];
+					pDst[7] = pNormals[(pIndices[2] - 1) * 3 + 2];
+				}
+				else
+				{
+					pDst[5] = 0.0f;
+					pDst[6] = 0.0f;
+					pDst[7] = 0.0f;
+				}
+			}
+		}
+	}
+}
+
+///
+// Read nCount floats from the rest of a line, which must be terminated.
+// \return 0 if the line has fewer.
+//
+static int ParseFloats(char* pStr, float* pDst, int nCount)
+{
+	for (int i = 0; i < nCount; i++)
+	{
+		pStr = strtok(i == 0 ? pStr : 0, " \t\r");
+
+		if (pStr == 0)
+			return 0;
+
+		pDst[i] = (float)atof(pStr);
+	}
+
+	return 1;
+}
+
+///
+// Read one face index and check it against the number of elements it
+// refers to. Relative (negative) indices are not supported.
+// \return 0 if the index is missing or out of range.
+//
+static int ParseIndex(char*& pEnd, int nCount, int* pIndex)
+{
+	char* pStart = pEnd;
+	long nIndex = strtol(pStart, &pEnd, 10);
+
+	if (pEnd == pStart || nIndex < 1 || nIndex > nCount)
+		return 0;
+
+	*pIndex = (int) nIndex;
+	return 1;
+}
+
+float* ParseOBJ(const char*   pFileName,
+	unsigned int& nFaces,
+	int&          nAttributes,
+	ObjTimings*   pTimings)
+{
+	int i = 0;
+	char* pStr = 0;
+	char* pNewLine = 0;
+	int v = 0;
+	int n = 0;
+	int t = 0;
+	int f = 0;
+	int bValid = 1;
+	float* pVertexBuffer = 0;
+
+	int nNumVerts = 0;
+	int nNumFaces = 0;
+	int nNumNormals = 0;
+	int nNumUVs = 0;
+
+	float* pVertices = 0;
+	float* pNormals = 0;
+	float* pUVs = 0;
+	int*   pFaces = 0;
+
+	long nFileSize = 0;
+	uint64_t uStart = ProfilerNow();
+	uint64_t uRead;
+	uint64_t uCounts;
+	uint64_t uParse;
+
+	char* pBuffer = ReadAsset(pFileName, &nFileSize);
+	uRead = ProfilerNow();
+
+	// Retrieve the counts for positions/UVs/normals/faces
+	if (pBuffer != 0)
+	{
+		GetCounts(pBuffer,
+			nNumVerts,
+			nNumUVs,
+			nNumNormals,
+			nNumFaces);
+	}
+
+	uCounts = ProfilerNow();
+
+	// Set the number of faces output
+	nFaces = nNumFaces;
+
+	// Report which attributes the file actually has
+	nAttributes = 0;
+	if (nNumUVs > 0)
+		nAttributes |= OBJ_HAS_TEXCOORDS;
+	if (nNumNormals > 0)
+		nAttributes |= OBJ_HAS_NORMALS;
+
+	// Allocate arrays to store vertex data
+	pVertices = new float[nNumVerts * 3];
+	pNormals = new float[nNumNormals * 3];
+	pUVs = new float[nNumUVs * 2];
+	pFaces = new   int[nNumFaces * 9];
+
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pVertices, nNumVerts * 3 * sizeof(float));
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pNormals, nNumNormals * 3 * sizeof(float));
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pUVs, nNumUVs * 2 * sizeof(float));
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pFaces, nNumFaces * 9 * sizeof(int));
+
+	// Set string pointer to beginning of file buffer
+	pStr = (pBuffer != 0) ? pBuffer : (char*) "";
+
+	TraceBegin("ParseLines");
+
+	// Loop until end of file, reading line by line.
+	while (1)
+	{
+		pNewLine = strchr(pStr, '\n');
+
+		if (pNewLine == 0)
+		{
+			break;
+		}
+
+		// Terminate the line so a short one cannot take its numbers
+		// from the next
+		*pNewLine = '\0';
+
+		if (pStr[0] == 'v' &&
+			pStr[1] == ' ')
+		{
+			// Extract X/Y/Z coordinates
+			bValid = bValid && ParseFloats(&pStr[2], &pVertices[v * 3], 3);
+
+			// Increase the number of vertices
+			v++;
+		}
+		else if (pStr[0] == 'v' &&
+			pStr[1] == 't')
+		{
+			// Extract U/V coordinates
+			bValid = bValid && ParseFloats(&pStr[2], &pUVs[t * 2], 2);
+
+			// Increase number of texcoords
+			t++;
+		}
+		else if (pStr[0] == 'v' &&
+			pStr[1] == 'n')
+		{
+			bValid = bValid && ParseFloats(&pStr[2], &pNormals[n * 3], 3);
+
+			// Increase number of normals
+			n++;
+		}
+		else if (pStr[0] == 'f')
+		{
+			char* pEnd = &pStr[1];
+
+			// Parse the position/texcoord/normal indices of all three
+			// vertices, accepting v, v/t, v//n and v/t/n. Missing
+			// texcoords and normals are stored as 0.
+			for (i = 0; i < 3 && bValid; i++)
+			{
+				int* pIndices = &pFaces[f * 9 + i * 3];
+
+				pIndices[1] = 0;
+				pIndices[2] = 0;
+				bValid = ParseIndex(pEnd, nNumVerts, &pIndices[0]);
+
+				if (bValid && *pEnd == '/')
+				{
+					pEnd++;
+
+					if (*pEnd != '/')
+					{
+						bValid = ParseIndex(pEnd, nNumUVs, &pIndices[1]);
+					}
+
+					if (bValid && *pEnd == '/')
+					{
+						pEnd++;
+						bValid = ParseIndex(pEnd, nNumNormals, &pIndices[2]);
+					}
+				}
+			}
+
+			// Increase the face count
+			f++;
+		}
+
+		// Now move the pointer to the next line.
+		pStr = pNewLine + 1;
+	}
+
+	// A file that does not parse is treated as unreadable
+	if (!bValid)
+	{
+		printf("Model does not parse: %s\n", pFileName);
+		nNumFaces = 0;
+		nFaces = 0;
+		nAttributes = 0;
+	}
+
+	TraceEnd("ParseLines", -1);
+	uParse = ProfilerNow();
+
+	// From the separate arrays, create one big buffer
+	// that has the vertex data interleaved.
+	pVertexBuffer = new float[nNumFaces * 24];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pVertexBuffer, nNumFaces * 24 * sizeof(float));
+	GenerateVertexBuffer(nNumFaces,
+		pVertices,
+		pUVs,
+		pNormals,
+		pFaces,
+		pVertexBuffer);
+
+	if (pTimings != 0)
+	{
+		pTimings->read = uRead - uStart;
+		pTimings->counts = uCounts - uRead;
+		pTimings->parse = uParse - uCounts;
+		pTimings->generate = ProfilerNow() - uParse;
+	}
+
+	if (s_bVerbose)
+		printf("Generated Veretex Buffer.\n");
+
+	// Free arrays made to hold data.
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pVertices);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pNormals);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pUVs);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pFaces);
+
+	delete[] pVertices;
+	pVertices = 0;
+	delete[] pNormals;
+	pNormals = 0;
+	delete[] pUVs;
+	pUVs = 0;
+	delete[] pFaces;
+	pFaces = 0;
+
+	return pVertexBuffer;
+}
+
+unsigned char* DecodeBMP(const char* path, int* pWidth, int* pHeight)
+{
+	long nSize = 0;
+	char* data = ReadAsset(path, &nSize);
+
+	*pWidth = 0;
+	*pHeight = 0;
+
+	// Header and pixel offset of a BITMAPINFOHEADER file
+	if (data == 0 || nSize < 54)
+		return 0;
+
+	ScopedTrace trace("DecodeBMP");
+
+	unsigned char* pData = 0;
+	unsigned char* pSrc = 0;
+
+	int nWidth = 0;
+	int nHeight = 0;
+	unsigned short sBPP = 0;
+
+	// Grab the dimensions of texture. The fields are not aligned.
+	memcpy(&nWidth, &data[18], sizeof(nWidth));
+	memcpy(&nHeight, &data[22], sizeof(nHeight));
+	memcpy(&sBPP, &data[28], sizeof(sBPP));
+
+	if (s_bVerbose)
+	{
+		printf("Width: %d\n", nWidth);
+		printf("Height: %d\n", nHeight);
+		printf("BPP: %d\n", sBPP);
+	}
+
+	// Top-down (negative height) files are not supported either
+	if (nWidth <= 0 || nHeight <= 0)
+	{
+		printf("Texture has no pixels: %s\n", path);
+		return 0;
+	}
+
+	if (nWidth > MAX_TEXTURE_SIZE ||
+		nHeight > MAX_TEXTURE_SIZE)
+	{
+		printf("Texture too big: %s\n", path);
+		return 0;
+	}
+
+	if (sBPP != 24)
+	{
+		printf("Unsupported BPP: %s\n", path);
+		return 0;
+	}
+
+	// Rows are padded to 4 bytes
+	int nPadding = (nWidth * 3) % 4;
+
+	if (nPadding != 0)
+		nPadding = 4 - nPadding;
+
+	if (54 + (long) nHeight * (nWidth * 3 + nPadding) > nSize)
+	{
+		printf("Texture is cut short: %s\n", path);
+		return 0;
+	}
+
+	pSrc = reinterpret_cast<unsigned char*>(&data[54]);
+
+	pData = new unsigned char[nWidth * nHeight * 4];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pData, nWidth * nHeight * 4);
+
+	unsigned char* pDst = pData;
+
+	for (int i = 0; i < nHeight; i++)
+	{
+		for (int j = 0; j < nWidth; j++)
+		{
+			pDst[0] = pSrc[2];
+			pDst[1] = pSrc[1];
+			pDst[2] = pSrc[0];
+
+			pDst += 3;
+			pSrc += 3;
+		}
+
+		pSrc += nPadding;
+	}
+
+	*pWidth = nWidth;
+	*pHeight = nHeight;
+
+	return pData;
+}
@@ -0,0 +1,85 @@
+//
+/// \file AssetLoader.h
+/// \brief OBJ and BMP loading into client memory. Nothing here touches
+///        GL, so the loaders can be linked into tools and benchmarks
+///        that run without a GPU.
+//
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <stdint.h>
+
+// Attributes ParseOBJ found in a file.
+#define OBJ_HAS_TEXCOORDS 1
+#define OBJ_HAS_NORMALS 2
+
+#define MAX_TEXTURE_SIZE 2048
+
+//
+/// \brief Time spent in each step of ParseOBJ, in nanoseconds.
+//
+typedef struct
+{
+   uint64_t read;
+   uint64_t counts;
+   uint64_t parse;
+   uint64_t generate;
+} ObjTimings;
+
+//
+/// \brief Read a whole file into the calling thread's file buffer,
+///        which grows to fit and is null terminated. The contents stay
+///        valid until the thread's next call.
+/// \return The buffer, or null if the file could not be read.
+//
+char* ReadAsset(const char* pFileName, long* pSize);
+
+//
+/// \brief Count the positions, texcoords, normals and faces in OBJ text.
+//
+void GetCounts(const char* pBuffer,
+	int& nNumVerts,
+	int& nNumUVs,
+	int& nNumNormals,
+	int& nNumFaces);
+
+//
+/// \brief Interleave the indexed OBJ arrays into 8 floats per vertex,
+///        position, texcoord and normal, three vertices per face. The
+///        indices must already be in range, as ParseOBJ checks them.
+//
+void GenerateVertexBuffer(int nNumFaces,
+	float* pVertices,
+	float* pUVs,
+	float* pNormals,
+	int*   pFaces,
+	float* pVB);
+
+//
+/// \brief Parse an OBJ file into an interleaved vertex buffer, see
+///        GenerateVertexBuffer. The caller owns the buffer. Unreadable
+///        files give an empty buffer and no faces, as do files with a
+///        missing coordinate or a face index out of range.
+/// \param nAttributes Set to the OBJ_HAS_ bits of the file
+/// \param pTimings If not NULL, receives the time of every step
+//
+float* ParseOBJ(const char*   pFileName,
+	unsigned int& nFaces,
+	int&          nAttributes,
+	ObjTimings*   pTimings = 0);
+
+//
+/// \brief Decode a 24 bit BMP into tightly packed RGB rows, bottom row
+///        first.
+/// \return Null for unsupported files, sizes over MAX_TEXTURE_SIZE and
+///         files shorter than their header says, otherwise the caller
+///         deletes it.
+//
+unsigned char* DecodeBMP(const char* path, int* pWidth, int* pHeight);
+
+//
+/// \brief Turn the loaders' progress messages on or off. On by default.
+//
+void SetAssetLoaderVerbose(int bVerbose);
+
+#endif // ASSET_LOADER_H
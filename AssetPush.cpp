@@ -0,0 +1,548 @@
+//
+// AssetPush.cpp
+//
+//    One push at a time: the asset thread accepts a connection and
+//    serves its offers in turn. Each chunk is checked against its CRC
+//    before it is appended to name.part, so the partial file only ever
+//    holds good data and its length is where a later offer of the same
+//    file (same size and CRC, kept in name.part.info) resumes. A chunk
+//    that fails its check is sent again from the offset in the reply.
+//
+//    When the last chunk is in, the whole file is checked and renamed
+//    into place, then parsed on this thread, so rendering never waits
+//    for a pushed model. The parsed buffers wait in a single slot for
+//    the render thread, which answers with the model index before the
+//    reply goes out; a controller can send M with it right away.
+//
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "AssetLoader.h"
+#include "AssetPush.h"
+#include "Memory.h"
+#include "Protocol.h"
+#include "Trace.h"
+
+// Longest the asset thread waits in accept before it checks for
+// AssetPushStop.
+#define ASSET_PUSH_ACCEPT_TIMEOUT_MS 100
+
+// A pusher silent this long is dropped, keeping its partial file.
+#define ASSET_PUSH_RECV_TIMEOUT_S 5
+
+// How long a parsed asset waits for the render thread.
+#define ASSET_PUSH_DONE_TIMEOUT_S 5
+
+static int s_nListen = -1;
+static std::thread s_thread;
+static std::atomic<int> s_bStopping(0);
+static char s_arDirectory[48];
+
+static char s_arChunk[PROTOCOL_ASSET_MAX_CHUNK];
+
+// Progress of the current push, size 0 between pushes
+static std::atomic<uint64_t> s_uPushSize(0);
+static std::atomic<uint64_t> s_uPushReceived(0);
+
+// Handover to the render thread. A slot is waiting while s_bReady is
+// set, and taken until s_bDone is.
+static std::mutex s_readyMutex;
+static std::condition_variable s_doneChanged;
+static AssetReady s_ready;
+static int s_bReady = 0;
+static int s_bTaken = 0;
+static int s_bDone = 0;
+static int s_nDoneModel = -1;
+
+///
+// Read exactly nLength bytes.
+// \return 0 on disconnect, timeout or stop.
+//
+static int ReadFull(int nSocket, void* pBuffer, int nLength)
+{
+   char* pBytes = (char*) pBuffer;
+
+   while (nLength > 0)
+   {
+      int nRead = recv(nSocket, pBytes, nLength, 0);
+
+      if (nRead <= 0)
+      {
+         if (nRead < 0 && errno == EINTR && !s_bStopping.load())
+            continue;
+
+         return 0;
+      }
+
+      pBytes += nRead;
+      nLength -= nRead;
+   }
+
+   return 1;
+}
+
+static void Reply(int nSocket, int nStatus, int64_t nValue)
+{
+   char arReply[PROTOCOL_ASSET_REPLY_SIZE];
+
+   ProtocolEncodeAssetReply(nStatus, nValue, arReply);
+   send(nSocket, arReply, sizeof(arReply), MSG_NOSIGNAL);
+}
+
+///
+// Names are plain file names, with the extension of their kind, so
+// nothing can be written outside the store.
+//
+static int CheckName(const ProtocolAssetOffer* pOffer)
+{
+   const char* pName = pOffer->name;
+   const char* pDot = strrchr(pName, '.');
+
+   if (pName[0] == '.' || pDot == 0)
+      return 0;
+
+   for (const char* p = pName; *p != 0; p++)
+   {
+      if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+            (*p >= '0' && *p <= '9') || *p == '.' || *p == '_' || *p == '-'))
+      {
+         return 0;
+      }
+   }
+
+   if (pOffer->kind == PROTOCOL_ASSET_MODEL)
+      return strcmp(pDot, ".obj") == 0;
+
+   if (pOffer->kind == PROTOCOL_ASSET_TEXTURE)
+      return strcmp(pDot, ".bmp") == 0;
+
+   return 0;
+}
+
+///
+// Where to resume an offer: the length of its partial file if that
+// was started for the same file, otherwise 0 with the partial file
+// cleared.
+//
+static uint64_t ResumeOffset(const ProtocolAssetOffer* pOffer, const char* pPart, const char* pInfo)
+{
+   FILE* pFile = fopen(pInfo, "r");
+   unsigned long long uSize = 0;
+   unsigned int uCrc = 0;
+   struct stat part;
+
+   if (pFile != 0)
+   {
+      int nRead = fscanf(pFile, "%llu %u", &uSize, &uCrc);
+      fclose(pFile);
+
+      if (nRead == 2 && uSize == pOffer->size && uCrc == pOffer->crc &&
+          stat(pPart, &part) == 0 && (uint64_t) part.st_size <= pOffer->size)
+      {
+         return (uint64_t) part.st_size;
+      }
+   }
+
+   pFile = fopen(pInfo, "w");
+   if (pFile != 0)
+   {
+      fprintf(pFile, "%llu %u\n", (unsigned long long) pOffer->size, (unsigned int) pOffer->crc);
+      fclose(pFile);
+   }
+
+   pFile = fopen(pPart, "wb");
+   if (pFile != 0)
+      fclose(pFile);
+
+   return 0;
+}
+
+static uint32_t FileCrc(const char* pPath)
+{
+   FILE* pFile = fopen(pPath, "rb");
+   uint32_t uCrc = 0;
+   size_t nRead;
+
+   if (pFile == 0)
+      return 0;
+
+   while ((nRead = fread(s_arChunk, 1, sizeof(s_arChunk), pFile)) > 0)
+      uCrc = ProtocolCrc32(uCrc, s_arChunk, (int) nRead);
+
+   fclose(pFile);
+   return uCrc;
+}
+
+///
+// Parse a finished file and wait for the render thread to take it.
+// \return The model index, -1 if it has none, or -2 if the file did
+//         not parse.
+//
+static int Publish(const ProtocolAssetOffer* pOffer, const char* pPath)
+{
+   AssetReady ready;
+
+   memset(&ready, 0, sizeof(ready));
+   ready.kind = pOffer->kind;
+   snprintf(ready.path, sizeof(ready.path), "%s", pPath);
+
+   {
+      ScopedTrace trace("ParsePushedAsset");
+      ScopedMemoryAsset asset(pPath);
+
+      if (pOffer->kind == PROTOCOL_ASSET_MODEL)
+      {
+         ready.vertices = ParseOBJ(pPath, ready.faces, ready.attributes);
+
+         if (ready.faces == 0)
+         {
+            MemoryRelease(MEMORY_HEAP, (uintptr_t) ready.vertices);
+            delete[] ready.vertices;
+            return -2;
+         }
+      }
+      else
+      {
+         ready.pixels = DecodeBMP(pPath, &ready.width, &ready.height);
+
+         if (ready.pixels == 0)
+            return -2;
+      }
+   }
+
+   std::unique_lock<std::mutex> lock(s_readyMutex);
+
+   s_ready = ready;
+   s_bReady = 1;
+   s_bTaken = 0;
+   s_bDone = 0;
+
+   s_doneChanged.wait_for(lock, std::chrono::seconds(ASSET_PUSH_DONE_TIMEOUT_S),
+                          [] { return s_bDone != 0 || s_bStopping.load() != 0; });
+
+   // Without a render thread, or when stopping before it took them, the
+   // buffers are taken back
+   if (!s_bTaken)
+   {
+      s_bReady = 0;
+      MemoryRelease(MEMORY_HEAP, (uintptr_t) ready.vertices);
+      MemoryRelease(MEMORY_HEAP, (uintptr_t) ready.pixels);
+      delete[] ready.vertices;
+      delete[] ready.pixels;
+      return -1;
+   }
+
+   // Taken but not answered yet: the index comes too late for this reply
+   if (!s_bDone)
+      return -1;
+
+   return s_nDoneModel;
+}
+
+///
+// Serve one offer and its chunks.
+// \return 0 when the connection should be closed.
+//
+static int HandleOffer(int nSocket)
+{
+   char arHeader[PROTOCOL_ASSET_OFFER_SIZE];
+   ProtocolAssetOffer offer;
+
+   if (!ReadFull(nSocket, arHeader, sizeof(arHeader)))
+      return 0;
+
+   int nName = ProtocolDecodeAssetOffer(arHeader, &offer);
+
+   if (nName < 0 || !ReadFull(nSocket, offer.name, nName))
+   {
+      Reply(nSocket, PROTOCOL_ASSET_REJECTED, 0);
+      return 0;
+   }
+
+   offer.name[nName] = 0;
+
+   if (!CheckName(&offer) || offer.size == 0 || offer.size > (uint64_t) ASSET_PUSH_MAX_SIZE)
+   {
+      printf("Asset push of %s rejected.\n", offer.name);
+      Reply(nSocket, PROTOCOL_ASSET_REJECTED, 0);
+      return 0;
+   }
+
+   char arPath[128];
+   char arPart[160];
+   char arInfo[160];
+
+   snprintf(arPath, sizeof(arPath), "%s/%s", s_arDirectory, offer.name);
+   snprintf(arPart, sizeof(arPart), "%s.part", arPath);
+   snprintf(arInfo, sizeof(arInfo), "%s.part.info", arPath);
+
+   uint64_t uOffset = ResumeOffset(&offer, arPart, arInfo);
+   FILE* pFile = fopen(arPart, "ab");
+
+   if (pFile == 0)
+   {
+      printf("Asset push of %s: cannot write %s.\n", offer.name, arPart);
+      Reply(nSocket, PROTOCOL_ASSET_REJECTED, 0);
+      return 0;
+   }
+
+   printf("Asset push of %s, %llu bytes, from %llu.\n",
+      offer.name, (unsigned long long) offer.size, (unsigned long long) uOffset);
+   Reply(nSocket, PROTOCOL_ASSET_OK, (int64_t) uOffset);
+
+   ScopedTrace trace("AssetPush");
+   uint64_t uStart = uOffset;
+
+   s_uPushReceived.store(uOffset, std::memory_order_relaxed);
+   s_uPushSize.store(offer.size, std::memory_order_relaxed);
+
+   for (;;)
+   {
+      char arChunk[PROTOCOL_ASSET_CHUNK_SIZE];
+      uint32_t uLength;
+      uint32_t uCrc;
+
+      if (!ReadFull(nSocket, arChunk, sizeof(arChunk)))
+      {
+         // The partial file stays for a resume
+         fclose(pFile);
+         return 0;
+      }
+
+      ProtocolDecodeAssetChunk(arChunk, &uLength, &uCrc);
+
+      if (uLength == 0)
+         break;
+
+      if (uLength > PROTOCOL_ASSET_MAX_CHUNK || uOffset + uLength > offer.size)
+      {
+         Reply(nSocket, PROTOCOL_ASSET_REJECTED, (int64_t) uOffset);
+         fclose(pFile);
+         return 0;
+      }
+
+      if (!ReadFull(nSocket, s_arChunk, uLength))
+      {
+         fclose(pFile);
+         return 0;
+      }
+
+      if (ProtocolCrc32(0, s_arChunk, uLength) != uCrc)
+      {
+         Reply(nSocket, PROTOCOL_ASSET_BAD_CHUNK, (int64_t) uOffset);
+         continue;
+      }
+
+      if (fwrite(s_arChunk, 1, uLength, pFile) != uLength || fflush(pFile) != 0)
+      {
+         printf("Asset push of %s: write failed.\n", offer.name);
+         Reply(nSocket, PROTOCOL_ASSET_REJECTED, (int64_t) uOffset);
+         fclose(pFile);
+         return 0;
+      }
+
+      uOffset += uLength;
+      s_uPushReceived.store(uOffset, std::memory_order_relaxed);
+      Reply(nSocket, PROTOCOL_ASSET_OK, (int64_t) uOffset);
+   }
+
+   fclose(pFile);
+   trace.SetBytes((int64_t) (uOffset - uStart));
+
+   if (uOffset != offer.size)
+   {
+      Reply(nSocket, PROTOCOL_ASSET_BAD_FILE, (int64_t) uOffset);
+      return 1;
+   }
+
+   // Chunks can be good and the file still not the one offered
+   if (FileCrc(arPart) != offer.crc)
+   {
+      printf("Asset push of %s: checksum mismatch, discarded.\n", offer.name);
+      remove(arPart);
+      remove(arInfo);
+      Reply(nSocket, PROTOCOL_ASSET_BAD_FILE, 0);
+      return 1;
+   }
+
+   rename(arPart, arPath);
+   remove(arInfo);
+
+   int nModel = Publish(&offer, arPath);
+
+   if (nModel == -2)
+   {
+      printf("Asset push of %s: not a valid %s, discarded.\n",
+         offer.name, (offer.kind == PROTOCOL_ASSET_MODEL) ? "OBJ" : "BMP");
+      remove(arPath);
+      Reply(nSocket, PROTOCOL_ASSET_PARSE_FAILED, 0);
+      return 1;
+   }
+
+   printf("Asset push of %s complete, model %d.\n", offer.name, nModel);
+   Reply(nSocket, PROTOCOL_ASSET_OK, nModel);
+   return 1;
+}
+
+static void AssetThread()
+{
+   TraceThreadName("assets");
+
+   while (!s_bStopping.load(std::memory_order_relaxed))
+   {
+      int nSocket = accept(s_nListen, 0, 0);
+
+      // Timeouts and the wake-up from AssetPushStop
+      if (nSocket < 0)
+         continue;
+
+      timeval timeoutLength;
+      timeoutLength.tv_sec = ASSET_PUSH_RECV_TIMEOUT_S;
+      timeoutLength.tv_usec = 0;
+      setsockopt(nSocket, SOL_SOCKET, SO_RCVTIMEO, &timeoutLength, sizeof(timeval));
+
+      // Every reply is waited for, Nagle would hold each one back
+      int nNoDelay = 1;
+      setsockopt(nSocket, IPPROTO_TCP, TCP_NODELAY, &nNoDelay, sizeof(nNoDelay));
+
+      while (!s_bStopping.load(std::memory_order_relaxed))
+      {
+         int bMore = HandleOffer(nSocket);
+
+         // Done with this file, whichever way it ended
+         s_uPushSize.store(0, std::memory_order_relaxed);
+
+         if (!bMore)
+            break;
+      }
+
+      close(nSocket);
+   }
+}
+
+int AssetPushStart(int nPort, const char* pAddress, const char* pDirectory)
+{
+   struct sockaddr_in serverAddr;
+   memset(&serverAddr, 0, sizeof(sockaddr_in));
+   serverAddr.sin_family = AF_INET;
+   serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+   serverAddr.sin_port = htons(nPort);
+
+   if (pAddress != 0 && inet_pton(AF_INET, pAddress, &serverAddr.sin_addr) != 1)
+   {
+      printf("Asset address must be an IPv4 address.\n");
+      return 0;
+   }
+
+   snprintf(s_arDirectory, sizeof(s_arDirectory), "%s", pDirectory);
+   mkdir(s_arDirectory, 0755);
+
+   s_nListen = socket(AF_INET, SOCK_STREAM, 0);
+   if (s_nListen < 0)
+   {
+      printf("Failed to create asset socket.\n");
+      return 0;
+   }
+
+   int nReuse = 1;
+   setsockopt(s_nListen, SOL_SOCKET, SO_REUSEADDR, &nReuse, sizeof(nReuse));
+
+   if (bind(s_nListen, (struct sockaddr*) &serverAddr, sizeof(serverAddr)) < 0 || listen(s_nListen, 4) < 0)
+   {
+      printf("Failed to bind asset socket.\n");
+      close(s_nListen);
+      s_nListen = -1;
+      return 0;
+   }
+
+   // Only bounds how long AssetPushStop can wait
+   timeval timeoutLength;
+   timeoutLength.tv_sec = 0;
+   timeoutLength.tv_usec = ASSET_PUSH_ACCEPT_TIMEOUT_MS * 1000;
+   setsockopt(s_nListen, SOL_SOCKET, SO_RCVTIMEO, &timeoutLength, sizeof(timeval));
+
+   {
+      ScopedMemoryAsset asset("network");
+      MemoryTrack(MEMORY_HEAP, (uintptr_t) s_arChunk, sizeof(s_arChunk));
+   }
+
+   s_bStopping.store(0);
+   s_thread = std::thread(AssetThread);
+
+   return 1;
+}
+
+void AssetPushStop()
+{
+   if (s_nListen < 0)
+      return;
+
+   {
+      // Set under the lock so a parse about to wait cannot miss it
+      std::lock_guard<std::mutex> lock(s_readyMutex);
+      s_bStopping.store(1);
+   }
+
+   shutdown(s_nListen, SHUT_RDWR);
+
+   // A parse waiting for the render thread gives up now
+   s_doneChanged.notify_all();
+
+   if (s_thread.joinable())
+      s_thread.join();
+
+   close(s_nListen);
+   s_nListen = -1;
+}
+
+int AssetPushPoll(AssetReady* pAsset)
+{
+   std::lock_guard<std::mutex> lock(s_readyMutex);
+
+   if (!s_bReady)
+      return 0;
+
+   *pAsset = s_ready;
+   s_bReady = 0;
+   s_bTaken = 1;
+
+   return 1;
+}
+
+void AssetPushGetStats(AssetPushStats* pStats)
+{
+   pStats->size = s_uPushSize.load(std::memory_order_relaxed);
+   pStats->received = s_uPushReceived.load(std::memory_order_relaxed);
+   pStats->pushing = pStats->size != 0;
+
+   std::lock_guard<std::mutex> lock(s_readyMutex);
+   pStats->waiting = s_bReady;
+}
+
+void AssetPushDone(int nModel)
+{
+   {
+      std::lock_guard<std::mutex> lock(s_readyMutex);
+
+      s_nDoneModel = nModel;
+      s_bDone = 1;
+   }
+
+   s_doneChanged.notify_all();
+}
@@ -0,0 +1,90 @@
+//
+/// \file AssetPush.h
+/// \brief Models and textures pushed by a controller while the renderer
+///        runs. A TCP server on its own thread receives files in
+///        checked chunks (Protocol.h) into the asset store, keeps
+///        partial files so an interrupted push resumes where it stopped,
+///        and parses each file once it is complete. The render thread
+///        picks up parsed assets without waiting and says which model
+///        index they got, which is sent back to the controller.
+//
+#ifndef ASSET_PUSH_H
+#define ASSET_PUSH_H
+
+#include <stdint.h>
+
+// Port the push tool uses by default. The renderer only listens when
+// given one with --asset-port.
+#define ASSET_PUSH_PORT 4002
+#define ASSET_PUSH_DIR "AssetStore"
+
+// Longest file accepted, in bytes.
+#define ASSET_PUSH_MAX_SIZE (256ll << 20)
+
+//
+/// \brief A pushed file, parsed. The render thread owns the buffers
+///        once AssetPushPoll returns them.
+//
+typedef struct
+{
+   // PROTOCOL_ASSET_MODEL or PROTOCOL_ASSET_TEXTURE
+   int kind;
+   // Where the file is in the asset store
+   char path[128];
+
+   // Models: ParseOBJ's interleaved vertices
+   float* vertices;
+   unsigned int faces;
+   int attributes;
+
+   // Textures: DecodeBMP's RGB rows
+   unsigned char* pixels;
+   int width;
+   int height;
+} AssetReady;
+
+//
+/// \brief What the asset thread is doing, for health queries.
+//
+typedef struct
+{
+   // A file is arriving, with bytes stored so far of its size
+   int pushing;
+   uint64_t received;
+   uint64_t size;
+   // Parsed and not taken by the render thread yet
+   int waiting;
+} AssetPushStats;
+
+//
+/// \brief Listen for pushes and start the asset thread. Partial files
+///        are kept in pDirectory next to the finished ones.
+/// \param pAddress Local IPv4 address to listen on, 0 for all of them
+/// \return 0 if the port could not be opened.
+//
+int AssetPushStart(int nPort, const char* pAddress, const char* pDirectory);
+
+//
+/// \brief Stop the asset thread. A push in progress keeps its partial
+///        file. Safe to call when AssetPushStart failed.
+//
+void AssetPushStop();
+
+//
+/// \brief Take a parsed asset, without blocking. Every asset taken must
+///        be answered with AssetPushDone before the next is returned.
+/// \return 0 if none is waiting.
+//
+int AssetPushPoll(AssetReady* pAsset);
+
+//
+/// \brief Tell the pusher the model index the asset is shown as, or -1.
+//
+void AssetPushDone(int nModel);
+
+//
+/// \brief Current state, from any thread.
+//
+void AssetPushGetStats(AssetPushStats* pStats);
+
+#endif // ASSET_PUSH_H
@@ -0,0 +1,329 @@
+//
+// AssetPushClient.cpp
+//
+//    Pushes OBJ models and BMP textures to a running renderer, the way a
+//    controller would, and prints the model index each one got; send
+//    that index with M to show it. Rerunning an interrupted push
+//    resumes from what the renderer already has. --stop-after drops the
+//    connection after that many bytes of a file, and --corrupt-chunk
+//    damages the data of that chunk once, to try resume and the chunk
+//    checks on loopback.
+//
+//    Usage: ghost-asset-push [--host 127.0.0.1] [--port 4002]
+//                            [--chunk 16384] [--stop-after bytes]
+//                            [--corrupt-chunk n] file...
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "Protocol.h"
+
+#define PUSH_HOST "127.0.0.1"
+#define PUSH_PORT 4002
+#define PUSH_CHUNK 16384
+
+static const char* s_arStatus[] = { "ok", "bad chunk", "bad file", "rejected", "parse failed" };
+
+static const char* StatusName(int nStatus)
+{
+   return (nStatus >= 0 && nStatus <= PROTOCOL_ASSET_PARSE_FAILED) ? s_arStatus[nStatus] : "unknown";
+}
+
+static double Seconds(const struct timespec* pTime)
+{
+   return pTime->tv_sec + pTime->tv_nsec * 1e-9;
+}
+
+static int SendFull(int nSocket, const void* pData, int nLength)
+{
+   const char* pBytes = (const char*) pData;
+
+   while (nLength > 0)
+   {
+      int nSent = send(nSocket, pBytes, nLength, MSG_NOSIGNAL);
+
+      if (nSent <= 0)
+         return 0;
+
+      pBytes += nSent;
+      nLength -= nSent;
+   }
+
+   return 1;
+}
+
+static int ReadReply(int nSocket, int* pStatus, int64_t* pValue)
+{
+   char arReply[PROTOCOL_ASSET_REPLY_SIZE];
+   int nHave = 0;
+
+   while (nHave < (int) sizeof(arReply))
+   {
+      int nRead = recv(nSocket, arReply + nHave, sizeof(arReply) - nHave, 0);
+
+      if (nRead <= 0)
+         return 0;
+
+      nHave += nRead;
+   }
+
+   ProtocolDecodeAssetReply(arReply, pStatus, pValue);
+   return 1;
+}
+
+static char* ReadFile(const char* pPath, long* pSize)
+{
+   FILE* pFile = fopen(pPath, "rb");
+
+   if (pFile == 0)
+      return 0;
+
+   fseek(pFile, 0, SEEK_END);
+   *pSize = ftell(pFile);
+   fseek(pFile, 0, SEEK_SET);
+
+   char* pData = (char*) malloc(*pSize > 0 ? *pSize : 1);
+
+   if (fread(pData, 1, *pSize, pFile) != (size_t) *pSize)
+   {
+      free(pData);
+      pData = 0;
+   }
+
+   fclose(pFile);
+   return pData;
+}
+
+///
+// Push one file over an open connection.
+// \return The model index, -1 if it has none, or -2 if the push failed
+//         and the connection is unusable.
+//
+static int PushFile(int nSocket, const char* pPath, int nChunk, long nStopAfter, int* pCorruptChunk)
+{
+   ProtocolAssetOffer offer;
+   const char* pName = strrchr(pPath, '/');
+   const char* pDot = strrchr(pPath, '.');
+   long nSize = 0;
+
+   pName = (pName != 0) ? pName + 1 : pPath;
+
+   memset(&offer, 0, sizeof(offer));
+   offer.kind = (pDot != 0 && strcmp(pDot, ".bmp") == 0) ? PROTOCOL_ASSET_TEXTURE : PROTOCOL_ASSET_MODEL;
+   snprintf(offer.name, sizeof(offer.name), "%s", pName);
+
+   char* pData = ReadFile(pPath, &nSize);
+
+   if (pData == 0)
+   {
+      printf("%s: cannot read.\n", pPath);
+      return -1;
+   }
+
+   offer.size = (uint64_t) nSize;
+   offer.crc = ProtocolCrc32(0, pData, (int) nSize);
+
+   char arOffer[PROTOCOL_ASSET_OFFER_SIZE + PROTOCOL_ASSET_MAX_NAME];
+   int nOffer = ProtocolEncodeAssetOffer(&offer, arOffer, sizeof(arOffer));
+   int nStatus = 0;
+   int64_t nValue = 0;
+
+   if (nOffer == 0 || !SendFull(nSocket, arOffer, nOffer) || !ReadReply(nSocket, &nStatus, &nValue))
+   {
+      printf("%s: offer failed.\n", pPath);
+      free(pData);
+      return -2;
+   }
+
+   if (nStatus != PROTOCOL_ASSET_OK)
+   {
+      printf("%s: %s.\n", pPath, StatusName(nStatus));
+      free(pData);
+      return -2;
+   }
+
+   struct timespec start;
+   struct timespec end;
+   long nOffset = (long) nValue;
+   long nSent = 0;
+   int nResent = 0;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   if (nOffset > 0)
+      printf("%s: resuming at %ld of %ld bytes.\n", pPath, nOffset, nSize);
+
+   // Stop and wait: the reply to every chunk says where to go on from
+   while (nOffset < nSize)
+   {
+      int nLength = (nSize - nOffset < nChunk) ? (int) (nSize - nOffset) : nChunk;
+      char arChunk[PROTOCOL_ASSET_CHUNK_SIZE];
+
+      if (nStopAfter >= 0 && nSent >= nStopAfter)
+      {
+         printf("%s: stopped after %ld bytes, at %ld of %ld.\n", pPath, nSent, nOffset, nSize);
+         free(pData);
+         return -2;
+      }
+
+      ProtocolEncodeAssetChunk(nLength, ProtocolCrc32(0, pData + nOffset, nLength), arChunk);
+
+      // The checksum is of the good data, so the renderer sees damage
+      if (*pCorruptChunk == 0)
+         pData[nOffset] ^= 0x5a;
+
+      int bSent = SendFull(nSocket, arChunk, sizeof(arChunk)) && SendFull(nSocket, pData + nOffset, nLength);
+
+      if (*pCorruptChunk == 0)
+         pData[nOffset] ^= 0x5a;
+
+      (*pCorruptChunk)--;
+
+      if (!bSent || !ReadReply(nSocket, &nStatus, &nValue))
+      {
+         printf("%s: connection lost at %ld of %ld bytes.\n", pPath, nOffset, nSize);
+         free(pData);
+         return -2;
+      }
+
+      if (nStatus == PROTOCOL_ASSET_BAD_CHUNK)
+         nResent++;
+      else if (nStatus != PROTOCOL_ASSET_OK)
+      {
+         printf("%s: %s at %ld.\n", pPath, StatusName(nStatus), nOffset);
+         free(pData);
+         return -2;
+      }
+
+      nSent += nLength;
+      nOffset = (long) nValue;
+   }
+
+   free(pData);
+
+   char arEnd[PROTOCOL_ASSET_CHUNK_SIZE];
+   ProtocolEncodeAssetChunk(0, 0, arEnd);
+
+   if (!SendFull(nSocket, arEnd, sizeof(arEnd)) || !ReadReply(nSocket, &nStatus, &nValue))
+   {
+      printf("%s: connection lost before the result.\n", pPath);
+      return -2;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   double fSeconds = Seconds(&end) - Seconds(&start);
+
+   if (nStatus != PROTOCOL_ASSET_OK)
+   {
+      printf("%s: %s.\n", pPath, StatusName(nStatus));
+      return -1;
+   }
+
+   printf("%s: %ld bytes sent in %.3f s (%.1f MB/s), %d chunks resent, model %d\n",
+      pPath,
+      nSent,
+      fSeconds,
+      (fSeconds > 0.0) ? nSent / fSeconds / 1e6 : 0.0,
+      nResent,
+      (int) nValue);
+
+   return (int) nValue;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* pHost = PUSH_HOST;
+   int nPort = PUSH_PORT;
+   int nChunk = PUSH_CHUNK;
+   long nStopAfter = -1;
+   int nCorruptChunk = -1;
+   int nFirstFile = argc;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+      {
+         pHost = argv[++i];
+      }
+      else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      {
+         nPort = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc)
+      {
+         nChunk = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--stop-after") == 0 && i + 1 < argc)
+      {
+         nStopAfter = atol(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--corrupt-chunk") == 0 && i + 1 < argc)
+      {
+         nCorruptChunk = atoi(argv[++i]);
+      }
+      else if (argv[i][0] == '-')
+      {
+         nFirstFile = argc;
+         break;
+      }
+      else
+      {
+         nFirstFile = i;
+         break;
+      }
+   }
+
+   if (nFirstFile == argc || nChunk <= 0 || nChunk > PROTOCOL_ASSET_MAX_CHUNK)
+   {
+      printf("Usage: %s [--host %s] [--port %d] [--chunk %d] [--stop-after bytes] [--corrupt-chunk n] file...\n",
+         argv[0], PUSH_HOST, PUSH_PORT, PUSH_CHUNK);
+      return 0;
+   }
+
+   int nSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+   struct sockaddr_in serverAddr;
+   memset(&serverAddr, 0, sizeof(sockaddr_in));
+   serverAddr.sin_family = AF_INET;
+   serverAddr.sin_port = htons(nPort);
+
+   if (inet_pton(AF_INET, pHost, &serverAddr.sin_addr) != 1)
+   {
+      printf("Bad host address %s\n", pHost);
+      return 1;
+   }
+
+   if (nSocket < 0 || connect(nSocket, (struct sockaddr*) &serverAddr, sizeof(serverAddr)) < 0)
+   {
+      printf("Cannot connect to %s:%d\n", pHost, nPort);
+      return 1;
+   }
+
+   // Chunk headers are small sends that must not wait for an ack
+   int nNoDelay = 1;
+   setsockopt(nSocket, IPPROTO_TCP, TCP_NODELAY, &nNoDelay, sizeof(nNoDelay));
+
+   int nFailed = 0;
+
+   for (int i = nFirstFile; i < argc; i++)
+   {
+      int nResult = PushFile(nSocket, argv[i], nChunk, nStopAfter, &nCorruptChunk);
+
+      if (nResult == -2)
+      {
+         nFailed = 1;
+         break;
+      }
+   }
+
+   close(nSocket);
+   return nFailed;
+}
@@ -0,0 +1,145 @@
+//
+// Capture.cpp
+//
+//    Records are written through stdio with its default buffering, so
+//    the network thread pays for a write system call only every few
+//    kilobytes. Whatever is buffered is lost if the renderer crashes;
+//    a clean exit flushes it in CaptureClose.
+//
+#include <string.h>
+
+#include "Capture.h"
+
+static void WriteU16(uint8_t* p, uint16_t uValue)
+{
+   p[0] = (uint8_t) uValue;
+   p[1] = (uint8_t) (uValue >> 8);
+}
+
+static void WriteU32(uint8_t* p, uint32_t uValue)
+{
+   WriteU16(p, (uint16_t) uValue);
+   WriteU16(p + 2, (uint16_t) (uValue >> 16));
+}
+
+static void WriteU64(uint8_t* p, uint64_t uValue)
+{
+   WriteU32(p, (uint32_t) uValue);
+   WriteU32(p + 4, (uint32_t) (uValue >> 32));
+}
+
+static uint16_t ReadU16(const uint8_t* p)
+{
+   return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t ReadU32(const uint8_t* p)
+{
+   return (uint32_t) ReadU16(p) | ((uint32_t) ReadU16(p + 2) << 16);
+}
+
+static uint64_t ReadU64(const uint8_t* p)
+{
+   return (uint64_t) ReadU32(p) | ((uint64_t) ReadU32(p + 4) << 32);
+}
+
+int CaptureCreate(CaptureFile* pCapture, const char* pPath)
+{
+   uint8_t arHeader[CAPTURE_FILE_HEADER_SIZE];
+
+   memset(pCapture, 0, sizeof(CaptureFile));
+   pCapture->file = fopen(pPath, "wb");
+
+   if (pCapture->file == 0)
+      return 0;
+
+   memcpy(arHeader, CAPTURE_MAGIC, 8);
+   WriteU32(arHeader + 8, CAPTURE_VERSION);
+   fwrite(arHeader, 1, sizeof(arHeader), pCapture->file);
+
+   return 1;
+}
+
+void CaptureWrite(CaptureFile* pCapture, uint64_t uTime, uint32_t uAddress, uint16_t uPort, const void* pData, int nLength)
+{
+   uint8_t arHeader[CAPTURE_RECORD_HEADER_SIZE];
+
+   if (pCapture->records == 0)
+      pCapture->start = uTime;
+
+   // Receive times taken from the kernel can run slightly backwards
+   // across batches
+   uint64_t uOffset = (uTime > pCapture->start) ? uTime - pCapture->start : 0;
+
+   if (nLength > CAPTURE_MAX_DATAGRAM)
+      nLength = CAPTURE_MAX_DATAGRAM;
+
+   WriteU64(arHeader, uOffset);
+   WriteU32(arHeader + 8, uAddress);
+   WriteU16(arHeader + 12, uPort);
+   WriteU16(arHeader + 14, (uint16_t) nLength);
+
+   fwrite(arHeader, 1, sizeof(arHeader), pCapture->file);
+   fwrite(pData, 1, nLength, pCapture->file);
+
+   pCapture->records++;
+   pCapture->bytes += nLength;
+}
+
+int CaptureOpen(CaptureFile* pCapture, const char* pPath)
+{
+   uint8_t arHeader[CAPTURE_FILE_HEADER_SIZE];
+
+   memset(pCapture, 0, sizeof(CaptureFile));
+   pCapture->file = fopen(pPath, "rb");
+
+   if (pCapture->file == 0)
+      return 0;
+
+   if (fread(arHeader, 1, sizeof(arHeader), pCapture->file) != sizeof(arHeader) ||
+       memcmp(arHeader, CAPTURE_MAGIC, 8) != 0 ||
+       ReadU32(arHeader + 8) != CAPTURE_VERSION)
+   {
+      CaptureClose(pCapture);
+      return 0;
+   }
+
+   return 1;
+}
+
+int CaptureRead(CaptureFile* pCapture, CaptureRecord* pRecord)
+{
+   uint8_t arHeader[CAPTURE_RECORD_HEADER_SIZE];
+
+   if (fread(arHeader, 1, sizeof(arHeader), pCapture->file) != sizeof(arHeader))
+      return 0;
+
+   pRecord->time = ReadU64(arHeader);
+   pRecord->address = ReadU32(arHeader + 8);
+   pRecord->port = ReadU16(arHeader + 12);
+   pRecord->length = ReadU16(arHeader + 14);
+
+   if (pRecord->length > CAPTURE_MAX_DATAGRAM ||
+       fread(pRecord->data, 1, pRecord->length, pCapture->file) != (size_t) pRecord->length)
+   {
+      return 0;
+   }
+
+   pCapture->records++;
+   pCapture->bytes += pRecord->length;
+
+   return 1;
+}
+
+void CaptureRewind(CaptureFile* pCapture)
+{
+   fseek(pCapture->file, CAPTURE_FILE_HEADER_SIZE, SEEK_SET);
+}
+
+void CaptureClose(CaptureFile* pCapture)
+{
+   if (pCapture->file != 0)
+      fclose(pCapture->file);
+
+   pCapture->file = 0;
+}
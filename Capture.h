@@ -0,0 +1,81 @@
+//
+/// \file Capture.h
+/// \brief Files of received control datagrams, each with its receive
+///        time and sender, as the renderer writes them with --capture
+///        and ghost-replay sends them again. Little-endian throughout:
+///        an 8 byte magic and a version, then per datagram its time in
+///        nanoseconds since the first, the sender's IPv4 address and
+///        port, its length and its bytes.
+//
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CAPTURE_MAGIC "GHOSTCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FILE_HEADER_SIZE 12
+#define CAPTURE_RECORD_HEADER_SIZE 16
+
+// Longest datagram kept, as received by the network thread.
+#define CAPTURE_MAX_DATAGRAM 2048
+
+typedef struct
+{
+   FILE* file;
+   // Receive time of the first datagram, on the writer's clock
+   uint64_t start;
+   uint64_t records;
+   uint64_t bytes;
+} CaptureFile;
+
+//
+/// \brief One datagram of a capture.
+//
+typedef struct
+{
+   // Nanoseconds since the first datagram of the file
+   uint64_t time;
+   // Sender, host byte order
+   uint32_t address;
+   uint16_t port;
+   int length;
+   char data[CAPTURE_MAX_DATAGRAM];
+} CaptureRecord;
+
+//
+/// \brief Create a capture file, replacing any old one.
+/// \return 0 if it could not be written.
+//
+int CaptureCreate(CaptureFile* pCapture, const char* pPath);
+
+//
+/// \brief Append a datagram. uTime is in nanoseconds on any clock, the
+///        file keeps it relative to the first datagram.
+//
+void CaptureWrite(CaptureFile* pCapture, uint64_t uTime, uint32_t uAddress, uint16_t uPort, const void* pData, int nLength);
+
+//
+/// \brief Open a capture for reading and check its header.
+/// \return 0 if it is not a capture of this version.
+//
+int CaptureOpen(CaptureFile* pCapture, const char* pPath);
+
+//
+/// \brief Read the next datagram.
+/// \return 0 at the end of the file or a record cut short.
+//
+int CaptureRead(CaptureFile* pCapture, CaptureRecord* pRecord);
+
+//
+/// \brief Go back to the first datagram of a capture being read.
+//
+void CaptureRewind(CaptureFile* pCapture);
+
+//
+/// \brief Close either kind. Safe on a capture that failed to open.
+//
+void CaptureClose(CaptureFile* pCapture);
+
+#endif // CAPTURE_H
@@ -32,6 +32,54 @@
 //
 //
 
+///
+// Pseudo random value in [-1, 1] for a lattice point
+//
+static float LatticeValue ( int x, int y, int z, unsigned int seed )
+{
+   unsigned int h = seed;
+
+   h ^= (unsigned int) x * 0x8da6b343u;
+   h ^= (unsigned int) y * 0xd8163841u;
+   h ^= (unsigned int) z * 0xcb1ab31fu;
+   h ^= h >> 15;
+   h *= 0x2c1b3c6du;
+   h ^= h >> 12;
+   h *= 0x297a2d39u;
+   h ^= h >> 15;
+
+   return (float) ( h & 0xffffff ) / (float) 0x7fffff - 1.0f;
+}
+
+///
+// Smoothly interpolated value noise at a point, in [-1, 1]
+//
+static float ValueNoise ( float x, float y, float z, unsigned int seed )
+{
+   int ix = (int) floorf ( x );
+   int iy = (int) floorf ( y );
+   int iz = (int) floorf ( z );
+   float fx = x - (float) ix;
+   float fy = y - (float) iy;
+   float fz = z - (float) iz;
+   float corners[8];
+   int c;
+
+   fx = fx * fx * ( 3.0f - 2.0f * fx );
+   fy = fy * fy * ( 3.0f - 2.0f * fy );
+   fz = fz * fz * ( 3.0f - 2.0f * fz );
+
+   for ( c = 0; c < 8; c++ )
+      corners[c] = LatticeValue ( ix + ( c & 1 ), iy + ( ( c >> 1 ) & 1 ), iz + ( c >> 2 ), seed );
+
+   for ( c = 0; c < 4; c++ )
+      corners[c] = corners[c * 2] + ( corners[c * 2 + 1] - corners[c * 2] ) * fx;
+
+   corners[0] = corners[0] + ( corners[1] - corners[0] ) * fy;
+   corners[1] = corners[2] + ( corners[3] - corners[2] ) * fy;
+
+   return corners[0] + ( corners[1] - corners[0] ) * fz;
+}
 
 
 //////////////////////////////////////////////////////////////////
@@ -127,6 +175,119 @@ int ESUTIL_API esGenSphere ( int numSlices, float radius, GLfloat **vertices, GL
    return numIndices;
 }
 
+//
+/// \brief Generates a sphere like esGenSphere with its surface pushed in and out
+///        by four octaves of value noise, for large irregular test meshes. The
+///        same seed always gives the same mesh. Normals are recomputed from the
+///        displaced surface.
+/// \param numSlices The number of slices in the sphere, the mesh has numSlices^2 triangles
+/// \param roughness Largest displacement as a fraction of the radius
+/// \param seed Selects the noise pattern
+/// \return The number of indices for rendering the buffers as GL_TRIANGLES
+//
+int ESUTIL_API esGenNoisySphere ( int numSlices, float radius, float roughness, unsigned int seed,
+                                  GLfloat **vertices, GLfloat **normals,
+                                  GLfloat **texCoords, GLuint **indices )
+{
+   GLfloat *positions = NULL;
+   GLfloat *sphereNormals = NULL;
+   GLuint *triangles = NULL;
+   int numParallels = numSlices / 2;
+   int numVertices = ( numParallels + 1 ) * ( numSlices + 1 );
+   int numIndices;
+   int i;
+
+   numIndices = esGenSphere ( numSlices, radius, &positions, &sphereNormals, texCoords, &triangles );
+
+   // Displace along the sphere normal, which is the unit position
+   for ( i = 0; i < numVertices; i++ )
+   {
+      float *n = &sphereNormals[i * 3];
+      float frequency = 2.0f;
+      float amplitude = 0.5f;
+      float noise = 0.0f;
+      int octave;
+
+      for ( octave = 0; octave < 4; octave++ )
+      {
+         noise += amplitude * ValueNoise ( n[0] * frequency, n[1] * frequency, n[2] * frequency, seed + octave );
+         frequency *= 2.0f;
+         amplitude *= 0.5f;
+      }
+
+      positions[i * 3 + 0] = n[0] * radius * ( 1.0f + roughness * noise );
+      positions[i * 3 + 1] = n[1] * radius * ( 1.0f + roughness * noise );
+      positions[i * 3 + 2] = n[2] * radius * ( 1.0f + roughness * noise );
+   }
+
+   if ( normals != NULL )
+   {
+      *normals = calloc ( numVertices * 3, sizeof(GLfloat) );
+
+      // Sum the area weighted face normals around every vertex
+      for ( i = 0; i < numIndices; i += 3 )
+      {
+         const float *p0 = &positions[triangles[i + 0] * 3];
+         const float *p1 = &positions[triangles[i + 1] * 3];
+         const float *p2 = &positions[triangles[i + 2] * 3];
+         float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+         float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+         float faceNormal[3];
+         int k;
+
+         faceNormal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+         faceNormal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+         faceNormal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+         for ( k = 0; k < 3; k++ )
+         {
+            float *sum = &(*normals)[triangles[i + k] * 3];
+            sum[0] += faceNormal[0];
+            sum[1] += faceNormal[1];
+            sum[2] += faceNormal[2];
+         }
+      }
+
+      for ( i = 0; i < numVertices; i++ )
+      {
+         float *n = &(*normals)[i * 3];
+         const float *outward = &sphereNormals[i * 3];
+         float length = sqrtf ( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+
+         // Vertices on the poles and seams only touch degenerate faces
+         if ( length == 0.0f )
+         {
+            n[0] = outward[0];
+            n[1] = outward[1];
+            n[2] = outward[2];
+            continue;
+         }
+
+         // Keep the normals on the side the sphere normals point to
+         if ( n[0] * outward[0] + n[1] * outward[1] + n[2] * outward[2] < 0.0f )
+            length = -length;
+
+         n[0] /= length;
+         n[1] /= length;
+         n[2] /= length;
+      }
+   }
+
+   free ( sphereNormals );
+
+   if ( vertices != NULL )
+      *vertices = positions;
+   else
+      free ( positions );
+
+   if ( indices != NULL )
+      *indices = triangles;
+   else
+      free ( triangles );
+
+   return numIndices;
+}
+
 //
 /// \brief Generates geometry for a cube.  Allocates memory for the vertex data and stores 
 ///        the results in the arrays.  Generate index list for a TRIANGLES
@@ -122,6 +122,107 @@ EGLBoolean CreateEGLContext ( EGLNativeWindowType hWnd, EGLDisplay* eglDisplay,
    return EGL_TRUE;
 } 
 
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+typedef EGLDisplay (*GetPlatformDisplayProc) ( EGLenum platform, void *nativeDisplay, const EGLint *attribList );
+
+///
+// CreateHeadlessEGLContext()
+//
+//    Creates an EGL rendering context on a pbuffer surface. Uses Mesa's
+//    surfaceless platform when the EGL library offers it, so software
+//    drivers like llvmpipe need neither a display server nor a GPU.
+//
+EGLBoolean CreateHeadlessEGLContext ( ESContext *esContext, EGLint attribList[] )
+{
+   EGLint numConfigs;
+   EGLint majorVersion;
+   EGLint minorVersion;
+   EGLDisplay display = EGL_NO_DISPLAY;
+   EGLContext context;
+   EGLSurface surface;
+   EGLConfig config;
+   EGLint configAttribs[32];
+   EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+   EGLint pbufferAttribs[] = { EGL_WIDTH, esContext->width, EGL_HEIGHT, esContext->height, EGL_NONE };
+   const char *extensions = eglQueryString ( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+   int i = 0;
+
+   // Get Display
+   if ( extensions != NULL && strstr ( extensions, "EGL_MESA_platform_surfaceless" ) != NULL )
+   {
+      GetPlatformDisplayProc getPlatformDisplay =
+         (GetPlatformDisplayProc) eglGetProcAddress ( "eglGetPlatformDisplayEXT" );
+
+      if ( getPlatformDisplay != NULL )
+      {
+         display = getPlatformDisplay ( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+      }
+   }
+
+   if ( display == EGL_NO_DISPLAY )
+   {
+      display = eglGetDisplay ( EGL_DEFAULT_DISPLAY );
+   }
+
+   if ( display == EGL_NO_DISPLAY )
+   {
+      return EGL_FALSE;
+   }
+
+   // Initialize EGL
+   if ( !eglInitialize(display, &majorVersion, &minorVersion) )
+   {
+      return EGL_FALSE;
+   }
+
+   // Ask for a pbuffer capable ES2 config on top of the window attributes
+   while ( i < 24 && attribList[i] != EGL_NONE )
+   {
+      configAttribs[i] = attribList[i];
+      configAttribs[i + 1] = attribList[i + 1];
+      i += 2;
+   }
+   configAttribs[i++] = EGL_SURFACE_TYPE;
+   configAttribs[i++] = EGL_PBUFFER_BIT;
+   configAttribs[i++] = EGL_RENDERABLE_TYPE;
+   configAttribs[i++] = EGL_OPENGL_ES2_BIT;
+   configAttribs[i] = EGL_NONE;
+
+   // Choose config
+   if ( !eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs < 1 )
+   {
+      return EGL_FALSE;
+   }
+
+   // Create a surface
+   surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+   if ( surface == EGL_NO_SURFACE )
+   {
+      return EGL_FALSE;
+   }
+
+   // Create a GL context
+   context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs );
+   if ( context == EGL_NO_CONTEXT )
+   {
+      return EGL_FALSE;
+   }
+
+   // Make the context current
+   if ( !eglMakeCurrent(display, surface, surface, context) )
+   {
+      return EGL_FALSE;
+   }
+
+   esContext->eglDisplay = display;
+   esContext->eglSurface = surface;
+   esContext->eglContext = context;
+   return EGL_TRUE;
+}
+
 #ifdef RPI_NO_X
 ///
 //  WinCreate() - RaspberryPi, direct surface (No X, Xlib)
@@ -356,6 +457,12 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char* title, G
 
    esContext->width = width;
    esContext->height = height;
+   esContext->flags = flags;
+
+   if ( flags & ES_WINDOW_HEADLESS )
+   {
+      return CreateHeadlessEGLContext ( esContext, attribList ) ? GL_TRUE : GL_FALSE;
+   }
 
    if ( !WinCreate ( esContext, title) )
    {
@@ -385,16 +492,23 @@ GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char* title, G
 
 void ESUTIL_API esMainLoop ( ESContext *esContext )
 {
-    struct timeval t1, t2;
+    struct timeval t1, t2, t3, t4;
     struct timezone tz;
     float deltatime;
     float totaltime = 0.0f;
     unsigned int frames = 0;
+    unsigned int totalframes = 0;
 
     gettimeofday ( &t1 , &tz );
 
-    while(userInterrupt(esContext) == GL_FALSE)
+    // There are no window events to pump without a window
+    while((esContext->flags & ES_WINDOW_HEADLESS) || userInterrupt(esContext) == GL_FALSE)
     {
+        if (esContext->quit)
+            break;
+        if (esContext->maxFrames != 0 && totalframes >= esContext->maxFrames)
+            break;
+
         gettimeofday(&t2, &tz);
         deltatime = (float)(t2.tv_sec - t1.tv_sec + (t2.tv_usec - t1.tv_usec) * 1e-6);
         t1 = t2;
@@ -404,13 +518,17 @@ void ESUTIL_API esMainLoop ( ESContext *esContext )
         if (esContext->drawFunc != NULL)
             esContext->drawFunc(esContext);
 
+        gettimeofday(&t3, &tz);
         eglSwapBuffers(esContext->eglDisplay, esContext->eglSurface);
+        gettimeofday(&t4, &tz);
+        esContext->swapTime = (float)(t4.tv_sec - t3.tv_sec + (t4.tv_usec - t3.tv_usec) * 1e-6);
 
         totaltime += deltatime;
         frames++;
+        totalframes++;
         if (totaltime >  2.0f)
         {
-            printf("%4d frames rendered in %1.4f seconds -> FPS=%3.4f\n", frames, totaltime, frames/totaltime);
+            printf("%4d frames rendered in %1.4f seconds -> FPS=%3.4f (%2.3f ms/frame)\n", frames, totaltime, frames/totaltime, 1000.0f*totaltime/frames);
             totaltime -= 2.0f;
             frames = 0;
         }
@@ -514,3 +632,47 @@ char* ESUTIL_API esLoadTGA ( char *fileName, int *width, int *height )
     fclose(f);
     return buffer;
 }
+
+
+///
+// esWritePPM()
+//
+//    Saves RGBA pixels read back with glReadPixels as a binary PPM. GL
+//    returns the bottom row first, PPM stores the top row first.
+//
+GLboolean ESUTIL_API esWritePPM ( const char *fileName, const GLubyte *pixels, int width, int height )
+{
+    FILE *f;
+    unsigned char *row;
+    int x, y;
+
+    f = fopen(fileName, "wb");
+    if(f == NULL) return GL_FALSE;
+
+    row = malloc(width * 3);
+    if (row == NULL)
+    {
+        fclose(f);
+        return GL_FALSE;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+
+    for (y = height - 1; y >= 0; y--)
+    {
+        const GLubyte *src = &pixels[y * width * 4];
+
+        for (x = 0; x < width; x++)
+        {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+
+        fwrite(row, 1, width * 3, f);
+    }
+
+    free(row);
+    fclose(f);
+    return GL_TRUE;
+}
@@ -22,6 +22,7 @@
 //
 #include <GLES2/gl2.h>
 #include <EGL/egl.h>
+#include <signal.h>
 
 #ifdef __cplusplus
 
@@ -46,6 +47,8 @@ extern "C" {
 #define ES_WINDOW_STENCIL       4
 /// esCreateWindow flat - multi-sample buffer
 #define ES_WINDOW_MULTISAMPLE   8
+/// esCreateWindow flag - render to an offscreen pbuffer, no window or display server
+#define ES_WINDOW_HEADLESS      16
 
 
 ///
@@ -87,6 +90,18 @@ typedef struct _escontext
    /// EGL surface
    EGLSurface  eglSurface;
 
+   /// Flags passed to esCreateWindow
+   GLuint      flags;
+
+   /// Frames esMainLoop renders before returning, 0 to run until interrupted
+   GLuint      maxFrames;
+
+   /// Set to make esMainLoop return after the current frame, e.g. from a signal handler
+   volatile sig_atomic_t quit;
+
+   /// Seconds the last eglSwapBuffers call took
+   float       swapTime;
+
    /// Callbacks
    void (ESCALLBACK *drawFunc) ( struct _escontext * );
    void (ESCALLBACK *keyFunc) ( struct _escontext *, unsigned char, int, int );
@@ -117,6 +132,7 @@ void ESUTIL_API esInitContext ( ESContext *esContext );
 ///         ES_WINDOW_DEPTH   - specifies that a depth buffer should be created
 ///         ES_WINDOW_STENCIL - specifies that a stencil buffer should be created
 ///         ES_WINDOW_MULTISAMPLE - specifies that a multi-sample buffer should be created
+///         ES_WINDOW_HEADLESS - specifies that a pbuffer should be used instead of a window
 /// \return GL_TRUE if window creation is succesful, GL_FALSE otherwise
 GLboolean ESUTIL_API esCreateWindow ( ESContext *esContext, const char *title, GLint width, GLint height, GLuint flags );
 
@@ -187,6 +203,19 @@ GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragSha
 int ESUTIL_API esGenSphere ( int numSlices, float radius, GLfloat **vertices, GLfloat **normals, 
                              GLfloat **texCoords, GLuint **indices );
 
+//
+/// \brief Generates a sphere like esGenSphere with its surface pushed in and out by
+///        value noise, for large irregular test meshes. Normals are recomputed from
+///        the displaced surface.
+/// \param numSlices The number of slices in the sphere, the mesh has numSlices^2 triangles
+/// \param roughness Largest displacement as a fraction of the radius
+/// \param seed Selects the noise pattern, the same seed gives the same mesh
+/// \return The number of indices for rendering the buffers as GL_TRIANGLES
+//
+int ESUTIL_API esGenNoisySphere ( int numSlices, float radius, float roughness, unsigned int seed,
+                                  GLfloat **vertices, GLfloat **normals,
+                                  GLfloat **texCoords, GLuint **indices );
+
 //
 /// \brief Generates geometry for a cube.  Allocates memory for the vertex data and stores 
 ///        the results in the arrays.  Generate index list for a TRIANGLES
@@ -210,6 +239,16 @@ int ESUTIL_API esGenCube ( float scale, GLfloat **vertices, GLfloat **normals,
 //
 char* ESUTIL_API esLoadTGA ( char *fileName, int *width, int *height );
 
+//
+/// \brief Saves RGBA pixels, as returned by glReadPixels, as a binary PPM
+/// \param fileName Name of the file to write
+/// \param pixels Rows of 4 byte pixels, bottom row first
+/// \param width Width of the image in pixels
+/// \param height Height of the image in pixels
+/// \return GL_TRUE if the file was written, GL_FALSE otherwise
+//
+GLboolean ESUTIL_API esWritePPM ( const char *fileName, const GLubyte *pixels, int width, int height );
+
 
 //
 /// \brief multiply matrix specified by result with a scaling matrix and return new matrix in result
@@ -0,0 +1,293 @@
+//
+// ControllerSim.cpp
+//
+//    Stands in for a controller: sends transforms at a fixed rate to a
+//    running renderer, turning the model at a steady speed, so input
+//    latency and the network counters can be measured under load. Sends
+//    are paced against absolute times, so a late wake-up does not slow
+//    the rate down. Messages are binary unless --text asks for the old
+//    T commands; --reorder swaps that percentage of neighbouring pairs,
+//    to see stale transforms being dropped. With --ack the acks of a
+//    renderer run with --ack are collected, and the percentiles of the
+//    latencies they carry and of their round trip are printed.
+//
+//    Usage: ghost-controller-sim [--host 127.0.0.1] [--port 4000]
+//                                [--rate 500] [--seconds 10] [--text]
+//                                [--reorder percent] [--ack]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "Protocol.h"
+
+#define SIM_HOST "127.0.0.1"
+#define SIM_PORT 4000
+#define SIM_RATE 500
+#define SIM_SECONDS 10.0
+#define SIM_DEGREES_PER_SECOND 90.0
+#define SIM_SEED 1
+
+// How long acks are waited for after the last transform.
+#define SIM_ACK_WAIT_MS 200
+
+//
+/// \brief Latencies taken from acks, in microseconds.
+//
+typedef struct
+{
+   uint32_t* applied;
+   uint32_t* presented;
+   uint32_t* roundTrip;
+   long count;
+   long size;
+} SimAcks;
+
+static double Seconds(const struct timespec* pTime)
+{
+   return pTime->tv_sec + pTime->tv_nsec * 1e-9;
+}
+
+static uint64_t NowMicroseconds()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint64_t) now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+///
+// Take every ack waiting on the socket. The timestamps are this
+// program's own, so the round trip needs no clock sync.
+//
+static void ReceiveAcks(int nSocket, SimAcks* pAcks)
+{
+   char arAck[PROTOCOL_MAX_SIZE];
+   ProtocolMessage ack;
+   int nLength;
+
+   while ((nLength = recv(nSocket, arAck, sizeof(arAck), MSG_DONTWAIT)) > 0)
+   {
+      if (ProtocolDecode(arAck, nLength, &ack) != PROTOCOL_OK || ack.type != PROTOCOL_ACK)
+         continue;
+
+      if (pAcks->count == pAcks->size)
+         continue;
+
+      pAcks->applied[pAcks->count] = ack.applied;
+      pAcks->presented[pAcks->count] = ack.presented;
+      pAcks->roundTrip[pAcks->count] = (uint32_t) (NowMicroseconds() - ack.timestamp);
+      pAcks->count++;
+   }
+}
+
+static int CompareU32(const void* pA, const void* pB)
+{
+   uint32_t uA = *(const uint32_t*) pA;
+   uint32_t uB = *(const uint32_t*) pB;
+
+   return (uA > uB) - (uA < uB);
+}
+
+static void PrintPercentiles(const char* pName, uint32_t* pValues, long nCount)
+{
+   qsort(pValues, nCount, sizeof(uint32_t), CompareU32);
+
+   printf("  %-10s p50 %7.3f ms  p95 %7.3f ms  p99 %7.3f ms  max %7.3f ms\n",
+      pName,
+      pValues[(nCount - 1) * 50 / 100] * 1e-3,
+      pValues[(nCount - 1) * 95 / 100] * 1e-3,
+      pValues[(nCount - 1) * 99 / 100] * 1e-3,
+      pValues[nCount - 1] * 1e-3);
+}
+
+int main(int argc, char *argv[])
+{
+   const char* pHost = SIM_HOST;
+   int nPort = SIM_PORT;
+   int nRate = SIM_RATE;
+   double fSeconds = SIM_SECONDS;
+   int bText = 0;
+   int nReorder = 0;
+   int bAck = 0;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+      {
+         pHost = argv[++i];
+      }
+      else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      {
+         nPort = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+      {
+         nRate = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+      {
+         fSeconds = atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--text") == 0)
+      {
+         bText = 1;
+      }
+      else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc)
+      {
+         nReorder = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--ack") == 0)
+      {
+         bAck = 1;
+      }
+      else
+      {
+         printf("Usage: %s [--host %s] [--port %d] [--rate %d] [--seconds %g] [--text] [--reorder percent] [--ack]\n",
+            argv[0], SIM_HOST, SIM_PORT, SIM_RATE, SIM_SECONDS);
+         return 0;
+      }
+   }
+
+   if (nRate < 1)
+      nRate = 1;
+
+   struct sockaddr_in renderer;
+   memset(&renderer, 0, sizeof(renderer));
+   renderer.sin_family = AF_INET;
+   renderer.sin_port = htons(nPort);
+
+   if (inet_pton(AF_INET, pHost, &renderer.sin_addr) != 1)
+   {
+      printf("%s is not an IPv4 address.\n", pHost);
+      return 1;
+   }
+
+   int nSocket = socket(AF_INET, SOCK_DGRAM, 0);
+   if (nSocket < 0)
+   {
+      printf("Failed to create socket.\n");
+      return 1;
+   }
+
+   long nMessages = (long) (fSeconds * nRate);
+   long nFailed = 0;
+   long nPeriod = 1000000000l / nRate;
+   struct timespec start;
+   struct timespec next;
+   struct timespec end;
+
+   // Text transforms are never acknowledged
+   SimAcks acks;
+   memset(&acks, 0, sizeof(acks));
+
+   if (bAck && !bText)
+   {
+      acks.size = nMessages;
+      acks.applied = new uint32_t[nMessages];
+      acks.presented = new uint32_t[nMessages];
+      acks.roundTrip = new uint32_t[nMessages];
+   }
+
+   long nSwapped = 0;
+   char arHeld[PROTOCOL_MAX_SIZE];
+   int nHeld = 0;
+
+   srand(SIM_SEED);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   next = start;
+
+   for (long i = 0; i < nMessages; i++)
+   {
+      ProtocolMessage message;
+      char arMessage[PROTOCOL_MAX_SIZE];
+      double fYaw = SIM_DEGREES_PER_SECOND * i / nRate;
+      struct timespec now;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      memset(&message, 0, sizeof(message));
+      message.type = PROTOCOL_TRANSFORM;
+      message.sequence = (uint32_t) i;
+      message.timestamp = (uint64_t) now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+      message.yaw = (float) (fYaw - 360.0 * (long) (fYaw / 360.0));
+      message.scale = 1.0f;
+
+      int nLength = bText ? ProtocolEncodeText(&message, arMessage, sizeof(arMessage))
+                          : ProtocolEncode(&message, arMessage, sizeof(arMessage));
+
+      // Hold this one back and send it after the next
+      if (nHeld == 0 && rand() % 100 < nReorder)
+      {
+         memcpy(arHeld, arMessage, nLength);
+         nHeld = nLength;
+         nSwapped++;
+      }
+      else
+      {
+         if (sendto(nSocket, arMessage, nLength, 0, (struct sockaddr*) &renderer, sizeof(renderer)) != nLength)
+            nFailed++;
+
+         if (nHeld > 0 && sendto(nSocket, arHeld, nHeld, 0, (struct sockaddr*) &renderer, sizeof(renderer)) != nHeld)
+            nFailed++;
+
+         nHeld = 0;
+      }
+
+      if (acks.size > 0)
+         ReceiveAcks(nSocket, &acks);
+
+      next.tv_nsec += nPeriod;
+      while (next.tv_nsec >= 1000000000l)
+      {
+         next.tv_nsec -= 1000000000l;
+         next.tv_sec++;
+      }
+
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+   }
+
+   if (nHeld > 0 && sendto(nSocket, arHeld, nHeld, 0, (struct sockaddr*) &renderer, sizeof(renderer)) != nHeld)
+      nFailed++;
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   double fElapsed = Seconds(&end) - Seconds(&start);
+
+   printf("Sent %ld %s transforms in %.2f s (%.1f Hz), %ld failed, %ld pairs swapped\n",
+      nMessages - nFailed, bText ? "text" : "binary", fElapsed, (nMessages - nFailed) / fElapsed, nFailed, nSwapped);
+
+   if (acks.size > 0)
+   {
+      // The last transforms are still on their way to the screen
+      struct pollfd waitFor = { nSocket, POLLIN, 0 };
+
+      while (poll(&waitFor, 1, SIM_ACK_WAIT_MS) > 0)
+         ReceiveAcks(nSocket, &acks);
+
+      // Only the newest transform of a frame is shown and acknowledged
+      printf("%ld transforms acknowledged\n", acks.count);
+
+      if (acks.count > 0)
+      {
+         PrintPercentiles("apply", acks.applied, acks.count);
+         PrintPercentiles("present", acks.presented, acks.count);
+         PrintPercentiles("round trip", acks.roundTrip, acks.count);
+      }
+
+      delete[] acks.applied;
+      delete[] acks.presented;
+      delete[] acks.roundTrip;
+   }
+
+   close(nSocket);
+   return 0;
+}
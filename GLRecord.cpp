@@ -0,0 +1,1225 @@
+//
+// GLRecord.cpp
+//
+//    Link-time stand-in for libGLESv2 and libEGL. Linked instead of the
+//    driver (see the ghost-renderer-record target), it implements every
+//    entry point the renderer calls, hands out object names in order,
+//    reflects attribute and uniform locations from the shader sources
+//    and records each call with its arguments into a binary stream.
+//    eglSwapBuffers ends a frame: the call counts, draws, uploaded bytes
+//    and state changes of the frame are written to a text summary. Data
+//    is recorded as size plus hash, and nothing depends on pointers or
+//    time, so two runs of the same build give identical files.
+//
+//    GLRECORD_TRACE names the stream (default glrecord.trace) and
+//    GLRECORD_STATS the summary (default glrecord.stats).
+//
+#include <GLES2/gl2.h>
+#include <EGL/egl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "GLRecord.h"
+
+// Newer Khronos headers made the source array of glShaderSource const.
+#ifdef GL_GLES_PROTOTYPES
+typedef const GLchar* const* ShaderSourceStrings;
+#else
+typedef const GLchar** ShaderSourceStrings;
+#endif
+
+#define GLRECORD_MAX_ATTRIBS 16
+
+#define GLRECORD_NAME(name, args) #name,
+static const char* s_arCallNames[] = { GLRECORD_CALLS(GLRECORD_NAME) };
+#undef GLRECORD_NAME
+
+typedef struct
+{
+   unsigned int calls[GLRECORD_CALL_COUNT];
+   unsigned int draws;
+   unsigned int vertices;
+   unsigned int stateChanges;
+   unsigned int redundantChanges;
+   unsigned int uploadBytes;
+   unsigned int uniformBytes;
+   unsigned int clientBytes;
+} FrameCounters;
+
+typedef struct
+{
+   int enabled;
+   GLint size;
+   GLenum type;
+   GLboolean normalized;
+   GLsizei stride;
+   GLuint buffer;
+   const void* pointer;
+} AttribState;
+
+typedef struct
+{
+   GLenum type;
+   std::string source;
+} ShaderObject;
+
+typedef struct
+{
+   std::vector<GLuint> shaders;
+   std::map<std::string, GLint> attribs;
+   std::map<std::string, GLint> uniforms;
+} ProgramObject;
+
+static FILE* s_pTrace = 0;
+static FILE* s_pStats = 0;
+static std::vector<uint32_t> s_record;
+static int s_nCall = 0;
+
+static FrameCounters s_frame;
+static FrameCounters s_total;
+static unsigned int s_nFrame = 0;
+
+// Shadow of the state the renderer changes, to spot redundant calls
+static GLuint s_uProgram = 0;
+static GLuint s_uArrayBuffer = 0;
+static GLuint s_uTexture = 0;
+static GLuint s_uFramebuffer = 0;
+static GLuint s_uRenderbuffer = 0;
+static GLint s_arViewport[4] = { 0, 0, 0, 0 };
+static GLenum s_arBlendFunc[2] = { GL_ONE, GL_ZERO };
+static GLenum s_eFrontFace = GL_CCW;
+static GLenum s_eCullFace = GL_BACK;
+static GLfloat s_arClearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+static GLfloat s_fLineWidth = 1.0f;
+static std::map<GLenum, int> s_capabilities;
+static AttribState s_arAttribs[GLRECORD_MAX_ATTRIBS];
+
+// Objects share one name counter, like shaders and programs do in GL
+static GLuint s_uNextName = 1;
+static std::map<GLuint, ShaderObject> s_shaders;
+static std::map<GLuint, ProgramObject> s_programs;
+
+static uint32_t HashBytes(const void* pData, size_t nSize, uint32_t uHash)
+{
+   const unsigned char* p = (const unsigned char*) pData;
+
+   for (size_t i = 0; i < nSize; i++)
+   {
+      uHash ^= p[i];
+      uHash *= 16777619u;
+   }
+
+   return uHash;
+}
+
+#define GLRECORD_HASH_SEED 2166136261u
+
+static void WriteFrameStats(const FrameCounters* pCounters, const char* pLabel)
+{
+   unsigned int nCalls = 0;
+
+   for (int i = 0; i < GLRECORD_CALL_COUNT; i++)
+      nCalls += pCounters->calls[i];
+
+   fprintf(s_pStats,
+      "%s: calls %u, draws %u, vertices %u, state %u (redundant %u), upload %u B, uniforms %u B, client arrays %u B\n",
+      pLabel,
+      nCalls,
+      pCounters->draws,
+      pCounters->vertices,
+      pCounters->stateChanges,
+      pCounters->redundantChanges,
+      pCounters->uploadBytes,
+      pCounters->uniformBytes,
+      pCounters->clientBytes);
+
+   for (int i = 0; i < GLRECORD_CALL_COUNT; i++)
+   {
+      if (pCounters->calls[i] != 0)
+         fprintf(s_pStats, "  %-28s %u\n", s_arCallNames[i], pCounters->calls[i]);
+   }
+}
+
+static void CloseRecording()
+{
+   if (s_pTrace == 0)
+      return;
+
+   fclose(s_pTrace);
+   s_pTrace = 0;
+
+   // Loading in frame 0 is left out of the total
+   if (s_nFrame > 1)
+   {
+      char arLabel[64];
+      snprintf(arLabel, sizeof(arLabel), "total of frames 1-%u", s_nFrame - 1);
+      WriteFrameStats(&s_total, arLabel);
+   }
+
+   fclose(s_pStats);
+   s_pStats = 0;
+}
+
+static void OpenRecording()
+{
+   const char* pTrace = getenv("GLRECORD_TRACE");
+   const char* pStats = getenv("GLRECORD_STATS");
+
+   s_pTrace = fopen(pTrace ? pTrace : "glrecord.trace", "wb");
+   s_pStats = fopen(pStats ? pStats : "glrecord.stats", "w");
+
+   if (s_pTrace == 0 || s_pStats == 0)
+   {
+      printf("GLRecord: could not open the trace or stats file.\n");
+      exit(1);
+   }
+
+   uint32_t arHeader[2] = { GLRECORD_MAGIC, GLRECORD_VERSION };
+   fwrite(arHeader, sizeof(arHeader), 1, s_pTrace);
+
+   atexit(CloseRecording);
+}
+
+void GLRecordGetTotals(GLRecordTotals* pTotals)
+{
+   memset(pTotals, 0, sizeof(GLRecordTotals));
+
+   for (int i = 0; i < GLRECORD_CALL_COUNT; i++)
+      pTotals->calls += s_total.calls[i];
+
+   pTotals->frames = (s_nFrame > 0) ? s_nFrame - 1 : 0;
+   pTotals->draws = s_total.draws;
+   pTotals->vertices = s_total.vertices;
+   pTotals->stateChanges = s_total.stateChanges;
+   pTotals->redundantChanges = s_total.redundantChanges;
+   pTotals->uploadBytes = s_total.uploadBytes;
+   pTotals->uniformBytes = s_total.uniformBytes;
+   pTotals->clientBytes = s_total.clientBytes;
+}
+
+static void Begin(int nCall)
+{
+   if (s_pTrace == 0)
+      OpenRecording();
+
+   s_nCall = nCall;
+   s_record.clear();
+   s_frame.calls[nCall]++;
+}
+
+static void Word(uint32_t uWord)
+{
+   s_record.push_back(uWord);
+}
+
+static void Float(GLfloat fValue)
+{
+   uint32_t uWord;
+   memcpy(&uWord, &fValue, sizeof(uWord));
+   Word(uWord);
+}
+
+static void Bytes(const void* pData, size_t nSize)
+{
+   Word((uint32_t) nSize);
+   Word(pData ? HashBytes(pData, nSize, GLRECORD_HASH_SEED) : 0);
+}
+
+static void String(const char* pString)
+{
+   size_t nLength = pString ? strlen(pString) : 0;
+   size_t nWords = (nLength + 3) / 4;
+
+   Word((uint32_t) nLength);
+
+   for (size_t i = 0; i < nWords; i++)
+   {
+      uint32_t uWord = 0;
+      size_t nCopy = (nLength - i * 4 < 4) ? nLength - i * 4 : 4;
+
+      memcpy(&uWord, &pString[i * 4], nCopy);
+      Word(uWord);
+   }
+}
+
+static void Names(GLsizei n, const GLuint* pNames)
+{
+   Word((uint32_t) n);
+
+   for (GLsizei i = 0; i < n; i++)
+      Word(pNames[i]);
+}
+
+static void End()
+{
+   uint32_t uHeader = (uint32_t) s_nCall | ((uint32_t) s_record.size() << 16);
+
+   fwrite(&uHeader, sizeof(uHeader), 1, s_pTrace);
+
+   if (!s_record.empty())
+      fwrite(&s_record[0], sizeof(uint32_t), s_record.size(), s_pTrace);
+}
+
+///
+// Count a state setting call, and whether it set what was already set.
+//
+static void StateChange(int bRedundant)
+{
+   s_frame.stateChanges++;
+
+   if (bRedundant)
+      s_frame.redundantChanges++;
+}
+
+static void GenNames(int nCall, GLsizei n, GLuint* pNames)
+{
+   for (GLsizei i = 0; i < n; i++)
+      pNames[i] = s_uNextName++;
+
+   Begin(nCall);
+   Names(n, pNames);
+   End();
+}
+
+static void DeleteNames(int nCall, GLsizei n, const GLuint* pNames)
+{
+   Begin(nCall);
+   Names(n, pNames);
+   End();
+}
+
+static int BytesPerPixel(GLenum format, GLenum type)
+{
+   if (type == GL_UNSIGNED_SHORT_5_6_5 ||
+       type == GL_UNSIGNED_SHORT_4_4_4_4 ||
+       type == GL_UNSIGNED_SHORT_5_5_5_1)
+      return 2;
+
+   switch (format)
+   {
+   case GL_RGBA:
+      return 4;
+   case GL_RGB:
+      return 3;
+   case GL_LUMINANCE_ALPHA:
+      return 2;
+   default:
+      return 1;
+   }
+}
+
+static int TypeSize(GLenum type)
+{
+   switch (type)
+   {
+   case GL_BYTE:
+   case GL_UNSIGNED_BYTE:
+      return 1;
+   case GL_SHORT:
+   case GL_UNSIGNED_SHORT:
+      return 2;
+   default:
+      return 4;
+   }
+}
+
+///
+// Collect the attributes and uniforms a shader declares, following
+// #define, #ifdef, #ifndef, #else and #endif like the compiler would.
+//
+static void ReflectShader(const ShaderObject* pShader, ProgramObject* pProgram)
+{
+   std::map<std::string, int> defines;
+   std::vector<int> active;
+   const std::string& source = pShader->source;
+   size_t nStart = 0;
+
+   while (nStart < source.size())
+   {
+      size_t nEnd = source.find('\n', nStart);
+      if (nEnd == std::string::npos)
+         nEnd = source.size();
+
+      std::string line = source.substr(nStart, nEnd - nStart);
+      nStart = nEnd + 1;
+
+      char arDirective[32] = "";
+      char arName[128] = "";
+      int bActive = 1;
+
+      for (size_t i = 0; i < active.size(); i++)
+         bActive = bActive && active[i];
+
+      if (sscanf(line.c_str(), " #%31s %127s", arDirective, arName) >= 1)
+      {
+         std::string directive = arDirective;
+
+         if (directive == "define" && bActive)
+            defines[arName] = 1;
+         else if (directive == "ifdef")
+            active.push_back(defines.count(arName) != 0);
+         else if (directive == "ifndef")
+            active.push_back(defines.count(arName) == 0);
+         else if (directive == "if")
+            active.push_back(1);
+         else if (directive == "else" && !active.empty())
+            active.back() = !active.back();
+         else if (directive == "endif" && !active.empty())
+            active.pop_back();
+
+         continue;
+      }
+
+      if (!bActive)
+         continue;
+
+      // One declaration per statement, the name is the last identifier
+      size_t nStatement = 0;
+      while (nStatement < line.size())
+      {
+         size_t nSemicolon = line.find(';', nStatement);
+         if (nSemicolon == std::string::npos)
+            break;
+
+         std::string statement = line.substr(nStatement, nSemicolon - nStatement);
+         nStatement = nSemicolon + 1;
+
+         char arQualifier[32] = "";
+         if (sscanf(statement.c_str(), " %31s", arQualifier) != 1)
+            continue;
+
+         int bAttribute = strcmp(arQualifier, "attribute") == 0;
+         int bUniform = strcmp(arQualifier, "uniform") == 0;
+
+         if (!bAttribute && !bUniform)
+            continue;
+
+         size_t nBracket = statement.find('[');
+         if (nBracket != std::string::npos)
+            statement = statement.substr(0, nBracket);
+
+         size_t nLast = statement.find_last_not_of(" \t");
+         size_t nFirst = statement.find_last_of(" \t", nLast);
+         std::string name = statement.substr(nFirst + 1, nLast - nFirst);
+
+         std::map<std::string, GLint>& table = bAttribute ? pProgram->attribs : pProgram->uniforms;
+
+         if (table.count(name) == 0)
+         {
+            GLint nLocation = (GLint) table.size();
+            table[name] = nLocation;
+         }
+      }
+   }
+}
+
+///
+// Bytes and hash of the enabled client side arrays a draw reads.
+//
+static void HashClientArrays(GLint first, GLsizei count, uint32_t* pSize, uint32_t* pHash)
+{
+   uint32_t uHash = GLRECORD_HASH_SEED;
+   uint32_t uSize = 0;
+
+   for (int i = 0; i < GLRECORD_MAX_ATTRIBS; i++)
+   {
+      const AttribState* pAttrib = &s_arAttribs[i];
+
+      if (!pAttrib->enabled || pAttrib->buffer != 0 || pAttrib->pointer == 0)
+         continue;
+
+      int nElementSize = pAttrib->size * TypeSize(pAttrib->type);
+      int nStride = pAttrib->stride ? pAttrib->stride : nElementSize;
+      const unsigned char* pData = (const unsigned char*) pAttrib->pointer;
+
+      for (GLsizei v = first; v < first + count; v++)
+      {
+         uHash = HashBytes(&pData[v * nStride], nElementSize, uHash);
+         uSize += nElementSize;
+      }
+   }
+
+   *pSize = uSize;
+   *pHash = uSize ? uHash : 0;
+}
+
+extern "C" {
+
+GL_APICALL void GL_APIENTRY glAttachShader (GLuint program, GLuint shader)
+{
+   s_programs[program].shaders.push_back(shader);
+
+   Begin(GLRECORD_glAttachShader);
+   Word(program);
+   Word(shader);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glBindBuffer (GLenum target, GLuint buffer)
+{
+   if (target == GL_ARRAY_BUFFER)
+   {
+      StateChange(s_uArrayBuffer == buffer);
+      s_uArrayBuffer = buffer;
+   }
+   else
+   {
+      StateChange(0);
+   }
+
+   Begin(GLRECORD_glBindBuffer);
+   Word(target);
+   Word(buffer);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glBindFramebuffer (GLenum target, GLuint framebuffer)
+{
+   StateChange(s_uFramebuffer == framebuffer);
+   s_uFramebuffer = framebuffer;
+
+   Begin(GLRECORD_glBindFramebuffer);
+   Word(target);
+   Word(framebuffer);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glBindRenderbuffer (GLenum target, GLuint renderbuffer)
+{
+   StateChange(s_uRenderbuffer == renderbuffer);
+   s_uRenderbuffer = renderbuffer;
+
+   Begin(GLRECORD_glBindRenderbuffer);
+   Word(target);
+   Word(renderbuffer);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glBindTexture (GLenum target, GLuint texture)
+{
+   StateChange(s_uTexture == texture);
+   s_uTexture = texture;
+
+   Begin(GLRECORD_glBindTexture);
+   Word(target);
+   Word(texture);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glBlendFunc (GLenum sfactor, GLenum dfactor)
+{
+   StateChange(s_arBlendFunc[0] == sfactor && s_arBlendFunc[1] == dfactor);
+   s_arBlendFunc[0] = sfactor;
+   s_arBlendFunc[1] = dfactor;
+
+   Begin(GLRECORD_glBlendFunc);
+   Word(sfactor);
+   Word(dfactor);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glBufferData (GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+   s_frame.uploadBytes += (unsigned int) size;
+
+   Begin(GLRECORD_glBufferData);
+   Word(target);
+   Bytes(data, size);
+   Word(usage);
+   End();
+}
+
+GL_APICALL GLenum GL_APIENTRY glCheckFramebufferStatus (GLenum target)
+{
+   Begin(GLRECORD_glCheckFramebufferStatus);
+   Word(target);
+   Word(GL_FRAMEBUFFER_COMPLETE);
+   End();
+
+   return GL_FRAMEBUFFER_COMPLETE;
+}
+
+GL_APICALL void GL_APIENTRY glClear (GLbitfield mask)
+{
+   Begin(GLRECORD_glClear);
+   Word(mask);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glClearColor (GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+   StateChange(s_arClearColor[0] == red && s_arClearColor[1] == green &&
+               s_arClearColor[2] == blue && s_arClearColor[3] == alpha);
+   s_arClearColor[0] = red;
+   s_arClearColor[1] = green;
+   s_arClearColor[2] = blue;
+   s_arClearColor[3] = alpha;
+
+   Begin(GLRECORD_glClearColor);
+   Float(red);
+   Float(green);
+   Float(blue);
+   Float(alpha);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glCompileShader (GLuint shader)
+{
+   Begin(GLRECORD_glCompileShader);
+   Word(shader);
+   End();
+}
+
+GL_APICALL GLuint GL_APIENTRY glCreateProgram (void)
+{
+   GLuint program = s_uNextName++;
+   s_programs[program] = ProgramObject();
+
+   Begin(GLRECORD_glCreateProgram);
+   Word(program);
+   End();
+
+   return program;
+}
+
+GL_APICALL GLuint GL_APIENTRY glCreateShader (GLenum type)
+{
+   GLuint shader = s_uNextName++;
+   s_shaders[shader].type = type;
+
+   Begin(GLRECORD_glCreateShader);
+   Word(type);
+   Word(shader);
+   End();
+
+   return shader;
+}
+
+GL_APICALL void GL_APIENTRY glCullFace (GLenum mode)
+{
+   StateChange(s_eCullFace == mode);
+   s_eCullFace = mode;
+
+   Begin(GLRECORD_glCullFace);
+   Word(mode);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glDeleteBuffers (GLsizei n, const GLuint *buffers)
+{
+   DeleteNames(GLRECORD_glDeleteBuffers, n, buffers);
+}
+
+GL_APICALL void GL_APIENTRY glDeleteFramebuffers (GLsizei n, const GLuint *framebuffers)
+{
+   DeleteNames(GLRECORD_glDeleteFramebuffers, n, framebuffers);
+}
+
+GL_APICALL void GL_APIENTRY glDeleteProgram (GLuint program)
+{
+   s_programs.erase(program);
+
+   Begin(GLRECORD_glDeleteProgram);
+   Word(program);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glDeleteRenderbuffers (GLsizei n, const GLuint *renderbuffers)
+{
+   DeleteNames(GLRECORD_glDeleteRenderbuffers, n, renderbuffers);
+}
+
+GL_APICALL void GL_APIENTRY glDeleteShader (GLuint shader)
+{
+   // Still attached shaders keep their source for linking
+   Begin(GLRECORD_glDeleteShader);
+   Word(shader);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glDeleteTextures (GLsizei n, const GLuint *textures)
+{
+   DeleteNames(GLRECORD_glDeleteTextures, n, textures);
+}
+
+GL_APICALL void GL_APIENTRY glDisable (GLenum cap)
+{
+   StateChange(s_capabilities[cap] == 0);
+   s_capabilities[cap] = 0;
+
+   Begin(GLRECORD_glDisable);
+   Word(cap);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glDisableVertexAttribArray (GLuint index)
+{
+   if (index < GLRECORD_MAX_ATTRIBS)
+   {
+      StateChange(s_arAttribs[index].enabled == 0);
+      s_arAttribs[index].enabled = 0;
+   }
+
+   Begin(GLRECORD_glDisableVertexAttribArray);
+   Word(index);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
+{
+   uint32_t uClientSize = 0;
+   uint32_t uClientHash = 0;
+
+   HashClientArrays(first, count, &uClientSize, &uClientHash);
+
+   s_frame.draws++;
+   s_frame.vertices += count;
+   s_frame.clientBytes += uClientSize;
+
+   Begin(GLRECORD_glDrawArrays);
+   Word(mode);
+   Word(first);
+   Word(count);
+   Word(uClientSize);
+   Word(uClientHash);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glEnable (GLenum cap)
+{
+   StateChange(s_capabilities[cap] == 1);
+   s_capabilities[cap] = 1;
+
+   Begin(GLRECORD_glEnable);
+   Word(cap);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glEnableVertexAttribArray (GLuint index)
+{
+   if (index < GLRECORD_MAX_ATTRIBS)
+   {
+      StateChange(s_arAttribs[index].enabled == 1);
+      s_arAttribs[index].enabled = 1;
+   }
+
+   Begin(GLRECORD_glEnableVertexAttribArray);
+   Word(index);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glFramebufferRenderbuffer (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer)
+{
+   Begin(GLRECORD_glFramebufferRenderbuffer);
+   Word(target);
+   Word(attachment);
+   Word(renderbuffertarget);
+   Word(renderbuffer);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glFramebufferTexture2D (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+{
+   Begin(GLRECORD_glFramebufferTexture2D);
+   Word(target);
+   Word(attachment);
+   Word(textarget);
+   Word(texture);
+   Word(level);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glFrontFace (GLenum mode)
+{
+   StateChange(s_eFrontFace == mode);
+   s_eFrontFace = mode;
+
+   Begin(GLRECORD_glFrontFace);
+   Word(mode);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glGenBuffers (GLsizei n, GLuint *buffers)
+{
+   GenNames(GLRECORD_glGenBuffers, n, buffers);
+}
+
+GL_APICALL void GL_APIENTRY glGenFramebuffers (GLsizei n, GLuint *framebuffers)
+{
+   GenNames(GLRECORD_glGenFramebuffers, n, framebuffers);
+}
+
+GL_APICALL void GL_APIENTRY glGenRenderbuffers (GLsizei n, GLuint *renderbuffers)
+{
+   GenNames(GLRECORD_glGenRenderbuffers, n, renderbuffers);
+}
+
+GL_APICALL void GL_APIENTRY glGenTextures (GLsizei n, GLuint *textures)
+{
+   GenNames(GLRECORD_glGenTextures, n, textures);
+}
+
+GL_APICALL GLint GL_APIENTRY glGetAttribLocation (GLuint program, const GLchar *name)
+{
+   std::map<std::string, GLint>& attribs = s_programs[program].attribs;
+   std::map<std::string, GLint>::iterator it = attribs.find(name);
+   GLint nLocation = (it != attribs.end()) ? it->second : -1;
+
+   Begin(GLRECORD_glGetAttribLocation);
+   Word(program);
+   String(name);
+   Word(nLocation);
+   End();
+
+   return nLocation;
+}
+
+GL_APICALL void GL_APIENTRY glGetIntegerv (GLenum pname, GLint *data)
+{
+   // Nothing optional is supported
+   *data = 0;
+
+   Begin(GLRECORD_glGetIntegerv);
+   Word(pname);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glGetProgramInfoLog (GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
+{
+   if (length != 0)
+      *length = 0;
+   if (bufSize > 0)
+      infoLog[0] = '\0';
+
+   Begin(GLRECORD_glGetProgramInfoLog);
+   Word(program);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glGetProgramiv (GLuint program, GLenum pname, GLint *params)
+{
+   *params = (pname == GL_LINK_STATUS) ? GL_TRUE : 0;
+
+   Begin(GLRECORD_glGetProgramiv);
+   Word(program);
+   Word(pname);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glGetShaderInfoLog (GLuint shader, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
+{
+   if (length != 0)
+      *length = 0;
+   if (bufSize > 0)
+      infoLog[0] = '\0';
+
+   Begin(GLRECORD_glGetShaderInfoLog);
+   Word(shader);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glGetShaderiv (GLuint shader, GLenum pname, GLint *params)
+{
+   *params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0;
+
+   Begin(GLRECORD_glGetShaderiv);
+   Word(shader);
+   Word(pname);
+   End();
+}
+
+GL_APICALL const GLubyte *GL_APIENTRY glGetString (GLenum name)
+{
+   const char* pValue = "";
+
+   switch (name)
+   {
+   case GL_VENDOR:
+   case GL_RENDERER:
+      pValue = "GLRecord";
+      break;
+   case GL_VERSION:
+      pValue = "OpenGL ES 2.0 GLRecord";
+      break;
+   case GL_SHADING_LANGUAGE_VERSION:
+      pValue = "OpenGL ES GLSL ES 1.00";
+      break;
+   }
+
+   Begin(GLRECORD_glGetString);
+   Word(name);
+   End();
+
+   return (const GLubyte*) pValue;
+}
+
+GL_APICALL GLint GL_APIENTRY glGetUniformLocation (GLuint program, const GLchar *name)
+{
+   std::string key = name;
+
+   // "array[0]" names the same location as "array"
+   if (key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0)
+      key.resize(key.size() - 3);
+
+   std::map<std::string, GLint>& uniforms = s_programs[program].uniforms;
+   std::map<std::string, GLint>::iterator it = uniforms.find(key);
+   GLint nLocation = (it != uniforms.end()) ? it->second : -1;
+
+   Begin(GLRECORD_glGetUniformLocation);
+   Word(program);
+   String(name);
+   Word(nLocation);
+   End();
+
+   return nLocation;
+}
+
+GL_APICALL void GL_APIENTRY glLineWidth (GLfloat width)
+{
+   StateChange(s_fLineWidth == width);
+   s_fLineWidth = width;
+
+   Begin(GLRECORD_glLineWidth);
+   Float(width);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glLinkProgram (GLuint program)
+{
+   ProgramObject* pProgram = &s_programs[program];
+
+   pProgram->attribs.clear();
+   pProgram->uniforms.clear();
+
+   // Attributes come from the vertex shader, uniforms from both
+   for (size_t i = 0; i < pProgram->shaders.size(); i++)
+   {
+      std::map<GLuint, ShaderObject>::iterator it = s_shaders.find(pProgram->shaders[i]);
+
+      if (it != s_shaders.end())
+         ReflectShader(&it->second, pProgram);
+   }
+
+   Begin(GLRECORD_glLinkProgram);
+   Word(program);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glReadPixels (GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *pixels)
+{
+   memset(pixels, 0, width * height * BytesPerPixel(format, type));
+
+   Begin(GLRECORD_glReadPixels);
+   Word(x);
+   Word(y);
+   Word(width);
+   Word(height);
+   Word(format);
+   Word(type);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glRenderbufferStorage (GLenum target, GLenum internalformat, GLsizei width, GLsizei height)
+{
+   Begin(GLRECORD_glRenderbufferStorage);
+   Word(target);
+   Word(internalformat);
+   Word(width);
+   Word(height);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glShaderSource (GLuint shader, GLsizei count, ShaderSourceStrings string, const GLint *length)
+{
+   std::string& source = s_shaders[shader].source;
+
+   source.clear();
+
+   for (GLsizei i = 0; i < count; i++)
+   {
+      if (length != 0 && length[i] >= 0)
+         source.append(string[i], length[i]);
+      else
+         source.append(string[i]);
+   }
+
+   Begin(GLRECORD_glShaderSource);
+   Word(shader);
+   Bytes(source.data(), source.size());
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glTexImage2D (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels)
+{
+   size_t nSize = width * height * BytesPerPixel(format, type);
+
+   s_frame.uploadBytes += (unsigned int) nSize;
+
+   Begin(GLRECORD_glTexImage2D);
+   Word(target);
+   Word(level);
+   Word(internalformat);
+   Word(width);
+   Word(height);
+   Word(border);
+   Word(format);
+   Word(type);
+   Bytes(pixels, pixels ? nSize : 0);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glTexParameteri (GLenum target, GLenum pname, GLint param)
+{
+   StateChange(0);
+
+   Begin(GLRECORD_glTexParameteri);
+   Word(target);
+   Word(pname);
+   Word(param);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glUniform1i (GLint location, GLint v0)
+{
+   StateChange(0);
+   s_frame.uniformBytes += sizeof(GLint);
+
+   Begin(GLRECORD_glUniform1i);
+   Word(location);
+   Word(v0);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glUniform2f (GLint location, GLfloat v0, GLfloat v1)
+{
+   StateChange(0);
+   s_frame.uniformBytes += 2 * sizeof(GLfloat);
+
+   Begin(GLRECORD_glUniform2f);
+   Word(location);
+   Float(v0);
+   Float(v1);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glUniform2fv (GLint location, GLsizei count, const GLfloat *value)
+{
+   StateChange(0);
+   s_frame.uniformBytes += count * 2 * sizeof(GLfloat);
+
+   Begin(GLRECORD_glUniform2fv);
+   Word(location);
+   Word(count);
+   Bytes(value, count * 2 * sizeof(GLfloat));
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glUniform4fv (GLint location, GLsizei count, const GLfloat *value)
+{
+   StateChange(0);
+   s_frame.uniformBytes += count * 4 * sizeof(GLfloat);
+
+   Begin(GLRECORD_glUniform4fv);
+   Word(location);
+   Word(count);
+   Bytes(value, count * 4 * sizeof(GLfloat));
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glUniformMatrix4fv (GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+   StateChange(0);
+   s_frame.uniformBytes += count * 16 * sizeof(GLfloat);
+
+   Begin(GLRECORD_glUniformMatrix4fv);
+   Word(location);
+   Word(count);
+   Word(transpose);
+   Bytes(value, count * 16 * sizeof(GLfloat));
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glUseProgram (GLuint program)
+{
+   StateChange(s_uProgram == program);
+   s_uProgram = program;
+
+   Begin(GLRECORD_glUseProgram);
+   Word(program);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glVertexAttribPointer (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer)
+{
+   if (index < GLRECORD_MAX_ATTRIBS)
+   {
+      AttribState* pAttrib = &s_arAttribs[index];
+
+      StateChange(pAttrib->size == size && pAttrib->type == type &&
+                  pAttrib->normalized == normalized && pAttrib->stride == stride &&
+                  pAttrib->buffer == s_uArrayBuffer && pAttrib->pointer == pointer);
+
+      pAttrib->size = size;
+      pAttrib->type = type;
+      pAttrib->normalized = normalized;
+      pAttrib->stride = stride;
+      pAttrib->buffer = s_uArrayBuffer;
+      pAttrib->pointer = pointer;
+   }
+
+   Begin(GLRECORD_glVertexAttribPointer);
+   Word(index);
+   Word(size);
+   Word(type);
+   Word(normalized);
+   Word(stride);
+   Word(s_uArrayBuffer ? (uint32_t) (size_t) pointer : GLRECORD_CLIENT_POINTER);
+   End();
+}
+
+GL_APICALL void GL_APIENTRY glViewport (GLint x, GLint y, GLsizei width, GLsizei height)
+{
+   StateChange(s_arViewport[0] == x && s_arViewport[1] == y &&
+               s_arViewport[2] == width && s_arViewport[3] == height);
+   s_arViewport[0] = x;
+   s_arViewport[1] = y;
+   s_arViewport[2] = width;
+   s_arViewport[3] = height;
+
+   Begin(GLRECORD_glViewport);
+   Word(x);
+   Word(y);
+   Word(width);
+   Word(height);
+   End();
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglChooseConfig (EGLDisplay dpy, const EGLint *attrib_list, EGLConfig *configs, EGLint config_size, EGLint *num_config)
+{
+   if (configs != 0 && config_size > 0)
+      configs[0] = (EGLConfig) 1;
+   *num_config = 1;
+
+   Begin(GLRECORD_eglChooseConfig);
+   End();
+
+   return EGL_TRUE;
+}
+
+EGLAPI EGLContext EGLAPIENTRY eglCreateContext (EGLDisplay dpy, EGLConfig config, EGLContext share_context, const EGLint *attrib_list)
+{
+   Begin(GLRECORD_eglCreateContext);
+   End();
+
+   return (EGLContext) 1;
+}
+
+EGLAPI EGLSurface EGLAPIENTRY eglCreatePbufferSurface (EGLDisplay dpy, EGLConfig config, const EGLint *attrib_list)
+{
+   Begin(GLRECORD_eglCreatePbufferSurface);
+   End();
+
+   return (EGLSurface) 1;
+}
+
+EGLAPI EGLSurface EGLAPIENTRY eglCreateWindowSurface (EGLDisplay dpy, EGLConfig config, EGLNativeWindowType win, const EGLint *attrib_list)
+{
+   Begin(GLRECORD_eglCreateWindowSurface);
+   End();
+
+   return (EGLSurface) 1;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglGetConfigs (EGLDisplay dpy, EGLConfig *configs, EGLint config_size, EGLint *num_config)
+{
+   if (configs != 0 && config_size > 0)
+      configs[0] = (EGLConfig) 1;
+   *num_config = 1;
+
+   Begin(GLRECORD_eglGetConfigs);
+   End();
+
+   return EGL_TRUE;
+}
+
+EGLAPI EGLDisplay EGLAPIENTRY eglGetDisplay (EGLNativeDisplayType display_id)
+{
+   Begin(GLRECORD_eglGetDisplay);
+   End();
+
+   return (EGLDisplay) 1;
+}
+
+EGLAPI __eglMustCastToProperFunctionPointerType EGLAPIENTRY eglGetProcAddress (const char *procname)
+{
+   // No extensions, callers fall back to the core path
+   Begin(GLRECORD_eglGetProcAddress);
+   String(procname);
+   End();
+
+   return 0;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglInitialize (EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+   if (major != 0)
+      *major = 1;
+   if (minor != 0)
+      *minor = 4;
+
+   Begin(GLRECORD_eglInitialize);
+   End();
+
+   return EGL_TRUE;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglMakeCurrent (EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx)
+{
+   Begin(GLRECORD_eglMakeCurrent);
+   End();
+
+   return EGL_TRUE;
+}
+
+EGLAPI const char *EGLAPIENTRY eglQueryString (EGLDisplay dpy, EGLint name)
+{
+   Begin(GLRECORD_eglQueryString);
+   Word(name);
+   End();
+
+   return (name == EGL_VERSION) ? "1.4 GLRecord" : "";
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglSwapBuffers (EGLDisplay dpy, EGLSurface surface)
+{
+   char arLabel[32];
+
+   Begin(GLRECORD_eglSwapBuffers);
+   End();
+
+   // Frame 0 is everything before the first swap, i.e. loading
+   snprintf(arLabel, sizeof(arLabel), "frame %u", s_nFrame);
+   WriteFrameStats(&s_frame, arLabel);
+
+   if (s_nFrame > 0)
+   {
+      unsigned int* pTotal = (unsigned int*) &s_total;
+      const unsigned int* pFrame = (const unsigned int*) &s_frame;
+
+      for (size_t i = 0; i < sizeof(FrameCounters) / sizeof(unsigned int); i++)
+         pTotal[i] += pFrame[i];
+   }
+
+   memset(&s_frame, 0, sizeof(s_frame));
+   s_nFrame++;
+
+   return EGL_TRUE;
+}
+
+} // extern "C"
@@ -0,0 +1,132 @@
+//
+/// \file GLRecord.h
+/// \brief Layout of the binary call stream written by the recording
+///        GLESv2/EGL stand-in (GLRecord.cpp) and read by glrecord-dump.
+//
+#ifndef GLRECORD_H
+#define GLRECORD_H
+
+#include <stdint.h>
+
+// "GLRC" and the version, the first two words of a stream.
+#define GLRECORD_MAGIC 0x43524C47
+#define GLRECORD_VERSION 1
+
+//
+// Every entry point the renderer uses, with one character per argument:
+//   i - signed integer     u - unsigned integer or object name
+//   e - GLenum             f - float, stored as its bits
+//   x - bitfield           p - buffer offset, or 0xffffffff for client memory
+//   b - byte count, then the FNV-1a hash of the bytes
+//   s - byte count, then the bytes padded to a whole word
+//   n - name count, then that many names
+//   r - value returned to the caller
+// Records are a word holding the call index in the low and the number
+// of argument words in the high 16 bits, followed by the arguments.
+//
+#define GLRECORD_CALLS(X) \
+   X(glAttachShader, "uu") \
+   X(glBindBuffer, "eu") \
+   X(glBindFramebuffer, "eu") \
+   X(glBindRenderbuffer, "eu") \
+   X(glBindTexture, "eu") \
+   X(glBlendFunc, "ee") \
+   X(glBufferData, "ebe") \
+   X(glCheckFramebufferStatus, "er") \
+   X(glClear, "x") \
+   X(glClearColor, "ffff") \
+   X(glCompileShader, "u") \
+   X(glCreateProgram, "r") \
+   X(glCreateShader, "er") \
+   X(glCullFace, "e") \
+   X(glDeleteBuffers, "n") \
+   X(glDeleteFramebuffers, "n") \
+   X(glDeleteProgram, "u") \
+   X(glDeleteRenderbuffers, "n") \
+   X(glDeleteShader, "u") \
+   X(glDeleteTextures, "n") \
+   X(glDisable, "e") \
+   X(glDisableVertexAttribArray, "u") \
+   X(glDrawArrays, "eiib") \
+   X(glEnable, "e") \
+   X(glEnableVertexAttribArray, "u") \
+   X(glFramebufferRenderbuffer, "eeeu") \
+   X(glFramebufferTexture2D, "eeeui") \
+   X(glFrontFace, "e") \
+   X(glGenBuffers, "n") \
+   X(glGenFramebuffers, "n") \
+   X(glGenRenderbuffers, "n") \
+   X(glGenTextures, "n") \
+   X(glGetAttribLocation, "usr") \
+   X(glGetIntegerv, "e") \
+   X(glGetProgramInfoLog, "u") \
+   X(glGetProgramiv, "ue") \
+   X(glGetShaderInfoLog, "u") \
+   X(glGetShaderiv, "ue") \
+   X(glGetString, "e") \
+   X(glGetUniformLocation, "usr") \
+   X(glLineWidth, "f") \
+   X(glLinkProgram, "u") \
+   X(glReadPixels, "iiiiee") \
+   X(glRenderbufferStorage, "eeii") \
+   X(glShaderSource, "ub") \
+   X(glTexImage2D, "eieiiieeb") \
+   X(glTexParameteri, "eei") \
+   X(glUniform1i, "ii") \
+   X(glUniform2f, "iff") \
+   X(glUniform2fv, "iib") \
+   X(glUniform4fv, "iib") \
+   X(glUniformMatrix4fv, "iiub") \
+   X(glUseProgram, "u") \
+   X(glVertexAttribPointer, "uieuip") \
+   X(glViewport, "iiii") \
+   X(eglChooseConfig, "") \
+   X(eglCreateContext, "") \
+   X(eglCreatePbufferSurface, "") \
+   X(eglCreateWindowSurface, "") \
+   X(eglGetConfigs, "") \
+   X(eglGetDisplay, "") \
+   X(eglGetProcAddress, "s") \
+   X(eglInitialize, "") \
+   X(eglMakeCurrent, "") \
+   X(eglQueryString, "i") \
+   X(eglSwapBuffers, "")
+
+#define GLRECORD_ENUM(name, args) GLRECORD_##name,
+
+enum
+{
+   GLRECORD_CALLS(GLRECORD_ENUM)
+   GLRECORD_CALL_COUNT
+};
+
+#undef GLRECORD_ENUM
+
+// Offset word of a 'p' argument pointing at client memory.
+#define GLRECORD_CLIENT_POINTER 0xffffffffu
+
+//
+/// \brief Counters summed over every frame after frame 0, the same
+///        numbers as the total line of the stats file.
+//
+typedef struct
+{
+   uint32_t frames;
+   uint32_t calls;
+   uint32_t draws;
+   uint32_t vertices;
+   uint32_t stateChanges;
+   uint32_t redundantChanges;
+   uint32_t uploadBytes;
+   uint32_t uniformBytes;
+   uint32_t clientBytes;
+} GLRecordTotals;
+
+//
+/// \brief Fill in the totals so far. Only the recording build defines
+///        it; the declaration is weak so code linked against the real
+///        driver can test the function for null.
+//
+void GLRecordGetTotals(GLRecordTotals* pTotals) __attribute__((weak));
+
+#endif // GLRECORD_H
@@ -0,0 +1,191 @@
+//
+// GLRecordDump.cpp
+//
+//    Prints a call stream written by GLRecord.cpp as text, one call per
+//    line with a marker after every eglSwapBuffers, so two recordings can
+//    be compared with diff.
+//
+//    Usage: glrecord-dump [glrecord.trace]
+//
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "GLRecord.h"
+
+#define GLRECORD_ENTRY(name, args) { #name, args },
+
+static const struct
+{
+   const char* pName;
+   const char* pArgs;
+} s_arCalls[] = { GLRECORD_CALLS(GLRECORD_ENTRY) };
+
+#undef GLRECORD_ENTRY
+
+///
+// Format the argument words of one record following its signature.
+// Returns 0 if the words do not match the signature.
+//
+static int FormatArgs(const char* pArgs, const std::vector<uint32_t>& words, std::string* pOut)
+{
+   size_t w = 0;
+   char arBuffer[64];
+
+   for (const char* p = pArgs; *p != '\0'; p++)
+   {
+      if (w >= words.size())
+         return 0;
+
+      if (*p == 'r')
+      {
+         snprintf(arBuffer, sizeof(arBuffer), " -> %d", (int) words[w++]);
+         pOut->append(arBuffer);
+         continue;
+      }
+
+      if (p != pArgs)
+         pOut->append(", ");
+
+      switch (*p)
+      {
+      case 'i':
+         snprintf(arBuffer, sizeof(arBuffer), "%d", (int) words[w++]);
+         pOut->append(arBuffer);
+         break;
+      case 'u':
+         snprintf(arBuffer, sizeof(arBuffer), "%u", words[w++]);
+         pOut->append(arBuffer);
+         break;
+      case 'e':
+      case 'x':
+         snprintf(arBuffer, sizeof(arBuffer), "0x%04x", words[w++]);
+         pOut->append(arBuffer);
+         break;
+      case 'f':
+      {
+         float fValue;
+         memcpy(&fValue, &words[w++], sizeof(fValue));
+         snprintf(arBuffer, sizeof(arBuffer), "%g", fValue);
+         pOut->append(arBuffer);
+         break;
+      }
+      case 'p':
+         if (words[w] == GLRECORD_CLIENT_POINTER)
+            pOut->append("client");
+         else
+         {
+            snprintf(arBuffer, sizeof(arBuffer), "+%u", words[w]);
+            pOut->append(arBuffer);
+         }
+         w++;
+         break;
+      case 'b':
+         if (w + 1 >= words.size())
+            return 0;
+         snprintf(arBuffer, sizeof(arBuffer), "%u bytes #%08x", words[w], words[w + 1]);
+         pOut->append(arBuffer);
+         w += 2;
+         break;
+      case 's':
+      {
+         uint32_t uLength = words[w++];
+         size_t nWords = (uLength + 3) / 4;
+
+         if (w + nWords > words.size())
+            return 0;
+
+         pOut->append("\"");
+         pOut->append((const char*) &words[w], uLength);
+         pOut->append("\"");
+         w += nWords;
+         break;
+      }
+      case 'n':
+      {
+         uint32_t uCount = words[w++];
+
+         if (w + uCount > words.size())
+            return 0;
+
+         pOut->append("[");
+         for (uint32_t i = 0; i < uCount; i++)
+         {
+            snprintf(arBuffer, sizeof(arBuffer), i ? " %u" : "%u", words[w++]);
+            pOut->append(arBuffer);
+         }
+         pOut->append("]");
+         break;
+      }
+      }
+   }
+
+   return w == words.size();
+}
+
+int main(int argc, char *argv[])
+{
+   const char* pPath = (argc > 1) ? argv[1] : "glrecord.trace";
+   FILE* pFile = fopen(pPath, "rb");
+   uint32_t arHeader[2];
+
+   if (pFile == 0)
+   {
+      printf("Could not open %s\n", pPath);
+      return 1;
+   }
+
+   if (fread(arHeader, sizeof(arHeader), 1, pFile) != 1 ||
+       arHeader[0] != GLRECORD_MAGIC ||
+       arHeader[1] != GLRECORD_VERSION)
+   {
+      printf("%s is not a version %d GLRecord trace\n", pPath, GLRECORD_VERSION);
+      fclose(pFile);
+      return 1;
+   }
+
+   unsigned int nFrame = 0;
+   uint32_t uRecord;
+   std::vector<uint32_t> words;
+
+   printf("-- frame 0 --\n");
+
+   while (fread(&uRecord, sizeof(uRecord), 1, pFile) == 1)
+   {
+      unsigned int nCall = uRecord & 0xffff;
+      unsigned int nWords = uRecord >> 16;
+
+      words.resize(nWords);
+
+      if (nCall >= GLRECORD_CALL_COUNT ||
+          (nWords > 0 && fread(&words[0], sizeof(uint32_t), nWords, pFile) != nWords))
+      {
+         printf("Corrupt record\n");
+         fclose(pFile);
+         return 1;
+      }
+
+      std::string args;
+      if (!FormatArgs(s_arCalls[nCall].pArgs, words, &args))
+      {
+         printf("Malformed %s\n", s_arCalls[nCall].pName);
+         fclose(pFile);
+         return 1;
+      }
+
+      // Returned values are appended after the closing bracket
+      size_t nReturn = args.find(" -> ");
+      if (nReturn != std::string::npos)
+         printf("%s(%s)%s\n", s_arCalls[nCall].pName, args.substr(0, nReturn).c_str(), args.substr(nReturn).c_str());
+      else
+         printf("%s(%s)\n", s_arCalls[nCall].pName, args.c_str());
+
+      if (nCall == GLRECORD_eglSwapBuffers)
+         printf("-- frame %u --\n", ++nFrame);
+   }
+
+   fclose(pFile);
+   return 0;
+}
@@ -0,0 +1,195 @@
+//
+// LightBake.cpp
+//
+//    Per-vertex light baking. The sky is projected once into 9 spherical
+//    harmonic coefficients per channel; each vertex then evaluates the
+//    irradiance for its normal (Ramamoorthi and Hanrahan, "An Efficient
+//    Representation for Irradiance Environment Maps") and adds the key
+//    light the shaders use.
+//
+#include <math.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "LightBake.h"
+#include "Trace.h"
+
+#define BAKE_PI 3.14159265f
+
+// Sampling grid for projecting the sky into spherical harmonics.
+#define BAKE_SKY_THETA_STEPS 32
+#define BAKE_SKY_PHI_STEPS 64
+
+// Vertices per thread below which spawning threads is not worth it.
+#define BAKE_MIN_VERTS_PER_THREAD 4096
+
+static const float s_arKeyLight[3] = { 0.577f, 0.577f, 0.577f };
+static const float s_arSkyColor[3] = { 0.30f, 0.32f, 0.38f };
+static const float s_arGroundColor[3] = { 0.06f, 0.05f, 0.05f };
+
+///
+// Real spherical harmonic basis up to order 2 for a unit direction.
+//
+static void EvaluateBasis(const float* pDir, float* pBasis)
+{
+	float x = pDir[0];
+	float y = pDir[1];
+	float z = pDir[2];
+
+	pBasis[0] = 0.282095f;
+	pBasis[1] = 0.488603f * y;
+	pBasis[2] = 0.488603f * z;
+	pBasis[3] = 0.488603f * x;
+	pBasis[4] = 1.092548f * x * y;
+	pBasis[5] = 1.092548f * y * z;
+	pBasis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+	pBasis[7] = 1.092548f * x * z;
+	pBasis[8] = 0.546274f * (x * x - y * y);
+}
+
+///
+// Radiance of the sky: a gradient from ground to zenith.
+//
+static void SkyRadiance(const float* pDir, float* pColor)
+{
+	float t = pDir[1] * 0.5f + 0.5f;
+
+	for (int c = 0; c < 3; c++)
+	{
+		pColor[c] = s_arGroundColor[c] + (s_arSkyColor[c] - s_arGroundColor[c]) * t;
+	}
+}
+
+///
+// Project the sky into SH coefficients and fold in the cosine lobe
+// convolution, so evaluating them gives irradiance / pi.
+//
+static void ProjectSky(float arCoeffs[9][3])
+{
+	static const float arBand[9] = { BAKE_PI,
+					 2.0f * BAKE_PI / 3.0f, 2.0f * BAKE_PI / 3.0f, 2.0f * BAKE_PI / 3.0f,
+					 BAKE_PI / 4.0f, BAKE_PI / 4.0f, BAKE_PI / 4.0f, BAKE_PI / 4.0f, BAKE_PI / 4.0f };
+
+	memset(arCoeffs, 0, sizeof(float) * 9 * 3);
+
+	for (int i = 0; i < BAKE_SKY_THETA_STEPS; i++)
+	{
+		float fTheta = (i + 0.5f) * BAKE_PI / BAKE_SKY_THETA_STEPS;
+		float fSolidAngle = sinf(fTheta) * (BAKE_PI / BAKE_SKY_THETA_STEPS) * (2.0f * BAKE_PI / BAKE_SKY_PHI_STEPS);
+
+		for (int j = 0; j < BAKE_SKY_PHI_STEPS; j++)
+		{
+			float fPhi = (j + 0.5f) * 2.0f * BAKE_PI / BAKE_SKY_PHI_STEPS;
+			float arDir[3] = { sinf(fTheta) * cosf(fPhi), cosf(fTheta), sinf(fTheta) * sinf(fPhi) };
+			float arBasis[9];
+			float arColor[3];
+
+			EvaluateBasis(arDir, arBasis);
+			SkyRadiance(arDir, arColor);
+
+			for (int k = 0; k < 9; k++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					arCoeffs[k][c] += arColor[c] * arBasis[k] * fSolidAngle;
+				}
+			}
+		}
+	}
+
+	for (int k = 0; k < 9; k++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			arCoeffs[k][c] *= arBand[k] / BAKE_PI;
+		}
+	}
+}
+
+static void BakeRange(const float* pVertexBuffer,
+	int nFirst,
+	int nLast,
+	const float arCoeffs[9][3],
+	unsigned char* pColors)
+{
+	for (int v = nFirst; v < nLast; v++)
+	{
+		const float* pNormal = &pVertexBuffer[v * 8 + 5];
+		float arDir[3] = { pNormal[0], pNormal[1], pNormal[2] };
+		float fLength = sqrtf(arDir[0] * arDir[0] + arDir[1] * arDir[1] + arDir[2] * arDir[2]);
+		float arBasis[9];
+		float arColor[3] = { 0.0f, 0.0f, 0.0f };
+
+		if (fLength > 0.0f)
+		{
+			arDir[0] /= fLength;
+			arDir[1] /= fLength;
+			arDir[2] /= fLength;
+		}
+
+		EvaluateBasis(arDir, arBasis);
+
+		for (int k = 0; k < 9; k++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				arColor[c] += arCoeffs[k][c] * arBasis[k];
+			}
+		}
+
+		float fKey = arDir[0] * s_arKeyLight[0] + arDir[1] * s_arKeyLight[1] + arDir[2] * s_arKeyLight[2];
+		if (fKey < 0.0f)
+			fKey = 0.0f;
+
+		for (int c = 0; c < 3; c++)
+		{
+			float fValue = arColor[c] + fKey;
+
+			if (fValue < 0.0f)
+				fValue = 0.0f;
+			if (fValue > 1.0f)
+				fValue = 1.0f;
+
+			pColors[v * 4 + c] = (unsigned char) (fValue * 255.0f + 0.5f);
+		}
+
+		pColors[v * 4 + 3] = 255;
+	}
+}
+
+void BakeVertexLighting(const float* pVertexBuffer, int nNumVerts, unsigned char* pColors)
+{
+	ScopedTrace trace("BakeVertexLighting");
+
+	float arCoeffs[9][3];
+	ProjectSky(arCoeffs);
+
+	int nThreads = (int) std::thread::hardware_concurrency();
+	int nMaxThreads = nNumVerts / BAKE_MIN_VERTS_PER_THREAD;
+
+	if (nThreads > nMaxThreads)
+		nThreads = nMaxThreads;
+	if (nThreads < 1)
+		nThreads = 1;
+
+	std::vector<std::thread> workers;
+	int nPerThread = (nNumVerts + nThreads - 1) / nThreads;
+
+	// The calling thread takes the first range
+	for (int i = 1; i < nThreads; i++)
+	{
+		int nFirst = i * nPerThread;
+		int nLast = (nFirst + nPerThread < nNumVerts) ? nFirst + nPerThread : nNumVerts;
+
+		workers.push_back(std::thread(BakeRange, pVertexBuffer, nFirst, nLast, arCoeffs, pColors));
+	}
+
+	BakeRange(pVertexBuffer, 0, (nPerThread < nNumVerts) ? nPerThread : nNumVerts, arCoeffs, pColors);
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
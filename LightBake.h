@@ -0,0 +1,20 @@
+//
+/// \file LightBake.h
+/// \brief Bakes static lighting into per-vertex colors on the CPU, so
+///        the fragment shader only has to modulate the texture.
+//
+#ifndef LIGHTBAKE_H
+#define LIGHTBAKE_H
+
+//
+/// \brief Light every vertex of an interleaved position/texcoord/normal
+///        buffer with an order 2 spherical harmonic sky plus the fixed key
+///        light of the renderer, in model space. Work is split over all
+///        hardware threads.
+/// \param pVertexBuffer Interleaved vertices, 8 floats each, normal at 5
+/// \param nNumVerts Number of vertices
+/// \param pColors Receives 4 bytes of RGBA per vertex
+//
+void BakeVertexLighting(const float* pVertexBuffer, int nNumVerts, unsigned char* pColors);
+
+#endif // LIGHTBAKE_H
@@ -0,0 +1,564 @@
+//
+// LoadBench.cpp
+//
+//    Times the asset loaders without a GPU: ReadAsset, GetCounts and
+//    the steps of ParseOBJ over the bundled models, DecodeBMP over the
+//    bundled textures, and the same OBJ steps over noisy spheres of
+//    100K to 10M faces generated on first use. Every asset is loaded
+//    --repeat times; min/median/mean/max, throughput and peak RSS go to
+//    stdout and, with --json, to a file for comparing runs.
+//
+//    Usage: ghost-bench [--repeat N] [--faces 100000,1000000,10000000]
+//                       [--dir BenchData] [--json bench.json]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glob.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "esUtil.h"
+#include "AssetLoader.h"
+#include "Memory.h"
+#include "Profiler.h"
+
+#define BENCH_REPEAT 5
+#define BENCH_FACES "100000,1000000,10000000"
+#define BENCH_DIR "BenchData"
+#define BENCH_RADIUS 100.0f
+#define BENCH_ROUGHNESS 0.15f
+#define BENCH_SEED 1
+#define BENCH_MAX_STAGES 5
+
+static const char* s_arModels[] = { "Models/Gun.obj",
+                                    "Models/Kat.obj" };
+
+// Which amount a stage's throughput is computed from.
+#define BENCH_PER_BYTE 1
+#define BENCH_PER_FACE 2
+#define BENCH_PER_PIXEL 4
+
+typedef struct
+{
+   const char* pName;
+   int rates;
+   std::vector<double> seconds;
+} BenchStage;
+
+typedef struct
+{
+   std::string path;
+   const char* pKind;
+   long bytes;
+   long faces;
+   long pixels;
+   long peakRSS;
+   int numStages;
+   BenchStage stages[BENCH_MAX_STAGES];
+} BenchResult;
+
+static double Seconds(uint64_t uNanoseconds)
+{
+   return uNanoseconds * 1e-9;
+}
+
+///
+// Forget the peak resident set size so far, so the next reading covers
+// only what follows. Needs Linux 4.0; otherwise the peak stays process
+// wide.
+//
+static void ResetPeakRSS()
+{
+   FILE* pFile = fopen("/proc/self/clear_refs", "w");
+
+   if (pFile != 0)
+   {
+      fputs("5", pFile);
+      fclose(pFile);
+   }
+}
+
+///
+// Peak resident set size in KB.
+//
+static long ReadPeakRSS()
+{
+   FILE* pFile = fopen("/proc/self/status", "r");
+   char arLine[256];
+   long nPeak = -1;
+
+   if (pFile != 0)
+   {
+      while (fgets(arLine, sizeof(arLine), pFile) != 0)
+      {
+         if (sscanf(arLine, "VmHWM: %ld", &nPeak) == 1)
+            break;
+      }
+
+      fclose(pFile);
+   }
+
+   if (nPeak < 0)
+   {
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      nPeak = usage.ru_maxrss;
+   }
+
+   return nPeak;
+}
+
+static void AddStage(BenchResult* pResult, const char* pName, int nRates)
+{
+   BenchStage* pStage = &pResult->stages[pResult->numStages++];
+
+   pStage->pName = pName;
+   pStage->rates = nRates;
+}
+
+///
+// Write a noisy sphere with about nFaces faces as an OBJ file with
+// positions, texcoords and normals. Returns the exact face count, or 0
+// if the file could not be written.
+//
+static long GenerateOBJ(const char* pPath, long nFaces)
+{
+   int nSlices = (int) (sqrt((double) nFaces) + 0.5);
+   GLfloat* pPositions = 0;
+   GLfloat* pNormals = 0;
+   GLfloat* pUVs = 0;
+   GLuint* pIndices = 0;
+
+   // esGenSphere makes numSlices / 2 parallels, so keep it even
+   nSlices += nSlices & 1;
+
+   FILE* pFile = fopen(pPath, "w");
+
+   if (pFile == 0)
+   {
+      printf("Could not create %s\n", pPath);
+      return 0;
+   }
+
+   static char arBuffer[1 << 20];
+   setvbuf(pFile, arBuffer, _IOFBF, sizeof(arBuffer));
+
+   int nNumIndices = esGenNoisySphere(nSlices, BENCH_RADIUS, BENCH_ROUGHNESS, BENCH_SEED,
+                                      &pPositions, &pNormals, &pUVs, &pIndices);
+   int nNumVertices = (nSlices / 2 + 1) * (nSlices + 1);
+
+   fprintf(pFile, "# Noisy sphere, %d slices, seed %d\n", nSlices, BENCH_SEED);
+
+   for (int i = 0; i < nNumVertices; i++)
+      fprintf(pFile, "v %.6f %.6f %.6f\n", pPositions[i * 3], pPositions[i * 3 + 1], pPositions[i * 3 + 2]);
+   for (int i = 0; i < nNumVertices; i++)
+      fprintf(pFile, "vt %.6f %.6f\n", pUVs[i * 2], pUVs[i * 2 + 1]);
+   for (int i = 0; i < nNumVertices; i++)
+      fprintf(pFile, "vn %.6f %.6f %.6f\n", pNormals[i * 3], pNormals[i * 3 + 1], pNormals[i * 3 + 2]);
+
+   // OBJ indices start at 1
+   for (int i = 0; i < nNumIndices; i += 3)
+   {
+      unsigned int a = pIndices[i] + 1;
+      unsigned int b = pIndices[i + 1] + 1;
+      unsigned int c = pIndices[i + 2] + 1;
+
+      fprintf(pFile, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c);
+   }
+
+   free(pPositions);
+   free(pNormals);
+   free(pUVs);
+   free(pIndices);
+
+   if (fclose(pFile) != 0)
+   {
+      printf("Could not write %s\n", pPath);
+      remove(pPath);
+      return 0;
+   }
+
+   return nNumIndices / 3;
+}
+
+static void BenchOBJ(const char* pPath, int nRepeat, BenchResult* pResult)
+{
+   pResult->path = pPath;
+   pResult->pKind = "obj";
+   pResult->numStages = 0;
+
+   AddStage(pResult, "ReadAsset", BENCH_PER_BYTE);
+   AddStage(pResult, "GetCounts", BENCH_PER_BYTE);
+   AddStage(pResult, "ParseLines", BENCH_PER_BYTE | BENCH_PER_FACE);
+   AddStage(pResult, "GenerateVertexBuffer", BENCH_PER_FACE);
+   AddStage(pResult, "ParseOBJ", BENCH_PER_BYTE | BENCH_PER_FACE);
+
+   ResetPeakRSS();
+
+   for (int r = 0; r < nRepeat; r++)
+   {
+      long nSize = 0;
+      int nVerts, nUVs, nNormals, nFaces;
+      uint64_t uStart = ProfilerNow();
+
+      char* pBuffer = ReadAsset(pPath, &nSize);
+      uint64_t uRead = ProfilerNow();
+
+      if (pBuffer == 0)
+         return;
+
+      GetCounts(pBuffer, nVerts, nUVs, nNormals, nFaces);
+      uint64_t uCounts = ProfilerNow();
+
+      unsigned int nParsedFaces = 0;
+      int nAttributes = 0;
+      ObjTimings timings;
+
+      uint64_t uLoadStart = ProfilerNow();
+      float* pVertexBuffer = ParseOBJ(pPath, nParsedFaces, nAttributes, &timings);
+      uint64_t uLoad = ProfilerNow() - uLoadStart;
+
+      MemoryRelease(MEMORY_HEAP, (uintptr_t) pVertexBuffer);
+      delete[] pVertexBuffer;
+
+      pResult->stages[0].seconds.push_back(Seconds(uRead - uStart));
+      pResult->stages[1].seconds.push_back(Seconds(uCounts - uRead));
+      pResult->stages[2].seconds.push_back(Seconds(timings.parse));
+      pResult->stages[3].seconds.push_back(Seconds(timings.generate));
+      pResult->stages[4].seconds.push_back(Seconds(uLoad));
+
+      pResult->bytes = nSize;
+      pResult->faces = nParsedFaces;
+      pResult->pixels = 0;
+   }
+
+   pResult->peakRSS = ReadPeakRSS();
+}
+
+static void BenchBMP(const char* pPath, int nRepeat, BenchResult* pResult)
+{
+   pResult->path = pPath;
+   pResult->pKind = "bmp";
+   pResult->numStages = 0;
+
+   AddStage(pResult, "ReadAsset", BENCH_PER_BYTE);
+   AddStage(pResult, "DecodeBMP", BENCH_PER_BYTE | BENCH_PER_PIXEL);
+
+   ResetPeakRSS();
+
+   for (int r = 0; r < nRepeat; r++)
+   {
+      long nSize = 0;
+      int nWidth = 0;
+      int nHeight = 0;
+      uint64_t uStart = ProfilerNow();
+
+      if (ReadAsset(pPath, &nSize) == 0)
+         return;
+
+      uint64_t uRead = ProfilerNow();
+      unsigned char* pData = DecodeBMP(pPath, &nWidth, &nHeight);
+      uint64_t uDecode = ProfilerNow();
+
+      MemoryRelease(MEMORY_HEAP, (uintptr_t) pData);
+      delete[] pData;
+
+      pResult->stages[0].seconds.push_back(Seconds(uRead - uStart));
+      pResult->stages[1].seconds.push_back(Seconds(uDecode - uRead));
+
+      pResult->bytes = nSize;
+      pResult->faces = 0;
+      pResult->pixels = (long) nWidth * nHeight;
+   }
+
+   pResult->peakRSS = ReadPeakRSS();
+}
+
+typedef struct
+{
+   double min;
+   double median;
+   double mean;
+   double max;
+} BenchSummary;
+
+static BenchSummary Summarize(const std::vector<double>& seconds)
+{
+   std::vector<double> sorted = seconds;
+   BenchSummary summary = { 0.0, 0.0, 0.0, 0.0 };
+   size_t n = sorted.size();
+
+   if (n == 0)
+      return summary;
+
+   std::sort(sorted.begin(), sorted.end());
+
+   for (size_t i = 0; i < n; i++)
+      summary.mean += sorted[i] / n;
+
+   summary.min = sorted[0];
+   summary.max = sorted[n - 1];
+   summary.median = (n & 1) ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+
+   return summary;
+}
+
+static void PrintResult(const BenchResult* pResult)
+{
+   printf("\n%s: %.1f MB", pResult->path.c_str(), pResult->bytes / 1e6);
+   if (pResult->faces > 0)
+      printf(", %ld faces", pResult->faces);
+   if (pResult->pixels > 0)
+      printf(", %ld pixels", pResult->pixels);
+   printf(", peak RSS %.1f MB\n", pResult->peakRSS / 1024.0);
+
+   printf("  %-22s %9s %9s %9s %9s %9s %11s\n", "stage", "min ms", "median", "mean", "max", "MB/s",
+      (pResult->pixels > 0) ? "Mpx/s" : "faces/s");
+
+   for (int i = 0; i < pResult->numStages; i++)
+   {
+      const BenchStage* pStage = &pResult->stages[i];
+      BenchSummary summary = Summarize(pStage->seconds);
+
+      printf("  %-22s %9.2f %9.2f %9.2f %9.2f",
+         pStage->pName,
+         summary.min * 1e3,
+         summary.median * 1e3,
+         summary.mean * 1e3,
+         summary.max * 1e3);
+
+      if ((pStage->rates & BENCH_PER_BYTE) && summary.median > 0.0)
+         printf(" %9.1f", pResult->bytes / 1e6 / summary.median);
+      else
+         printf(" %9s", "");
+
+      if ((pStage->rates & BENCH_PER_FACE) && summary.median > 0.0)
+         printf(" %11.0f", pResult->faces / summary.median);
+      else if ((pStage->rates & BENCH_PER_PIXEL) && summary.median > 0.0)
+         printf(" %11.1f", pResult->pixels / 1e6 / summary.median);
+
+      printf("\n");
+   }
+}
+
+///
+// The CPU model as /proc/cpuinfo names it on x86 and on the Pi.
+//
+static std::string ReadCPUName()
+{
+   FILE* pFile = fopen("/proc/cpuinfo", "r");
+   char arLine[256];
+   std::string name = "unknown";
+
+   if (pFile == 0)
+      return name;
+
+   while (fgets(arLine, sizeof(arLine), pFile) != 0)
+   {
+      if (strncmp(arLine, "model name", 10) == 0 || strncmp(arLine, "Model", 5) == 0)
+      {
+         char* pValue = strchr(arLine, ':');
+
+         if (pValue != 0)
+         {
+            name = pValue + 2;
+            name.erase(name.find_last_not_of("\r\n") + 1);
+            break;
+         }
+      }
+   }
+
+   fclose(pFile);
+   return name;
+}
+
+static void WriteJSONString(FILE* pFile, const std::string& value)
+{
+   fputc('"', pFile);
+
+   for (size_t i = 0; i < value.size(); i++)
+   {
+      if (value[i] == '"' || value[i] == '\\')
+         fputc('\\', pFile);
+      fputc(value[i], pFile);
+   }
+
+   fputc('"', pFile);
+}
+
+static int WriteJSON(const char* pPath, const std::vector<BenchResult>& results, int nRepeat)
+{
+   FILE* pFile = fopen(pPath, "w");
+   struct utsname system;
+
+   if (pFile == 0)
+   {
+      printf("Could not create %s\n", pPath);
+      return 0;
+   }
+
+   uname(&system);
+
+   fprintf(pFile, "{\n  \"machine\": { \"cpu\": ");
+   WriteJSONString(pFile, ReadCPUName());
+   fprintf(pFile, ", \"threads\": %u, \"system\": ", std::thread::hardware_concurrency());
+   WriteJSONString(pFile, std::string(system.sysname) + " " + system.release + " " + system.machine);
+   fprintf(pFile, " },\n  \"repeat\": %d,\n  \"assets\": [", nRepeat);
+
+   for (size_t a = 0; a < results.size(); a++)
+   {
+      const BenchResult* pResult = &results[a];
+
+      fprintf(pFile, "%s\n    { \"path\": ", a ? "," : "");
+      WriteJSONString(pFile, pResult->path);
+      fprintf(pFile, ", \"kind\": \"%s\", \"bytes\": %ld, \"faces\": %ld, \"pixels\": %ld, \"peak_rss_kb\": %ld,\n      \"stages\": [",
+         pResult->pKind, pResult->bytes, pResult->faces, pResult->pixels, pResult->peakRSS);
+
+      for (int i = 0; i < pResult->numStages; i++)
+      {
+         const BenchStage* pStage = &pResult->stages[i];
+         BenchSummary summary = Summarize(pStage->seconds);
+
+         fprintf(pFile, "%s\n        { \"name\": \"%s\", \"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f, \"max_ms\": %.4f",
+            i ? "," : "", pStage->pName,
+            summary.min * 1e3, summary.median * 1e3, summary.mean * 1e3, summary.max * 1e3);
+
+         if ((pStage->rates & BENCH_PER_BYTE) && summary.median > 0.0)
+            fprintf(pFile, ", \"mb_per_s\": %.2f", pResult->bytes / 1e6 / summary.median);
+         if ((pStage->rates & BENCH_PER_FACE) && summary.median > 0.0)
+            fprintf(pFile, ", \"faces_per_s\": %.0f", pResult->faces / summary.median);
+         if ((pStage->rates & BENCH_PER_PIXEL) && summary.median > 0.0)
+            fprintf(pFile, ", \"pixels_per_s\": %.0f", pResult->pixels / summary.median);
+
+         fprintf(pFile, ", \"runs_ms\": [");
+         for (size_t r = 0; r < pStage->seconds.size(); r++)
+            fprintf(pFile, "%s%.4f", r ? ", " : "", pStage->seconds[r] * 1e3);
+         fprintf(pFile, "] }");
+      }
+
+      fprintf(pFile, "\n      ] }");
+   }
+
+   fprintf(pFile, "\n  ]\n}\n");
+   fclose(pFile);
+
+   return 1;
+}
+
+int main(int argc, char *argv[])
+{
+   int nRepeat = BENCH_REPEAT;
+   const char* pFaces = BENCH_FACES;
+   const char* pDir = BENCH_DIR;
+   const char* pJSON = 0;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+      {
+         nRepeat = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--faces") == 0 && i + 1 < argc)
+      {
+         pFaces = argv[++i];
+      }
+      else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+      {
+         pDir = argv[++i];
+      }
+      else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+      {
+         pJSON = argv[++i];
+      }
+      else
+      {
+         printf("Usage: %s [--repeat N] [--faces 100000,1000000,...] [--dir %s] [--json out.json]\n", argv[0], BENCH_DIR);
+         return 0;
+      }
+   }
+
+   if (nRepeat < 1)
+      nRepeat = 1;
+
+   SetAssetLoaderVerbose(0);
+
+   std::vector<std::string> objs(s_arModels, s_arModels + sizeof(s_arModels) / sizeof(s_arModels[0]));
+   std::vector<std::string> bmps;
+   glob_t textures;
+
+   if (glob("Textures/*.bmp", 0, 0, &textures) == 0)
+   {
+      for (size_t i = 0; i < textures.gl_pathc; i++)
+         bmps.push_back(textures.gl_pathv[i]);
+   }
+
+   globfree(&textures);
+
+   // Generated meshes are kept, the same seed always gives the same file
+   mkdir(pDir, 0755);
+
+   for (const char* p = pFaces; *p != '\0'; )
+   {
+      long nFaces = strtol(p, (char**) &p, 10);
+      char arPath[512];
+      struct stat info;
+
+      while (*p == ',')
+         p++;
+
+      if (nFaces <= 0)
+         break;
+
+      snprintf(arPath, sizeof(arPath), "%s/sphere_%ld.obj", pDir, nFaces);
+
+      if (stat(arPath, &info) != 0)
+      {
+         uint64_t uStart = ProfilerNow();
+
+         printf("Generating %s...\n", arPath);
+         fflush(stdout);
+
+         if (GenerateOBJ(arPath, nFaces) == 0)
+            continue;
+
+         printf("  %.1f s\n", Seconds(ProfilerNow() - uStart));
+      }
+
+      objs.push_back(arPath);
+   }
+
+   std::vector<BenchResult> results;
+
+   printf("%d runs per asset\n", nRepeat);
+
+   // The loader's file buffer never shrinks, so the peak RSS of an asset
+   // includes the largest file before it. Smallest first keeps it fair.
+   for (size_t i = 0; i < bmps.size(); i++)
+   {
+      results.push_back(BenchResult());
+      BenchBMP(bmps[i].c_str(), nRepeat, &results.back());
+      PrintResult(&results.back());
+      fflush(stdout);
+   }
+
+   for (size_t i = 0; i < objs.size(); i++)
+   {
+      results.push_back(BenchResult());
+      BenchOBJ(objs[i].c_str(), nRepeat, &results.back());
+      PrintResult(&results.back());
+      fflush(stdout);
+   }
+
+   if (pJSON != 0 && WriteJSON(pJSON, results, nRepeat))
+      printf("\nWrote %s\n", pJSON);
+
+   return 0;
+}
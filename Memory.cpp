@@ -0,0 +1,183 @@
+//
+// Memory.cpp
+//
+//    Every allocation remembers the asset it was charged to, so a buffer
+//    deleted while another model loads still comes off the right total.
+//    Assets are never forgotten, so the report also shows the peaks of
+//    models that have since been unloaded.
+//
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Memory.h"
+
+typedef struct
+{
+   std::string name;
+   int64_t current[2];
+   int64_t peak[2];
+} MemoryAsset;
+
+typedef struct
+{
+   int asset;
+   int64_t bytes;
+} MemoryAllocation;
+
+static std::mutex s_lock;
+static std::vector<MemoryAsset> s_assets(1, MemoryAsset{ "other", { 0, 0 }, { 0, 0 } });
+static std::unordered_map<uintptr_t, MemoryAllocation> s_arAllocations[MEMORY_KIND_COUNT];
+static int64_t s_arTotal[2];
+static int64_t s_arTotalPeak[2];
+// Per thread, so a model loading in the background does not take the
+// render thread's allocations with it
+static thread_local int s_nCurrentAsset = 0;
+
+static int KindPool(int nKind)
+{
+   return (nKind == MEMORY_HEAP) ? MEMORY_POOL_CPU : MEMORY_POOL_GPU;
+}
+
+static void Adjust(int nAsset, int nPool, int64_t nBytes)
+{
+   MemoryAsset* pAsset = &s_assets[nAsset];
+
+   pAsset->current[nPool] += nBytes;
+   if (pAsset->current[nPool] > pAsset->peak[nPool])
+      pAsset->peak[nPool] = pAsset->current[nPool];
+
+   s_arTotal[nPool] += nBytes;
+   if (s_arTotal[nPool] > s_arTotalPeak[nPool])
+      s_arTotalPeak[nPool] = s_arTotal[nPool];
+}
+
+void MemoryTrack(int nKind, uintptr_t key, int64_t nBytes)
+{
+   std::lock_guard<std::mutex> guard(s_lock);
+   int nPool = KindPool(nKind);
+
+   if (key == 0)
+      return;
+
+   MemoryAllocation* pAllocation = &s_arAllocations[nKind][key];
+
+   // Respecified objects give back their old storage first
+   if (pAllocation->bytes != 0)
+      Adjust(pAllocation->asset, nPool, -pAllocation->bytes);
+
+   pAllocation->asset = s_nCurrentAsset;
+   pAllocation->bytes = nBytes;
+
+   Adjust(s_nCurrentAsset, nPool, nBytes);
+}
+
+void MemoryRelease(int nKind, uintptr_t key)
+{
+   std::lock_guard<std::mutex> guard(s_lock);
+   std::unordered_map<uintptr_t, MemoryAllocation>::iterator it = s_arAllocations[nKind].find(key);
+
+   if (it == s_arAllocations[nKind].end())
+      return;
+
+   Adjust(it->second.asset, KindPool(nKind), -it->second.bytes);
+   s_arAllocations[nKind].erase(it);
+}
+
+int64_t MemoryTextureBytes(int nWidth, int nHeight, int nBytesPerPixel, int bMipmapped)
+{
+   int64_t nBytes = (int64_t) nWidth * nHeight * nBytesPerPixel;
+
+   while (bMipmapped && (nWidth > 1 || nHeight > 1))
+   {
+      nWidth = (nWidth > 1) ? nWidth / 2 : 1;
+      nHeight = (nHeight > 1) ? nHeight / 2 : 1;
+      nBytes += (int64_t) nWidth * nHeight * nBytesPerPixel;
+   }
+
+   return nBytes;
+}
+
+///
+// Append to the report, keeping track of the length the full text
+// would have so truncation stays safe.
+//
+static void Append(char* pBuffer, int nSize, int* pLength, const char* pName, const int64_t* pCurrent, const int64_t* pPeak)
+{
+   int nLeft = (*pLength < nSize) ? nSize - *pLength : 0;
+
+   *pLength += snprintf(nLeft > 0 ? pBuffer + *pLength : 0, nLeft,
+      "%10.1f %10.1f %10.1f %10.1f  %s\n",
+      pCurrent[MEMORY_POOL_CPU] / 1024.0,
+      pPeak[MEMORY_POOL_CPU] / 1024.0,
+      pCurrent[MEMORY_POOL_GPU] / 1024.0,
+      pPeak[MEMORY_POOL_GPU] / 1024.0,
+      pName);
+}
+
+int64_t MemoryGetTotal(int nPool)
+{
+   std::lock_guard<std::mutex> guard(s_lock);
+   return s_arTotal[nPool];
+}
+
+int MemoryFormatReport(char* pBuffer, int nSize)
+{
+   std::lock_guard<std::mutex> guard(s_lock);
+   int nLength = snprintf(pBuffer, nSize, "%10s %10s %10s %10s  %s\n", "cpu KB", "cpu peak", "gpu KB", "gpu peak", "asset");
+
+   for (size_t i = 0; i < s_assets.size(); i++)
+   {
+      const MemoryAsset* pAsset = &s_assets[i];
+
+      if (pAsset->peak[MEMORY_POOL_CPU] == 0 && pAsset->peak[MEMORY_POOL_GPU] == 0)
+         continue;
+
+      Append(pBuffer, nSize, &nLength, pAsset->name.c_str(), pAsset->current, pAsset->peak);
+   }
+
+   Append(pBuffer, nSize, &nLength, "total", s_arTotal, s_arTotalPeak);
+
+   return (nLength < nSize) ? nLength : nSize - 1;
+}
+
+void MemoryReport()
+{
+   char arReport[8192];
+
+   MemoryFormatReport(arReport, sizeof(arReport));
+   fputs(arReport, stdout);
+}
+
+ScopedMemoryAsset::ScopedMemoryAsset(const char* pName)
+{
+   std::lock_guard<std::mutex> guard(s_lock);
+   int nAsset = -1;
+
+   for (size_t i = 0; i < s_assets.size(); i++)
+   {
+      if (s_assets[i].name == pName)
+      {
+         nAsset = (int) i;
+         break;
+      }
+   }
+
+   if (nAsset < 0)
+   {
+      nAsset = (int) s_assets.size();
+      s_assets.push_back(MemoryAsset{ pName, { 0, 0 }, { 0, 0 } });
+   }
+
+   m_nPrevious = s_nCurrentAsset;
+   s_nCurrentAsset = nAsset;
+}
+
+ScopedMemoryAsset::~ScopedMemoryAsset()
+{
+   std::lock_guard<std::mutex> guard(s_lock);
+   s_nCurrentAsset = m_nPrevious;
+}
@@ -0,0 +1,74 @@
+//
+/// \file Memory.h
+/// \brief Bytes held by every asset, on the CPU and on the GPU. Heap
+///        blocks and GL objects are registered with their size when they
+///        are created and released by the same key, and each asset keeps
+///        its current total and high-water mark per pool.
+//
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+
+// Kinds of allocation. Heap blocks count against the CPU pool, the GL
+// objects against the GPU pool.
+#define MEMORY_HEAP 0
+#define MEMORY_BUFFER 1
+#define MEMORY_TEXTURE 2
+#define MEMORY_RENDERBUFFER 3
+#define MEMORY_KIND_COUNT 4
+
+#define MEMORY_POOL_CPU 0
+#define MEMORY_POOL_GPU 1
+
+//
+/// \brief Register an allocation with the current asset. Keys are the
+///        pointer of a heap block or the name of a GL object; tracking a
+///        key again replaces its old size, as glBufferData does.
+//
+void MemoryTrack(int nKind, uintptr_t key, int64_t nBytes);
+
+//
+/// \brief Release an allocation from whichever asset it was charged to.
+///        Unknown keys, including 0, are ignored.
+//
+void MemoryRelease(int nKind, uintptr_t key);
+
+//
+/// \brief Bytes of a texture with all of its mip levels when bMipmapped
+///        is set.
+//
+int64_t MemoryTextureBytes(int nWidth, int nHeight, int nBytesPerPixel, int bMipmapped);
+
+//
+/// \brief Bytes currently allocated in a pool, MEMORY_POOL_CPU or
+///        MEMORY_POOL_GPU.
+//
+int64_t MemoryGetTotal(int nPool);
+
+//
+/// \brief Write the current and peak bytes per asset and overall as text.
+/// \return Length of the text, truncated to fit the buffer.
+//
+int MemoryFormatReport(char* pBuffer, int nSize);
+
+//
+/// \brief Print the report to stdout.
+//
+void MemoryReport();
+
+//
+/// \brief Charges allocations made in the enclosing scope to an asset.
+///        Scopes nest; the name is copied.
+//
+class ScopedMemoryAsset
+{
+public:
+   explicit ScopedMemoryAsset(const char* pName);
+   ~ScopedMemoryAsset();
+
+private:
+   int m_nPrevious;
+};
+
+#endif // MEMORY_H
@@ -0,0 +1,262 @@
+//
+// Motion.cpp
+//
+//    Sender and renderer clocks are not synchronised, so each sample's
+//    sender time is moved onto the local clock with the smallest
+//    receive minus send difference of the recent samples: the sample
+//    that had the least network delay. Jitter then only shows up as
+//    samples arriving later, not as uneven spacing, and the fixed
+//    display delay absorbs it. Angles are blended the short way round.
+//
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Motion.h"
+
+// A jump in clock offset this large means the sender restarted.
+#define MOTION_RESYNC_NS 1000000000ll
+
+static float WrapAngle(float fAngle)
+{
+   fAngle = fmodf(fAngle + 180.0f, 360.0f);
+
+   if (fAngle < 0.0f)
+      fAngle += 360.0f;
+
+   return fAngle - 180.0f;
+}
+
+///
+// a + t * (b - a) per value; t above 1 extrapolates.
+//
+static void Blend(const MotionSample* pA, const MotionSample* pB, double fT, float* pValues)
+{
+   for (int i = 0; i < MOTION_VALUES; i++)
+   {
+      float fDelta = pB->values[i] - pA->values[i];
+
+      if (i < MOTION_ANGLES)
+         fDelta = WrapAngle(fDelta);
+
+      pValues[i] = pA->values[i] + (float) (fT * fDelta);
+   }
+}
+
+///
+// Continue the motion of the last two samples to time uTime, for no
+// longer than the extrapolation limit.
+// \return 1 if the limit was reached.
+//
+static int Extrapolate(const MotionBuffer* pBuffer, uint64_t uTime, float* pValues)
+{
+   const MotionSample* pLast = &pBuffer->samples[pBuffer->count - 1];
+   int bHeld = 0;
+
+   if (pBuffer->count < 2)
+   {
+      memcpy(pValues, pLast->values, sizeof(pLast->values));
+      return 1;
+   }
+
+   const MotionSample* pPrevious = pLast - 1;
+
+   if (uTime > pLast->time + pBuffer->maxExtrapolation)
+   {
+      uTime = pLast->time + pBuffer->maxExtrapolation;
+      bHeld = 1;
+   }
+
+   if (pLast->time == pPrevious->time)
+   {
+      memcpy(pValues, pLast->values, sizeof(pLast->values));
+      return bHeld;
+   }
+
+   Blend(pPrevious, pLast, (double) (uTime - pPrevious->time) / (pLast->time - pPrevious->time), pValues);
+   return bHeld;
+}
+
+static int64_t MinOffset(const MotionBuffer* pBuffer)
+{
+   int64_t nMin = pBuffer->offsets[0];
+
+   for (int i = 1; i < pBuffer->numOffsets; i++)
+   {
+      if (pBuffer->offsets[i] < nMin)
+         nMin = pBuffer->offsets[i];
+   }
+
+   return nMin;
+}
+
+static void ResetStats(MotionBuffer* pBuffer)
+{
+   memset(&pBuffer->stats, 0, sizeof(pBuffer->stats));
+   pBuffer->stats.minDepth = MOTION_MAX_SAMPLES;
+   pBuffer->depthSum = 0;
+   pBuffer->errorSum = 0.0;
+}
+
+void MotionInit(MotionBuffer* pBuffer, uint64_t uDelay, uint64_t uMaxExtrapolation)
+{
+   memset(pBuffer, 0, sizeof(MotionBuffer));
+   pBuffer->delay = uDelay;
+   pBuffer->maxExtrapolation = uMaxExtrapolation;
+
+   ResetStats(pBuffer);
+}
+
+void MotionAdd(MotionBuffer* pBuffer, uint64_t uReceived, uint64_t uSent, const float* pValues, uint32_t uTag)
+{
+   uint64_t uTime = uReceived;
+
+   if (uSent != 0)
+   {
+      int64_t nOffset = (int64_t) uReceived - (int64_t) (uSent * 1000);
+
+      if (pBuffer->numOffsets > 0 && llabs(nOffset - MinOffset(pBuffer)) > MOTION_RESYNC_NS)
+      {
+         pBuffer->count = 0;
+         pBuffer->numOffsets = 0;
+         pBuffer->nextOffset = 0;
+      }
+
+      pBuffer->offsets[pBuffer->nextOffset] = nOffset;
+      pBuffer->nextOffset = (pBuffer->nextOffset + 1) % MOTION_OFFSET_WINDOW;
+
+      if (pBuffer->numOffsets < MOTION_OFFSET_WINDOW)
+         pBuffer->numOffsets++;
+
+      uTime = (uint64_t) ((int64_t) (uSent * 1000) + MinOffset(pBuffer));
+   }
+
+   // How far off extrapolation would have been had this not arrived
+   if (pBuffer->count >= 2 && uTime > pBuffer->samples[pBuffer->count - 1].time)
+   {
+      float arPredicted[MOTION_VALUES];
+      float fError = 0.0f;
+
+      Extrapolate(pBuffer, uTime, arPredicted);
+
+      for (int i = 0; i < MOTION_ANGLES; i++)
+      {
+         float fAngle = fabsf(WrapAngle(arPredicted[i] - pValues[i]));
+
+         if (fAngle > fError)
+            fError = fAngle;
+      }
+
+      pBuffer->stats.predictions++;
+      pBuffer->errorSum += fError;
+
+      if (fError > pBuffer->stats.maxError)
+         pBuffer->stats.maxError = fError;
+   }
+
+   if (pBuffer->count == MOTION_MAX_SAMPLES)
+   {
+      memmove(&pBuffer->samples[0], &pBuffer->samples[1], (MOTION_MAX_SAMPLES - 1) * sizeof(MotionSample));
+      pBuffer->count--;
+   }
+
+   // Keep the samples in time order
+   int i = pBuffer->count;
+
+   while (i > 0 && pBuffer->samples[i - 1].time > uTime)
+   {
+      pBuffer->samples[i] = pBuffer->samples[i - 1];
+      i--;
+   }
+
+   pBuffer->samples[i].time = uTime;
+   memcpy(pBuffer->samples[i].values, pValues, sizeof(pBuffer->samples[i].values));
+   pBuffer->samples[i].tag = uTag;
+   pBuffer->samples[i].shown = 0;
+   pBuffer->count++;
+}
+
+int MotionEvaluate(MotionBuffer* pBuffer, uint64_t uNow, float* pValues, uint32_t* pShown)
+{
+   *pShown = 0;
+
+   if (pBuffer->count == 0)
+      return 0;
+
+   uint64_t uTime = (uNow > pBuffer->delay) ? uNow - pBuffer->delay : 0;
+   MotionSample* pSamples = pBuffer->samples;
+   int nCount = pBuffer->count;
+
+   // Last sample at or before the displayed moment, -1 if none
+   int nBefore = nCount - 1;
+
+   while (nBefore >= 0 && pSamples[nBefore].time > uTime)
+      nBefore--;
+
+   int nDepth = nCount - 1 - nBefore;
+
+   pBuffer->stats.frames++;
+   pBuffer->depthSum += nDepth;
+
+   if (nDepth < pBuffer->stats.minDepth)
+      pBuffer->stats.minDepth = nDepth;
+   if (nDepth > pBuffer->stats.maxDepth)
+      pBuffer->stats.maxDepth = nDepth;
+
+   if (nBefore < 0)
+   {
+      memcpy(pValues, pSamples[0].values, sizeof(pSamples[0].values));
+   }
+   else if (nBefore == nCount - 1)
+   {
+      if (Extrapolate(pBuffer, uTime, pValues))
+         pBuffer->stats.held++;
+      else
+         pBuffer->stats.extrapolated++;
+   }
+   else
+   {
+      const MotionSample* pA = &pSamples[nBefore];
+      const MotionSample* pB = &pSamples[nBefore + 1];
+
+      Blend(pA, pB, (double) (uTime - pA->time) / (pB->time - pA->time), pValues);
+   }
+
+   // The newest sample at or before the displayed moment, or the first
+   // while it is held before it, is now on screen
+   int nReached = (nBefore < 0) ? 0 : nBefore;
+
+   if (!pSamples[nReached].shown)
+   {
+      *pShown = pSamples[nReached].tag;
+
+      for (int i = 0; i <= nReached; i++)
+         pSamples[i].shown = 1;
+   }
+
+   // Samples before the one preceding the displayed moment are done with
+   int nDone = nBefore - 1;
+
+   if (nDone > 0)
+   {
+      memmove(&pSamples[0], &pSamples[nDone], (nCount - nDone) * sizeof(MotionSample));
+      pBuffer->count = nCount - nDone;
+   }
+
+   return 1;
+}
+
+void MotionGetStats(MotionBuffer* pBuffer, MotionStats* pStats)
+{
+   *pStats = pBuffer->stats;
+
+   if (pStats->frames == 0)
+      pStats->minDepth = 0;
+   else
+      pStats->meanDepth = (float) pBuffer->depthSum / pStats->frames;
+
+   if (pStats->predictions > 0)
+      pStats->meanError = (float) (pBuffer->errorSum / pStats->predictions);
+
+   ResetStats(pBuffer);
+}
@@ -0,0 +1,106 @@
+//
+/// \file Motion.h
+/// \brief Jitter buffer for controller transforms. Samples are kept
+///        with the time they were sent, and the renderer shows the pose
+///        of a moment a fixed delay in the past, interpolated between
+///        the samples around it. When the samples run out, the motion of
+///        the last two is continued for a short while.
+//
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+
+#define MOTION_MAX_SAMPLES 32
+#define MOTION_OFFSET_WINDOW 64
+
+// Pitch, yaw and roll in degrees, then the uniform scale.
+#define MOTION_VALUES 4
+#define MOTION_ANGLES 3
+
+typedef struct
+{
+   // Local time on the ProfilerNow() clock
+   uint64_t time;
+   float values[MOTION_VALUES];
+
+   // Given to MotionAdd, reported once the displayed moment reaches
+   // the sample
+   uint32_t tag;
+   int shown;
+} MotionSample;
+
+//
+/// \brief Interval metrics, see MotionGetStats.
+//
+typedef struct
+{
+   // Frames that sampled the buffer, and how many were extrapolated
+   // or held the last pose because extrapolation ran out
+   uint64_t frames;
+   uint64_t extrapolated;
+   uint64_t held;
+
+   // Samples newer than the displayed moment, per frame
+   float meanDepth;
+   int minDepth;
+   int maxDepth;
+
+   // Largest angle between where extrapolation from the previous two
+   // samples put a new sample and where it was, in degrees
+   uint64_t predictions;
+   float meanError;
+   float maxError;
+} MotionStats;
+
+typedef struct
+{
+   MotionSample samples[MOTION_MAX_SAMPLES];
+   int count;
+
+   // Recent differences between local receive and sender time; the
+   // smallest is the one with the least network delay
+   int64_t offsets[MOTION_OFFSET_WINDOW];
+   int numOffsets;
+   int nextOffset;
+
+   uint64_t delay;
+   uint64_t maxExtrapolation;
+
+   uint64_t depthSum;
+   double errorSum;
+   MotionStats stats;
+} MotionBuffer;
+
+//
+/// \brief Start empty. Times are in nanoseconds.
+/// \param uDelay How far behind the present the displayed pose is
+/// \param uMaxExtrapolation How long to continue a motion with no new
+///        samples before holding still
+//
+void MotionInit(MotionBuffer* pBuffer, uint64_t uDelay, uint64_t uMaxExtrapolation);
+
+//
+/// \brief Add a sample.
+/// \param uReceived Local receive time, ProfilerNow() clock
+/// \param uSent Sender's clock in microseconds, or 0 to place the sample
+///        at its receive time
+/// \param uTag Any value but 0, handed back by MotionEvaluate
+//
+void MotionAdd(MotionBuffer* pBuffer, uint64_t uReceived, uint64_t uSent, const float* pValues, uint32_t uTag);
+
+//
+/// \brief The pose to display at local time uNow.
+/// \param pShown Set to the tag of the newest sample whose pose is
+///        shown for the first time, the first frame it is drawn in, or
+///        to 0. Older samples skipped over are not reported.
+/// \return 0 if no sample has been added yet.
+//
+int MotionEvaluate(MotionBuffer* pBuffer, uint64_t uNow, float* pValues, uint32_t* pShown);
+
+//
+/// \brief Metrics since the last call.
+//
+void MotionGetStats(MotionBuffer* pBuffer, MotionStats* pStats);
+
+#endif // MOTION_H
@@ -0,0 +1,781 @@
+//
+// Network.cpp
+//
+//    The network thread blocks in recvmmsg, so a message is parsed as
+//    soon as it arrives instead of at the next frame, and whatever else
+//    is already queued on the socket comes back in the same call. Of a
+//    run of transforms, in a batch or waiting in the ring, only the
+//    newest is kept unless coalescing is turned off for interpolation;
+//    the other commands keep their order. Commands go into
+//    a ring of fixed size: the network thread only writes the head and
+//    the render thread only writes the tail, each on its own cache
+//    line, so neither side ever waits for the other. When the render
+//    thread falls behind and the ring is full, new commands are dropped
+//    and counted. Memory reports and stats queries are answered on the
+//    network thread; the render thread only refreshes its part of the
+//    stats once per stats interval. Binary messages are checked against
+//    the sequence numbers of their sender before they are queued.
+//
+//    Discovery requests are answered from the control socket itself, to
+//    the port after it, with the status last set by the render thread.
+//    The answers of a batch go out in one non-blocking sendmmsg, and an
+//    address answered within the holdoff is not answered again, so a
+//    burst of controllers costs the network thread a few system calls
+//    and the render thread nothing.
+//
+//    With a capture open every datagram is written to it before it is
+//    parsed, stamped with the same receive time the command gets.
+//
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "Capture.h"
+#include "Memory.h"
+#include "Network.h"
+#include "Profiler.h"
+#include "Protocol.h"
+#include "Trace.h"
+
+// Must be a power of two.
+#define NET_RING_SIZE 256
+#define NET_RECV_BUFFER_SIZE 2048
+
+// Datagrams taken off the socket per system call.
+#define NET_RECV_BATCH 32
+
+// Longest the network thread sleeps before it checks for NetStop.
+#define NET_RECV_TIMEOUT_MS 100
+
+#define NET_CACHE_LINE 64
+
+// A sequence number this far behind the newest means the sender
+// started over.
+#define NET_SEQUENCE_RESTART 1024
+
+// Discovery replies go to the control port plus this.
+#define NET_DISCOVERY_REPLY_PORT_OFFSET 1
+#define NET_DISCOVERY_REPLY_SIZE 1024
+#define NET_DISCOVERY_HOLDOFF_MS 100
+
+// Answered addresses remembered for the holdoff, forgotten all at once
+// past this many.
+#define NET_DISCOVERY_MAX_ADDRESSES 4096
+
+// Senders whose sequence numbers are tracked, forgotten all at once
+// past this many like the answered addresses. A forgotten sender's
+// next message starts a new window.
+#define NET_MAX_SENDERS 4096
+
+typedef struct
+{
+   // Next slot the network thread writes
+   alignas(NET_CACHE_LINE) std::atomic<uint32_t> head;
+   // Next slot the render thread reads
+   alignas(NET_CACHE_LINE) std::atomic<uint32_t> tail;
+   alignas(NET_CACHE_LINE) NetCommand commands[NET_RING_SIZE];
+} NetRing;
+
+//
+// Buffers of one recvmmsg call. The control data holds the kernel's
+// receive time of each datagram.
+//
+typedef struct
+{
+   struct mmsghdr headers[NET_RECV_BATCH];
+   struct iovec vectors[NET_RECV_BATCH];
+   struct sockaddr_in addresses[NET_RECV_BATCH];
+   char control[NET_RECV_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+   char data[NET_RECV_BATCH][NET_RECV_BUFFER_SIZE];
+} NetBatch;
+
+//
+// Sequence numbers seen from one sender of binary messages: the newest,
+// which of the 64 before it arrived, and the newest transform.
+//
+typedef struct
+{
+   uint32_t highest;
+   uint64_t window;
+   uint32_t lastTransform;
+} NetSender;
+
+//
+// Discovery replies of one batch, all with the same text.
+//
+typedef struct
+{
+   struct mmsghdr headers[NET_RECV_BATCH];
+   struct iovec vectors[NET_RECV_BATCH];
+   struct sockaddr_in addresses[NET_RECV_BATCH];
+   char text[NET_DISCOVERY_REPLY_SIZE];
+   int count;
+} NetReplies;
+
+static NetRing s_ring;
+static NetBatch s_batch;
+static NetReplies s_replies;
+
+// Set by the render thread, copied by the network thread
+static std::mutex s_statusMutex;
+static char s_arStatus[NET_DISCOVERY_REPLY_SIZE] = "SERVER ACTIVE\n";
+static int s_nStatusLength = 14;
+static ProtocolStats s_renderStats;
+
+// Owned by the network thread: when each address was last answered
+static std::unordered_map<uint32_t, uint64_t> s_discovered;
+static int s_nReplyPort = 0;
+
+// Owned by the network thread, keyed by address and port
+static std::unordered_map<uint64_t, NetSender> s_senders;
+
+static CaptureFile s_capture;
+
+static int s_nSocket = -1;
+static std::thread s_thread;
+static std::atomic<int> s_bStopping(0);
+static std::atomic<int> s_bCoalesce(1);
+
+static std::atomic<uint64_t> s_nDatagrams(0);
+static std::atomic<uint64_t> s_nBatches(0);
+static std::atomic<uint64_t> s_nCoalesced(0);
+static std::atomic<uint64_t> s_nCommands(0);
+static std::atomic<uint64_t> s_nDropped(0);
+static std::atomic<uint64_t> s_nUnknown(0);
+static std::atomic<uint64_t> s_nMalformed(0);
+static std::atomic<uint64_t> s_nDuplicates(0);
+static std::atomic<uint64_t> s_nStale(0);
+static std::atomic<uint64_t> s_nDiscoveries(0);
+static std::atomic<uint64_t> s_nReplies(0);
+static std::atomic<uint64_t> s_nAcks(0);
+static std::atomic<uint32_t> s_nMaxDepth(0);
+
+///
+// Append a command for the render thread, or drop it if the ring is
+// full. Called by the network thread only.
+//
+static void Push(const NetCommand* pCommand)
+{
+   uint32_t uHead = s_ring.head.load(std::memory_order_relaxed);
+   uint32_t uTail = s_ring.tail.load(std::memory_order_acquire);
+
+   if (uHead - uTail >= NET_RING_SIZE)
+   {
+      s_nDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+   }
+
+   s_ring.commands[uHead & (NET_RING_SIZE - 1)] = *pCommand;
+   s_ring.head.store(uHead + 1, std::memory_order_release);
+
+   uint32_t uDepth = uHead + 1 - uTail;
+   if (uDepth > s_nMaxDepth.load(std::memory_order_relaxed))
+      s_nMaxDepth.store(uDepth, std::memory_order_relaxed);
+
+   s_nCommands.fetch_add(1, std::memory_order_relaxed);
+}
+
+int NetPoll(NetCommand* pCommand)
+{
+   uint32_t uTail = s_ring.tail.load(std::memory_order_relaxed);
+   uint32_t uHead = s_ring.head.load(std::memory_order_acquire);
+
+   if (uTail == uHead)
+      return 0;
+
+   *pCommand = s_ring.commands[uTail & (NET_RING_SIZE - 1)];
+   uTail++;
+
+   // A transform followed by another is already out of date
+   while (s_bCoalesce.load(std::memory_order_relaxed) &&
+          pCommand->type == NET_CMD_TRANSFORM &&
+          uTail != uHead &&
+          s_ring.commands[uTail & (NET_RING_SIZE - 1)].type == NET_CMD_TRANSFORM)
+   {
+      *pCommand = s_ring.commands[uTail & (NET_RING_SIZE - 1)];
+      uTail++;
+      s_nCoalesced.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   s_ring.tail.store(uTail, std::memory_order_release);
+
+   return 1;
+}
+
+///
+// Whether a binary message is new, by its sender's sequence numbers.
+// Duplicates and messages too old to tell are dropped, and so are
+// transforms older than the newest transform seen, which reordering
+// made stale; the other commands are applied late rather than not at
+// all.
+//
+static int AcceptSequence(const struct sockaddr_in* pRemote, const ProtocolMessage* pMessage)
+{
+   uint64_t uKey = ((uint64_t) pRemote->sin_addr.s_addr << 16) | pRemote->sin_port;
+   std::unordered_map<uint64_t, NetSender>::iterator it = s_senders.find(uKey);
+   uint32_t uSequence = pMessage->sequence;
+
+   if (it == s_senders.end())
+   {
+      NetSender sender = { uSequence, 1, uSequence - 1 };
+
+      if (pMessage->type == PROTOCOL_TRANSFORM)
+         sender.lastTransform = uSequence;
+
+      if (s_senders.size() >= NET_MAX_SENDERS)
+         s_senders.clear();
+
+      s_senders[uKey] = sender;
+      return 1;
+   }
+
+   NetSender* pSender = &it->second;
+   uint32_t uAhead = uSequence - pSender->highest;
+   uint32_t uBehind = pSender->highest - uSequence;
+
+   // Unsigned differences, so that half the sequence space apart is
+   // still well defined
+   if (uAhead != 0 && uAhead < 0x80000000u)
+   {
+      pSender->window = (uAhead < 64) ? (pSender->window << uAhead) | 1 : 1;
+      pSender->highest = uSequence;
+   }
+   else if (uBehind > NET_SEQUENCE_RESTART)
+   {
+      // Far behind is a restarted sender, not an old packet
+      pSender->highest = uSequence;
+      pSender->window = 1;
+      pSender->lastTransform = uSequence - 1;
+   }
+   else if (uBehind >= 64 || (pSender->window & (1ull << uBehind)) != 0)
+   {
+      s_nDuplicates.fetch_add(1, std::memory_order_relaxed);
+      return 0;
+   }
+   else
+   {
+      pSender->window |= 1ull << uBehind;
+   }
+
+   if (pMessage->type == PROTOCOL_TRANSFORM)
+   {
+      if ((int32_t) (uSequence - pSender->lastTransform) <= 0)
+      {
+         s_nStale.fetch_add(1, std::memory_order_relaxed);
+         return 0;
+      }
+
+      pSender->lastTransform = uSequence;
+   }
+
+   return 1;
+}
+
+void NetSetStatus(const NetStatus* pStatus)
+{
+   char arStatus[NET_DISCOVERY_REPLY_SIZE];
+   int nLength = snprintf(arStatus, sizeof(arStatus),
+      "SERVER ACTIVE\nprotocol %d\nresolution %dx%d\nviews %d\nload %.2f\nmodels %d\n",
+      PROTOCOL_VERSION, pStatus->width, pStatus->height, pStatus->views, pStatus->load, pStatus->numModels);
+
+   for (int i = 0; i < pStatus->numModels && nLength < (int) sizeof(arStatus); i++)
+      nLength += snprintf(arStatus + nLength, sizeof(arStatus) - nLength, "model %d %s\n", i, pStatus->models[i]);
+
+   // A reply cut short still starts with everything but the names
+   if (nLength >= (int) sizeof(arStatus))
+      nLength = sizeof(arStatus) - 1;
+
+   std::lock_guard<std::mutex> lock(s_statusMutex);
+
+   memcpy(s_arStatus, arStatus, nLength);
+   s_nStatusLength = nLength;
+}
+
+void NetSetRenderStats(const ProtocolStats* pStats)
+{
+   std::lock_guard<std::mutex> lock(s_statusMutex);
+
+   s_renderStats = *pStats;
+}
+
+///
+// Answer a stats query in its own format. Binary answers carry the
+// query's sequence number and timestamp, so a poller can match them
+// up and time the round trip.
+//
+static void SendStats(const ProtocolMessage* pQuery, const struct sockaddr_in* pRemote, socklen_t addrlen)
+{
+   ProtocolMessage reply;
+
+   memset(&reply, 0, sizeof(reply));
+   {
+      std::lock_guard<std::mutex> lock(s_statusMutex);
+
+      reply.stats = s_renderStats;
+   }
+
+   uint32_t uHead = s_ring.head.load(std::memory_order_relaxed);
+   uint32_t uTail = s_ring.tail.load(std::memory_order_acquire);
+
+   reply.stats.queueDepth = (uint16_t) (uHead - uTail);
+   reply.stats.cpuKB = (uint32_t) (MemoryGetTotal(MEMORY_POOL_CPU) / 1024);
+   reply.stats.gpuKB = (uint32_t) (MemoryGetTotal(MEMORY_POOL_GPU) / 1024);
+
+   char arReply[NET_RECV_BUFFER_SIZE];
+   int nReply;
+
+   if (pQuery->binary)
+   {
+      reply.type = PROTOCOL_STATS;
+      reply.sequence = pQuery->sequence;
+      reply.timestamp = pQuery->timestamp;
+
+      nReply = ProtocolEncode(&reply, arReply, sizeof(arReply));
+   }
+   else
+   {
+      nReply = ProtocolFormatStats(&reply.stats, arReply, sizeof(arReply));
+   }
+
+   sendto(s_nSocket, arReply, nReply, 0, (const struct sockaddr*) pRemote, addrlen);
+}
+
+///
+// Answer a discovery request with the next batch of replies, unless
+// this address was answered within the holdoff.
+//
+static void QueueDiscoveryReply(const struct sockaddr_in* pRemote, uint64_t uNow)
+{
+   s_nDiscoveries.fetch_add(1, std::memory_order_relaxed);
+
+   std::unordered_map<uint32_t, uint64_t>::iterator it = s_discovered.find(pRemote->sin_addr.s_addr);
+
+   if (it != s_discovered.end() && uNow - it->second < NET_DISCOVERY_HOLDOFF_MS * 1000000ull)
+      return;
+
+   if (s_discovered.size() >= NET_DISCOVERY_MAX_ADDRESSES)
+      s_discovered.clear();
+
+   s_discovered[pRemote->sin_addr.s_addr] = uNow;
+
+   struct sockaddr_in* pReply = &s_replies.addresses[s_replies.count++];
+
+   *pReply = *pRemote;
+   pReply->sin_port = htons(s_nReplyPort);
+}
+
+///
+// Send the discovery replies of a batch. MSG_DONTWAIT, as a full send
+// buffer is no reason to stop receiving.
+//
+static void SendDiscoveryReplies()
+{
+   if (s_replies.count == 0)
+      return;
+
+   int nLength;
+   {
+      std::lock_guard<std::mutex> lock(s_statusMutex);
+
+      nLength = s_nStatusLength;
+      memcpy(s_replies.text, s_arStatus, nLength);
+   }
+
+   for (int i = 0; i < s_replies.count; i++)
+   {
+      s_replies.vectors[i].iov_len = nLength;
+      s_replies.headers[i].msg_len = 0;
+   }
+
+   int nSent = sendmmsg(s_nSocket, s_replies.headers, s_replies.count, MSG_DONTWAIT);
+
+   if (nSent > 0)
+      s_nReplies.fetch_add(nSent, std::memory_order_relaxed);
+
+   s_replies.count = 0;
+}
+
+///
+// Decode one datagram, answering memory and stats queries on the
+// spot and discovery requests with the batch.
+// \return 0 if there is nothing for the render thread.
+//
+static int ParseDatagram(const char* pData, int nLength, const struct sockaddr_in* pRemote, socklen_t addrlen, NetCommand* pCommand)
+{
+   ProtocolMessage message;
+   int nResult = ProtocolDecode(pData, nLength, &message);
+
+   if (nResult == PROTOCOL_UNKNOWN)
+   {
+      s_nUnknown.fetch_add(1, std::memory_order_relaxed);
+      printf("Message Received: %d bytes \n", nLength);
+      return 0;
+   }
+
+   if (nResult != PROTOCOL_OK)
+   {
+      s_nMalformed.fetch_add(1, std::memory_order_relaxed);
+      return 0;
+   }
+
+   if (message.binary && !AcceptSequence(pRemote, &message))
+      return 0;
+
+   pCommand->sequence = message.sequence;
+   pCommand->sent = message.timestamp;
+   pCommand->binary = message.binary;
+   pCommand->address = pRemote->sin_addr.s_addr;
+   pCommand->port = pRemote->sin_port;
+
+   switch (message.type)
+   {
+   case PROTOCOL_FLIP:
+      pCommand->type = NET_CMD_FLIP;
+      break;
+
+   case PROTOCOL_LINES:
+      pCommand->type = NET_CMD_LINES;
+      break;
+
+   case PROTOCOL_MODEL:
+      pCommand->type = NET_CMD_MODEL;
+      pCommand->model = message.model;
+      break;
+
+   case PROTOCOL_TRANSFORM:
+      pCommand->type = NET_CMD_TRANSFORM;
+      pCommand->pitch = message.pitch;
+      pCommand->yaw = message.yaw;
+      pCommand->roll = message.roll;
+      pCommand->scale = message.scale;
+      break;
+
+   case PROTOCOL_QUERY_MEMORY:
+   {
+      // Memory report, sent back to whoever asked
+      char arReport[NET_RECV_BUFFER_SIZE];
+      int nReport = MemoryFormatReport(arReport, sizeof(arReport));
+
+      sendto(s_nSocket, arReport, nReport, 0, (const struct sockaddr*) pRemote, addrlen);
+      return 0;
+   }
+
+   case PROTOCOL_QUERY_STATS:
+      SendStats(&message, pRemote, addrlen);
+      return 0;
+
+   case PROTOCOL_DISCOVER:
+      QueueDiscoveryReply(pRemote, pCommand->received);
+      return 0;
+
+   default:
+      // Sync messages belong on the sync port
+      s_nUnknown.fetch_add(1, std::memory_order_relaxed);
+      return 0;
+   }
+
+   return 1;
+}
+
+///
+// Nanoseconds to add to CLOCK_REALTIME to get ProfilerNow() time.
+//
+static int64_t RealtimeOffset()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_REALTIME, &now);
+
+   return (int64_t) ProfilerNow() - ((int64_t) now.tv_sec * 1000000000ll + now.tv_nsec);
+}
+
+///
+// When the kernel queued a datagram, on the ProfilerNow() clock. Time
+// spent waiting in the socket buffer thus counts as latency.
+//
+static uint64_t ReceiveTime(struct msghdr* pHeader, int64_t nOffset)
+{
+   for (struct cmsghdr* pControl = CMSG_FIRSTHDR(pHeader); pControl != 0; pControl = CMSG_NXTHDR(pHeader, pControl))
+   {
+      if (pControl->cmsg_level == SOL_SOCKET && pControl->cmsg_type == SCM_TIMESTAMPNS)
+      {
+         struct timespec stamp;
+
+         memcpy(&stamp, CMSG_DATA(pControl), sizeof(stamp));
+
+         return (uint64_t) ((int64_t) stamp.tv_sec * 1000000000ll + stamp.tv_nsec + nOffset);
+      }
+   }
+
+   return ProfilerNow();
+}
+
+///
+// Parse a batch in order and queue the commands, leaving out every
+// transform that is followed by another one.
+//
+static void HandleBatch(int nCount)
+{
+   NetCommand arCommands[NET_RECV_BATCH];
+   int nCommands = 0;
+   int64_t nOffset = RealtimeOffset();
+   int64_t nBytes = 0;
+
+   ScopedTrace trace("NetworkBatch");
+
+   for (int i = 0; i < nCount; i++)
+   {
+      struct mmsghdr* pMessage = &s_batch.headers[i];
+      int nLength = (int) pMessage->msg_len;
+      char* pData = s_batch.data[i];
+      NetCommand* pCommand = &arCommands[nCommands];
+
+      if (nLength == 0)
+         continue;
+
+      pData[nLength] = 0;
+      nBytes += nLength;
+
+      memset(pCommand, 0, sizeof(NetCommand));
+      pCommand->received = ReceiveTime(&pMessage->msg_hdr, nOffset);
+
+      if (s_capture.file != 0)
+      {
+         const struct sockaddr_in* pRemote = &s_batch.addresses[i];
+         CaptureWrite(&s_capture, pCommand->received, ntohl(pRemote->sin_addr.s_addr), ntohs(pRemote->sin_port), pData, nLength);
+      }
+
+      if (!ParseDatagram(pData, nLength, &s_batch.addresses[i], pMessage->msg_hdr.msg_namelen, pCommand))
+         continue;
+
+      if (s_bCoalesce.load(std::memory_order_relaxed) &&
+          pCommand->type == NET_CMD_TRANSFORM &&
+          nCommands > 0 &&
+          arCommands[nCommands - 1].type == NET_CMD_TRANSFORM)
+      {
+         arCommands[nCommands - 1] = *pCommand;
+         s_nCoalesced.fetch_add(1, std::memory_order_relaxed);
+         continue;
+      }
+
+      nCommands++;
+   }
+
+   for (int i = 0; i < nCommands; i++)
+      Push(&arCommands[i]);
+
+   SendDiscoveryReplies();
+
+   trace.SetBytes(nBytes);
+}
+
+static void NetThread()
+{
+   TraceThreadName("network");
+
+   while (!s_bStopping.load(std::memory_order_relaxed))
+   {
+      // recvmmsg writes back the lengths of names and control data
+      for (int i = 0; i < NET_RECV_BATCH; i++)
+      {
+         struct msghdr* pHeader = &s_batch.headers[i].msg_hdr;
+
+         pHeader->msg_namelen = sizeof(struct sockaddr_in);
+         pHeader->msg_controllen = sizeof(s_batch.control[i]);
+      }
+
+      // Sleeps until the first datagram, then takes what is queued
+      int nCount = recvmmsg(s_nSocket, s_batch.headers, NET_RECV_BATCH, MSG_WAITFORONE, 0);
+
+      // Timeouts, interruptions and the wake-up from NetStop
+      if (nCount <= 0)
+         continue;
+
+      s_nDatagrams.fetch_add(nCount, std::memory_order_relaxed);
+      s_nBatches.fetch_add(1, std::memory_order_relaxed);
+
+      HandleBatch(nCount);
+   }
+}
+
+void NetSetCoalescing(int bCoalesce)
+{
+   s_bCoalesce.store(bCoalesce, std::memory_order_relaxed);
+}
+
+int NetStartCapture(const char* pPath)
+{
+   if (!CaptureCreate(&s_capture, pPath))
+   {
+      printf("Failed to create capture %s.\n", pPath);
+      return 0;
+   }
+
+   printf("Capturing control datagrams to %s\n", pPath);
+   return 1;
+}
+
+int NetStart(int nPort)
+{
+   s_nSocket = socket(AF_INET, SOCK_DGRAM, 0);
+   if (s_nSocket < 0)
+   {
+      printf("Failed to create socket.\n");
+      CaptureClose(&s_capture);
+      return 0;
+   }
+
+   struct sockaddr_in serverAddr;
+   memset(&serverAddr, 0, sizeof(sockaddr_in));
+   serverAddr.sin_family = AF_INET;
+   serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+   serverAddr.sin_port = htons(nPort);
+
+   if (bind(s_nSocket, (struct sockaddr*) &serverAddr, sizeof(serverAddr)) < 0)
+   {
+      printf("Failed to bind socket.\n");
+      close(s_nSocket);
+      s_nSocket = -1;
+      CaptureClose(&s_capture);
+      return 0;
+   }
+
+   // Only bounds how long NetStop can wait, receiving is still blocking
+   timeval timeoutLength;
+   timeoutLength.tv_sec = 0;
+   timeoutLength.tv_usec = NET_RECV_TIMEOUT_MS * 1000;
+   setsockopt(s_nSocket, SOL_SOCKET, SO_RCVTIMEO, &timeoutLength, sizeof(timeval));
+
+   int nEnable = 1;
+   setsockopt(s_nSocket, SOL_SOCKET, SO_TIMESTAMPNS, &nEnable, sizeof(nEnable));
+
+   // One byte of every buffer is left for the terminator
+   for (int i = 0; i < NET_RECV_BATCH; i++)
+   {
+      struct msghdr* pHeader = &s_batch.headers[i].msg_hdr;
+
+      s_batch.vectors[i].iov_base = s_batch.data[i];
+      s_batch.vectors[i].iov_len = NET_RECV_BUFFER_SIZE - 1;
+
+      pHeader->msg_name = &s_batch.addresses[i];
+      pHeader->msg_iov = &s_batch.vectors[i];
+      pHeader->msg_iovlen = 1;
+      pHeader->msg_control = s_batch.control[i];
+   }
+
+   for (int i = 0; i < NET_RECV_BATCH; i++)
+   {
+      struct msghdr* pHeader = &s_replies.headers[i].msg_hdr;
+
+      s_replies.vectors[i].iov_base = s_replies.text;
+
+      memset(pHeader, 0, sizeof(struct msghdr));
+      pHeader->msg_name = &s_replies.addresses[i];
+      pHeader->msg_namelen = sizeof(struct sockaddr_in);
+      pHeader->msg_iov = &s_replies.vectors[i];
+      pHeader->msg_iovlen = 1;
+   }
+
+   s_nReplyPort = nPort + NET_DISCOVERY_REPLY_PORT_OFFSET;
+
+   {
+      ScopedMemoryAsset asset("network");
+      MemoryTrack(MEMORY_HEAP, (uintptr_t) &s_ring, sizeof(s_ring));
+      MemoryTrack(MEMORY_HEAP, (uintptr_t) &s_batch, sizeof(s_batch));
+      MemoryTrack(MEMORY_HEAP, (uintptr_t) &s_replies, sizeof(s_replies));
+   }
+
+   s_bStopping.store(0);
+   s_thread = std::thread(NetThread);
+
+   return 1;
+}
+
+void NetStop()
+{
+   if (s_nSocket < 0)
+      return;
+
+   s_bStopping.store(1);
+
+   // Wakes the blocked recvfrom at once
+   shutdown(s_nSocket, SHUT_RDWR);
+
+   if (s_thread.joinable())
+      s_thread.join();
+
+   close(s_nSocket);
+   s_nSocket = -1;
+
+   if (s_capture.file != 0)
+   {
+      printf("Captured %llu datagrams, %llu bytes\n",
+         (unsigned long long) s_capture.records,
+         (unsigned long long) s_capture.bytes);
+      CaptureClose(&s_capture);
+   }
+}
+
+void NetAcknowledge(const NetCommand* pCommand, uint64_t uApplied, uint64_t uPresented)
+{
+   if (s_nSocket < 0 || !pCommand->binary)
+      return;
+
+   ProtocolMessage ack;
+   char arAck[PROTOCOL_MAX_SIZE];
+
+   memset(&ack, 0, sizeof(ack));
+   ack.type = PROTOCOL_ACK;
+   ack.sequence = pCommand->sequence;
+   ack.timestamp = pCommand->sent;
+   ack.applied = (uint32_t) ((uApplied - pCommand->received) / 1000);
+   ack.presented = (uint32_t) ((uPresented - pCommand->received) / 1000);
+
+   struct sockaddr_in remote;
+   memset(&remote, 0, sizeof(remote));
+   remote.sin_family = AF_INET;
+   remote.sin_addr.s_addr = pCommand->address;
+   remote.sin_port = pCommand->port;
+
+   int nLength = ProtocolEncode(&ack, arAck, sizeof(arAck));
+
+   // The render thread must not wait on the network
+   if (sendto(s_nSocket, arAck, nLength, MSG_DONTWAIT, (const struct sockaddr*) &remote, sizeof(remote)) == nLength)
+      s_nAcks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NetGetStats(NetStats* pStats)
+{
+   uint32_t uHead = s_ring.head.load(std::memory_order_acquire);
+   uint32_t uTail = s_ring.tail.load(std::memory_order_acquire);
+
+   pStats->datagrams = s_nDatagrams.exchange(0, std::memory_order_relaxed);
+   pStats->batches = s_nBatches.exchange(0, std::memory_order_relaxed);
+   pStats->coalesced = s_nCoalesced.exchange(0, std::memory_order_relaxed);
+   pStats->commands = s_nCommands.exchange(0, std::memory_order_relaxed);
+   pStats->dropped = s_nDropped.exchange(0, std::memory_order_relaxed);
+   pStats->unknown = s_nUnknown.exchange(0, std::memory_order_relaxed);
+   pStats->malformed = s_nMalformed.exchange(0, std::memory_order_relaxed);
+   pStats->duplicates = s_nDuplicates.exchange(0, std::memory_order_relaxed);
+   pStats->stale = s_nStale.exchange(0, std::memory_order_relaxed);
+   pStats->discoveries = s_nDiscoveries.exchange(0, std::memory_order_relaxed);
+   pStats->replies = s_nReplies.exchange(0, std::memory_order_relaxed);
+   pStats->acks = s_nAcks.exchange(0, std::memory_order_relaxed);
+   pStats->depth = uHead - uTail;
+   pStats->maxDepth = s_nMaxDepth.exchange(pStats->depth, std::memory_order_relaxed);
+
+   if (pStats->maxDepth < pStats->depth)
+      pStats->maxDepth = pStats->depth;
+}
@@ -0,0 +1,152 @@
+//
+/// \file Network.h
+/// \brief Control socket served from its own thread. Datagrams are
+///        received and parsed into commands on the network thread and
+///        handed to the render thread through a single producer, single
+///        consumer ring, which the render thread drains once a frame
+///        without system calls or locks.
+//
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stdint.h>
+
+#include "Protocol.h"
+
+// Commands the render thread applies.
+#define NET_CMD_FLIP 0
+#define NET_CMD_LINES 1
+#define NET_CMD_MODEL 2
+#define NET_CMD_TRANSFORM 3
+
+//
+/// \brief One parsed control message.
+//
+typedef struct
+{
+   int type;
+   // ProfilerNow() when the kernel received the datagram
+   uint64_t received;
+   // Sender's sequence number and clock in microseconds, 0 for text
+   uint32_t sequence;
+   uint64_t sent;
+   int binary;
+   // Sender, network byte order, where acknowledgements go
+   uint32_t address;
+   uint16_t port;
+
+   // NET_CMD_MODEL
+   int model;
+
+   // NET_CMD_TRANSFORM, in degrees and a uniform scale
+   float pitch;
+   float yaw;
+   float roll;
+   float scale;
+} NetCommand;
+
+//
+/// \brief Counters of the network thread. Depths are in commands.
+//
+typedef struct
+{
+   uint64_t datagrams;
+   // recvmmsg calls that returned datagrams
+   uint64_t batches;
+   uint64_t commands;
+   // Transforms replaced by a newer one before they were applied
+   uint64_t coalesced;
+   uint64_t dropped;
+   uint64_t unknown;
+   // Bad length, version or values
+   uint64_t malformed;
+   // Binary messages seen before, and transforms older than one applied
+   uint64_t duplicates;
+   uint64_t stale;
+   // Discovery requests, and how many were answered; the rest came
+   // from an address answered moments before
+   uint64_t discoveries;
+   uint64_t replies;
+   // Acknowledgements sent for presented transforms
+   uint64_t acks;
+   uint32_t depth;
+   uint32_t maxDepth;
+} NetStats;
+
+//
+/// \brief What discovery replies advertise. The model names are copied.
+//
+typedef struct
+{
+   const char* const* models;
+   int numModels;
+   int width;
+   int height;
+   int views;
+   // Mean frame time over the frame budget, 1 is a full budget
+   float load;
+} NetStatus;
+
+//
+/// \brief Bind the control socket and start the network thread.
+/// \return 0 if the socket could not be set up.
+//
+int NetStart(int nPort);
+
+//
+/// \brief Write every datagram the network thread receives to a capture
+///        file until NetStop. Call before NetStart, which closes the
+///        file again if it fails.
+/// \return 0 if the file could not be created.
+//
+int NetStartCapture(const char* pPath);
+
+//
+/// \brief Whether runs of transforms are cut down to the newest, on by
+///        default. Turn it off when every sample is used, as by the
+///        jitter buffer. Call before NetStart.
+//
+void NetSetCoalescing(int bCoalesce);
+
+//
+/// \brief Stop the network thread and close the socket. Safe to call
+///        when NetStart failed or was never called.
+//
+void NetStop();
+
+//
+/// \brief Set the discovery reply. Takes a lock the network thread holds
+///        only to copy the reply, so call it now and then, not per frame.
+//
+void NetSetStatus(const NetStatus* pStatus);
+
+//
+/// \brief Set the render thread's part of the answer to stats queries.
+///        Queue depth and memory use are filled in when a query is
+///        answered. Same lock as NetSetStatus.
+//
+void NetSetRenderStats(const ProtocolStats* pStats);
+
+//
+/// \brief Take the oldest command off the ring. Of consecutive
+///        transforms only the newest is returned, unless coalescing is
+///        off. Called by the render thread only.
+/// \return 0 when the ring is empty.
+//
+int NetPoll(NetCommand* pCommand);
+
+//
+/// \brief Tell the sender of a binary command when it was applied and
+///        presented, ProfilerNow() times, with a PROTOCOL_ACK. Sent
+///        from the calling thread without blocking; an ack that does
+///        not fit in the socket buffer is dropped.
+//
+void NetAcknowledge(const NetCommand* pCommand, uint64_t uApplied, uint64_t uPresented);
+
+//
+/// \brief Counters since the last call, except depth which is the
+///        current depth of the ring. maxDepth restarts from it.
+//
+void NetGetStats(NetStats* pStats);
+
+#endif // NETWORK_H
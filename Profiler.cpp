@@ -0,0 +1,275 @@
+//
+// Profiler.cpp
+//
+//    Stage histograms in the style of HdrHistogram: values below 128 ns
+//    get a bucket each, above that every power of two is split into 64
+//    buckets, which keeps the error under 1.6% from nanoseconds up to
+//    minutes in 2240 counters. Buckets are atomics updated with relaxed
+//    adds, so any thread can record without locks; the reporter takes
+//    them with exchange, which moves each sample into exactly one
+//    interval even while other threads keep recording.
+//
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "Profiler.h"
+#include "Trace.h"
+
+#define HISTOGRAM_LINEAR_BUCKETS 128
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_MAX_SHIFT 33
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR_BUCKETS + HISTOGRAM_MAX_SHIFT * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+   std::atomic<uint32_t> counts[HISTOGRAM_BUCKETS];
+   std::atomic<uint64_t> max;
+} Histogram;
+
+// Plain counts owned by the reporting thread.
+typedef struct
+{
+   uint64_t counts[HISTOGRAM_BUCKETS];
+   uint64_t total;
+   uint64_t max;
+} HistogramSnapshot;
+
+static const char* s_arStageNames[PROFILER_STAGE_COUNT] = { "frame",
+							   "network",
+							   "matrices",
+							   "submit",
+							   "composite",
+							   "overlay",
+							   "swap",
+							   "input",
+							   "apply",
+							   "present" };
+
+static Histogram s_arHistograms[PROFILER_STAGE_COUNT];
+static HistogramSnapshot s_arRunTotals[PROFILER_STAGE_COUNT];
+static HistogramSnapshot s_arLastInterval[PROFILER_STAGE_COUNT];
+
+// Time this thread's timers spent per stage in the current frame
+static thread_local uint64_t s_arFrameTime[PROFILER_STAGE_COUNT];
+static thread_local int s_arFrameRan[PROFILER_STAGE_COUNT];
+static thread_local ScopedStageTimer* s_pCurrentTimer = 0;
+
+static int BucketIndex(uint64_t uValue)
+{
+   if (uValue < HISTOGRAM_LINEAR_BUCKETS)
+      return (int) uValue;
+
+   // Shift the value into [64, 128)
+   int nShift = 63 - __builtin_clzll(uValue) - 6;
+
+   if (nShift > HISTOGRAM_MAX_SHIFT)
+      return HISTOGRAM_BUCKETS - 1;
+
+   return HISTOGRAM_LINEAR_BUCKETS +
+          (nShift - 1) * HISTOGRAM_SUB_BUCKETS +
+          (int) ((uValue >> nShift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+///
+// Middle of the range of values a bucket holds.
+//
+static uint64_t BucketValue(int nIndex)
+{
+   if (nIndex < HISTOGRAM_LINEAR_BUCKETS)
+      return nIndex;
+
+   int nShift = (nIndex - HISTOGRAM_LINEAR_BUCKETS) / HISTOGRAM_SUB_BUCKETS + 1;
+   uint64_t uMantissa = (nIndex - HISTOGRAM_LINEAR_BUCKETS) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+
+   return (uMantissa << nShift) + ((1ull << nShift) >> 1);
+}
+
+uint64_t ProfilerNow()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+ScopedStageTimer::ScopedStageTimer(int nStage)
+   : m_nStage(nStage), m_uStart(ProfilerNow()), m_pParent(s_pCurrentTimer)
+{
+   // Pause the enclosing stage
+   if (m_pParent != 0)
+      s_arFrameTime[m_pParent->m_nStage] += m_uStart - m_pParent->m_uStart;
+
+   s_pCurrentTimer = this;
+
+   TraceBegin(s_arStageNames[m_nStage]);
+}
+
+ScopedStageTimer::~ScopedStageTimer()
+{
+   uint64_t uNow = ProfilerNow();
+
+   TraceEnd(s_arStageNames[m_nStage], -1);
+
+   s_arFrameTime[m_nStage] += uNow - m_uStart;
+   s_arFrameRan[m_nStage] = 1;
+
+   // Resume the enclosing stage
+   if (m_pParent != 0)
+      m_pParent->m_uStart = uNow;
+
+   s_pCurrentTimer = m_pParent;
+}
+
+void ProfilerRecord(int nStage, uint64_t uNanoseconds)
+{
+   Histogram* pHistogram = &s_arHistograms[nStage];
+
+   pHistogram->counts[BucketIndex(uNanoseconds)].fetch_add(1, std::memory_order_relaxed);
+
+   uint64_t uMax = pHistogram->max.load(std::memory_order_relaxed);
+   while (uNanoseconds > uMax &&
+          !pHistogram->max.compare_exchange_weak(uMax, uNanoseconds, std::memory_order_relaxed))
+   {
+   }
+}
+
+void ProfilerEndFrame()
+{
+   for (int i = 0; i < PROFILER_STAGE_COUNT; i++)
+   {
+      if (s_arFrameRan[i])
+         ProfilerRecord(i, s_arFrameTime[i]);
+
+      s_arFrameTime[i] = 0;
+      s_arFrameRan[i] = 0;
+   }
+}
+
+static uint64_t Percentile(const HistogramSnapshot* pSnapshot, double fPercentile)
+{
+   uint64_t uTarget = (uint64_t) (fPercentile * pSnapshot->total + 0.999999);
+   uint64_t uSeen = 0;
+
+   if (uTarget < 1)
+      uTarget = 1;
+
+   for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+   {
+      uSeen += pSnapshot->counts[i];
+
+      if (uSeen >= uTarget)
+      {
+         // The middle of the top bucket can lie above the real max
+         uint64_t uValue = BucketValue(i);
+         return (uValue < pSnapshot->max) ? uValue : pSnapshot->max;
+      }
+   }
+
+   return pSnapshot->max;
+}
+
+static void PrintStages(const HistogramSnapshot* pSnapshots, const char* pTitle)
+{
+   printf("%-10s %9s %9s %9s %9s %8s\n", pTitle, "p50 ms", "p95 ms", "p99 ms", "max ms", "samples");
+
+   for (int i = 0; i < PROFILER_STAGE_COUNT; i++)
+   {
+      const HistogramSnapshot* pSnapshot = &pSnapshots[i];
+
+      if (pSnapshot->total == 0)
+         continue;
+
+      printf("%-10s %9.3f %9.3f %9.3f %9.3f %8llu\n",
+         s_arStageNames[i],
+         Percentile(pSnapshot, 0.50) * 1e-6,
+         Percentile(pSnapshot, 0.95) * 1e-6,
+         Percentile(pSnapshot, 0.99) * 1e-6,
+         pSnapshot->max * 1e-6,
+         (unsigned long long) pSnapshot->total);
+   }
+}
+
+void ProfilerReportInterval()
+{
+   HistogramSnapshot* arInterval = s_arLastInterval;
+
+   memset(s_arLastInterval, 0, sizeof(s_arLastInterval));
+
+   for (int i = 0; i < PROFILER_STAGE_COUNT; i++)
+   {
+      Histogram* pHistogram = &s_arHistograms[i];
+      HistogramSnapshot* pSnapshot = &arInterval[i];
+      HistogramSnapshot* pRun = &s_arRunTotals[i];
+
+      for (int j = 0; j < HISTOGRAM_BUCKETS; j++)
+      {
+         uint32_t uCount = pHistogram->counts[j].exchange(0, std::memory_order_relaxed);
+
+         pSnapshot->counts[j] = uCount;
+         pSnapshot->total += uCount;
+         pRun->counts[j] += uCount;
+      }
+
+      pSnapshot->max = pHistogram->max.exchange(0, std::memory_order_relaxed);
+      pRun->total += pSnapshot->total;
+
+      if (pSnapshot->max > pRun->max)
+         pRun->max = pSnapshot->max;
+   }
+
+   PrintStages(arInterval, "interval");
+}
+
+void ProfilerReportTotal()
+{
+   // Pick up whatever was recorded since the last interval
+   ProfilerReportInterval();
+   PrintStages(s_arRunTotals, "run");
+}
+
+static void Summarize(const HistogramSnapshot* pSnapshot, ProfilerSummary* pSummary)
+{
+   memset(pSummary, 0, sizeof(ProfilerSummary));
+
+   if (pSnapshot->total == 0)
+      return;
+
+   pSummary->p50 = Percentile(pSnapshot, 0.50);
+   pSummary->p95 = Percentile(pSnapshot, 0.95);
+   pSummary->p99 = Percentile(pSnapshot, 0.99);
+   pSummary->max = pSnapshot->max;
+   pSummary->samples = pSnapshot->total;
+}
+
+void ProfilerGetSummary(int nStage, ProfilerSummary* pSummary)
+{
+   Summarize(&s_arRunTotals[nStage], pSummary);
+}
+
+void ProfilerGetIntervalSummary(int nStage, ProfilerSummary* pSummary)
+{
+   Summarize(&s_arLastInterval[nStage], pSummary);
+}
+
+const char* ProfilerStageName(int nStage)
+{
+   return s_arStageNames[nStage];
+}
+
+void ProfilerReset()
+{
+   for (int i = 0; i < PROFILER_STAGE_COUNT; i++)
+   {
+      for (int j = 0; j < HISTOGRAM_BUCKETS; j++)
+         s_arHistograms[i].counts[j].store(0, std::memory_order_relaxed);
+
+      s_arHistograms[i].max.store(0, std::memory_order_relaxed);
+   }
+
+   memset(s_arRunTotals, 0, sizeof(s_arRunTotals));
+   memset(s_arLastInterval, 0, sizeof(s_arLastInterval));
+}
@@ -0,0 +1,110 @@
+//
+/// \file Profiler.h
+/// \brief Per-stage frame timing. Scoped timers add up the time each
+///        stage takes in a frame, the totals go into log-linear
+///        histograms once per frame, and the p50/p95/p99/max of every
+///        stage can be printed for the last interval or the whole run.
+//
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+// Stages of a frame, in report order.
+#define PROFILER_STAGE_FRAME 0
+#define PROFILER_STAGE_NETWORK 1
+#define PROFILER_STAGE_MATRICES 2
+#define PROFILER_STAGE_SUBMIT 3
+#define PROFILER_STAGE_COMPOSITE 4
+#define PROFILER_STAGE_OVERLAY 5
+#define PROFILER_STAGE_SWAP 6
+// Not part of the frame: from a transform reaching the socket to the
+// end of the swap that showed it.
+#define PROFILER_STAGE_INPUT 7
+// The two parts of it: until the frame applied the transform, and from
+// there to the end of the swap.
+#define PROFILER_STAGE_APPLY 8
+#define PROFILER_STAGE_PRESENT 9
+#define PROFILER_STAGE_COUNT 10
+
+//
+/// \brief Percentiles of one stage over the run, in nanoseconds.
+//
+typedef struct
+{
+   uint64_t p50;
+   uint64_t p95;
+   uint64_t p99;
+   uint64_t max;
+   uint64_t samples;
+} ProfilerSummary;
+
+//
+/// \brief Monotonic clock in nanoseconds.
+//
+uint64_t ProfilerNow();
+
+//
+/// \brief Times the enclosing scope as part of a stage. Timers nest:
+///        while an inner timer runs, the outer stage is paused, so each
+///        nanosecond is counted for one stage only. Timers on other
+///        threads do not interact.
+//
+class ScopedStageTimer
+{
+public:
+   explicit ScopedStageTimer(int nStage);
+   ~ScopedStageTimer();
+
+private:
+   int m_nStage;
+   uint64_t m_uStart;
+   ScopedStageTimer* m_pParent;
+};
+
+//
+/// \brief Add one sample straight to the histogram of a stage, for
+///        durations measured elsewhere such as the swap.
+//
+void ProfilerRecord(int nStage, uint64_t uNanoseconds);
+
+//
+/// \brief Move the time the calling thread's timers collected this frame
+///        into the histograms, one sample per stage that ran.
+//
+void ProfilerEndFrame();
+
+//
+/// \brief Print percentiles per stage for the samples since the last
+///        interval report, and fold them into the run totals.
+//
+void ProfilerReportInterval();
+
+//
+/// \brief Print percentiles per stage over the whole run.
+//
+void ProfilerReportTotal();
+
+//
+/// \brief Percentiles of a stage over the samples folded into the run
+///        totals so far, i.e. up to the last report.
+//
+void ProfilerGetSummary(int nStage, ProfilerSummary* pSummary);
+
+//
+/// \brief Percentiles of a stage over the last interval reported.
+//
+void ProfilerGetIntervalSummary(int nStage, ProfilerSummary* pSummary);
+
+//
+/// \brief Name of a stage as it appears in the reports.
+//
+const char* ProfilerStageName(int nStage);
+
+//
+/// \brief Drop every sample recorded so far, for runs that leave out
+///        their warm-up frames.
+//
+void ProfilerReset();
+
+#endif // PROFILER_H
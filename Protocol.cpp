@@ -0,0 +1,567 @@
+//
+// Protocol.cpp
+//
+//    Binary layout, all little-endian:
+//
+//       0  uint16  magic, PROTOCOL_MAGIC
+//       2  uint8   version
+//       3  uint8   type
+//       4  uint32  sequence number, counting up per sender
+//       8  uint64  send time in microseconds
+//      16          payload: nothing, an int32 model index, or four
+//                  float32s of pitch, yaw, roll and scale
+//
+//    Sync state carries a uint64 present time, int32 model, uint32
+//    flags and the four floats of a transform; a time reply two uint64s,
+//    the originate and receive times.
+//
+//    A message must be exactly as long as its type says, and floats
+//    must be finite. Values are assembled byte by byte, so the code
+//    does not depend on the host byte order or alignment.
+//
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Protocol.h"
+
+// Longest text command that is parsed, the rest is ignored.
+#define PROTOCOL_MAX_TEXT 255
+
+// Stats payloads from before the input latency percentiles stop here.
+// They still decode, with the percentiles at 0; longer ones from newer
+// renderers decode as far as this one knows.
+#define PROTOCOL_STATS_MIN_SIZE 48
+
+static int PayloadSize(int nType)
+{
+   switch (nType)
+   {
+   case PROTOCOL_FLIP:
+   case PROTOCOL_LINES:
+   case PROTOCOL_QUERY_MEMORY:
+   case PROTOCOL_DISCOVER:
+   case PROTOCOL_SYNC_TIME_REQUEST:
+   case PROTOCOL_SYNC_FRAME_REPORT:
+   case PROTOCOL_QUERY_STATS:
+      return 0;
+
+   case PROTOCOL_MODEL:
+      return 4;
+
+   case PROTOCOL_ACK:
+      return 8;
+
+   case PROTOCOL_TRANSFORM:
+   case PROTOCOL_SYNC_TIME_REPLY:
+      return 16;
+
+   case PROTOCOL_SYNC_STATE:
+      return 32;
+
+   case PROTOCOL_STATS:
+      return 60;
+   }
+
+   return -1;
+}
+
+static uint32_t ReadU32(const uint8_t* p)
+{
+   return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t ReadU64(const uint8_t* p)
+{
+   return (uint64_t) ReadU32(p) | ((uint64_t) ReadU32(p + 4) << 32);
+}
+
+static float ReadF32(const uint8_t* p)
+{
+   uint32_t uBits = ReadU32(p);
+   float fValue;
+
+   memcpy(&fValue, &uBits, sizeof(fValue));
+   return fValue;
+}
+
+static void WriteU32(uint8_t* p, uint32_t uValue)
+{
+   p[0] = (uint8_t) uValue;
+   p[1] = (uint8_t) (uValue >> 8);
+   p[2] = (uint8_t) (uValue >> 16);
+   p[3] = (uint8_t) (uValue >> 24);
+}
+
+static void WriteU64(uint8_t* p, uint64_t uValue)
+{
+   WriteU32(p, (uint32_t) uValue);
+   WriteU32(p + 4, (uint32_t) (uValue >> 32));
+}
+
+static void WriteF32(uint8_t* p, float fValue)
+{
+   uint32_t uBits;
+
+   memcpy(&uBits, &fValue, sizeof(uBits));
+   WriteU32(p, uBits);
+}
+
+static int DecodePose(const uint8_t* pPayload, ProtocolMessage* pMessage)
+{
+   pMessage->pitch = ReadF32(pPayload);
+   pMessage->yaw = ReadF32(pPayload + 4);
+   pMessage->roll = ReadF32(pPayload + 8);
+   pMessage->scale = ReadF32(pPayload + 12);
+
+   if (!isfinite(pMessage->pitch) || !isfinite(pMessage->yaw) ||
+       !isfinite(pMessage->roll) || !isfinite(pMessage->scale))
+   {
+      return PROTOCOL_MALFORMED;
+   }
+
+   return PROTOCOL_OK;
+}
+
+static void EncodePose(uint8_t* pPayload, const ProtocolMessage* pMessage)
+{
+   WriteF32(pPayload, pMessage->pitch);
+   WriteF32(pPayload + 4, pMessage->yaw);
+   WriteF32(pPayload + 8, pMessage->roll);
+   WriteF32(pPayload + 12, pMessage->scale);
+}
+
+static int DecodeStats(const uint8_t* pPayload, int nLength, ProtocolStats* pStats)
+{
+   float* arValues[7] = { &pStats->fps, &pStats->frameP50, &pStats->frameP95, &pStats->frameP99,
+                          &pStats->frameMax, &pStats->load, &pStats->latency };
+
+   for (int i = 0; i < 7; i++)
+   {
+      *arValues[i] = ReadF32(pPayload + i * 4);
+
+      if (!isfinite(*arValues[i]))
+         return PROTOCOL_MALFORMED;
+   }
+
+   pStats->cpuKB = ReadU32(pPayload + 28);
+   pStats->gpuKB = ReadU32(pPayload + 32);
+   pStats->queueDepth = (uint16_t) (pPayload[36] | (pPayload[37] << 8));
+   pStats->models = (uint16_t) (pPayload[38] | (pPayload[39] << 8));
+   pStats->pushing = pPayload[40];
+   pStats->pushProgress = pPayload[41];
+   pStats->assetsWaiting = pPayload[42];
+   pStats->shaderHits = (uint16_t) (pPayload[44] | (pPayload[45] << 8));
+   pStats->shaderMisses = (uint16_t) (pPayload[46] | (pPayload[47] << 8));
+
+   // Older renderers send no percentiles
+   if (nLength < PayloadSize(PROTOCOL_STATS))
+      return PROTOCOL_OK;
+
+   float* arInput[3] = { &pStats->inputP50, &pStats->inputP95, &pStats->inputP99 };
+
+   for (int i = 0; i < 3; i++)
+   {
+      *arInput[i] = ReadF32(pPayload + 48 + i * 4);
+
+      if (!isfinite(*arInput[i]))
+         return PROTOCOL_MALFORMED;
+   }
+
+   return PROTOCOL_OK;
+}
+
+static void EncodeStats(uint8_t* pPayload, const ProtocolStats* pStats)
+{
+   const float arValues[7] = { pStats->fps, pStats->frameP50, pStats->frameP95, pStats->frameP99,
+                               pStats->frameMax, pStats->load, pStats->latency };
+
+   for (int i = 0; i < 7; i++)
+      WriteF32(pPayload + i * 4, arValues[i]);
+
+   WriteU32(pPayload + 28, pStats->cpuKB);
+   WriteU32(pPayload + 32, pStats->gpuKB);
+   pPayload[36] = (uint8_t) pStats->queueDepth;
+   pPayload[37] = (uint8_t) (pStats->queueDepth >> 8);
+   pPayload[38] = (uint8_t) pStats->models;
+   pPayload[39] = (uint8_t) (pStats->models >> 8);
+   pPayload[40] = pStats->pushing;
+   pPayload[41] = pStats->pushProgress;
+   pPayload[42] = pStats->assetsWaiting;
+   pPayload[43] = 0;
+   pPayload[44] = (uint8_t) pStats->shaderHits;
+   pPayload[45] = (uint8_t) (pStats->shaderHits >> 8);
+   pPayload[46] = (uint8_t) pStats->shaderMisses;
+   pPayload[47] = (uint8_t) (pStats->shaderMisses >> 8);
+   WriteF32(pPayload + 48, pStats->inputP50);
+   WriteF32(pPayload + 52, pStats->inputP95);
+   WriteF32(pPayload + 56, pStats->inputP99);
+}
+
+static int DecodeBinary(const uint8_t* pData, int nLength, ProtocolMessage* pMessage)
+{
+   if (nLength < PROTOCOL_HEADER_SIZE)
+      return PROTOCOL_MALFORMED;
+
+   if (pData[2] != PROTOCOL_VERSION)
+      return PROTOCOL_UNSUPPORTED_VERSION;
+
+   int nPayload = PayloadSize(pData[3]);
+
+   if (nPayload < 0)
+      return PROTOCOL_UNKNOWN;
+
+   int nReceived = nLength - PROTOCOL_HEADER_SIZE;
+
+   // Stats may be shorter or longer, see PROTOCOL_STATS_MIN_SIZE
+   if (pData[3] == PROTOCOL_STATS ? nReceived < PROTOCOL_STATS_MIN_SIZE : nReceived != nPayload)
+      return PROTOCOL_MALFORMED;
+
+   const uint8_t* pPayload = pData + PROTOCOL_HEADER_SIZE;
+
+   pMessage->type = pData[3];
+   pMessage->binary = 1;
+   pMessage->sequence = ReadU32(pData + 4);
+   pMessage->timestamp = ReadU64(pData + 8);
+
+   if (pMessage->type == PROTOCOL_MODEL)
+   {
+      pMessage->model = (int32_t) ReadU32(pPayload);
+   }
+   else if (pMessage->type == PROTOCOL_TRANSFORM)
+   {
+      return DecodePose(pPayload, pMessage);
+   }
+   else if (pMessage->type == PROTOCOL_SYNC_STATE)
+   {
+      pMessage->present = ReadU64(pPayload);
+      pMessage->model = (int32_t) ReadU32(pPayload + 8);
+      pMessage->flags = ReadU32(pPayload + 12);
+
+      return DecodePose(pPayload + 16, pMessage);
+   }
+   else if (pMessage->type == PROTOCOL_SYNC_TIME_REPLY)
+   {
+      pMessage->originate = ReadU64(pPayload);
+      pMessage->receive = ReadU64(pPayload + 8);
+   }
+   else if (pMessage->type == PROTOCOL_STATS)
+   {
+      return DecodeStats(pPayload, nReceived, &pMessage->stats);
+   }
+   else if (pMessage->type == PROTOCOL_ACK)
+   {
+      pMessage->applied = ReadU32(pPayload);
+      pMessage->presented = ReadU32(pPayload + 4);
+   }
+
+   return PROTOCOL_OK;
+}
+
+///
+// The ASCII commands: F, L, Q and S alone, "M index", "T pitch yaw roll
+// scale" and the discovery string. Missing numbers keep their defaults,
+// as with sscanf.
+//
+static int DecodeText(const char* pData, int nLength, ProtocolMessage* pMessage)
+{
+   char arText[PROTOCOL_MAX_TEXT + 1];
+
+   if (nLength > PROTOCOL_MAX_TEXT)
+      nLength = PROTOCOL_MAX_TEXT;
+
+   memcpy(arText, pData, nLength);
+   arText[nLength] = 0;
+
+   if (nLength == 1 && arText[0] == 'F')
+   {
+      pMessage->type = PROTOCOL_FLIP;
+   }
+   else if (nLength == 1 && arText[0] == 'L')
+   {
+      pMessage->type = PROTOCOL_LINES;
+   }
+   else if (nLength == 1 && arText[0] == 'Q')
+   {
+      pMessage->type = PROTOCOL_QUERY_MEMORY;
+   }
+   else if (nLength == 1 && arText[0] == 'S')
+   {
+      pMessage->type = PROTOCOL_QUERY_STATS;
+   }
+   else if (strcmp(arText, PROTOCOL_DISCOVER_TEXT) == 0)
+   {
+      pMessage->type = PROTOCOL_DISCOVER;
+   }
+   else if (arText[0] == 'M')
+   {
+      pMessage->type = PROTOCOL_MODEL;
+      pMessage->model = (int32_t) strtol(arText + 1, 0, 10);
+   }
+   else if (arText[0] == 'T')
+   {
+      float* arValues[4] = { &pMessage->pitch, &pMessage->yaw, &pMessage->roll, &pMessage->scale };
+      char* pStr = arText + 1;
+
+      pMessage->type = PROTOCOL_TRANSFORM;
+
+      for (int i = 0; i < 4; i++)
+      {
+         char* pEnd = 0;
+         float fValue = strtof(pStr, &pEnd);
+
+         if (pEnd == pStr)
+            break;
+
+         // NaN or infinity would poison every matrix after it
+         if (!isfinite(fValue))
+            return PROTOCOL_MALFORMED;
+
+         *arValues[i] = fValue;
+         pStr = pEnd;
+      }
+   }
+   else
+   {
+      return PROTOCOL_UNKNOWN;
+   }
+
+   return PROTOCOL_OK;
+}
+
+int ProtocolDecode(const void* pData, int nLength, ProtocolMessage* pMessage)
+{
+   const uint8_t* pBytes = (const uint8_t*) pData;
+
+   memset(pMessage, 0, sizeof(ProtocolMessage));
+   pMessage->scale = 1.0f;
+
+   if (nLength <= 0)
+      return PROTOCOL_MALFORMED;
+
+   if (nLength >= 2 &&
+       pBytes[0] == (PROTOCOL_MAGIC & 0xff) &&
+       pBytes[1] == (PROTOCOL_MAGIC >> 8))
+   {
+      return DecodeBinary(pBytes, nLength, pMessage);
+   }
+
+   return DecodeText((const char*) pData, nLength, pMessage);
+}
+
+int ProtocolEncode(const ProtocolMessage* pMessage, void* pBuffer, int nSize)
+{
+   uint8_t* pBytes = (uint8_t*) pBuffer;
+   int nPayload = PayloadSize(pMessage->type);
+
+   if (nPayload < 0 || nSize < PROTOCOL_HEADER_SIZE + nPayload)
+      return 0;
+
+   pBytes[0] = PROTOCOL_MAGIC & 0xff;
+   pBytes[1] = PROTOCOL_MAGIC >> 8;
+   pBytes[2] = PROTOCOL_VERSION;
+   pBytes[3] = (uint8_t) pMessage->type;
+   WriteU32(pBytes + 4, pMessage->sequence);
+   WriteU64(pBytes + 8, pMessage->timestamp);
+
+   uint8_t* pPayload = pBytes + PROTOCOL_HEADER_SIZE;
+
+   if (pMessage->type == PROTOCOL_MODEL)
+   {
+      WriteU32(pPayload, (uint32_t) pMessage->model);
+   }
+   else if (pMessage->type == PROTOCOL_TRANSFORM)
+   {
+      EncodePose(pPayload, pMessage);
+   }
+   else if (pMessage->type == PROTOCOL_SYNC_STATE)
+   {
+      WriteU64(pPayload, pMessage->present);
+      WriteU32(pPayload + 8, (uint32_t) pMessage->model);
+      WriteU32(pPayload + 12, pMessage->flags);
+      EncodePose(pPayload + 16, pMessage);
+   }
+   else if (pMessage->type == PROTOCOL_SYNC_TIME_REPLY)
+   {
+      WriteU64(pPayload, pMessage->originate);
+      WriteU64(pPayload + 8, pMessage->receive);
+   }
+   else if (pMessage->type == PROTOCOL_STATS)
+   {
+      EncodeStats(pPayload, &pMessage->stats);
+   }
+   else if (pMessage->type == PROTOCOL_ACK)
+   {
+      WriteU32(pPayload, pMessage->applied);
+      WriteU32(pPayload + 4, pMessage->presented);
+   }
+
+   return PROTOCOL_HEADER_SIZE + nPayload;
+}
+
+int ProtocolEncodeText(const ProtocolMessage* pMessage, char* pBuffer, int nSize)
+{
+   int nLength = 0;
+
+   switch (pMessage->type)
+   {
+   case PROTOCOL_FLIP:
+      nLength = snprintf(pBuffer, nSize, "F");
+      break;
+
+   case PROTOCOL_LINES:
+      nLength = snprintf(pBuffer, nSize, "L");
+      break;
+
+   case PROTOCOL_QUERY_MEMORY:
+      nLength = snprintf(pBuffer, nSize, "Q");
+      break;
+
+   case PROTOCOL_QUERY_STATS:
+      nLength = snprintf(pBuffer, nSize, "S");
+      break;
+
+   case PROTOCOL_DISCOVER:
+      nLength = snprintf(pBuffer, nSize, "%s", PROTOCOL_DISCOVER_TEXT);
+      break;
+
+   case PROTOCOL_MODEL:
+      nLength = snprintf(pBuffer, nSize, "M%d", (int) pMessage->model);
+      break;
+
+   case PROTOCOL_TRANSFORM:
+      nLength = snprintf(pBuffer, nSize, "T %.3f %.3f %.3f %.3f",
+         pMessage->pitch, pMessage->yaw, pMessage->roll, pMessage->scale);
+      break;
+
+   default:
+      return 0;
+   }
+
+   return (nLength > 0 && nLength < nSize) ? nLength : 0;
+}
+
+int ProtocolFormatStats(const ProtocolStats* pStats, char* pBuffer, int nSize)
+{
+   int nLength = snprintf(pBuffer, nSize,
+      "fps %.1f\n"
+      "frame %.3f %.3f %.3f %.3f\n"
+      "load %.2f\n"
+      "latency %.3f\n"
+      "input %.3f %.3f %.3f\n"
+      "memory %u %u\n"
+      "queue %u\n"
+      "models %u\n"
+      "push %u %u %u\n"
+      "shader-cache %u %u\n",
+      pStats->fps,
+      pStats->frameP50, pStats->frameP95, pStats->frameP99, pStats->frameMax,
+      pStats->load,
+      pStats->latency,
+      pStats->inputP50, pStats->inputP95, pStats->inputP99,
+      (unsigned int) pStats->cpuKB, (unsigned int) pStats->gpuKB,
+      (unsigned int) pStats->queueDepth,
+      (unsigned int) pStats->models,
+      (unsigned int) pStats->pushing, (unsigned int) pStats->pushProgress, (unsigned int) pStats->assetsWaiting,
+      (unsigned int) pStats->shaderHits, (unsigned int) pStats->shaderMisses);
+
+   return (nLength > 0 && nLength < nSize) ? nLength : 0;
+}
+
+int ProtocolEncodeAssetOffer(const ProtocolAssetOffer* pOffer, void* pBuffer, int nSize)
+{
+   uint8_t* pBytes = (uint8_t*) pBuffer;
+   int nName = (int) strlen(pOffer->name);
+
+   if (nName > PROTOCOL_ASSET_MAX_NAME || nSize < PROTOCOL_ASSET_OFFER_SIZE + nName)
+      return 0;
+
+   WriteU32(pBytes, PROTOCOL_ASSET_MAGIC);
+   pBytes[4] = PROTOCOL_VERSION;
+   pBytes[5] = (uint8_t) pOffer->kind;
+   pBytes[6] = (uint8_t) nName;
+   pBytes[7] = (uint8_t) (nName >> 8);
+   WriteU64(pBytes + 8, pOffer->size);
+   WriteU32(pBytes + 16, pOffer->crc);
+   memcpy(pBytes + PROTOCOL_ASSET_OFFER_SIZE, pOffer->name, nName);
+
+   return PROTOCOL_ASSET_OFFER_SIZE + nName;
+}
+
+int ProtocolDecodeAssetOffer(const void* pData, ProtocolAssetOffer* pOffer)
+{
+   const uint8_t* pBytes = (const uint8_t*) pData;
+   int nName = pBytes[6] | (pBytes[7] << 8);
+
+   memset(pOffer, 0, sizeof(ProtocolAssetOffer));
+
+   if (ReadU32(pBytes) != PROTOCOL_ASSET_MAGIC ||
+       pBytes[4] != PROTOCOL_VERSION ||
+       nName == 0 || nName > PROTOCOL_ASSET_MAX_NAME)
+   {
+      return PROTOCOL_MALFORMED;
+   }
+
+   pOffer->kind = pBytes[5];
+   pOffer->size = ReadU64(pBytes + 8);
+   pOffer->crc = ReadU32(pBytes + 16);
+
+   return nName;
+}
+
+void ProtocolEncodeAssetChunk(uint32_t uLength, uint32_t uCrc, void* pBuffer)
+{
+   WriteU32((uint8_t*) pBuffer, uLength);
+   WriteU32((uint8_t*) pBuffer + 4, uCrc);
+}
+
+void ProtocolDecodeAssetChunk(const void* pData, uint32_t* pLength, uint32_t* pCrc)
+{
+   *pLength = ReadU32((const uint8_t*) pData);
+   *pCrc = ReadU32((const uint8_t*) pData + 4);
+}
+
+void ProtocolEncodeAssetReply(int nStatus, int64_t nValue, void* pBuffer)
+{
+   WriteU32((uint8_t*) pBuffer, (uint32_t) nStatus);
+   WriteU64((uint8_t*) pBuffer + 4, (uint64_t) nValue);
+}
+
+void ProtocolDecodeAssetReply(const void* pData, int* pStatus, int64_t* pValue)
+{
+   *pStatus = (int) ReadU32((const uint8_t*) pData);
+   *pValue = (int64_t) ReadU64((const uint8_t*) pData + 4);
+}
+
+static int FillCrc32Table(uint32_t* pTable)
+{
+   for (uint32_t i = 0; i < 256; i++)
+   {
+      uint32_t uValue = i;
+
+      for (int j = 0; j < 8; j++)
+         uValue = (uValue & 1) ? 0xedb88320u ^ (uValue >> 1) : uValue >> 1;
+
+      pTable[i] = uValue;
+   }
+
+   return 1;
+}
+
+uint32_t ProtocolCrc32(uint32_t uCrc, const void* pData, int nLength)
+{
+   static uint32_t s_arTable[256];
+   // Filled once, thread safe as a local static
+   static const int s_bTable = FillCrc32Table(s_arTable);
+
+   const uint8_t* pBytes = (const uint8_t*) pData;
+
+   (void) s_bTable;
+   uCrc = ~uCrc;
+
+   for (int i = 0; i < nLength; i++)
+      uCrc = s_arTable[(uCrc ^ pBytes[i]) & 0xff] ^ (uCrc >> 8);
+
+   return ~uCrc;
+}
@@ -0,0 +1,226 @@
+//
+/// \file Protocol.h
+/// \brief Control messages on the wire. Binary messages have a fixed
+///        header of magic, version, type, sequence number and send time
+///        followed by a little-endian payload; the older ASCII commands
+///        are still understood. Nothing here touches sockets, so tools
+///        and benchmarks can encode and decode without a renderer.
+//
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// First two bytes of a binary message, 0x9a 0x47. The first byte is not
+// printable, so binary messages never look like a text command.
+#define PROTOCOL_MAGIC 0x479a
+#define PROTOCOL_VERSION 1
+
+// Magic, version, type, sequence and timestamp.
+#define PROTOCOL_HEADER_SIZE 16
+#define PROTOCOL_MAX_SIZE 80
+
+// Message types, shared by both formats.
+#define PROTOCOL_FLIP 1
+#define PROTOCOL_LINES 2
+#define PROTOCOL_MODEL 3
+#define PROTOCOL_TRANSFORM 4
+#define PROTOCOL_QUERY_MEMORY 5
+#define PROTOCOL_DISCOVER 6
+
+// Multi-node sync, binary only (Sync.h).
+#define PROTOCOL_SYNC_STATE 7
+#define PROTOCOL_SYNC_TIME_REQUEST 8
+#define PROTOCOL_SYNC_TIME_REPLY 9
+#define PROTOCOL_SYNC_FRAME_REPORT 10
+
+// Health snapshot. A query is answered to its sender with a
+// PROTOCOL_STATS carrying the query's sequence number and timestamp,
+// or with text for the text query S.
+#define PROTOCOL_QUERY_STATS 11
+#define PROTOCOL_STATS 12
+
+// Sent by a renderer run with --ack to the sender of each transform it
+// presents, carrying the transform's sequence number and timestamp.
+// Binary only.
+#define PROTOCOL_ACK 13
+
+// The text form of PROTOCOL_DISCOVER, as broadcast by controllers.
+#define PROTOCOL_DISCOVER_TEXT "GHOST-CONTROLLER"
+
+// Asset push, a TCP stream on its own port (AssetPush.h). An offer of
+// PROTOCOL_ASSET_OFFER_SIZE bytes and the name is answered with the
+// offset to resume from; then every chunk header and its data is
+// answered with the offset stored so far, until a chunk of length 0.
+#define PROTOCOL_ASSET_MAGIC 0x50414847
+#define PROTOCOL_ASSET_OFFER_SIZE 20
+#define PROTOCOL_ASSET_CHUNK_SIZE 8
+#define PROTOCOL_ASSET_REPLY_SIZE 12
+#define PROTOCOL_ASSET_MAX_NAME 64
+#define PROTOCOL_ASSET_MAX_CHUNK 65536
+
+#define PROTOCOL_ASSET_MODEL 1
+#define PROTOCOL_ASSET_TEXTURE 2
+
+// Reply statuses. After a bad chunk the sender continues from the
+// offset in the reply.
+#define PROTOCOL_ASSET_OK 0
+#define PROTOCOL_ASSET_BAD_CHUNK 1
+#define PROTOCOL_ASSET_BAD_FILE 2
+#define PROTOCOL_ASSET_REJECTED 3
+#define PROTOCOL_ASSET_PARSE_FAILED 4
+
+// Results of ProtocolDecode.
+#define PROTOCOL_OK 0
+#define PROTOCOL_UNKNOWN -1
+#define PROTOCOL_MALFORMED -2
+#define PROTOCOL_UNSUPPORTED_VERSION -3
+
+//
+/// \brief Payload of PROTOCOL_STATS. Frame times and FPS cover the last
+///        stats interval of the renderer; times in milliseconds.
+//
+typedef struct
+{
+   float fps;
+   float frameP50;
+   float frameP95;
+   float frameP99;
+   float frameMax;
+   // Mean frame time over the frame budget, 1 is a full budget
+   float load;
+   // From the newest command reaching the socket to the end of the
+   // swap that showed it
+   float latency;
+
+   uint32_t cpuKB;
+   uint32_t gpuKB;
+
+   // Commands waiting for the render thread, and models it can show
+   uint16_t queueDepth;
+   uint16_t models;
+
+   // Asset push: a file arriving, its percentage, and parsed assets
+   // waiting for the render thread
+   uint8_t pushing;
+   uint8_t pushProgress;
+   uint8_t assetsWaiting;
+
+   // Shader programs loaded from the binary cache and built from source
+   uint16_t shaderHits;
+   uint16_t shaderMisses;
+
+   // Percentiles of the latency above over the transforms of the
+   // interval. Older renderers send the payload without them.
+   float inputP50;
+   float inputP95;
+   float inputP99;
+} ProtocolStats;
+
+//
+/// \brief A decoded message. Text commands have no sequence number or
+///        timestamp and leave binary at 0.
+//
+typedef struct
+{
+   int type;
+   int binary;
+   uint32_t sequence;
+   // Sender's clock in microseconds
+   uint64_t timestamp;
+
+   // PROTOCOL_MODEL
+   int32_t model;
+
+   // PROTOCOL_TRANSFORM, in degrees and a uniform scale
+   float pitch;
+   float yaw;
+   float roll;
+   float scale;
+
+   // PROTOCOL_SYNC_STATE: when the frame is shown, master clock in
+   // microseconds, and SYNC_FLAG_* bits; pose and model as above
+   uint64_t present;
+   uint32_t flags;
+
+   // PROTOCOL_SYNC_TIME_REPLY: timestamp of the request, and when it
+   // arrived, master clock in microseconds
+   uint64_t originate;
+   uint64_t receive;
+
+   // PROTOCOL_STATS
+   ProtocolStats stats;
+
+   // PROTOCOL_ACK: microseconds from the transform reaching the
+   // renderer's socket until the frame that first draws it, and until
+   // the end of that frame's swap
+   uint32_t applied;
+   uint32_t presented;
+} ProtocolMessage;
+
+//
+/// \brief Start of an asset push.
+//
+typedef struct
+{
+   int kind;
+   uint64_t size;
+   // CRC-32 of the whole file
+   uint32_t crc;
+   char name[PROTOCOL_ASSET_MAX_NAME + 1];
+} ProtocolAssetOffer;
+
+//
+/// \brief Decode one datagram of either format. Any bytes are safe to
+///        pass; nothing past nLength is read.
+/// \return PROTOCOL_OK or one of the errors.
+//
+int ProtocolDecode(const void* pData, int nLength, ProtocolMessage* pMessage);
+
+//
+/// \brief Write a message in the binary format.
+/// \return Bytes written, 0 if the type is unknown or nSize too small.
+//
+int ProtocolEncode(const ProtocolMessage* pMessage, void* pBuffer, int nSize);
+
+//
+/// \brief Write a message as a text command, for older renderers.
+/// \return Bytes written, without a terminator, 0 on failure.
+//
+int ProtocolEncodeText(const ProtocolMessage* pMessage, char* pBuffer, int nSize);
+
+//
+/// \brief Write a stats snapshot as text, one value per line, the form
+///        the text query S is answered with.
+/// \return Length of the text, 0 if it does not fit.
+//
+int ProtocolFormatStats(const ProtocolStats* pStats, char* pBuffer, int nSize);
+
+//
+/// \brief Write an offer with its name.
+/// \return Bytes written, 0 if the name is too long or nSize too small.
+//
+int ProtocolEncodeAssetOffer(const ProtocolAssetOffer* pOffer, void* pBuffer, int nSize);
+
+//
+/// \brief Decode the fixed PROTOCOL_ASSET_OFFER_SIZE bytes of an offer;
+///        the name that follows is left to the caller.
+/// \return Length of the name, or PROTOCOL_MALFORMED.
+//
+int ProtocolDecodeAssetOffer(const void* pData, ProtocolAssetOffer* pOffer);
+
+//
+/// \brief Chunk headers and replies, of fixed size.
+//
+void ProtocolEncodeAssetChunk(uint32_t uLength, uint32_t uCrc, void* pBuffer);
+void ProtocolDecodeAssetChunk(const void* pData, uint32_t* pLength, uint32_t* pCrc);
+void ProtocolEncodeAssetReply(int nStatus, int64_t nValue, void* pBuffer);
+void ProtocolDecodeAssetReply(const void* pData, int* pStatus, int64_t* pValue);
+
+//
+/// \brief CRC-32 as in zlib; pass 0 to start and the last result to
+///        continue.
+//
+uint32_t ProtocolCrc32(uint32_t uCrc, const void* pData, int nLength);
+
+#endif // PROTOCOL_H
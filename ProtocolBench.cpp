@@ -0,0 +1,264 @@
+//
+// ProtocolBench.cpp
+//
+//    Times ProtocolDecode on binary and text transforms and
+//    ProtocolEncode on binary ones, in nanoseconds per message, then
+//    decodes mutated messages: valid ones with flipped bytes, cut
+//    short, grown with random bytes or replaced by noise. Every result
+//    must be a known code and every accepted transform finite; the
+//    first violation is printed and the exit code is 1. The random
+//    sequence is fixed by the seed, so a failing case can be replayed.
+//
+//    Usage: ghost-protocol-bench [--messages N] [--mutations N] [--seed S]
+//
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "Protocol.h"
+
+#define PROTOCOL_BENCH_MESSAGES 1000000
+#define PROTOCOL_BENCH_MUTATIONS 1000000
+#define PROTOCOL_BENCH_SEED 1
+
+// Encoded messages of one format, packed back to back.
+typedef struct
+{
+   std::vector<char> bytes;
+   std::vector<int> offsets;
+   std::vector<int> lengths;
+} MessageSet;
+
+static double Seconds()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void MakeTransform(ProtocolMessage* pMessage, uint32_t uSequence)
+{
+   memset(pMessage, 0, sizeof(ProtocolMessage));
+   pMessage->type = PROTOCOL_TRANSFORM;
+   pMessage->sequence = uSequence;
+   pMessage->timestamp = 1000ull * uSequence;
+   pMessage->pitch = (float) (rand() % 36000) * 0.01f - 180.0f;
+   pMessage->yaw = (float) (rand() % 36000) * 0.01f;
+   pMessage->roll = (float) (rand() % 36000) * 0.01f - 180.0f;
+   pMessage->scale = 0.5f + (float) (rand() % 1000) * 0.001f;
+}
+
+static void AddMessage(MessageSet* pSet, const char* pData, int nLength)
+{
+   pSet->offsets.push_back((int) pSet->bytes.size());
+   pSet->lengths.push_back(nLength);
+   pSet->bytes.insert(pSet->bytes.end(), pData, pData + nLength);
+}
+
+///
+// Decode every message of a set and return ns per message. The sum
+// of the yaws keeps the compiler from dropping the work.
+//
+static double TimeDecode(const MessageSet* pSet, double* pChecksum)
+{
+   ProtocolMessage message;
+   size_t nCount = pSet->offsets.size();
+   double fSum = 0.0;
+   double fStart = Seconds();
+
+   for (size_t i = 0; i < nCount; i++)
+   {
+      if (ProtocolDecode(&pSet->bytes[pSet->offsets[i]], pSet->lengths[i], &message) == PROTOCOL_OK)
+         fSum += message.yaw;
+   }
+
+   double fElapsed = Seconds() - fStart;
+
+   *pChecksum += fSum;
+   return 1e9 * fElapsed / nCount;
+}
+
+///
+// One valid message of any type in either format.
+//
+static int MakeRandomMessage(char* pBuffer, int nSize)
+{
+   ProtocolMessage message;
+
+   MakeTransform(&message, (uint32_t) rand());
+   message.type = 1 + rand() % PROTOCOL_ACK;
+   message.model = rand() % 8;
+   message.present = message.timestamp + 16667;
+   message.flags = rand() % 4;
+   message.stats.fps = 60.0f;
+   message.stats.frameP50 = 16.7f;
+   message.stats.cpuKB = rand() % 65536;
+   message.stats.models = 2;
+
+   // Sync, stats and ack messages have no text form
+   int nLength = (rand() % 2) ? ProtocolEncodeText(&message, pBuffer, nSize) : 0;
+
+   if (nLength == 0)
+      nLength = ProtocolEncode(&message, pBuffer, nSize);
+
+   return nLength;
+}
+
+static int Mutate(char* pBuffer, int nLength, int nSize)
+{
+   switch (rand() % 4)
+   {
+   case 0:
+   {
+      // Flip one to four bytes
+      int nFlips = 1 + rand() % 4;
+
+      for (int i = 0; i < nFlips; i++)
+         pBuffer[rand() % nLength] ^= (char) (1 + rand() % 255);
+
+      return nLength;
+   }
+
+   case 1:
+      return rand() % (nLength + 1);
+
+   case 2:
+   {
+      int nGrown = nLength + 1 + rand() % (nSize - nLength);
+
+      for (int i = nLength; i < nGrown; i++)
+         pBuffer[i] = (char) rand();
+
+      return nGrown;
+   }
+
+   default:
+   {
+      int nNoise = rand() % (nSize + 1);
+
+      for (int i = 0; i < nNoise; i++)
+         pBuffer[i] = (char) rand();
+
+      // Keep the magic now and then, so the binary checks get noise too
+      if (nNoise >= 2 && rand() % 2)
+      {
+         pBuffer[0] = (char) (PROTOCOL_MAGIC & 0xff);
+         pBuffer[1] = (char) (PROTOCOL_MAGIC >> 8);
+      }
+
+      return nNoise;
+   }
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   int nMessages = PROTOCOL_BENCH_MESSAGES;
+   int nMutations = PROTOCOL_BENCH_MUTATIONS;
+   unsigned int uSeed = PROTOCOL_BENCH_SEED;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--messages") == 0 && i + 1 < argc)
+      {
+         nMessages = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--mutations") == 0 && i + 1 < argc)
+      {
+         nMutations = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+      {
+         uSeed = (unsigned int) strtoul(argv[++i], 0, 10);
+      }
+      else
+      {
+         printf("Usage: %s [--messages N] [--mutations N] [--seed S]\n", argv[0]);
+         return 0;
+      }
+   }
+
+   if (nMessages < 1)
+      nMessages = 1;
+
+   srand(uSeed);
+
+   std::vector<ProtocolMessage> transforms(nMessages);
+   MessageSet binary;
+   MessageSet text;
+
+   for (int i = 0; i < nMessages; i++)
+   {
+      char arBuffer[PROTOCOL_MAX_SIZE];
+
+      MakeTransform(&transforms[i], (uint32_t) i);
+
+      AddMessage(&binary, arBuffer, ProtocolEncode(&transforms[i], arBuffer, sizeof(arBuffer)));
+      AddMessage(&text, arBuffer, ProtocolEncodeText(&transforms[i], arBuffer, sizeof(arBuffer)));
+   }
+
+   double fChecksum = 0.0;
+   double fBinary = TimeDecode(&binary, &fChecksum);
+   double fText = TimeDecode(&text, &fChecksum);
+
+   char arEncoded[PROTOCOL_MAX_SIZE];
+   double fStart = Seconds();
+
+   for (int i = 0; i < nMessages; i++)
+   {
+      ProtocolEncode(&transforms[i], arEncoded, sizeof(arEncoded));
+      fChecksum += arEncoded[i % PROTOCOL_HEADER_SIZE];
+   }
+
+   double fEncode = 1e9 * (Seconds() - fStart) / nMessages;
+
+   printf("%d transforms, %d bytes binary, %.1f bytes text on average\n",
+      nMessages,
+      binary.lengths[0],
+      (double) text.bytes.size() / nMessages);
+   printf("decode binary %8.1f ns/message\n", fBinary);
+   printf("decode text   %8.1f ns/message (%.1fx)\n", fText, fText / fBinary);
+   printf("encode binary %8.1f ns/message\n", fEncode);
+   printf("checksum %g\n", fChecksum);
+
+   // Mutated messages
+   long arResults[4] = { 0, 0, 0, 0 };
+
+   for (int i = 0; i < nMutations; i++)
+   {
+      char arBuffer[PROTOCOL_MAX_SIZE * 2];
+      ProtocolMessage message;
+      int nLength = MakeRandomMessage(arBuffer, PROTOCOL_MAX_SIZE);
+
+      nLength = Mutate(arBuffer, nLength, sizeof(arBuffer));
+
+      int nResult = ProtocolDecode(arBuffer, nLength, &message);
+
+      if (nResult > PROTOCOL_OK || nResult < PROTOCOL_UNSUPPORTED_VERSION)
+      {
+         printf("Mutation %d: unknown result %d\n", i, nResult);
+         return 1;
+      }
+
+      if (nResult == PROTOCOL_OK &&
+          (message.type == PROTOCOL_TRANSFORM || message.type == PROTOCOL_SYNC_STATE) &&
+          !(isfinite(message.pitch) && isfinite(message.yaw) && isfinite(message.roll) && isfinite(message.scale)))
+      {
+         printf("Mutation %d: accepted a pose that is not finite\n", i);
+         return 1;
+      }
+
+      arResults[-nResult]++;
+   }
+
+   printf("%d mutations: %ld ok, %ld unknown, %ld malformed, %ld unsupported version\n",
+      nMutations, arResults[0], arResults[1], arResults[2], arResults[3]);
+
+   return 0;
+}
@@ -0,0 +1,290 @@
+//
+// ReplayTool.cpp
+//
+//    Sends a capture written by the renderer's --capture back to a
+//    renderer, to load UpdateServer the same way every run. Datagrams go
+//    out at their captured times, scaled by --speed, or as fast as the
+//    socket takes them with --speed 0; sends are paced against absolute
+//    times like the controller simulator. Each sender of the capture is
+//    replayed from --controllers sockets of its own, every one sending
+//    the whole of that sender's stream, so one captured controller can
+//    stand in for many.
+//
+//    The renderer drops binary messages whose sequence number it has
+//    already seen and reads the timestamp as the sender's clock, so
+//    unless --verbatim is given each binary message is sent with its
+//    timestamp set to the time it is sent and its sequence number moved
+//    past the previous loop and previous runs, whose ports may come
+//    round again. Reordering in the capture is kept. Text commands and
+//    anything that does not decode are sent as captured.
+//
+//    Usage: ghost-replay [--host 127.0.0.1] [--port 4000] [--speed 1]
+//                        [--controllers 1] [--loop 1] [--verbatim]
+//                        file.cap
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "Capture.h"
+#include "Protocol.h"
+
+#define REPLAY_HOST "127.0.0.1"
+#define REPLAY_PORT 4000
+#define REPLAY_MAX_SENDERS 64
+#define REPLAY_MAX_SOCKETS 1024
+
+typedef struct
+{
+   uint32_t address;
+   uint16_t port;
+   // First of this sender's sockets in arSockets
+   int first;
+} ReplaySender;
+
+static uint64_t Nanoseconds(const struct timespec* pTime)
+{
+   return (uint64_t) pTime->tv_sec * 1000000000ull + pTime->tv_nsec;
+}
+
+static int FindSender(const ReplaySender* pSenders, int nSenders, const CaptureRecord* pRecord)
+{
+   for (int i = 0; i < nSenders; i++)
+   {
+      if (pSenders[i].address == pRecord->address && pSenders[i].port == pRecord->port)
+         return i;
+   }
+
+   return -1;
+}
+
+int main(int argc, char *argv[])
+{
+   const char* pHost = REPLAY_HOST;
+   int nPort = REPLAY_PORT;
+   double fSpeed = 1.0;
+   int nControllers = 1;
+   int nLoops = 1;
+   int bVerbatim = 0;
+   const char* pPath = 0;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+      {
+         pHost = argv[++i];
+      }
+      else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      {
+         nPort = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+      {
+         fSpeed = atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--controllers") == 0 && i + 1 < argc)
+      {
+         nControllers = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc)
+      {
+         nLoops = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--verbatim") == 0)
+      {
+         bVerbatim = 1;
+      }
+      else if (argv[i][0] != '-' && pPath == 0)
+      {
+         pPath = argv[i];
+      }
+      else
+      {
+         pPath = 0;
+         break;
+      }
+   }
+
+   if (pPath == 0)
+   {
+      printf("Usage: %s [--host %s] [--port %d] [--speed 1] [--controllers 1] [--loop 1] [--verbatim] file.cap\n",
+         argv[0], REPLAY_HOST, REPLAY_PORT);
+      printf("       --speed 0 sends as fast as possible\n");
+      return 0;
+   }
+
+   if (nControllers < 1)
+      nControllers = 1;
+
+   if (nLoops < 1)
+      nLoops = 1;
+
+   struct sockaddr_in renderer;
+   memset(&renderer, 0, sizeof(renderer));
+   renderer.sin_family = AF_INET;
+   renderer.sin_port = htons(nPort);
+
+   if (inet_pton(AF_INET, pHost, &renderer.sin_addr) != 1)
+   {
+      printf("%s is not an IPv4 address.\n", pHost);
+      return 1;
+   }
+
+   CaptureFile capture;
+
+   if (!CaptureOpen(&capture, pPath))
+   {
+      printf("%s is not a capture.\n", pPath);
+      return 1;
+   }
+
+   // One pass for the senders, the length of the capture and the span
+   // of its sequence numbers
+   static CaptureRecord record;
+   ReplaySender arSenders[REPLAY_MAX_SENDERS];
+   int nSenders = 0;
+   long nRecords = 0;
+   uint64_t uDuration = 0;
+   uint32_t uSequenceSpan = 0;
+
+   while (CaptureRead(&capture, &record))
+   {
+      ProtocolMessage message;
+
+      if (FindSender(arSenders, nSenders, &record) < 0)
+      {
+         if (nSenders == REPLAY_MAX_SENDERS || (nSenders + 1) * nControllers > REPLAY_MAX_SOCKETS)
+         {
+            printf("More senders in %s than %d sockets can replay.\n", pPath, REPLAY_MAX_SOCKETS);
+            CaptureClose(&capture);
+            return 1;
+         }
+
+         arSenders[nSenders].address = record.address;
+         arSenders[nSenders].port = record.port;
+         arSenders[nSenders].first = nSenders * nControllers;
+         nSenders++;
+      }
+
+      if (ProtocolDecode(record.data, record.length, &message) == PROTOCOL_OK &&
+          message.binary && message.sequence >= uSequenceSpan)
+      {
+         uSequenceSpan = message.sequence + 1;
+      }
+
+      uDuration = record.time;
+      nRecords++;
+   }
+
+   if (nRecords == 0)
+   {
+      printf("%s holds no datagrams.\n", pPath);
+      CaptureClose(&capture);
+      return 1;
+   }
+
+   int nSockets = nSenders * nControllers;
+   static int arSockets[REPLAY_MAX_SOCKETS];
+
+   for (int i = 0; i < nSockets; i++)
+   {
+      arSockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+      if (arSockets[i] < 0)
+      {
+         printf("Failed to create socket.\n");
+         return 1;
+      }
+   }
+
+   printf("Replaying %ld datagrams over %.2f s from %d senders, %d controllers each\n",
+      nRecords, uDuration * 1e-9, nSenders, nControllers);
+
+   long nSent = 0;
+   long nFailed = 0;
+   long nRewritten = 0;
+   uint64_t uMaxLate = 0;
+   struct timespec start;
+   struct timespec end;
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   uint64_t uLoopStart = Nanoseconds(&start);
+   uint32_t uSequenceBase = (uint32_t) (uLoopStart / 1000);
+
+   for (int nLoop = 0; nLoop < nLoops; nLoop++)
+   {
+      CaptureRewind(&capture);
+
+      while (CaptureRead(&capture, &record))
+      {
+         struct timespec now;
+
+         if (fSpeed > 0.0)
+         {
+            uint64_t uDue = uLoopStart + (uint64_t) (record.time / fSpeed);
+            struct timespec due;
+
+            due.tv_sec = (time_t) (uDue / 1000000000ull);
+            due.tv_nsec = (long) (uDue % 1000000000ull);
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, 0);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            if (Nanoseconds(&now) > uDue && Nanoseconds(&now) - uDue > uMaxLate)
+               uMaxLate = Nanoseconds(&now) - uDue;
+         }
+         else
+         {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+         }
+
+         const char* pData = record.data;
+         int nLength = record.length;
+         ProtocolMessage message;
+         char arMessage[PROTOCOL_MAX_SIZE];
+
+         if (!bVerbatim &&
+             ProtocolDecode(record.data, record.length, &message) == PROTOCOL_OK &&
+             message.binary)
+         {
+            message.sequence += uSequenceBase + (uint32_t) nLoop * uSequenceSpan;
+            message.timestamp = Nanoseconds(&now) / 1000;
+
+            nLength = ProtocolEncode(&message, arMessage, sizeof(arMessage));
+            pData = arMessage;
+            nRewritten++;
+         }
+
+         const ReplaySender* pSender = &arSenders[FindSender(arSenders, nSenders, &record)];
+
+         for (int i = 0; i < nControllers; i++)
+         {
+            if (sendto(arSockets[pSender->first + i], pData, nLength, 0, (struct sockaddr*) &renderer, sizeof(renderer)) == nLength)
+               nSent++;
+            else
+               nFailed++;
+         }
+      }
+
+      // The next loop starts one capture length after this one
+      uLoopStart += (fSpeed > 0.0) ? (uint64_t) (uDuration / fSpeed) : 0;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   double fElapsed = (Nanoseconds(&end) - Nanoseconds(&start)) * 1e-9;
+
+   printf("Sent %ld datagrams in %.2f s (%.1f Hz), %ld failed, %ld rewritten, %.3f ms late at most\n",
+      nSent, fElapsed, nSent / fElapsed, nFailed, nRewritten * nControllers, uMaxLate * 1e-6);
+
+   for (int i = 0; i < nSockets; i++)
+      close(arSockets[i]);
+
+   CaptureClose(&capture);
+   return nFailed > 0;
+}
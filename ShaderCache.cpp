@@ -0,0 +1,216 @@
+//
+// ShaderCache.cpp
+//
+//    Program binary cache on top of GL_OES_get_program_binary. Each
+//    binary is stored in its own file named after a hash of the shader
+//    sources and the driver strings. The file holds the binary format
+//    followed by the binary itself.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "ShaderCache.h"
+
+#define SHADER_CACHE_PATH_SIZE 512
+
+// A slash, 16 hex digits and ".bin" follow the directory in a path.
+#define SHADER_CACHE_NAME_SIZE 21
+
+static PFNGLGETPROGRAMBINARYOESPROC s_pGetProgramBinary = 0;
+static PFNGLPROGRAMBINARYOESPROC s_pProgramBinary = 0;
+static char s_arDirectory[SHADER_CACHE_PATH_SIZE - SHADER_CACHE_NAME_SIZE];
+static int s_nHits = 0;
+static int s_nMisses = 0;
+
+///
+// 64 bit FNV-1a, continued from a previous hash value.
+//
+static unsigned long long HashString(unsigned long long hash, const char* pStr)
+{
+	if (pStr == 0)
+		return hash;
+
+	while (*pStr != 0)
+	{
+		hash ^= (unsigned char) *pStr++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	// Separate consecutive strings
+	hash ^= 0xff;
+	hash *= 0x100000001b3ULL;
+
+	return hash;
+}
+
+static void GetCachePath(const char* pVertSrc, const char* pFragSrc, char* pPath)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+
+	hash = HashString(hash, pVertSrc);
+	hash = HashString(hash, pFragSrc);
+	hash = HashString(hash, (const char*) glGetString(GL_RENDERER));
+	hash = HashString(hash, (const char*) glGetString(GL_VERSION));
+
+	snprintf(pPath, SHADER_CACHE_PATH_SIZE, "%s/%016llx.bin", s_arDirectory, hash);
+}
+
+int InitShaderCache(const char* pDirectory)
+{
+	const char* pExtensions = (const char*) glGetString(GL_EXTENSIONS);
+
+	s_pGetProgramBinary = 0;
+	s_pProgramBinary = 0;
+
+	if (pExtensions == 0 ||
+	    strstr(pExtensions, "GL_OES_get_program_binary") == 0)
+	{
+		printf("Program binaries not supported, shaders compile from source.\n");
+		return 0;
+	}
+
+	GLint nNumFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &nNumFormats);
+
+	if (nNumFormats == 0)
+	{
+		printf("Driver has no program binary formats.\n");
+		return 0;
+	}
+
+	s_pGetProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinaryOES");
+	s_pProgramBinary = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinaryOES");
+
+	if (s_pGetProgramBinary == 0 || s_pProgramBinary == 0)
+	{
+		s_pGetProgramBinary = 0;
+		s_pProgramBinary = 0;
+		return 0;
+	}
+
+	strncpy(s_arDirectory, pDirectory, sizeof(s_arDirectory) - 1);
+	s_arDirectory[sizeof(s_arDirectory) - 1] = 0;
+	mkdir(s_arDirectory, 0755);
+
+	return 1;
+}
+
+///
+// The program cached for a source pair, or 0 if there is none or the
+// driver rejects it.
+//
+static GLuint LoadBinary(const char* pVertSrc, const char* pFragSrc)
+{
+	char arPath[SHADER_CACHE_PATH_SIZE];
+	FILE* pFile = 0;
+	GLenum binaryFormat = 0;
+	long nSize = 0;
+
+	if (s_pProgramBinary == 0)
+		return 0;
+
+	GetCachePath(pVertSrc, pFragSrc, arPath);
+
+	pFile = fopen(arPath, "rb");
+	if (pFile == 0)
+		return 0;
+
+	fseek(pFile, 0, SEEK_END);
+	nSize = ftell(pFile) - (long) sizeof(GLenum);
+	fseek(pFile, 0, SEEK_SET);
+
+	if (nSize <= 0 ||
+	    fread(&binaryFormat, sizeof(GLenum), 1, pFile) != 1)
+	{
+		fclose(pFile);
+		return 0;
+	}
+
+	char* pBinary = (char*) malloc(nSize);
+
+	if (fread(pBinary, nSize, 1, pFile) != 1)
+	{
+		free(pBinary);
+		fclose(pFile);
+		return 0;
+	}
+
+	fclose(pFile);
+
+	GLuint program = glCreateProgram();
+	GLint linked = 0;
+
+	s_pProgramBinary(program, binaryFormat, pBinary, (GLint) nSize);
+	free(pBinary);
+
+	// The driver may reject binaries it no longer understands
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+	if (!linked)
+	{
+		glDeleteProgram(program);
+		remove(arPath);
+		return 0;
+	}
+
+	return program;
+}
+
+GLuint LoadCachedProgram(const char* pVertSrc, const char* pFragSrc)
+{
+	GLuint program = LoadBinary(pVertSrc, pFragSrc);
+
+	if (program != 0)
+		s_nHits++;
+	else
+		s_nMisses++;
+
+	return program;
+}
+
+void GetShaderCacheStats(int* pHits, int* pMisses)
+{
+	*pHits = s_nHits;
+	*pMisses = s_nMisses;
+}
+
+void SaveProgramBinary(GLuint program, const char* pVertSrc, const char* pFragSrc)
+{
+	char arPath[SHADER_CACHE_PATH_SIZE];
+	GLint nLength = 0;
+	GLsizei nWritten = 0;
+	GLenum binaryFormat = 0;
+
+	if (s_pGetProgramBinary == 0 || program == 0)
+		return;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &nLength);
+
+	if (nLength <= 0)
+		return;
+
+	char* pBinary = (char*) malloc(nLength);
+	s_pGetProgramBinary(program, nLength, &nWritten, &binaryFormat, pBinary);
+
+	if (nWritten > 0)
+	{
+		GetCachePath(pVertSrc, pFragSrc, arPath);
+
+		FILE* pFile = fopen(arPath, "wb");
+		if (pFile != 0)
+		{
+			fwrite(&binaryFormat, sizeof(GLenum), 1, pFile);
+			fwrite(pBinary, nWritten, 1, pFile);
+			fclose(pFile);
+		}
+	}
+
+	free(pBinary);
+}
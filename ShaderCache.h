@@ -0,0 +1,39 @@
+//
+/// \file ShaderCache.h
+/// \brief Caches linked program binaries on disk through
+///        GL_OES_get_program_binary, so shaders are only compiled from
+///        source the first time a driver sees them.
+//
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <GLES2/gl2.h>
+
+//
+/// \brief Check for GL_OES_get_program_binary and prepare the cache directory.
+///        Must be called with a current context.
+/// \param pDirectory Directory the binaries are stored in
+/// \return 1 if binaries can be cached, 0 if every program has to be compiled
+//
+int InitShaderCache(const char* pDirectory);
+
+//
+/// \brief Create a program from a cached binary for this source pair.
+///        The cache key covers both sources and the driver's renderer
+///        and version strings, so a driver update invalidates it.
+/// \return A linked program object, or 0 if there is no usable binary
+//
+GLuint LoadCachedProgram(const char* pVertSrc, const char* pFragSrc);
+
+//
+/// \brief Programs LoadCachedProgram returned, and lookups that found
+///        no usable binary, since startup.
+//
+void GetShaderCacheStats(int* pHits, int* pMisses);
+
+//
+/// \brief Store the binary of a linked program under the key of its sources.
+//
+void SaveProgramBinary(GLuint program, const char* pVertSrc, const char* pFragSrc);
+
+#endif // SHADERCACHE_H
@@ -0,0 +1,634 @@
+//
+// SoftRaster.cpp
+//
+//    Software rasterizer. SoftDrawTriangles transforms vertices, clips
+//    against the near plane, culls and sets up each triangle for
+//    perspective correct interpolation, then appends it to the list of
+//    every tile its bounds touch. SoftFinish hands tiles out to workers
+//    through an atomic counter; a tile is only ever touched by one
+//    worker, so the color and depth buffers need no locking, and
+//    triangles are drawn in submission order within each tile. The
+//    workers are started with the target and sleep between frames.
+//
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "esUtil.h"
+#include "SoftRaster.h"
+#include "Trace.h"
+#include "Memory.h"
+
+// Texcoords plus up to three lighting values per vertex.
+#define SOFT_MAX_ATTRIBS 5
+
+// Triangles can gain one vertex from the near plane.
+#define SOFT_MAX_CLIP_VERTS 4
+
+typedef struct
+{
+   float clip[4];
+   float attribs[SOFT_MAX_ATTRIBS];
+} ClipVertex;
+
+typedef struct
+{
+   // Edge functions A * x + B * y + C, scaled so they sum to 1
+   float edgeA[3];
+   float edgeB[3];
+   float edgeC[3];
+
+   // Depth, 1 / w and attributes / w as planes over the screen
+   float depth[3];
+   float invW[3];
+   float attribs[SOFT_MAX_ATTRIBS][3];
+
+   // Pixel bounds, already clamped to the viewport
+   int minX;
+   int minY;
+   int maxX;
+   int maxY;
+
+   const SoftTexture* pTexture;
+   int lighting;
+} SoftTriangle;
+
+struct SoftBins
+{
+   std::vector<SoftTriangle> triangles;
+   std::vector< std::vector<int> > tiles;
+};
+
+struct SoftWorkers
+{
+   std::vector<std::thread> threads;
+   std::mutex mutex;
+   std::condition_variable start;
+   std::condition_variable done;
+
+   // Bumped by SoftFinish for each frame the workers rasterize
+   unsigned int frame;
+   // Workers still rasterizing the current frame
+   int busy;
+   int stopping;
+
+   std::atomic<int> nextTile;
+};
+
+static void WorkerThread(SoftTarget* pTarget);
+static void RasterizeTiles(SoftTarget* pTarget, std::atomic<int>* pNextTile);
+
+static const float s_arLightDir[3] = { 0.57735f, 0.57735f, 0.57735f };
+
+int CreateSoftTarget(SoftTarget* pTarget, int nWidth, int nHeight, int nThreads)
+{
+   memset(pTarget, 0, sizeof(SoftTarget));
+
+   if (nWidth <= 0 || nHeight <= 0)
+      return 0;
+
+   if (nThreads <= 0)
+      nThreads = (int) std::thread::hardware_concurrency();
+   if (nThreads <= 0)
+      nThreads = 1;
+
+   pTarget->width = nWidth;
+   pTarget->height = nHeight;
+   pTarget->numThreads = nThreads;
+   pTarget->tilesX = (nWidth + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+   pTarget->tilesY = (nHeight + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+   pTarget->pColor = new unsigned char[nWidth * nHeight * 4];
+   pTarget->pDepth = new float[nWidth * nHeight];
+
+   ScopedMemoryAsset asset("soft target");
+   MemoryTrack(MEMORY_HEAP, (uintptr_t) pTarget->pColor, nWidth * nHeight * 4);
+   MemoryTrack(MEMORY_HEAP, (uintptr_t) pTarget->pDepth, nWidth * nHeight * sizeof(float));
+
+   pTarget->pBins = new SoftBins;
+   pTarget->pBins->tiles.resize(pTarget->tilesX * pTarget->tilesY);
+
+   SoftWorkers* pWorkers = new SoftWorkers;
+   pWorkers->frame = 0;
+   pWorkers->busy = 0;
+   pWorkers->stopping = 0;
+   pTarget->pWorkers = pWorkers;
+
+   // The thread calling SoftFinish is one of the workers
+   for (int i = 1; i < nThreads; i++)
+   {
+      pWorkers->threads.push_back(std::thread(WorkerThread, pTarget));
+   }
+
+   SoftClear(pTarget);
+   SoftFinish(pTarget);
+
+   return 1;
+}
+
+void DestroySoftTarget(SoftTarget* pTarget)
+{
+   SoftWorkers* pWorkers = pTarget->pWorkers;
+
+   if (pWorkers != 0)
+   {
+      {
+         std::lock_guard<std::mutex> lock(pWorkers->mutex);
+         pWorkers->stopping = 1;
+      }
+
+      pWorkers->start.notify_all();
+
+      for (size_t i = 0; i < pWorkers->threads.size(); i++)
+      {
+         pWorkers->threads[i].join();
+      }
+
+      delete pWorkers;
+   }
+
+   MemoryRelease(MEMORY_HEAP, (uintptr_t) pTarget->pColor);
+   MemoryRelease(MEMORY_HEAP, (uintptr_t) pTarget->pDepth);
+
+   delete[] pTarget->pColor;
+   delete[] pTarget->pDepth;
+   delete pTarget->pBins;
+
+   memset(pTarget, 0, sizeof(SoftTarget));
+}
+
+void SoftClear(SoftTarget* pTarget)
+{
+   pTarget->clearPending = 1;
+}
+
+///
+// Clip a polygon against the near plane, z >= -w in clip space.
+//
+static int ClipNear(const ClipVertex* pIn, int nIn, ClipVertex* pOut)
+{
+   int nOut = 0;
+
+   for (int i = 0; i < nIn; i++)
+   {
+      const ClipVertex* pA = &pIn[i];
+      const ClipVertex* pB = &pIn[(i + 1) % nIn];
+      float fDistA = pA->clip[2] + pA->clip[3];
+      float fDistB = pB->clip[2] + pB->clip[3];
+
+      if (fDistA >= 0.0f)
+      {
+         pOut[nOut++] = *pA;
+      }
+
+      if ((fDistA >= 0.0f) != (fDistB >= 0.0f))
+      {
+         float t = fDistA / (fDistA - fDistB);
+         ClipVertex* pNew = &pOut[nOut++];
+
+         for (int k = 0; k < 4; k++)
+            pNew->clip[k] = pA->clip[k] + (pB->clip[k] - pA->clip[k]) * t;
+         for (int k = 0; k < SOFT_MAX_ATTRIBS; k++)
+            pNew->attribs[k] = pA->attribs[k] + (pB->attribs[k] - pA->attribs[k]) * t;
+      }
+   }
+
+   return nOut;
+}
+
+///
+// Project a clipped triangle to the window, cull it and bin it.
+//
+static void SetupTriangle(SoftTarget* pTarget,
+   const SoftDraw* pDraw,
+   const ClipVertex* pV0,
+   const ClipVertex* pV1,
+   const ClipVertex* pV2)
+{
+   const ClipVertex* arVerts[3] = { pV0, pV1, pV2 };
+   const int* pViewport = pDraw->viewport;
+   float arX[3];
+   float arY[3];
+   float arZ[3];
+   float arInvW[3];
+
+   for (int i = 0; i < 3; i++)
+   {
+      const float* pClip = arVerts[i]->clip;
+
+      arInvW[i] = 1.0f / pClip[3];
+      arX[i] = pViewport[0] + (pClip[0] * arInvW[i] + 1.0f) * 0.5f * pViewport[2];
+      arY[i] = pViewport[1] + (pClip[1] * arInvW[i] + 1.0f) * 0.5f * pViewport[3];
+      arZ[i] = (pClip[2] * arInvW[i] + 1.0f) * 0.5f;
+   }
+
+   // Counter clockwise on screen is positive, as in GL window space
+   float fArea = (arX[1] - arX[0]) * (arY[2] - arY[0]) - (arX[2] - arX[0]) * (arY[1] - arY[0]);
+
+   if (fArea == 0.0f)
+      return;
+
+   if (pDraw->cullBackFaces)
+   {
+      int bFront = pDraw->frontFaceCW ? (fArea < 0.0f) : (fArea > 0.0f);
+
+      if (!bFront)
+         return;
+   }
+
+   float fMinX = fminf(arX[0], fminf(arX[1], arX[2]));
+   float fMaxX = fmaxf(arX[0], fmaxf(arX[1], arX[2]));
+   float fMinY = fminf(arY[0], fminf(arY[1], arY[2]));
+   float fMaxY = fmaxf(arY[0], fmaxf(arY[1], arY[2]));
+
+   // Pixel centers at +0.5 inside the bounds, clamped to the viewport
+   int nMinX = (int) fmaxf(ceilf(fMinX - 0.5f), (float) pViewport[0]);
+   int nMinY = (int) fmaxf(ceilf(fMinY - 0.5f), (float) pViewport[1]);
+   int nMaxX = (int) fminf(floorf(fMaxX - 0.5f), (float) (pViewport[0] + pViewport[2] - 1));
+   int nMaxY = (int) fminf(floorf(fMaxY - 0.5f), (float) (pViewport[1] + pViewport[3] - 1));
+
+   if (nMinX < 0)
+      nMinX = 0;
+   if (nMinY < 0)
+      nMinY = 0;
+   if (nMaxX > pTarget->width - 1)
+      nMaxX = pTarget->width - 1;
+   if (nMaxY > pTarget->height - 1)
+      nMaxY = pTarget->height - 1;
+
+   if (nMinX > nMaxX || nMinY > nMaxY)
+      return;
+
+   SoftTriangle tri;
+   float fInvArea = 1.0f / fArea;
+
+   // Edge i is opposite vertex i, so it is that vertex's barycentric
+   for (int i = 0; i < 3; i++)
+   {
+      int a = (i + 1) % 3;
+      int b = (i + 2) % 3;
+
+      tri.edgeA[i] = (arY[a] - arY[b]) * fInvArea;
+      tri.edgeB[i] = (arX[b] - arX[a]) * fInvArea;
+      tri.edgeC[i] = (arX[a] * arY[b] - arX[b] * arY[a]) * fInvArea;
+      tri.depth[i] = arZ[i];
+      tri.invW[i] = arInvW[i];
+
+      for (int k = 0; k < SOFT_MAX_ATTRIBS; k++)
+         tri.attribs[k][i] = arVerts[i]->attribs[k] * arInvW[i];
+   }
+
+   tri.minX = nMinX;
+   tri.minY = nMinY;
+   tri.maxX = nMaxX;
+   tri.maxY = nMaxY;
+   tri.pTexture = pDraw->pTexture;
+   tri.lighting = pDraw->lighting;
+
+   SoftBins* pBins = pTarget->pBins;
+   int nIndex = (int) pBins->triangles.size();
+   pBins->triangles.push_back(tri);
+
+   for (int ty = nMinY / SOFT_TILE_SIZE; ty <= nMaxY / SOFT_TILE_SIZE; ty++)
+   {
+      for (int tx = nMinX / SOFT_TILE_SIZE; tx <= nMaxX / SOFT_TILE_SIZE; tx++)
+      {
+         pBins->tiles[ty * pTarget->tilesX + tx].push_back(nIndex);
+      }
+   }
+}
+
+void SoftDrawTriangles(SoftTarget* pTarget, const SoftDraw* pDraw)
+{
+   ScopedTrace trace("SoftBin");
+
+   const float* m = pDraw->pMVPMatrix;
+   const float* n = pDraw->pNormalMatrix;
+
+   for (int f = 0; f < pDraw->numFaces; f++)
+   {
+      ClipVertex arIn[3];
+      ClipVertex arClipped[SOFT_MAX_CLIP_VERTS];
+
+      for (int i = 0; i < 3; i++)
+      {
+         int nVertex = f * 3 + i;
+         const float* pSrc = &pDraw->pVertexBuffer[nVertex * 8];
+         ClipVertex* pDst = &arIn[i];
+
+         for (int j = 0; j < 4; j++)
+         {
+            pDst->clip[j] = pSrc[0] * m[0 * 4 + j] +
+                            pSrc[1] * m[1 * 4 + j] +
+                            pSrc[2] * m[2 * 4 + j] +
+                            m[3 * 4 + j];
+         }
+
+         pDst->attribs[0] = pSrc[3];
+         pDst->attribs[1] = pSrc[4];
+         pDst->attribs[2] = 0.0f;
+         pDst->attribs[3] = 0.0f;
+         pDst->attribs[4] = 0.0f;
+
+         if (pDraw->lighting == SOFT_LIGHT_PIXEL || pDraw->lighting == SOFT_LIGHT_VERTEX)
+         {
+            float arNormal[3];
+
+            for (int j = 0; j < 3; j++)
+            {
+               arNormal[j] = pSrc[5] * n[0 * 4 + j] +
+                             pSrc[6] * n[1 * 4 + j] +
+                             pSrc[7] * n[2 * 4 + j];
+            }
+
+            if (pDraw->lighting == SOFT_LIGHT_PIXEL)
+            {
+               memcpy(&pDst->attribs[2], arNormal, sizeof(arNormal));
+            }
+            else
+            {
+               pDst->attribs[2] = fmaxf(arNormal[0] * s_arLightDir[0] +
+                                        arNormal[1] * s_arLightDir[1] +
+                                        arNormal[2] * s_arLightDir[2], 0.0f);
+            }
+         }
+         else if (pDraw->lighting == SOFT_LIGHT_BAKED)
+         {
+            const unsigned char* pColor = &pDraw->pColors[nVertex * 4];
+
+            pDst->attribs[2] = pColor[0] / 255.0f;
+            pDst->attribs[3] = pColor[1] / 255.0f;
+            pDst->attribs[4] = pColor[2] / 255.0f;
+         }
+      }
+
+      int nClipped = ClipNear(arIn, 3, arClipped);
+
+      // Fan out whatever is left of the triangle
+      for (int i = 1; i + 1 < nClipped; i++)
+      {
+         SetupTriangle(pTarget, pDraw, &arClipped[0], &arClipped[i], &arClipped[i + 1]);
+      }
+   }
+}
+
+///
+// Bilinear, repeating lookup like GL_LINEAR with GL_REPEAT.
+//
+static void SampleTexture(const SoftTexture* pTexture, float u, float v, float* pColor)
+{
+   float fX = u * pTexture->width - 0.5f;
+   float fY = v * pTexture->height - 0.5f;
+   float fFloorX = floorf(fX);
+   float fFloorY = floorf(fY);
+   float fFracX = fX - fFloorX;
+   float fFracY = fY - fFloorY;
+
+   int x0 = (int) fFloorX % pTexture->width;
+   int y0 = (int) fFloorY % pTexture->height;
+
+   if (x0 < 0)
+      x0 += pTexture->width;
+   if (y0 < 0)
+      y0 += pTexture->height;
+
+   int x1 = (x0 + 1) % pTexture->width;
+   int y1 = (y0 + 1) % pTexture->height;
+
+   const unsigned char* p00 = &pTexture->pData[(y0 * pTexture->width + x0) * 3];
+   const unsigned char* p10 = &pTexture->pData[(y0 * pTexture->width + x1) * 3];
+   const unsigned char* p01 = &pTexture->pData[(y1 * pTexture->width + x0) * 3];
+   const unsigned char* p11 = &pTexture->pData[(y1 * pTexture->width + x1) * 3];
+
+   for (int c = 0; c < 3; c++)
+   {
+      float fTop = p00[c] + (p10[c] - p00[c]) * fFracX;
+      float fBottom = p01[c] + (p11[c] - p01[c]) * fFracX;
+
+      pColor[c] = (fTop + (fBottom - fTop) * fFracY) * (1.0f / 255.0f);
+   }
+}
+
+///
+// Opaque black and far depth, like glClearColor(0, 0, 0, 1) and glClear.
+//
+static void ClearTile(SoftTarget* pTarget, int nMinX, int nMinY, int nMaxX, int nMaxY)
+{
+   for (int y = nMinY; y <= nMaxY; y++)
+   {
+      int nRow = y * pTarget->width;
+
+      for (int x = nMinX; x <= nMaxX; x++)
+      {
+         unsigned char* pColor = &pTarget->pColor[(nRow + x) * 4];
+
+         pColor[0] = 0;
+         pColor[1] = 0;
+         pColor[2] = 0;
+         pColor[3] = 255;
+         pTarget->pDepth[nRow + x] = 1.0f;
+      }
+   }
+}
+
+static void RasterizeTile(SoftTarget* pTarget, int nTile)
+{
+   const SoftBins* pBins = pTarget->pBins;
+   const std::vector<int>& tile = pBins->tiles[nTile];
+   int nTileMinX = (nTile % pTarget->tilesX) * SOFT_TILE_SIZE;
+   int nTileMinY = (nTile / pTarget->tilesX) * SOFT_TILE_SIZE;
+   int nTileMaxX = nTileMinX + SOFT_TILE_SIZE - 1;
+   int nTileMaxY = nTileMinY + SOFT_TILE_SIZE - 1;
+
+   if (nTileMaxX > pTarget->width - 1)
+      nTileMaxX = pTarget->width - 1;
+   if (nTileMaxY > pTarget->height - 1)
+      nTileMaxY = pTarget->height - 1;
+
+   if (pTarget->clearPending)
+   {
+      ClearTile(pTarget, nTileMinX, nTileMinY, nTileMaxX, nTileMaxY);
+   }
+
+   for (size_t t = 0; t < tile.size(); t++)
+   {
+      const SoftTriangle* pTri = &pBins->triangles[tile[t]];
+      int nMinX = (pTri->minX > nTileMinX) ? pTri->minX : nTileMinX;
+      int nMinY = (pTri->minY > nTileMinY) ? pTri->minY : nTileMinY;
+      int nMaxX = (pTri->maxX < nTileMaxX) ? pTri->maxX : nTileMaxX;
+      int nMaxY = (pTri->maxY < nTileMaxY) ? pTri->maxY : nTileMaxY;
+
+      for (int y = nMinY; y <= nMaxY; y++)
+      {
+         float fY = y + 0.5f;
+         int nRow = y * pTarget->width;
+
+         for (int x = nMinX; x <= nMaxX; x++)
+         {
+            float fX = x + 0.5f;
+            float l0 = pTri->edgeA[0] * fX + pTri->edgeB[0] * fY + pTri->edgeC[0];
+            float l1 = pTri->edgeA[1] * fX + pTri->edgeB[1] * fY + pTri->edgeC[1];
+            float l2 = pTri->edgeA[2] * fX + pTri->edgeB[2] * fY + pTri->edgeC[2];
+
+            if (l0 < 0.0f || l1 < 0.0f || l2 < 0.0f)
+               continue;
+
+            float fDepth = l0 * pTri->depth[0] + l1 * pTri->depth[1] + l2 * pTri->depth[2];
+            float* pDepth = &pTarget->pDepth[nRow + x];
+
+            if (fDepth >= *pDepth)
+               continue;
+
+            *pDepth = fDepth;
+
+            // Undo the divide by w for perspective correct attributes
+            float w = 1.0f / (l0 * pTri->invW[0] + l1 * pTri->invW[1] + l2 * pTri->invW[2]);
+            float arAttribs[SOFT_MAX_ATTRIBS];
+
+            for (int k = 0; k < SOFT_MAX_ATTRIBS; k++)
+            {
+               arAttribs[k] = (l0 * pTri->attribs[k][0] +
+                               l1 * pTri->attribs[k][1] +
+                               l2 * pTri->attribs[k][2]) * w;
+            }
+
+            float arColor[3] = { 1.0f, 1.0f, 1.0f };
+
+            if (pTri->pTexture != 0)
+            {
+               SampleTexture(pTri->pTexture, arAttribs[0], arAttribs[1], arColor);
+            }
+
+            switch (pTri->lighting)
+            {
+            case SOFT_LIGHT_PIXEL:
+            {
+               float fDiffuse = fmaxf(arAttribs[2] * s_arLightDir[0] +
+                                      arAttribs[3] * s_arLightDir[1] +
+                                      arAttribs[4] * s_arLightDir[2], 0.0f);
+
+               arColor[0] *= fDiffuse;
+               arColor[1] *= fDiffuse;
+               arColor[2] *= fDiffuse;
+               break;
+            }
+            case SOFT_LIGHT_VERTEX:
+               arColor[0] *= arAttribs[2];
+               arColor[1] *= arAttribs[2];
+               arColor[2] *= arAttribs[2];
+               break;
+            case SOFT_LIGHT_BAKED:
+               arColor[0] *= arAttribs[2];
+               arColor[1] *= arAttribs[3];
+               arColor[2] *= arAttribs[4];
+               break;
+            }
+
+            unsigned char* pDst = &pTarget->pColor[(nRow + x) * 4];
+
+            for (int c = 0; c < 3; c++)
+            {
+               float fValue = fminf(fmaxf(arColor[c], 0.0f), 1.0f);
+               pDst[c] = (unsigned char) (fValue * 255.0f + 0.5f);
+            }
+
+            pDst[3] = 255;
+         }
+      }
+   }
+}
+
+static void RasterizeTiles(SoftTarget* pTarget, std::atomic<int>* pNextTile)
+{
+   int nNumTiles = pTarget->tilesX * pTarget->tilesY;
+
+   for (;;)
+   {
+      int nTile = pNextTile->fetch_add(1);
+
+      if (nTile >= nNumTiles)
+         break;
+
+      RasterizeTile(pTarget, nTile);
+   }
+}
+
+///
+// Body of the pool threads: rasterize tiles each time SoftFinish starts
+// a frame, until the target is destroyed.
+//
+static void WorkerThread(SoftTarget* pTarget)
+{
+   SoftWorkers* pWorkers = pTarget->pWorkers;
+   unsigned int uFrame = 0;
+
+   for (;;)
+   {
+      {
+         std::unique_lock<std::mutex> lock(pWorkers->mutex);
+         pWorkers->start.wait(lock, [&] { return pWorkers->stopping || pWorkers->frame != uFrame; });
+
+         if (pWorkers->stopping)
+            return;
+
+         uFrame = pWorkers->frame;
+      }
+
+      RasterizeTiles(pTarget, &pWorkers->nextTile);
+
+      // Taking the lock also publishes this worker's tiles to SoftFinish
+      std::lock_guard<std::mutex> lock(pWorkers->mutex);
+
+      if (--pWorkers->busy == 0)
+         pWorkers->done.notify_one();
+   }
+}
+
+void SoftFinish(SoftTarget* pTarget)
+{
+   ScopedTrace trace("SoftRasterize");
+
+   SoftWorkers* pWorkers = pTarget->pWorkers;
+
+   {
+      std::lock_guard<std::mutex> lock(pWorkers->mutex);
+      pWorkers->nextTile = 0;
+      pWorkers->busy = (int) pWorkers->threads.size();
+      pWorkers->frame++;
+   }
+
+   pWorkers->start.notify_all();
+
+   RasterizeTiles(pTarget, &pWorkers->nextTile);
+
+   {
+      std::unique_lock<std::mutex> lock(pWorkers->mutex);
+      pWorkers->done.wait(lock, [&] { return pWorkers->busy == 0; });
+   }
+
+   SoftBins* pBins = pTarget->pBins;
+   pBins->triangles.clear();
+
+   for (size_t i = 0; i < pBins->tiles.size(); i++)
+   {
+      pBins->tiles[i].clear();
+   }
+
+   pTarget->clearPending = 0;
+}
+
+int SoftWritePPM(const SoftTarget* pTarget, const char* pPath)
+{
+   if (!esWritePPM(pPath, pTarget->pColor, pTarget->width, pTarget->height))
+   {
+      printf("Could not write %s\n", pPath);
+      return 0;
+   }
+
+   return 1;
+}
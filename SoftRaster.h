@@ -0,0 +1,109 @@
+//
+/// \file SoftRaster.h
+/// \brief Tile binned, multithreaded software rasterizer. Draws the same
+///        interleaved vertex buffers as the GL path, with perspective
+///        correct texturing, a depth test and the renderer's lighting,
+///        so the pipeline can run on machines without a GPU.
+//
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+// Size of the square screen tiles the workers own.
+#define SOFT_TILE_SIZE 64
+
+// Where diffuse lighting is computed, as in the shader variants.
+#define SOFT_LIGHT_NONE 0
+#define SOFT_LIGHT_PIXEL 1
+#define SOFT_LIGHT_VERTEX 2
+#define SOFT_LIGHT_BAKED 3
+
+struct SoftBins;
+struct SoftWorkers;
+
+typedef struct
+{
+   int width;
+   int height;
+
+   // RGB texels, first row at v = 0 like glTexImage2D
+   const unsigned char* pData;
+} SoftTexture;
+
+typedef struct
+{
+   // Transforms in esTransform layout, applied as mat * vec in the shaders
+   const float* pMVPMatrix;
+   const float* pNormalMatrix;
+
+   // Interleaved position/texcoord/normal, 8 floats per vertex
+   const float* pVertexBuffer;
+   int numFaces;
+
+   // RGBA per vertex, only read for SOFT_LIGHT_BAKED
+   const unsigned char* pColors;
+
+   // Null draws white
+   const SoftTexture* pTexture;
+
+   int lighting;
+   int cullBackFaces;
+   int frontFaceCW;
+
+   // x, y, width, height in pixels, bottom left origin
+   int viewport[4];
+} SoftDraw;
+
+typedef struct
+{
+   int width;
+   int height;
+   int numThreads;
+
+   // RGBA8 and depth, bottom row first like glReadPixels
+   unsigned char* pColor;
+   float* pDepth;
+
+   int tilesX;
+   int tilesY;
+   int clearPending;
+
+   SoftBins* pBins;
+   SoftWorkers* pWorkers;
+} SoftTarget;
+
+//
+/// \brief Allocate the buffers and tile bins of a target and start its
+///        workers, which live until DestroySoftTarget. The target must
+///        not be moved while they run.
+/// \param nThreads Workers used by SoftFinish, 0 for one per hardware thread
+/// \return 1 on success, 0 on failure
+//
+int CreateSoftTarget(SoftTarget* pTarget, int nWidth, int nHeight, int nThreads);
+
+void DestroySoftTarget(SoftTarget* pTarget);
+
+//
+/// \brief Clear color to black and depth to 1. Deferred to SoftFinish,
+///        where every tile clears itself.
+//
+void SoftClear(SoftTarget* pTarget);
+
+//
+/// \brief Transform, clip and cull the triangles of a draw and bin them
+///        into the tiles they touch. Runs on the calling thread.
+//
+void SoftDrawTriangles(SoftTarget* pTarget, const SoftDraw* pDraw);
+
+//
+/// \brief Rasterize everything binned since the last call, one tile at a
+///        time per worker, and empty the bins.
+//
+void SoftFinish(SoftTarget* pTarget);
+
+//
+/// \brief Write the color buffer as a binary PPM, top row first.
+/// \return 1 on success, 0 on failure
+//
+int SoftWritePPM(const SoftTarget* pTarget, const char* pPath);
+
+#endif // SOFTRASTER_H
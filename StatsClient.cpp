@@ -0,0 +1,229 @@
+//
+// StatsClient.cpp
+//
+//    Polls renderers for their health over the control port and prints
+//    one line per renderer: FPS and frame time percentiles of the last
+//    stats interval, load, the latency of the newest command, p50 and
+//    p99 of transforms from socket to screen, memory, the command
+//    queue, asset pushes in progress and the shader cache hit rate.
+//    Every renderer is sent a binary stats query at once and
+//    the answers are matched by sequence number, so a slow or missing
+//    renderer only costs the timeout. With --interval it keeps polling.
+//
+//    Usage: ghost-stats [--port 4000] [--timeout 500] [--interval s]
+//                       [--count n] host...
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "Protocol.h"
+
+#define STATS_PORT 4000
+#define STATS_TIMEOUT_MS 500
+#define STATS_MAX_HOSTS 64
+
+static uint64_t NowMicroseconds()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint64_t) now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+static void PrintHeader()
+{
+   printf("%-16s %6s %8s %8s %8s %8s %5s %8s %8s %8s %8s %8s %5s %6s %7s %7s\n",
+      "host", "fps", "p50 ms", "p95 ms", "p99 ms", "max ms", "load", "cmd ms",
+      "in p50", "in p99", "cpu MB", "gpu MB", "queue", "push", "shaders", "rtt ms");
+}
+
+static void PrintStats(const char* pHost, const ProtocolStats* pStats, uint64_t uRoundTrip)
+{
+   char arPush[16];
+   int nLookups = pStats->shaderHits + pStats->shaderMisses;
+
+   if (pStats->pushing)
+      snprintf(arPush, sizeof(arPush), "%u%%", (unsigned int) pStats->pushProgress);
+   else
+      snprintf(arPush, sizeof(arPush), "-");
+
+   // A parsed asset waiting for the render thread
+   if (pStats->assetsWaiting)
+      snprintf(arPush + strlen(arPush), sizeof(arPush) - strlen(arPush), "+%u", (unsigned int) pStats->assetsWaiting);
+
+   printf("%-16s %6.1f %8.3f %8.3f %8.3f %8.3f %5.2f %8.3f %8.3f %8.3f %8.1f %8.1f %5u %6s %6.0f%% %7.3f\n",
+      pHost,
+      pStats->fps,
+      pStats->frameP50,
+      pStats->frameP95,
+      pStats->frameP99,
+      pStats->frameMax,
+      pStats->load,
+      pStats->latency,
+      pStats->inputP50,
+      pStats->inputP99,
+      pStats->cpuKB / 1024.0,
+      pStats->gpuKB / 1024.0,
+      (unsigned int) pStats->queueDepth,
+      arPush,
+      (nLookups > 0) ? 100.0 * pStats->shaderHits / nLookups : 0.0,
+      uRoundTrip * 1e-3);
+}
+
+int main(int argc, char *argv[])
+{
+   int nPort = STATS_PORT;
+   int nTimeout = STATS_TIMEOUT_MS;
+   double fInterval = 0.0;
+   // Once, or until interrupted with --interval
+   int nCount = -1;
+   const char* arHosts[STATS_MAX_HOSTS];
+   int nHosts = 0;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+      {
+         nPort = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+      {
+         nTimeout = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+      {
+         fInterval = atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+      {
+         nCount = atoi(argv[++i]);
+      }
+      else if (argv[i][0] != '-' && nHosts < STATS_MAX_HOSTS)
+      {
+         arHosts[nHosts++] = argv[i];
+      }
+      else
+      {
+         nHosts = 0;
+         break;
+      }
+   }
+
+   if (nHosts == 0)
+   {
+      printf("Usage: %s [--port %d] [--timeout %d] [--interval s] [--count n] host...\n",
+         argv[0], STATS_PORT, STATS_TIMEOUT_MS);
+      return 0;
+   }
+
+   if (nCount < 0)
+      nCount = (fInterval > 0.0) ? 0 : 1;
+
+   struct sockaddr_in arAddresses[STATS_MAX_HOSTS];
+
+   for (int i = 0; i < nHosts; i++)
+   {
+      memset(&arAddresses[i], 0, sizeof(sockaddr_in));
+      arAddresses[i].sin_family = AF_INET;
+      arAddresses[i].sin_port = htons(nPort);
+
+      if (inet_pton(AF_INET, arHosts[i], &arAddresses[i].sin_addr) != 1)
+      {
+         printf("Bad host address %s\n", arHosts[i]);
+         return 1;
+      }
+   }
+
+   int nSocket = socket(AF_INET, SOCK_DGRAM, 0);
+   if (nSocket < 0)
+   {
+      printf("Failed to create socket.\n");
+      return 1;
+   }
+
+   // Renderers drop repeated sequence numbers per sender, so every
+   // query of a run gets its own
+   uint32_t uSequence = (uint32_t) NowMicroseconds();
+   int nMissing = 0;
+
+   for (int nRound = 0; nCount == 0 || nRound < nCount; nRound++)
+   {
+      uint32_t uFirst = uSequence;
+      int arAnswered[STATS_MAX_HOSTS];
+
+      memset(arAnswered, 0, sizeof(arAnswered));
+
+      for (int i = 0; i < nHosts; i++)
+      {
+         ProtocolMessage query;
+         char arQuery[PROTOCOL_MAX_SIZE];
+
+         memset(&query, 0, sizeof(query));
+         query.type = PROTOCOL_QUERY_STATS;
+         query.sequence = uSequence++;
+         query.timestamp = NowMicroseconds();
+
+         int nLength = ProtocolEncode(&query, arQuery, sizeof(arQuery));
+         sendto(nSocket, arQuery, nLength, 0, (const struct sockaddr*) &arAddresses[i], sizeof(sockaddr_in));
+      }
+
+      PrintHeader();
+
+      uint64_t uDeadline = NowMicroseconds() + nTimeout * 1000ull;
+      int nAnswered = 0;
+
+      while (nAnswered < nHosts)
+      {
+         uint64_t uNow = NowMicroseconds();
+
+         if (uNow >= uDeadline)
+            break;
+
+         struct pollfd waitFor = { nSocket, POLLIN, 0 };
+
+         if (poll(&waitFor, 1, (int) ((uDeadline - uNow + 999) / 1000)) <= 0)
+            continue;
+
+         char arReply[PROTOCOL_MAX_SIZE];
+         ProtocolMessage reply;
+         int nLength = recv(nSocket, arReply, sizeof(arReply), 0);
+
+         if (ProtocolDecode(arReply, nLength, &reply) != PROTOCOL_OK || reply.type != PROTOCOL_STATS)
+            continue;
+
+         // Late answers to an earlier round are ignored
+         uint32_t uHost = reply.sequence - uFirst;
+
+         if (uHost >= (uint32_t) nHosts || arAnswered[uHost])
+            continue;
+
+         arAnswered[uHost] = 1;
+         nAnswered++;
+
+         PrintStats(arHosts[uHost], &reply.stats, NowMicroseconds() - reply.timestamp);
+      }
+
+      for (int i = 0; i < nHosts; i++)
+      {
+         if (!arAnswered[i])
+         {
+            printf("%-16s no answer\n", arHosts[i]);
+            nMissing++;
+         }
+      }
+
+      if (nCount == 0 || nRound + 1 < nCount)
+         usleep((useconds_t) (fInterval * 1e6));
+   }
+
+   close(nSocket);
+   return nMissing > 0;
+}
@@ -0,0 +1,621 @@
+//
+// Sync.cpp
+//
+//    The master schedules frame N one frame period after frame N-1 and
+//    multicasts it at the start of drawing, so followers have almost a
+//    period to render it. Followers send a time request to the master
+//    every 100 ms; of the last 16 answers, the one with the shortest
+//    round trip gives the clock offset, as its two legs are the most
+//    likely to be equal. Every node holds its swap until the present
+//    time, then reports when the swap finished on the master's clock;
+//    the spread of those times per frame is the skew.
+//
+//    Requests, replies and reports travel between the unicast sockets
+//    of master and followers, so several nodes on one machine can share
+//    the group port. The sync thread answers and collects them, the
+//    render thread only waits for states and sends its own reports.
+//
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "Profiler.h"
+#include "Protocol.h"
+#include "Sync.h"
+#include "Trace.h"
+
+#define SYNC_CLOCK_INTERVAL_MS 100
+#define SYNC_CLOCK_SAMPLES 16
+
+// Frames whose swap times are collected at once. A frame's skew is
+// taken once a frame this much newer starts, later reports are dropped.
+#define SYNC_SKEW_FRAMES 64
+#define SYNC_SKEW_SETTLE 8
+
+// A frame number this far behind the newest means the master restarted.
+#define SYNC_FRAME_RESTART 1024
+
+//
+// Swap times of one frame on the master clock.
+//
+typedef struct
+{
+   uint32_t frame;
+   uint64_t first;
+   uint64_t last;
+   int count;
+} SyncSlot;
+
+static int s_nMode = SYNC_OFF;
+static uint64_t s_uPeriod = 0;
+static struct sockaddr_in s_group;
+
+// Unicast, on a free port, and the group port of followers
+static int s_nSocket = -1;
+static int s_nGroupSocket = -1;
+
+static std::thread s_thread;
+static std::atomic<int> s_bStopping(0);
+
+// Master schedule, render thread only
+static uint32_t s_uFrame = 0;
+static uint64_t s_uNextPresent = 0;
+
+// Master: swap times of recent frames from every node
+static std::mutex s_skewMutex;
+static SyncSlot s_arSlots[SYNC_SKEW_FRAMES];
+static std::vector<float> s_skews;
+static std::unordered_set<uint64_t> s_nodes;
+
+// Follower: newest state and where it came from
+static std::mutex s_stateMutex;
+static std::condition_variable s_stateChanged;
+static ProtocolMessage s_latest;
+static int s_bHaveState = 0;
+static struct sockaddr_in s_master;
+static int s_bHaveMaster = 0;
+
+// Follower clock samples, sync thread only
+static int64_t s_arOffsets[SYNC_CLOCK_SAMPLES];
+static int64_t s_arRoundTrips[SYNC_CLOCK_SAMPLES];
+static int s_nClockSamples = 0;
+static int s_nNextClockSample = 0;
+
+// Master clock minus local clock, in ns
+static std::atomic<int64_t> s_nOffset(0);
+static std::atomic<int64_t> s_nRoundTrip(0);
+static std::atomic<int> s_bSynced(0);
+
+// Render thread counters
+static uint32_t s_uApplied = 0;
+static int s_bApplied = 0;
+static uint64_t s_nFrames = 0;
+static uint64_t s_nSkipped = 0;
+static uint64_t s_nTimeouts = 0;
+static uint64_t s_nLate = 0;
+static uint64_t s_nSwaps = 0;
+static uint64_t s_uSwapSum = 0;
+static uint64_t s_uSwapMax = 0;
+
+static uint64_t AddressKey(const struct sockaddr_in* pAddress)
+{
+   return ((uint64_t) pAddress->sin_addr.s_addr << 16) | pAddress->sin_port;
+}
+
+static void Send(const ProtocolMessage* pMessage, const struct sockaddr_in* pTo)
+{
+   char arBuffer[PROTOCOL_MAX_SIZE];
+   int nLength = ProtocolEncode(pMessage, arBuffer, sizeof(arBuffer));
+
+   sendto(s_nSocket, arBuffer, nLength, MSG_DONTWAIT, (const struct sockaddr*) pTo, sizeof(struct sockaddr_in));
+}
+
+static void FinishSlot(SyncSlot* pSlot)
+{
+   if (pSlot->count >= 2)
+      s_skews.push_back((pSlot->last - pSlot->first) * 1e-6f);
+
+   pSlot->count = 0;
+}
+
+///
+// Add one node's swap time of a frame, master clock. Key 0 is the
+// master itself.
+//
+static void AddSwap(uint64_t uKey, uint32_t uFrame, uint64_t uTime)
+{
+   std::lock_guard<std::mutex> lock(s_skewMutex);
+   SyncSlot* pSlot = &s_arSlots[uFrame % SYNC_SKEW_FRAMES];
+
+   if (uKey != 0)
+      s_nodes.insert(uKey);
+
+   if (pSlot->count == 0 || pSlot->frame != uFrame)
+   {
+      // Reported after its slot went to a newer frame, or settled
+      if ((pSlot->count > 0 && (int32_t) (uFrame - pSlot->frame) < 0) || pSlot->frame == uFrame)
+         return;
+
+      FinishSlot(pSlot);
+
+      SyncSlot* pSettled = &s_arSlots[(uFrame - SYNC_SKEW_SETTLE) % SYNC_SKEW_FRAMES];
+
+      if (pSettled->frame == uFrame - SYNC_SKEW_SETTLE)
+         FinishSlot(pSettled);
+
+      pSlot->frame = uFrame;
+      pSlot->first = uTime;
+      pSlot->last = uTime;
+      pSlot->count = 1;
+      return;
+   }
+
+   pSlot->first = std::min(pSlot->first, uTime);
+   pSlot->last = std::max(pSlot->last, uTime);
+   pSlot->count++;
+}
+
+///
+// One answer to a time request. t1 and t4 are the follower's send and
+// receive times, t2 and t3 the master's.
+//
+static void AddClockSample(const ProtocolMessage* pReply, uint64_t uReceived)
+{
+   int64_t t1 = (int64_t) pReply->originate * 1000;
+   int64_t t2 = (int64_t) pReply->receive * 1000;
+   int64_t t3 = (int64_t) pReply->timestamp * 1000;
+   int64_t t4 = (int64_t) uReceived;
+   int64_t nRoundTrip = (t4 - t1) - (t3 - t2);
+
+   if (nRoundTrip < 0)
+      return;
+
+   s_arOffsets[s_nNextClockSample] = ((t2 - t1) + (t3 - t4)) / 2;
+   s_arRoundTrips[s_nNextClockSample] = nRoundTrip;
+   s_nNextClockSample = (s_nNextClockSample + 1) % SYNC_CLOCK_SAMPLES;
+
+   if (s_nClockSamples < SYNC_CLOCK_SAMPLES)
+      s_nClockSamples++;
+
+   int nBest = 0;
+
+   for (int i = 1; i < s_nClockSamples; i++)
+   {
+      if (s_arRoundTrips[i] < s_arRoundTrips[nBest])
+         nBest = i;
+   }
+
+   s_nOffset.store(s_arOffsets[nBest], std::memory_order_relaxed);
+   s_nRoundTrip.store(s_arRoundTrips[nBest], std::memory_order_relaxed);
+   s_bSynced.store(1, std::memory_order_release);
+}
+
+static void HandleMessage(const ProtocolMessage* pMessage, const struct sockaddr_in* pFrom, uint64_t uReceived)
+{
+   switch (pMessage->type)
+   {
+   case PROTOCOL_SYNC_STATE:
+   {
+      if (s_nMode != SYNC_FOLLOWER)
+         break;
+
+      {
+         std::lock_guard<std::mutex> lock(s_stateMutex);
+         int32_t nAhead = (int32_t) (pMessage->sequence - s_latest.sequence);
+
+         if (!s_bHaveState || nAhead > 0 || -nAhead > SYNC_FRAME_RESTART)
+         {
+            s_latest = *pMessage;
+            s_bHaveState = 1;
+         }
+
+         s_master = *pFrom;
+         s_bHaveMaster = 1;
+      }
+
+      s_stateChanged.notify_one();
+      break;
+   }
+
+   case PROTOCOL_SYNC_TIME_REQUEST:
+   {
+      if (s_nMode != SYNC_MASTER)
+         break;
+
+      ProtocolMessage reply;
+
+      memset(&reply, 0, sizeof(reply));
+      reply.type = PROTOCOL_SYNC_TIME_REPLY;
+      reply.sequence = pMessage->sequence;
+      reply.originate = pMessage->timestamp;
+      reply.receive = uReceived / 1000;
+      reply.timestamp = ProfilerNow() / 1000;
+
+      Send(&reply, pFrom);
+      break;
+   }
+
+   case PROTOCOL_SYNC_TIME_REPLY:
+      if (s_nMode == SYNC_FOLLOWER)
+         AddClockSample(pMessage, uReceived);
+      break;
+
+   case PROTOCOL_SYNC_FRAME_REPORT:
+      if (s_nMode == SYNC_MASTER)
+         AddSwap(AddressKey(pFrom), pMessage->sequence, pMessage->timestamp * 1000);
+      break;
+   }
+}
+
+///
+// Everything waiting on a socket.
+//
+static void Receive(int nSocket)
+{
+   char arBuffer[PROTOCOL_MAX_SIZE];
+   struct sockaddr_in from;
+   socklen_t addrlen = sizeof(from);
+   int nLength;
+
+   while ((nLength = recvfrom(nSocket, arBuffer, sizeof(arBuffer), MSG_DONTWAIT, (struct sockaddr*) &from, &addrlen)) > 0)
+   {
+      uint64_t uReceived = ProfilerNow();
+      ProtocolMessage message;
+
+      if (ProtocolDecode(arBuffer, nLength, &message) == PROTOCOL_OK && message.binary)
+         HandleMessage(&message, &from, uReceived);
+
+      addrlen = sizeof(from);
+   }
+}
+
+static void SendTimeRequest(uint32_t uSequence)
+{
+   struct sockaddr_in master;
+
+   {
+      std::lock_guard<std::mutex> lock(s_stateMutex);
+
+      if (!s_bHaveMaster)
+         return;
+
+      master = s_master;
+   }
+
+   ProtocolMessage request;
+
+   memset(&request, 0, sizeof(request));
+   request.type = PROTOCOL_SYNC_TIME_REQUEST;
+   request.sequence = uSequence;
+   request.timestamp = ProfilerNow() / 1000;
+
+   Send(&request, &master);
+}
+
+static void SyncThread()
+{
+   TraceThreadName("sync");
+
+   uint64_t uNextRequest = 0;
+   uint32_t uRequests = 0;
+
+   while (!s_bStopping.load(std::memory_order_relaxed))
+   {
+      struct pollfd arFds[2];
+      int nFds = 1;
+
+      arFds[0].fd = s_nSocket;
+      arFds[0].events = POLLIN;
+
+      if (s_nGroupSocket >= 0)
+      {
+         arFds[1].fd = s_nGroupSocket;
+         arFds[1].events = POLLIN;
+         nFds = 2;
+      }
+
+      if (s_nMode == SYNC_FOLLOWER && ProfilerNow() >= uNextRequest)
+      {
+         SendTimeRequest(uRequests++);
+         uNextRequest = ProfilerNow() + SYNC_CLOCK_INTERVAL_MS * 1000000ull;
+      }
+
+      if (poll(arFds, nFds, SYNC_CLOCK_INTERVAL_MS) <= 0)
+         continue;
+
+      for (int i = 0; i < nFds; i++)
+      {
+         if (arFds[i].revents & POLLIN)
+            Receive(arFds[i].fd);
+      }
+   }
+}
+
+int SyncStart(int nMode, const char* pGroup, int nPort, const char* pInterface, uint64_t uPeriod)
+{
+   struct in_addr iface;
+
+   iface.s_addr = htonl(INADDR_ANY);
+
+   memset(&s_group, 0, sizeof(s_group));
+   s_group.sin_family = AF_INET;
+   s_group.sin_port = htons(nPort);
+
+   if (inet_pton(AF_INET, pGroup, &s_group.sin_addr) != 1 ||
+       (pInterface != 0 && inet_pton(AF_INET, pInterface, &iface) != 1))
+   {
+      printf("Sync group and interface must be IPv4 addresses.\n");
+      return 0;
+   }
+
+   s_nSocket = socket(AF_INET, SOCK_DGRAM, 0);
+   if (s_nSocket < 0)
+   {
+      printf("Failed to create sync socket.\n");
+      return 0;
+   }
+
+   struct sockaddr_in local;
+   memset(&local, 0, sizeof(local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+   bind(s_nSocket, (struct sockaddr*) &local, sizeof(local));
+
+   // One hop, and looped back so nodes on this machine hear it too
+   unsigned char uTtl = 1;
+   unsigned char uLoop = 1;
+   setsockopt(s_nSocket, IPPROTO_IP, IP_MULTICAST_TTL, &uTtl, sizeof(uTtl));
+   setsockopt(s_nSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &uLoop, sizeof(uLoop));
+
+   if (pInterface != 0)
+      setsockopt(s_nSocket, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+
+   if (nMode == SYNC_FOLLOWER)
+   {
+      s_nGroupSocket = socket(AF_INET, SOCK_DGRAM, 0);
+
+      int nReuse = 1;
+      setsockopt(s_nGroupSocket, SOL_SOCKET, SO_REUSEADDR, &nReuse, sizeof(nReuse));
+
+      local.sin_port = htons(nPort);
+
+      struct ip_mreq request;
+      request.imr_multiaddr = s_group.sin_addr;
+      request.imr_interface = iface;
+
+      if (s_nGroupSocket < 0 ||
+          bind(s_nGroupSocket, (struct sockaddr*) &local, sizeof(local)) < 0 ||
+          setsockopt(s_nGroupSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0)
+      {
+         printf("Failed to join sync group %s:%d (%s).\n", pGroup, nPort, strerror(errno));
+
+         if (s_nGroupSocket >= 0)
+            close(s_nGroupSocket);
+
+         close(s_nSocket);
+         s_nGroupSocket = -1;
+         s_nSocket = -1;
+         return 0;
+      }
+   }
+
+   s_nMode = nMode;
+   s_uPeriod = uPeriod;
+
+   printf("Sync: %s on %s:%d\n", (nMode == SYNC_MASTER) ? "master" : "follower", pGroup, nPort);
+
+   s_bStopping.store(0);
+   s_thread = std::thread(SyncThread);
+
+   return 1;
+}
+
+void SyncStop()
+{
+   if (s_nSocket < 0)
+      return;
+
+   s_bStopping.store(1);
+
+   if (s_thread.joinable())
+      s_thread.join();
+
+   if (s_nGroupSocket >= 0)
+      close(s_nGroupSocket);
+
+   close(s_nSocket);
+   s_nGroupSocket = -1;
+   s_nSocket = -1;
+   s_nMode = SYNC_OFF;
+}
+
+void SyncPublish(SyncState* pState)
+{
+   uint64_t uNow = ProfilerNow();
+
+   // The first frame, or drawing fell behind: start over from now
+   if (s_uNextPresent < uNow + s_uPeriod / 2)
+      s_uNextPresent = uNow + s_uPeriod;
+
+   pState->frame = ++s_uFrame;
+   pState->present = s_uNextPresent;
+   s_uNextPresent += s_uPeriod;
+
+   ProtocolMessage message;
+
+   memset(&message, 0, sizeof(message));
+   message.type = PROTOCOL_SYNC_STATE;
+   message.sequence = pState->frame;
+   message.timestamp = uNow / 1000;
+   message.present = pState->present / 1000;
+   message.model = pState->model;
+   message.flags = pState->flags;
+   message.pitch = pState->pitch;
+   message.yaw = pState->yaw;
+   message.roll = pState->roll;
+   message.scale = pState->scale;
+
+   Send(&message, &s_group);
+   s_nFrames++;
+}
+
+int SyncWaitState(SyncState* pState, uint64_t uTimeout)
+{
+   ProtocolMessage message;
+
+   {
+      std::unique_lock<std::mutex> lock(s_stateMutex);
+
+      if (!s_stateChanged.wait_for(lock, std::chrono::nanoseconds(uTimeout), []
+            { return s_bHaveState && (!s_bApplied || s_latest.sequence != s_uApplied); }))
+      {
+         s_nTimeouts++;
+         return 0;
+      }
+
+      message = s_latest;
+   }
+
+   int32_t nGap = (int32_t) (message.sequence - s_uApplied) - 1;
+
+   if (s_bApplied && nGap > 0 && nGap < SYNC_FRAME_RESTART)
+      s_nSkipped += nGap;
+
+   s_uApplied = message.sequence;
+   s_bApplied = 1;
+   s_nFrames++;
+
+   pState->frame = message.sequence;
+   pState->present = 0;
+   pState->model = message.model;
+   pState->flags = message.flags;
+   pState->pitch = message.pitch;
+   pState->yaw = message.yaw;
+   pState->roll = message.roll;
+   pState->scale = message.scale;
+
+   if (s_bSynced.load(std::memory_order_acquire))
+      pState->present = (uint64_t) ((int64_t) message.present * 1000 - s_nOffset.load(std::memory_order_relaxed));
+
+   return 1;
+}
+
+void SyncWaitPresent(uint64_t uPresent)
+{
+   if (uPresent == 0)
+      return;
+
+   if (ProfilerNow() > uPresent)
+   {
+      s_nLate++;
+      return;
+   }
+
+   // ProfilerNow() reads CLOCK_MONOTONIC
+   struct timespec until;
+   until.tv_sec = (time_t) (uPresent / 1000000000ull);
+   until.tv_nsec = (long) (uPresent % 1000000000ull);
+
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 0) == EINTR)
+   {
+   }
+}
+
+void SyncReportSwap(const SyncState* pState, uint64_t uSwapped)
+{
+   if (pState->present == 0)
+      return;
+
+   uint64_t uError = (uSwapped > pState->present) ? uSwapped - pState->present : 0;
+
+   s_nSwaps++;
+   s_uSwapSum += uError;
+   s_uSwapMax = std::max(s_uSwapMax, uError);
+
+   if (s_nMode == SYNC_MASTER)
+   {
+      AddSwap(0, pState->frame, uSwapped);
+      return;
+   }
+
+   struct sockaddr_in master;
+
+   {
+      std::lock_guard<std::mutex> lock(s_stateMutex);
+      master = s_master;
+   }
+
+   ProtocolMessage report;
+
+   memset(&report, 0, sizeof(report));
+   report.type = PROTOCOL_SYNC_FRAME_REPORT;
+   report.sequence = pState->frame;
+   report.timestamp = (uint64_t) ((int64_t) uSwapped + s_nOffset.load(std::memory_order_relaxed)) / 1000;
+
+   Send(&report, &master);
+}
+
+void SyncGetStats(SyncStats* pStats)
+{
+   memset(pStats, 0, sizeof(SyncStats));
+
+   pStats->mode = s_nMode;
+   pStats->frames = s_nFrames;
+   pStats->skipped = s_nSkipped;
+   pStats->timeouts = s_nTimeouts;
+   pStats->late = s_nLate;
+   pStats->synced = s_bSynced.load(std::memory_order_acquire);
+   pStats->offset = s_nOffset.load(std::memory_order_relaxed) * 1e-6f;
+   pStats->roundTrip = s_nRoundTrip.load(std::memory_order_relaxed) * 1e-6f;
+
+   if (s_nSwaps > 0)
+   {
+      pStats->swapMean = s_uSwapSum * 1e-6f / s_nSwaps;
+      pStats->swapMax = s_uSwapMax * 1e-6f;
+   }
+
+   s_nFrames = 0;
+   s_nSkipped = 0;
+   s_nTimeouts = 0;
+   s_nLate = 0;
+   s_nSwaps = 0;
+   s_uSwapSum = 0;
+   s_uSwapMax = 0;
+
+   if (s_nMode != SYNC_MASTER)
+      return;
+
+   std::lock_guard<std::mutex> lock(s_skewMutex);
+
+   pStats->nodes = (int) s_nodes.size() + 1;
+   pStats->skewFrames = s_skews.size();
+
+   if (!s_skews.empty())
+   {
+      std::sort(s_skews.begin(), s_skews.end());
+
+      pStats->skewP50 = s_skews[s_skews.size() / 2];
+      pStats->skewP95 = s_skews[(s_skews.size() * 95) / 100];
+      pStats->skewMax = s_skews.back();
+   }
+
+   s_skews.clear();
+   s_nodes.clear();
+}
@@ -0,0 +1,122 @@
+//
+/// \file Sync.h
+/// \brief Frame synchronised rendering across several renderers, one
+///        per face of a bigger chamber. The master multicasts the state
+///        of every frame with its frame number and the time it is to be
+///        shown on the master's clock; followers estimate the offset to
+///        that clock NTP style, render the newest state and hold their
+///        swap until its time. Every node reports when its swaps
+///        finished, and the master measures the skew between nodes.
+///        A controller can take the master's place by sending the same
+///        messages (Protocol.h).
+//
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+
+#define SYNC_OFF 0
+#define SYNC_MASTER 1
+#define SYNC_FOLLOWER 2
+
+#define SYNC_DEFAULT_GROUP "239.255.71.1"
+#define SYNC_DEFAULT_PORT 4010
+
+// Bits of SyncState::flags.
+#define SYNC_FLAG_LINES 1
+#define SYNC_FLAG_FLIPPED 2
+
+//
+/// \brief The authoritative state of one frame.
+//
+typedef struct
+{
+   uint32_t frame;
+   // When to swap, on the local ProfilerNow() clock; 0 when a follower
+   // has no clock estimate yet
+   uint64_t present;
+
+   int model;
+   uint32_t flags;
+   float pitch;
+   float yaw;
+   float roll;
+   float scale;
+} SyncState;
+
+//
+/// \brief Metrics since the last call. Times in milliseconds.
+//
+typedef struct
+{
+   int mode;
+   // Nodes that reported a swap, the master included
+   int nodes;
+
+   // Frames published or applied, states a follower never rendered, and
+   // frames that waited for a state in vain
+   uint64_t frames;
+   uint64_t skipped;
+   uint64_t timeouts;
+
+   // Frames whose drawing ran past their present time
+   uint64_t late;
+
+   // How long after its present time each swap of this node finished
+   float swapMean;
+   float swapMax;
+
+   // Follower: master clock minus local clock, and the round trip of
+   // the request it came from
+   int synced;
+   float offset;
+   float roundTrip;
+
+   // Master: spread of the swap times of one frame across all nodes
+   uint64_t skewFrames;
+   float skewP50;
+   float skewP95;
+   float skewMax;
+} SyncStats;
+
+//
+/// \brief Open the sync sockets and start the sync thread.
+/// \param pGroup Multicast group the master sends to and followers join
+/// \param pInterface Local address to multicast through, 0 for the
+///        default route; 127.0.0.1 runs several nodes on one machine
+/// \param uPeriod Frame period of the master in nanoseconds
+/// \return 0 if the sockets could not be set up.
+//
+int SyncStart(int nMode, const char* pGroup, int nPort, const char* pInterface, uint64_t uPeriod);
+
+//
+/// \brief Stop the sync thread. Safe to call when SyncStart failed.
+//
+void SyncStop();
+
+//
+/// \brief Master: number the frame, schedule it one period after the
+///        last and multicast it. Fills in frame and present.
+//
+void SyncPublish(SyncState* pState);
+
+//
+/// \brief Follower: wait up to uTimeout ns for a frame newer than the
+///        last one returned, and return the newest.
+/// \return 0 on timeout.
+//
+int SyncWaitState(SyncState* pState, uint64_t uTimeout);
+
+//
+/// \brief Sleep until a present time, counting frames that are late.
+//
+void SyncWaitPresent(uint64_t uPresent);
+
+//
+/// \brief Record when the swap of a frame finished, local clock.
+//
+void SyncReportSwap(const SyncState* pState, uint64_t uSwapped);
+
+void SyncGetStats(SyncStats* pStats);
+
+#endif // SYNC_H
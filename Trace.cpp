@@ -0,0 +1,323 @@
+//
+// Trace.cpp
+//
+//    Every thread that records an event gets a buffer in a registry.
+//    Appending takes only that buffer's lock, which the writer thread
+//    holds just long enough to swap the event vector for an empty one,
+//    so recording threads never wait on file I/O. The writer wakes
+//    every 100 ms, or sooner when a buffer fills up.
+//
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Profiler.h"
+#include "Trace.h"
+
+#define TRACE_FLUSH_EVENTS 8192
+#define TRACE_FLUSH_MS 100
+
+typedef struct
+{
+   const char* pName;
+   uint64_t uTime;
+   uint64_t uDuration;
+   int64_t nBytes;
+   char phase;
+} TraceEvent;
+
+typedef struct
+{
+   std::mutex lock;
+   std::vector<TraceEvent> events;
+   int tid;
+   char name[32];
+   int exited;
+} TraceBuffer;
+
+// Marks the buffer of a thread as finished when the thread exits, so the
+// writer can free it after the last flush.
+struct TraceThread
+{
+   TraceBuffer* pBuffer;
+
+   TraceThread() : pBuffer(0) {}
+   ~TraceThread();
+};
+
+static std::atomic<int> s_nEnabled(0);
+static FILE* s_pFile = 0;
+static uint64_t s_uStartTime = 0;
+static int s_bFirstEvent = 1;
+
+static std::mutex s_registryLock;
+static std::vector<TraceBuffer*> s_buffers;
+static int s_nNextTid = 1;
+
+static std::thread s_writer;
+static std::mutex s_wakeLock;
+static std::condition_variable s_wake;
+static int s_bStopping = 0;
+
+static thread_local TraceThread s_thread;
+
+TraceThread::~TraceThread()
+{
+   if (pBuffer != 0)
+   {
+      std::lock_guard<std::mutex> guard(s_registryLock);
+      pBuffer->exited = 1;
+   }
+}
+
+static TraceBuffer* GetThreadBuffer()
+{
+   if (s_thread.pBuffer == 0)
+   {
+      TraceBuffer* pBuffer = new TraceBuffer;
+
+      pBuffer->events.reserve(TRACE_FLUSH_EVENTS);
+      pBuffer->exited = 0;
+
+      std::lock_guard<std::mutex> guard(s_registryLock);
+      pBuffer->tid = s_nNextTid++;
+      snprintf(pBuffer->name, sizeof(pBuffer->name), "thread %d", pBuffer->tid);
+      s_buffers.push_back(pBuffer);
+
+      s_thread.pBuffer = pBuffer;
+   }
+
+   return s_thread.pBuffer;
+}
+
+static void Append(const char* pName, char phase, uint64_t uTime, uint64_t uDuration, int64_t nBytes)
+{
+   TraceBuffer* pBuffer = GetThreadBuffer();
+   TraceEvent event = { pName, uTime, uDuration, nBytes, phase };
+   size_t nCount;
+
+   {
+      std::lock_guard<std::mutex> guard(pBuffer->lock);
+      pBuffer->events.push_back(event);
+      nCount = pBuffer->events.size();
+   }
+
+   if (nCount == TRACE_FLUSH_EVENTS)
+      s_wake.notify_one();
+}
+
+static void WriteSeparator()
+{
+   fputs(s_bFirstEvent ? "\n" : ",\n", s_pFile);
+   s_bFirstEvent = 0;
+}
+
+static void WriteThreadName(const TraceBuffer* pBuffer)
+{
+   WriteSeparator();
+   fprintf(s_pFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+      (int) getpid(), pBuffer->tid, pBuffer->name);
+}
+
+static void WriteEvents(const std::vector<TraceEvent>& events, int nTid)
+{
+   int nPid = (int) getpid();
+
+   for (size_t i = 0; i < events.size(); i++)
+   {
+      const TraceEvent* pEvent = &events[i];
+
+      // Timestamps are microseconds since the start of the trace
+      WriteSeparator();
+      fprintf(s_pFile, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+         pEvent->pName,
+         pEvent->phase,
+         (pEvent->uTime - s_uStartTime) * 1e-3,
+         nPid,
+         nTid);
+
+      if (pEvent->phase == 'X')
+         fprintf(s_pFile, ",\"dur\":%.3f", pEvent->uDuration * 1e-3);
+
+      if (pEvent->nBytes >= 0)
+         fprintf(s_pFile, ",\"args\":{\"bytes\":%lld}", (long long) pEvent->nBytes);
+
+      fputs("}", s_pFile);
+   }
+}
+
+///
+// Write out everything recorded so far and free the buffers of threads
+// that have exited. Only the writer thread, or TraceStop after joining
+// it, calls this.
+//
+static void Flush()
+{
+   std::vector<TraceEvent> events;
+   std::vector<TraceBuffer*> buffers;
+
+   {
+      std::lock_guard<std::mutex> guard(s_registryLock);
+      buffers = s_buffers;
+   }
+
+   for (size_t i = 0; i < buffers.size(); i++)
+   {
+      TraceBuffer* pBuffer = buffers[i];
+      int bExited;
+
+      events.clear();
+      events.reserve(TRACE_FLUSH_EVENTS);
+
+      {
+         std::lock_guard<std::mutex> guard(s_registryLock);
+         bExited = pBuffer->exited;
+      }
+
+      {
+         std::lock_guard<std::mutex> guard(pBuffer->lock);
+         pBuffer->events.swap(events);
+      }
+
+      WriteEvents(events, pBuffer->tid);
+
+      // The thread is gone, nothing can be appended any more
+      if (bExited)
+      {
+         WriteThreadName(pBuffer);
+
+         std::lock_guard<std::mutex> guard(s_registryLock);
+         for (size_t j = 0; j < s_buffers.size(); j++)
+         {
+            if (s_buffers[j] == pBuffer)
+            {
+               s_buffers.erase(s_buffers.begin() + j);
+               break;
+            }
+         }
+
+         delete pBuffer;
+      }
+   }
+
+   fflush(s_pFile);
+}
+
+static void WriterThread()
+{
+   std::unique_lock<std::mutex> guard(s_wakeLock);
+
+   while (!s_bStopping)
+   {
+      s_wake.wait_for(guard, std::chrono::milliseconds(TRACE_FLUSH_MS));
+
+      guard.unlock();
+      Flush();
+      guard.lock();
+   }
+}
+
+int TraceStart(const char* pPath)
+{
+   if (s_nEnabled.load())
+      return 1;
+
+   s_pFile = fopen(pPath, "w");
+
+   if (s_pFile == 0)
+   {
+      printf("Could not create trace %s\n", pPath);
+      return 0;
+   }
+
+   fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", s_pFile);
+
+   s_uStartTime = ProfilerNow();
+   s_bFirstEvent = 1;
+   s_bStopping = 0;
+   s_writer = std::thread(WriterThread);
+   s_nEnabled.store(1);
+
+   return 1;
+}
+
+void TraceStop()
+{
+   if (!s_nEnabled.exchange(0))
+      return;
+
+   {
+      std::lock_guard<std::mutex> guard(s_wakeLock);
+      s_bStopping = 1;
+   }
+
+   s_wake.notify_one();
+   s_writer.join();
+
+   Flush();
+
+   // Threads still running keep their buffers, only their names are due
+   {
+      std::lock_guard<std::mutex> guard(s_registryLock);
+      for (size_t i = 0; i < s_buffers.size(); i++)
+         WriteThreadName(s_buffers[i]);
+   }
+
+   fputs("\n]}\n", s_pFile);
+   fclose(s_pFile);
+   s_pFile = 0;
+}
+
+void TraceThreadName(const char* pName)
+{
+   if (!s_nEnabled.load(std::memory_order_relaxed))
+      return;
+
+   TraceBuffer* pBuffer = GetThreadBuffer();
+
+   std::lock_guard<std::mutex> guard(s_registryLock);
+   snprintf(pBuffer->name, sizeof(pBuffer->name), "%s", pName);
+}
+
+void TraceBegin(const char* pName)
+{
+   if (!s_nEnabled.load(std::memory_order_relaxed))
+      return;
+
+   Append(pName, 'B', ProfilerNow(), 0, -1);
+}
+
+void TraceEnd(const char* pName, int64_t nBytes)
+{
+   if (!s_nEnabled.load(std::memory_order_relaxed))
+      return;
+
+   Append(pName, 'E', ProfilerNow(), 0, nBytes);
+}
+
+void TraceComplete(const char* pName, uint64_t uStart, uint64_t uDuration)
+{
+   if (!s_nEnabled.load(std::memory_order_relaxed))
+      return;
+
+   Append(pName, 'X', uStart, uDuration, -1);
+}
+
+ScopedTrace::ScopedTrace(const char* pName, int64_t nBytes)
+   : m_pName(pName), m_nBytes(nBytes), m_bActive(s_nEnabled.load(std::memory_order_relaxed))
+{
+   if (m_bActive)
+      Append(m_pName, 'B', ProfilerNow(), 0, -1);
+}
+
+ScopedTrace::~ScopedTrace()
+{
+   if (m_bActive)
+      TraceEnd(m_pName, m_nBytes);
+}
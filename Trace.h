@@ -0,0 +1,62 @@
+//
+/// \file Trace.h
+/// \brief Optional timeline of everything the renderer does, written in
+///        the Chrome trace event format so a session can be opened in
+///        Perfetto or chrome://tracing. Events are appended to a buffer
+///        owned by the calling thread and written to disk by a
+///        background thread; while tracing is off every call returns at
+///        once.
+//
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+//
+/// \brief Start writing events to a JSON file.
+/// \return 0 if the file could not be created.
+//
+int TraceStart(const char* pPath);
+
+//
+/// \brief Write out the remaining events and close the file.
+//
+void TraceStop();
+
+//
+/// \brief Label the calling thread in the timeline.
+//
+void TraceThreadName(const char* pName);
+
+//
+/// \brief Open and close a slice on the calling thread. Names are not
+///        copied and must be string literals. A byte count of -1 leaves
+///        the slice without a size.
+//
+void TraceBegin(const char* pName);
+void TraceEnd(const char* pName, int64_t nBytes);
+
+//
+/// \brief Add a finished slice, for durations measured elsewhere.
+///        Times are nanoseconds on the ProfilerNow() clock.
+//
+void TraceComplete(const char* pName, uint64_t uStart, uint64_t uDuration);
+
+//
+/// \brief Traces the enclosing scope as one slice.
+//
+class ScopedTrace
+{
+public:
+   explicit ScopedTrace(const char* pName, int64_t nBytes = -1);
+   ~ScopedTrace();
+
+   void SetBytes(int64_t nBytes) { m_nBytes = nBytes; }
+
+private:
+   const char* m_pName;
+   int64_t m_nBytes;
+   int m_bActive;
+};
+
+#endif // TRACE_H
@@ -17,16 +17,29 @@
 #include <stdlib.h>
 #include "esUtil.h"
 #include <stdio.h>
-
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>	
-#include <netdb.h>
-
-GLuint vbo = 0;
-GLuint texture = 0;
-GLuint faces = 0;
-int serverSocket = 0;
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "LightBake.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "AssetLoader.h"
+#include "ShaderCache.h"
+#include "SoftRaster.h"
+#include "GLRecord.h"
+#include "Network.h"
+#include "Motion.h"
+#include "Sync.h"
+#include "AssetPush.h"
+#include "Protocol.h"
+#include <unistd.h>
 
 float rotation = 0.0f;
 float scale = 1.0f;
@@ -34,13 +47,22 @@ float scale = 1.0f;
 int displayLines = 0;
 
 
+int numViews = 1;
+int replicateViews = 0;
+
+// LIGHTING_PIXEL, LIGHTING_VERTEX or LIGHTING_BAKED.
+int lightingMode = 0;
+
+// Models shipped with the renderer plus those pushed at runtime.
+#define MAX_MODELS 32
+
 int numModels = 2;
 int currentModel = 0;
 
-const char* modelPaths[] = { "Models/Gun.obj",
+const char* modelPaths[MAX_MODELS] = { "Models/Gun.obj",
 			     "Models/Combined.obj" };
 
-const char* texturePaths[] = { "Textures/gun_1024.bmp",
+const char* texturePaths[MAX_MODELS] = { "Textures/gun_1024.bmp",
 			       "Textures/red.bmp" };
 
 
@@ -52,18 +74,301 @@ const char* texturePaths[] = { "Textures/gun_1024.bmp",
 
 #define SERVER_PORT 4000
 
-#define OBJ_MAX_SIZE 13200000
-#define BMP_MAX_SIZE 13200000
-#define MAX_TEXTURE_SIZE 2048
-#define RECV_BUFFER_SIZE 2048
+// Transforms are shown this far behind the present, see Motion.h.
+#define INTERP_DELAY_MS 30.0f
+#define INTERP_MAX_EXTRAPOLATION_MS 100.0f
+
+// Longest a sync follower waits for the next frame before drawing the
+// last one again.
+#define SYNC_WAIT_MS 100
 
 #define MSG_ROTATE_LEFT 1
 #define MSG_ROTATE_RIGHT 2
 
 #define ROTATE_SPEED 10.0f
 
-static char s_arFileBuffer[OBJ_MAX_SIZE];
-static char s_arRecvBuffer[RECV_BUFFER_SIZE];
+#define MAX_VIEWS 4
+
+// Near plane extents of the single full screen view.
+#define FRUSTUM_HALF_WIDTH 0.025f
+#define FRUSTUM_HALF_HEIGHT 0.017f
+#define FRUSTUM_NEAR 0.1f
+#define FRUSTUM_FAR 1024.0f
+
+// Dynamic resolution controller defaults. Scale is the fraction of
+// the window resolution the scene is rendered at, per axis.
+#define DYNRES_MIN_SCALE 0.5f
+#define DYNRES_MAX_SCALE 1.0f
+#define DYNRES_TARGET_FPS 60.0f
+#define DYNRES_SMOOTHING 0.1f
+#define DYNRES_OVER_BUDGET 1.1f
+#define DYNRES_UNDER_BUDGET 1.03f
+#define DYNRES_STEP_UP 0.05f
+#define DYNRES_SETTLE_FRAMES 30
+#define DYNRES_PROBE_FRAMES 120
+
+#define DYNRES_HOLD 0
+#define DYNRES_DOWN 1
+#define DYNRES_UP 2
+
+#define STATS_INTERVAL 2.0f
+
+// Scripted camera of --bench-render: frames measured after the warm-up
+// frame, turns of the model over the run and how far the scale swings
+// around 1.
+#define BENCH_RENDER_FRAMES 300
+#define BENCH_RENDER_TURNS 2.0f
+#define BENCH_RENDER_SCALE_SWING 0.3f
+
+// Triangles per culling cluster, and the grid each cube face of
+// normal directions is split into when grouping triangles.
+#define CLUSTER_MAX_FACES 128
+#define CLUSTER_NORMAL_GRID 3
+#define CLUSTER_NORMAL_BINS (6 * CLUSTER_NORMAL_GRID * CLUSTER_NORMAL_GRID)
+
+// Pseudo-instancing: meshes up to INSTANCE_MAX_MESH_FACES get a batch
+// buffer with INSTANCE_BATCH_SIZE copies, each tagged with its index
+// into the per-instance uniform arrays. The arrays take 5 of the 128
+// vertex uniform vectors ES 2 guarantees per instance.
+#define INSTANCE_BATCH_SIZE 16
+#define INSTANCE_MAX_MESH_FACES 512
+#define MAX_INSTANCES 4096
+
+// Benchmark scene: a grid of small spheres this wide in model units.
+#define SCENE_EXTENT 160.0f
+#define SCENE_SPHERE_SLICES 16
+#define SCENE_TEXTURE "Textures/white.bmp"
+
+// Feature bits of the mesh shader variants, see vShaderStr.
+#define SHADER_TEXTURED 1
+#define SHADER_LIT 2
+#define SHADER_INSTANCED 4
+#define SHADER_VERTEX_LIGHTING 8
+#define SHADER_BAKED 16
+#define SHADER_FEATURE_COUNT 5
+#define SHADER_VARIANT_COUNT (1 << SHADER_FEATURE_COUNT)
+#define SHADER_HEADER_SIZE 256
+
+#define SHADER_CACHE_DIR "ShaderCache"
+
+// Where diffuse lighting is computed for meshes with normals.
+#define LIGHTING_PIXEL 0
+#define LIGHTING_VERTEX 1
+#define LIGHTING_BAKED 2
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+typedef struct
+{
+	// Viewport rectangle in window pixels.
+	int x;
+	int y;
+	int width;
+	int height;
+
+	// Yaw of the camera around the model, added to rotation.
+	float cameraAngle;
+
+	// Rotation of the image in the plane of the screen, so each
+	// view faces its side of the chamber.
+	float screenAngle;
+
+	// Frustum extents at the near plane.
+	float frustumHalfWidth;
+	float frustumHalfHeight;
+
+	// Mirror the image horizontally before rotating it.
+	int mirror;
+} View;
+
+typedef struct
+{
+	// Range of faces in the vertex buffer.
+	int firstFace;
+	int numFaces;
+
+	// Bounding sphere.
+	float center[3];
+	float radius;
+
+	// Normal cone. Every face points away from an eye at E when
+	// dot(C - E, axis) >= cutoff * |C - E| + radius.
+	float axis[3];
+	float cutoff;
+} Cluster;
+
+typedef struct
+{
+	GLuint vbo;
+	GLuint texture;
+	GLuint faces;
+
+	// Every edge is shared by two faces, so back faces are never seen.
+	int closed;
+
+	// Front faces are wound clockwise.
+	int clockwise;
+
+	Cluster* pClusters;
+	int numClusters;
+
+	// Replicated copies for pseudo-instancing, 0 if the mesh is too big.
+	GLuint batchVbo;
+	int batchSize;
+
+	// Baked RGBA8 lighting per vertex, repeated for every batch copy.
+	GLuint colorVbo;
+
+	// Shader features the vertex data supports.
+	int shaderFlags;
+} Mesh;
+
+typedef struct
+{
+	Mesh* pMesh;
+	float position[3];
+	float yaw;
+	float scale;
+} Instance;
+
+typedef struct
+{
+	GLuint framebuffer;
+	GLuint colorTexture;
+	GLuint depthBuffer;
+	int width;
+	int height;
+} RenderTarget;
+
+static View s_arViews[MAX_VIEWS];
+
+typedef struct
+{
+	int enabled;
+
+	// Bounds and goal of the controller.
+	float minScale;
+	float maxScale;
+	float targetFrameTime;
+
+	// Exponential moving average of the measured frame time.
+	float smoothedFrameTime;
+
+	// Current resolution scale and what the controller did last.
+	float scale;
+	int state;
+
+	// Frames to wait before the next decision, so the average can
+	// catch up with the last change.
+	int settleFrames;
+
+	// Frames spent within budget since the last change.
+	int stableFrames;
+} DynamicResolution;
+
+// Offscreen target the model is drawn into once when replicating views.
+static RenderTarget s_replicaTarget;
+
+// Offscreen target the scene is drawn into when the resolution adapts.
+static RenderTarget s_sceneTarget;
+
+static DynamicResolution s_dynRes = { 0,
+				      DYNRES_MIN_SCALE,
+				      DYNRES_MAX_SCALE,
+				      1.0f / DYNRES_TARGET_FPS,
+				      1.0f / DYNRES_TARGET_FPS,
+				      DYNRES_MAX_SCALE,
+				      DYNRES_HOLD,
+				      0,
+				      0 };
+
+static float s_fStatsTime = 0.0f;
+static float s_fStatsInterval = STATS_INTERVAL;
+
+// Set when the model list changed and discovery replies are stale.
+static int s_bStatusChanged = 0;
+
+static Mesh s_currentMesh;
+
+// Scene of instances drawn instead of the current model when not empty.
+// Instances sharing a mesh are kept next to each other.
+static Instance* s_pInstances = 0;
+static int s_nNumInstances = 0;
+static int s_bBatchInstances = 1;
+static Mesh s_sceneMesh;
+
+static unsigned int s_nDrawCalls = 0;
+
+// Faces submitted and skipped by cluster culling since the last stats print.
+static unsigned int s_nDrawnFaces = 0;
+static unsigned int s_nCulledFaces = 0;
+static unsigned int s_nStatsFrames = 0;
+
+// The newest transform drawn by this frame and when the frame took it
+// up, until the swap that shows it; received is 0 if there is none.
+// With interpolation that is the frame its pose is first drawn in.
+static NetCommand s_inputCommand;
+static uint64_t s_uInputApplied = 0;
+
+// Acknowledge each presented transform to its sender.
+static int s_bAck = 0;
+
+// The same for commands of any kind, and how long the newest one took
+// to reach the screen, for stats queries.
+static uint64_t s_uCommandReceived = 0;
+static uint64_t s_uCommandLatency = 0;
+
+// Timestamped transforms, unused when the delay is 0.
+static MotionBuffer s_motion;
+static float s_fInterpDelay = INTERP_DELAY_MS;
+
+// The commands of the transforms in the jitter buffer by tag, so the
+// one it first shows can be timed and acknowledged.
+typedef struct
+{
+   uint32_t tag;
+   NetCommand command;
+} MotionInput;
+
+static MotionInput s_arMotionInputs[MOTION_MAX_SAMPLES];
+static uint32_t s_uMotionTag = 0;
+
+// Multi-node sync: the frame being drawn and the draw function it wraps.
+static int s_nSyncMode = SYNC_OFF;
+static SyncState s_syncFrame;
+static void (*s_pDrawFrame)(ESContext*) = 0;
+
+// Whether the overlay triangles are upside down, so followers can match.
+static int s_bFlipped = 0;
+
+// Side of the chamber a single view faces, for one node per side.
+static int s_nFace = 0;
+
+///
+// Deterministic run of --bench-render. Frame 0 warms up, frames 1 to
+// frames are measured and their times kept for the report.
+//
+typedef struct
+{
+	const char* path;
+	int frames;
+	int frame;
+	uint64_t frameStart;
+	float* frameTimes;
+} RenderBench;
+
+static RenderBench s_bench = { 0, BENCH_RENDER_FRAMES, 0, 0, 0 };
+
+static const float s_arFullscreenVerts[] = { -1.0f, -1.0f, 0.0f, 0.0f,
+					      1.0f, -1.0f, 1.0f, 0.0f,
+					      1.0f,  1.0f, 1.0f, 1.0f,
+					     -1.0f, -1.0f, 0.0f, 0.0f,
+					      1.0f,  1.0f, 1.0f, 1.0f,
+					     -1.0f,  1.0f, 0.0f, 1.0f };
+
+// Position (xy) and texcoord (uv) for two triangles per view.
+static float s_arCompositeVerts[MAX_VIEWS * 6 * 4];
 
 static float triangleVerts[] = { -1.0f, -1.0f,
 				 -1.0f,  1.0f,
@@ -77,37 +382,123 @@ static float lineVerts[] = { -1.0f, -1.0f,
 			      1.0f, -1.0f };
 
 GLuint colorShader = 0;
-
- static const char* vShaderStr =  
+GLuint blitShader = 0;
+
+// Locations in colorShader for the overlays, looked up once in Init.
+static GLint s_hOverlayColor = -1;
+static GLint s_hOverlayPosition = -1;
+
+// Mesh shaders are built from one source. Variants are made by putting
+// #defines for the features a mesh needs in front of it:
+//   TEXTURED  - sample sTexture with the mesh texcoords
+//   LIT       - light with the mesh normals
+//   INSTANCED - take transforms from the per-instance uniform arrays
+//   VERTEX_LIGHTING - with LIT, do N.L per vertex instead of per pixel
+//   BAKED     - modulate by the baked per-vertex color, instead of LIT
+static const char* vShaderStr =  
       "attribute vec4 vPosition;    \n"
+      "#ifdef TEXTURED\n"
       "attribute vec2 vTexcoord;    \n"
-      "attribute vec3 vNormal;      \n"
       "varying vec2 inTexcoord;\n"
+      "#endif\n"
+      "#ifdef LIT\n"
+      "attribute vec3 vNormal;      \n"
+      "#ifdef VERTEX_LIGHTING\n"
+      "varying float inDiffuse;     \n"
+      "#else\n"
       "varying vec3 inNormal;      \n"
+      "#endif\n"
+      "#endif\n"
+      "#ifdef BAKED\n"
+      "attribute vec4 vColor;       \n"
+      "varying vec4 inColor;        \n"
+      "#endif\n"
+      "#ifdef INSTANCED\n"
+      "attribute float vInstance;   \n"
+      "uniform mat4 mInstanceMVP[" TO_STRING(INSTANCE_BATCH_SIZE) "];\n"
+      "uniform vec2 vInstanceYaw[" TO_STRING(INSTANCE_BATCH_SIZE) "];\n"
+      "#else\n"
       "uniform mat4 mMVPMatrix;        \n"
       "uniform mat4 mNormalMatrix;  \n"
+      "#endif\n"
       "void main()                  \n"
       "{                            \n"
+      "#ifdef INSTANCED\n"
+      "   int i = int(vInstance);   \n"
+      "   mat4 mvp = mInstanceMVP[i];\n"
+      "#else\n"
+      "   mat4 mvp = mMVPMatrix;    \n"
+      "#endif\n"
+      "#ifdef TEXTURED\n"
       "   inTexcoord = vTexcoord;   \n"
-      "   inNormal =  (mNormalMatrix * vec4(vNormal, 0.0)).xyz;      \n"
+      "#endif\n"
+      "#ifdef LIT\n"
+      "#ifdef INSTANCED\n"
+      "   vec2 yaw = vInstanceYaw[i];\n"
+      "   vec3 normal = vec3(yaw.x * vNormal.x - yaw.y * vNormal.z,\n"
+      "                      vNormal.y,\n"
+      "                      yaw.y * vNormal.x + yaw.x * vNormal.z);\n"
+      "#else\n"
+      "   vec3 normal = (mNormalMatrix * vec4(vNormal, 0.0)).xyz;\n"
+      "#endif\n"
+      "#ifdef VERTEX_LIGHTING\n"
+      "   const vec3 lightDir = normalize(vec3(0.577, 0.577, 0.577));\n"
+      "   inDiffuse = max(dot(normal, lightDir), 0.0);\n"
+      "#else\n"
+      "   inNormal = normal;        \n"
+      "#endif\n"
+      "#endif\n"
+      "#ifdef BAKED\n"
+      "   inColor = vColor;         \n"
+      "#endif\n"
       "   vec4 pos = vec4(vPosition.xyz, 1.0);        \n"
-      "   gl_Position = mMVPMatrix * pos;  \n"
+      "   gl_Position = mvp * pos;  \n"
       "}                            \n";
-   
+
 static const char* fShaderStr =  
       "precision mediump float;\n"
+      "#ifdef TEXTURED\n"
       "uniform sampler2D sTexture; \n"
       "varying vec2 inTexcoord;\n"
+      "#endif\n"
+      "#ifdef LIT\n"
+      "#ifdef VERTEX_LIGHTING\n"
+      "varying float inDiffuse;\n"
+      "#else\n"
       "varying vec3 inNormal;\n"
+      "#endif\n"
+      "#endif\n"
+      "#ifdef BAKED\n"
+      "varying vec4 inColor;\n"
+      "#endif\n"
       "void main()                                  \n"
       "{                                            \n"
-      "  const vec3 lightDir = normalize(vec3(0.577, 0.577, 0.577));\n"
+      "#ifdef TEXTURED\n"
       "  vec4 texColor = texture2D(sTexture, inTexcoord);\n"
+      "#else\n"
+      "  vec4 texColor = vec4(1.0);\n"
+      "#endif\n"
+      "#ifdef LIT\n"
+      "#ifdef VERTEX_LIGHTING\n"
+      "  texColor.rgb = texColor.rgb * inDiffuse;\n"
+      "#else\n"
+      "  const vec3 lightDir = normalize(vec3(0.577, 0.577, 0.577));\n"
       "  texColor.rgb = texColor.rgb * max(dot(inNormal, lightDir) , 0.0);\n" // vec4(inNormal, 1.0) * texColor; \n"
+      "#endif\n"
+      "#endif\n"
+      "#ifdef BAKED\n"
+      "  texColor.rgb = texColor.rgb * inColor.rgb;\n"
+      "#endif\n"
       "  gl_FragColor = texColor;"
      //"gl_FragColor = vec4(1.0, 0.0, 0.0, 1.0);\n" 
      "}                                            \n";
 
+static const char* s_arShaderFeatureNames[] = { "TEXTURED",
+						 "LIT",
+						 "INSTANCED",
+						 "VERTEX_LIGHTING",
+						 "BAKED" };
+
 static const char* vColorShader = 
 	"attribute vec4 aPosition; \n"
 	"void main() \n"
@@ -116,9 +507,25 @@ static const char* vColorShader =
 	" gl_Position = pos;}\n"; // aPosition; } \n";
 
 static const char* fColorShader = 
+	"precision mediump float;\n"
 	"uniform vec4 uColor;\n"
 	"void main() { gl_FragColor = uColor; }\n";
 
+static const char* vBlitShader =
+	"attribute vec2 aPosition;\n"
+	"attribute vec2 aTexcoord;\n"
+	"uniform vec2 uTexScale;\n"
+	"varying vec2 vTexcoord;\n"
+	"void main()\n"
+	"{ vTexcoord = aTexcoord * uTexScale;\n"
+	" gl_Position = vec4(aPosition, 0.0, 1.0);}\n";
+
+static const char* fBlitShader =
+	"precision mediump float;\n"
+	"uniform sampler2D sTexture;\n"
+	"varying vec2 vTexcoord;\n"
+	"void main() { gl_FragColor = texture2D(sTexture, vTexcoord); }\n";
+
 
 void UpdateServer();
 
@@ -127,6 +534,30 @@ typedef struct
    // Handle to a program object
    GLuint programObject;
 
+   // Attribute and uniform locations, resolved once in Init
+   GLint hPosition;
+   GLint hTexcoord;
+   GLint hNormal;
+   GLint hInstance;
+   GLint hColor;
+   GLint hTexture;
+   GLint hMVPMatrix;
+   GLint hNormalMatrix;
+   GLint hInstanceMVP;
+   GLint hInstanceYaw;
+
+   // Set once building was tried. A variant that failed keeps program 0
+   // and is not built again.
+   int built;
+
+} ShaderProgram;
+
+typedef struct
+{
+   // Mesh program variants by feature bits, built when the first mesh
+   // that needs them is loaded
+   ShaderProgram variants[SHADER_VARIANT_COUNT];
+
 } UserData;
 
 ///
@@ -226,435 +657,821 @@ GLuint CreateShaderProgram(const char* vertShader, const char* fragShader)
    return programObject;
 }
 
+///
+// Build the mesh program for a set of feature bits, from the binary
+// cache if possible, and look up its attributes and uniforms once
+// instead of every frame. Inputs the variant does not use stay -1.
+//
+void CreateShaderVariant(ShaderProgram* pProgram, int nFlags)
+{
+   char arHeader[SHADER_HEADER_SIZE];
+   int nLength = 0;
+
+   arHeader[0] = 0;
+   for (int i = 0; i < SHADER_FEATURE_COUNT; i++)
+   {
+      if (nFlags & (1 << i))
+      {
+         nLength += snprintf(arHeader + nLength,
+                             SHADER_HEADER_SIZE - nLength,
+                             "#define %s\n",
+                             s_arShaderFeatureNames[i]);
+      }
+   }
+
+   std::string vertSrc = std::string(arHeader) + vShaderStr;
+   std::string fragSrc = std::string(arHeader) + fShaderStr;
+
+   GLuint program = LoadCachedProgram(vertSrc.c_str(), fragSrc.c_str());
+
+   if (program != 0)
+   {
+      printf("Shader variant 0x%x loaded from cache.\n", nFlags);
+   }
+   else
+   {
+      program = CreateShaderProgram(vertSrc.c_str(), fragSrc.c_str());
+
+      if (program == 0)
+      {
+         printf("Shader variant 0x%x failed to build, meshes that need it are not drawn.\n", nFlags);
+         pProgram->programObject = 0;
+         return;
+      }
+
+      SaveProgramBinary(program, vertSrc.c_str(), fragSrc.c_str());
+      printf("Shader variant 0x%x compiled.\n", nFlags);
+   }
+
+   pProgram->programObject = program;
+
+   pProgram->hPosition = glGetAttribLocation(program, "vPosition");
+   if (pProgram->hPosition == -1)
+   {
+	   printf("Failed to find position attribute\n");
+   }
+
+   pProgram->hTexcoord = glGetAttribLocation(program, "vTexcoord");
+   pProgram->hNormal = glGetAttribLocation(program, "vNormal");
+   pProgram->hTexture = glGetUniformLocation(program, "sTexture");
+   pProgram->hMVPMatrix = glGetUniformLocation(program, "mMVPMatrix");
+   pProgram->hNormalMatrix = glGetUniformLocation(program, "mNormalMatrix");
+   pProgram->hInstance = glGetAttribLocation(program, "vInstance");
+   pProgram->hColor = glGetAttribLocation(program, "vColor");
+   pProgram->hInstanceMVP = glGetUniformLocation(program, "mInstanceMVP");
+   pProgram->hInstanceYaw = glGetUniformLocation(program, "vInstanceYaw");
+}
+
+///
+// The mesh program with the given feature bits. Meshes build theirs
+// when they are loaded, so during a frame this is only a lookup.
+//
+const ShaderProgram* GetShaderVariant(UserData* userData, int nFlags)
+{
+   ShaderProgram* pProgram = &userData->variants[nFlags];
+
+   if (!pProgram->built)
+   {
+      CreateShaderVariant(pProgram, nFlags);
+      pProgram->built = 1;
+   }
+
+   return pProgram;
+}
+
+// The user data Init created, for building variants outside of Draw.
+static UserData* s_pUserData = 0;
+
 ///
 // Initialize the shader and program object
 //
 int Init ( ESContext *esContext )
 {
-   esContext->userData = malloc(sizeof(UserData));
+   esContext->userData = calloc(1, sizeof(UserData));
+   s_pUserData = (UserData*) esContext->userData;
 
-   UserData *userData = (UserData*) esContext->userData;
+   // Mesh programs are built once the meshes that need them are loaded
+   InitShaderCache(SHADER_CACHE_DIR);
 
-   // Store the program object
-   userData->programObject = CreateShaderProgram(vShaderStr, fShaderStr);
+   // Store the program objects
    colorShader = CreateShaderProgram(vColorShader, fColorShader);
+   blitShader = CreateShaderProgram(vBlitShader, fBlitShader);
+
+   s_hOverlayColor = glGetUniformLocation(colorShader, "uColor");
+   s_hOverlayPosition = glGetAttribLocation(colorShader, "aPosition");
 
    glClearColor ( 0.0f, 0.0f, 0.0f, 1.0f );
 
    return GL_TRUE;
 }
 
-void ReadAsset(const char* pFileName,
-	char*       arBuffer,
-	int         nMaxSize)
+///
+// Create a texture from RGB rows, as DecodeBMP returns them.
+//
+GLuint UploadTexture(const unsigned char* pData, int nWidth, int nHeight)
 {
-	FILE* pFile = 0;
-	int   nFileSize = 0;
+	GLuint texHandle = 0;
 
-	// Open the requested file.
-	pFile = fopen(pFileName, "rb");
+	// Create texture 
+	// Generate and bind as current texture
+	glGenTextures(1, &texHandle);
+	glBindTexture(GL_TEXTURE_2D, texHandle);
+
+	printf("TexHandle : %d\n", texHandle);
+
+	// Set default texture paramters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// Allocate graphics memory and upload texture
+	TraceBegin("UploadTexture");
+	glTexImage2D(GL_TEXTURE_2D,
+		0,
+		GL_RGB,
+		nWidth,
+		nHeight,
+		0,
+		GL_RGB,
+		GL_UNSIGNED_BYTE,
+		pData);
+	TraceEnd("UploadTexture", nWidth * nHeight * 3);
+	MemoryTrack(MEMORY_TEXTURE, texHandle, MemoryTextureBytes(nWidth, nHeight, 3, 0));
 
-	// Check if file was found
-	if (pFile == 0)
-	{
-		printf("Asset could not be opened.");
-		return;
-	}
+	return texHandle;
+}
+
+GLuint LoadBMP(const char* path)
+{
+	GLuint texHandle = 0;
+	int nWidth = 0;
+	int nHeight = 0;
+
+	ScopedTrace trace("LoadBMP");
+	ScopedMemoryAsset asset(path);
 
-	// Check the file size.
-	fseek(pFile, 0, SEEK_END);
-	nFileSize = ftell(pFile);
-	fseek(pFile, 0, SEEK_SET);
+	unsigned char* pData = DecodeBMP(path, &nWidth, &nHeight);
 
-	// Check if file is too big
-	if (nFileSize > nMaxSize)
+	if (pData != 0)
 	{
-		printf("File is too large.");
-		fclose(pFile);
-		return;
+		texHandle = UploadTexture(pData, nWidth, nHeight);
+
+		MemoryRelease(MEMORY_HEAP, (uintptr_t) pData);
+		delete[] pData;
+		pData = nullptr;
 	}
 
-	// Clear the buffer that will hold contents of obj file
-	memset(arBuffer, 0, nFileSize + 1);
+	return texHandle;
+}
+
+///
+// Geometric normal of face i of an interleaved vertex buffer, assuming
+// counter clockwise winding. Not normalized.
+//
+void FaceNormal(const float* pVB, int i, float* pNormal)
+{
+	const float* p0 = &pVB[i * 24 + 0];
+	const float* p1 = &pVB[i * 24 + 8];
+	const float* p2 = &pVB[i * 24 + 16];
 
-	// Read from file and store in character buffer.
-	fread(arBuffer, nFileSize, 1, pFile);
+	float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
 
-	// Close file, it is no longer needed.
-	fclose(pFile);
+	pNormal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	pNormal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	pNormal[2] = e1[0] * e2[1] - e1[1] * e2[0];
 }
 
-void GetCounts(const char* pFileName,
-	int& nNumVerts,
-	int& nNumUVs,
-	int& nNumNormals,
-	int& nNumFaces)
+struct PositionKey
 {
-	int nFileSize = 0;
-	int nLineLength = 0;
-	char* pNewLine = 0;
-	char* pStr = 0;
-	FILE* pFile = 0;
+	float x;
+	float y;
+	float z;
 
-	nNumVerts = 0;
-	nNumFaces = 0;
-	nNumNormals = 0;
-	nNumUVs = 0;
+	bool operator==(const PositionKey& other) const
+	{
+		return x == other.x && y == other.y && z == other.z;
+	}
+};
 
-	ReadAsset(pFileName,
-		s_arFileBuffer,
-		OBJ_MAX_SIZE);
+struct PositionKeyHash
+{
+	size_t operator()(const PositionKey& key) const
+	{
+		unsigned int arBits[3];
+		memcpy(arBits, &key, sizeof(arBits));
+		return (arBits[0] * 73856093u) ^ (arBits[1] * 19349663u) ^ (arBits[2] * 83492791u);
+	}
+};
 
-	pStr = s_arFileBuffer;
+///
+// Decide the front face winding by checking which way the geometric
+// normals point compared to the normals stored in the file, and check
+// whether the mesh is closed by counting the faces on every edge.
+// Vertices are welded by position so texture seams do not open it up.
+//
+void DetectWinding(Mesh* pMesh, const float* pVB)
+{
+	int nFaces = pMesh->faces;
+	int nAgree = 0;
+	int nDisagree = 0;
 
-	while (1)
+	for (int i = 0; i < nFaces; i++)
 	{
-		// Find the next newline
-		pNewLine = strchr(pStr, '\n');
+		float arNormal[3];
+		FaceNormal(pVB, i, arNormal);
 
-		// If a null pointer was returned, that means
-		// a null terminator was hit.
-		if (pNewLine == 0)
+		float fDot = 0.0f;
+		for (int j = 0; j < 3; j++)
 		{
-			break;
+			const float* pN = &pVB[i * 24 + j * 8 + 5];
+			fDot += arNormal[0] * pN[0] + arNormal[1] * pN[1] + arNormal[2] * pN[2];
 		}
 
-		// Parse the beginning of each line to count
-		// the total number of vertices/UVs/normals/faces.
-		if (pStr[0] == 'v' &&
-			pStr[1] == ' ')
+		if (fDot > 0.0f)
+			nAgree++;
+		else if (fDot < 0.0f)
+			nDisagree++;
+	}
+
+	pMesh->clockwise = (nDisagree > nAgree);
+
+	// Weld positions
+	std::unordered_map<PositionKey, unsigned int, PositionKeyHash> positionIds;
+	unsigned int* pIds = new unsigned int[nFaces * 3];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pIds, nFaces * 3 * sizeof(unsigned int));
+
+	for (int i = 0; i < nFaces * 3; i++)
+	{
+		PositionKey key = { pVB[i * 8 + 0], pVB[i * 8 + 1], pVB[i * 8 + 2] };
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash>::iterator it = positionIds.find(key);
+
+		if (it == positionIds.end())
 		{
-			nNumVerts++;
+			unsigned int unId = positionIds.size();
+			positionIds[key] = unId;
+			pIds[i] = unId;
 		}
-		else if (pStr[0] == 'v' &&
-			pStr[1] == 't')
+		else
 		{
-			nNumUVs++;
+			pIds[i] = it->second;
 		}
-		else if (pStr[0] == 'v' &&
-			pStr[1] == 'n')
+	}
+
+	// Count faces per undirected edge
+	std::unordered_map<unsigned long long, int> edgeCounts;
+
+	for (int i = 0; i < nFaces; i++)
+	{
+		for (int j = 0; j < 3; j++)
 		{
-			nNumNormals++;
+			unsigned long long a = pIds[i * 3 + j];
+			unsigned long long b = pIds[i * 3 + (j + 1) % 3];
+
+			if (a > b)
+			{
+				unsigned long long tmp = a;
+				a = b;
+				b = tmp;
+			}
+
+			edgeCounts[(a << 32) | b]++;
 		}
-		else if (pStr[0] == 'f')
+	}
+
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pIds);
+	delete[] pIds;
+
+	pMesh->closed = (nFaces > 0);
+	for (std::unordered_map<unsigned long long, int>::iterator it = edgeCounts.begin();
+	     it != edgeCounts.end();
+	     ++it)
+	{
+		if (it->second != 2)
 		{
-			nNumFaces++;
+			pMesh->closed = 0;
+			break;
 		}
-
-		// Now move the pointer to the next line.
-		pStr = pNewLine + 1;
 	}
 
-	printf("Face Count: %d", nNumFaces);
+	printf("Mesh winding: %s, %s\n",
+		pMesh->clockwise ? "clockwise" : "counter clockwise",
+		pMesh->closed ? "closed" : "open");
 }
 
-GLuint LoadBMP(const char* path)
+///
+// Normal direction bin of a face: which cube face the normal points
+// at, and which cell of a grid on that face.
+//
+int NormalBin(const float* pNormal)
 {
-	GLuint texHandle = 0;
+	float ax = fabsf(pNormal[0]);
+	float ay = fabsf(pNormal[1]);
+	float az = fabsf(pNormal[2]);
+	int nAxis = 0;
+	float fMajor = ax;
+	float fU = pNormal[1];
+	float fV = pNormal[2];
+
+	if (ay >= ax && ay >= az)
+	{
+		nAxis = 1;
+		fMajor = ay;
+		fU = pNormal[0];
+		fV = pNormal[2];
+	}
+	else if (az >= ax && az >= ay)
+	{
+		nAxis = 2;
+		fMajor = az;
+		fU = pNormal[0];
+		fV = pNormal[1];
+	}
 
-	ReadAsset(path, s_arFileBuffer, BMP_MAX_SIZE);
-	char* data = s_arFileBuffer;
+	int nFace = nAxis * 2 + (pNormal[nAxis] < 0.0f);
+	int nU = (int) ((fU / fMajor * 0.5f + 0.5f) * CLUSTER_NORMAL_GRID);
+	int nV = (int) ((fV / fMajor * 0.5f + 0.5f) * CLUSTER_NORMAL_GRID);
 
-	unsigned char* pData = 0;
-	unsigned char* pSrc = 0;
+	if (nU >= CLUSTER_NORMAL_GRID)
+		nU = CLUSTER_NORMAL_GRID - 1;
+	if (nV >= CLUSTER_NORMAL_GRID)
+		nV = CLUSTER_NORMAL_GRID - 1;
 
-	int nWidth = 0;
-	int nHeight = 0;
-	unsigned short sBPP = 0;
+	return (nFace * CLUSTER_NORMAL_GRID + nU) * CLUSTER_NORMAL_GRID + nV;
+}
 
-	// Grab the dimensions of texture
-	nWidth = *reinterpret_cast<int*>(&data[18]);
-	nHeight = *reinterpret_cast<int*>(&data[22]);
-	sBPP = *reinterpret_cast<short*>(&data[28]);
+///
+// Reorder the faces of a vertex buffer so faces pointing the same way
+// are adjacent, then cut them into clusters with a bounding sphere and
+// normal cone each. Degenerate faces go in a last bin whose clusters
+// are never culled.
+//
+void BuildClusters(Mesh* pMesh, float* pVB)
+{
+	int nFaces = pMesh->faces;
+	int arBinStart[CLUSTER_NORMAL_BINS + 2];
+	int* pBins = new int[nFaces];
+	float* pNormals = new float[nFaces * 3];
 
-	printf("Width: %d\n", nWidth);
-	printf("Height: %d\n", nHeight);
-	printf("BPP: %d\n", sBPP);
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pBins, nFaces * sizeof(int));
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pNormals, nFaces * 3 * sizeof(float));
 
+	memset(arBinStart, 0, sizeof(arBinStart));
 
-	if (nWidth > MAX_TEXTURE_SIZE ||
-		nHeight > MAX_TEXTURE_SIZE)
+	// Bin faces by normal direction
+	for (int i = 0; i < nFaces; i++)
 	{
-		// Texture too big.
-		printf("Texture too big!");
-	}
+		float* pN = &pNormals[i * 3];
+		FaceNormal(pVB, i, pN);
 
-	if (sBPP == 24)
-	{
-		pSrc = reinterpret_cast<unsigned char*>(&data[54]);
+		if (pMesh->clockwise)
+		{
+			pN[0] = -pN[0];
+			pN[1] = -pN[1];
+			pN[2] = -pN[2];
+		}
 
-		pData = new unsigned char[nWidth * nHeight * 4];
+		float fLength = sqrtf(pN[0] * pN[0] + pN[1] * pN[1] + pN[2] * pN[2]);
 
-		unsigned char* pDst = pData;
+		if (fLength > 0.0f)
+		{
+			pN[0] /= fLength;
+			pN[1] /= fLength;
+			pN[2] /= fLength;
+			pBins[i] = NormalBin(pN);
+		}
+		else
+		{
+			pBins[i] = CLUSTER_NORMAL_BINS;
+		}
 
-		int nPadding = (nWidth * 3) % 4;
+		arBinStart[pBins[i] + 1]++;
+	}
 
-		if (nPadding != 0)
-			nPadding = 4 - nPadding;
+	for (int b = 0; b < CLUSTER_NORMAL_BINS + 1; b++)
+	{
+		arBinStart[b + 1] += arBinStart[b];
+	}
 
-		for (int i = 0; i < nHeight; i++)
-		{
-			for (int j = 0; j < nWidth; j++)
-			{
-				pDst[0] = pSrc[2];
-				pDst[1] = pSrc[1];
-				pDst[2] = pSrc[0];
+	// Counting sort keeps the file order inside each bin, which
+	// tends to be spatially coherent.
+	int* pOrder = new int[nFaces];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pOrder, nFaces * sizeof(int));
+	int arBinFill[CLUSTER_NORMAL_BINS + 1];
+	memcpy(arBinFill, arBinStart, sizeof(arBinFill));
 
-				pDst += 3;
-				pSrc += 3;
-			}
+	for (int i = 0; i < nFaces; i++)
+	{
+		pOrder[arBinFill[pBins[i]]++] = i;
+	}
 
-			pSrc += nPadding;
-		}
+	float* pSorted = new float[nFaces * 24];
+	float* pSortedNormals = new float[nFaces * 3];
 
-		// Create texture 
-		// Generate and bind as current texture
-		glGenTextures(1, &texHandle);
-		glBindTexture(GL_TEXTURE_2D, texHandle);
-
-		printf("TexHandle : %d\n", texHandle);
-
-		// Set default texture paramters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		// Allocate graphics memory and upload texture
-		glTexImage2D(GL_TEXTURE_2D,
-			0,
-			GL_RGB,
-			nWidth,
-			nHeight,
-			0,
-			GL_RGB,
-			GL_UNSIGNED_BYTE,
-			pData);
-
-		delete pData;
-		pData = nullptr;
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pSorted, nFaces * 24 * sizeof(float));
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pSortedNormals, nFaces * 3 * sizeof(float));
+
+	for (int i = 0; i < nFaces; i++)
+	{
+		memcpy(&pSorted[i * 24], &pVB[pOrder[i] * 24], 24 * sizeof(float));
+		memcpy(&pSortedNormals[i * 3], &pNormals[pOrder[i] * 3], 3 * sizeof(float));
 	}
-	else
+
+	memcpy(pVB, pSorted, nFaces * 24 * sizeof(float));
+
+	// Cut every bin into clusters
+	int nNumClusters = 0;
+	for (int b = 0; b < CLUSTER_NORMAL_BINS + 1; b++)
 	{
-		// Unsupported bits per pixel!
-		printf("Unsupported BPP");
+		int nBinFaces = arBinStart[b + 1] - arBinStart[b];
+		nNumClusters += (nBinFaces + CLUSTER_MAX_FACES - 1) / CLUSTER_MAX_FACES;
 	}
 
-	return texHandle;
-}
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pMesh->pClusters);
+	delete[] pMesh->pClusters;
+	pMesh->pClusters = new Cluster[nNumClusters];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pMesh->pClusters, nNumClusters * sizeof(Cluster));
+	pMesh->numClusters = 0;
 
-void GenerateVertexBuffer(int nNumFaces,
-	float* pVertices,
-	float* pUVs,
-	float* pNormals,
-	int*   pFaces,
-	float* pVB)
-{
-	if (pVB != 0)
+	for (int b = 0; b < CLUSTER_NORMAL_BINS + 1; b++)
 	{
-		//Add vertex data for each face	
-		for (int i = 0; i < nNumFaces; i++)
+		for (int nFirst = arBinStart[b]; nFirst < arBinStart[b + 1]; nFirst += CLUSTER_MAX_FACES)
 		{
-			//Vertex 1
-			pVB[i * 24 + 0] = pVertices[(pFaces[i * 9 + 0] - 1) * 3 + 0];
-			pVB[i * 24 + 1] = pVertices[(pFaces[i * 9 + 0] - 1) * 3 + 1];
-			pVB[i * 24 + 2] = pVertices[(pFaces[i * 9 + 0] - 1) * 3 + 2];
-			pVB[i * 24 + 3] = pUVs[(pFaces[i * 9 + 1] - 1) * 2 + 0];
-			pVB[i * 24 + 4] = pUVs[(pFaces[i * 9 + 1] - 1) * 2 + 1];
-			pVB[i * 24 + 5] = pNormals[(pFaces[i * 9 + 2] - 1) * 3 + 0];
-			pVB[i * 24 + 6] = pNormals[(pFaces[i * 9 + 2] - 1) * 3 + 1];
-			pVB[i * 24 + 7] = pNormals[(pFaces[i * 9 + 2] - 1) * 3 + 2];
-
-			//Vertex 2
-			pVB[i * 24 + 8] = pVertices[(pFaces[i * 9 + 3] - 1) * 3 + 0];
-			pVB[i * 24 + 9] = pVertices[(pFaces[i * 9 + 3] - 1) * 3 + 1];
-			pVB[i * 24 + 10] = pVertices[(pFaces[i * 9 + 3] - 1) * 3 + 2];
-			pVB[i * 24 + 11] = pUVs[(pFaces[i * 9 + 4] - 1) * 2 + 0];
-			pVB[i * 24 + 12] = pUVs[(pFaces[i * 9 + 4] - 1) * 2 + 1];
-			pVB[i * 24 + 13] = pNormals[(pFaces[i * 9 + 5] - 1) * 3 + 0];
-			pVB[i * 24 + 14] = pNormals[(pFaces[i * 9 + 5] - 1) * 3 + 1];
-			pVB[i * 24 + 15] = pNormals[(pFaces[i * 9 + 5] - 1) * 3 + 2];
-
-			//Vertex 3
-			pVB[i * 24 + 16] = pVertices[(pFaces[i * 9 + 6] - 1) * 3 + 0];
-			pVB[i * 24 + 17] = pVertices[(pFaces[i * 9 + 6] - 1) * 3 + 1];
-			pVB[i * 24 + 18] = pVertices[(pFaces[i * 9 + 6] - 1) * 3 + 2];
-			pVB[i * 24 + 19] = pUVs[(pFaces[i * 9 + 7] - 1) * 2 + 0];
-			pVB[i * 24 + 20] = pUVs[(pFaces[i * 9 + 7] - 1) * 2 + 1];
-			pVB[i * 24 + 21] = pNormals[(pFaces[i * 9 + 8] - 1) * 3 + 0];
-			pVB[i * 24 + 22] = pNormals[(pFaces[i * 9 + 8] - 1) * 3 + 1];
-			pVB[i * 24 + 23] = pNormals[(pFaces[i * 9 + 8] - 1) * 3 + 2];
-		}
-	}
-}
+			Cluster* pCluster = &pMesh->pClusters[pMesh->numClusters++];
+			int nCount = arBinStart[b + 1] - nFirst;
 
-unsigned int LoadOBJ(const char*   pFileName,
-	unsigned int& nFaces,
-	float** pVertexArray)
-{
-	int i = 0;
-	char* pStr = 0;
-	char* pNewLine = 0;
-	int v = 0;
-	int n = 0;
-	int t = 0;
-	int f = 0;
-	unsigned int unVBO = 0;
-	float* pVertexBuffer = 0;
+			if (nCount > CLUSTER_MAX_FACES)
+				nCount = CLUSTER_MAX_FACES;
 
-	int nNumVerts = 0;
-	int nNumFaces = 0;
-	int nNumNormals = 0;
-	int nNumUVs = 0;
+			pCluster->firstFace = nFirst;
+			pCluster->numFaces = nCount;
 
-	float* pVertices = 0;
-	float* pNormals = 0;
-	float* pUVs = 0;
-	int*   pFaces = 0;
+			// Bounding sphere around the center of the vertex bounds
+			float arMin[3] = { pSorted[nFirst * 24 + 0], pSorted[nFirst * 24 + 1], pSorted[nFirst * 24 + 2] };
+			float arMax[3] = { arMin[0], arMin[1], arMin[2] };
 
-	// Retrieve the counts for positions/UVs/normals/faces
-	GetCounts(pFileName,
-		nNumVerts,
-		nNumUVs,
-		nNumNormals,
-		nNumFaces);
+			for (int v = nFirst * 3; v < (nFirst + nCount) * 3; v++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					arMin[k] = fminf(arMin[k], pSorted[v * 8 + k]);
+					arMax[k] = fmaxf(arMax[k], pSorted[v * 8 + k]);
+				}
+			}
 
-	// Set the number of faces output
-	nFaces = nNumFaces;
+			float fRadius2 = 0.0f;
+			for (int k = 0; k < 3; k++)
+			{
+				pCluster->center[k] = (arMin[k] + arMax[k]) * 0.5f;
+			}
 
-	// Allocate arrays to store vertex data
-	pVertices = new float[nNumVerts * 3];
-	pNormals = new float[nNumNormals * 3];
-	pUVs = new float[nNumUVs * 2];
-	pFaces = new   int[nNumFaces * 9];
+			for (int v = nFirst * 3; v < (nFirst + nCount) * 3; v++)
+			{
+				float dx = pSorted[v * 8 + 0] - pCluster->center[0];
+				float dy = pSorted[v * 8 + 1] - pCluster->center[1];
+				float dz = pSorted[v * 8 + 2] - pCluster->center[2];
+				fRadius2 = fmaxf(fRadius2, dx * dx + dy * dy + dz * dz);
+			}
 
-	// Set string pointer to beginning of file buffer
-	pStr = s_arFileBuffer;
+			pCluster->radius = sqrtf(fRadius2);
 
-	// Loop until end of file, reading line by line.
-	while (1)
-	{
-		pNewLine = strchr(pStr, '\n');
+			// Normal cone around the average face normal
+			float arAxis[3] = { 0.0f, 0.0f, 0.0f };
 
-		if (pNewLine == 0)
-		{
-			break;
-		}
+			for (int i = nFirst; i < nFirst + nCount; i++)
+			{
+				arAxis[0] += pSortedNormals[i * 3 + 0];
+				arAxis[1] += pSortedNormals[i * 3 + 1];
+				arAxis[2] += pSortedNormals[i * 3 + 2];
+			}
 
-		if (pStr[0] == 'v' &&
-			pStr[1] == ' ')
-		{
-			// Extract X/Y/Z coordinates
-			pStr = &pStr[2];
-			pStr = strtok(pStr, " ");
-			pVertices[v * 3] = (float)atof(pStr);
-			pStr = strtok(0, " ");
-			pVertices[v * 3 + 1] = (float)atof(pStr);
-			pStr = strtok(0, " \n\r");
-			pVertices[v * 3 + 2] = (float)atof(pStr);
-
-			// Increase the number of vertices
-			v++;
-		}
-		else if (pStr[0] == 'v' &&
-			pStr[1] == 't')
-		{
-			// Extract U/V coordinates
-			pStr = &pStr[3];
-			pStr = strtok(pStr, " ");
-			pUVs[t * 2] = (float)atof(pStr);
-			pStr = strtok(0, " \n\r");
-			pUVs[t * 2 + 1] = (float)atof(pStr);
-
-			// Increase number of texcoords
-			t++;
-		}
-		else if (pStr[0] == 'v' &&
-			pStr[1] == 'n')
-		{
-			pStr = &pStr[3];
-			pStr = strtok(pStr, " ");
-			pNormals[n * 3] = (float)atof(pStr);
-			pStr = strtok(0, " ");
-			pNormals[n * 3 + 1] = (float)atof(pStr);
-			pStr = strtok(0, " \n\r");
-			pNormals[n * 3 + 2] = (float)atof(pStr);
-
-			// Increase number of normals
-			n++;
-		}
-		else if (pStr[0] == 'f')
-		{
-			pStr = &pStr[2];
+			float fLength = sqrtf(arAxis[0] * arAxis[0] + arAxis[1] * arAxis[1] + arAxis[2] * arAxis[2]);
+			float fMinDot = 1.0f;
 
-			// Parse and convert all 9 indices.
-			for (i = 0; i < 9; i++)
+			if (fLength > 0.0f && b < CLUSTER_NORMAL_BINS)
 			{
-				if (i == 0)
+				for (int k = 0; k < 3; k++)
 				{
-					pStr = strtok(pStr, " /\n\r");
+					arAxis[k] /= fLength;
 				}
-				else
+
+				for (int i = nFirst; i < nFirst + nCount; i++)
 				{
-					pStr = strtok(0, " /\n\r");
+					const float* pN = &pSortedNormals[i * 3];
+					fMinDot = fminf(fMinDot, pN[0] * arAxis[0] + pN[1] * arAxis[1] + pN[2] * arAxis[2]);
 				}
-				pFaces[f * 9 + i] = atoi(pStr);
+			}
+			else
+			{
+				fMinDot = -1.0f;
 			}
 
-			// Increase the face count
-			f++;
-		}
+			memcpy(pCluster->axis, arAxis, sizeof(arAxis));
 
-		// Now move the pointer to the next line.
-		pStr = pNewLine + 1;
+			// A cone wider than a hemisphere can always be seen.
+			pCluster->cutoff = (fMinDot <= 0.0f) ? 2.0f : sqrtf(1.0f - fMinDot * fMinDot);
+		}
 	}
 
-	// From the separate arrays, create one big buffer
-	// that has the vertex data interleaved.
-	pVertexBuffer = new float[nNumFaces * 24];
-	GenerateVertexBuffer(nNumFaces,
-		pVertices,
-		pUVs,
-		pNormals,
-		pFaces,
-		pVertexBuffer);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pBins);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pNormals);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pOrder);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pSorted);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pSortedNormals);
 
-	printf("Generated Veretex Buffer.\n");
-
-	// Free arrays made to hold data.
-	delete[] pVertices;
-	pVertices = 0;
+	delete[] pBins;
 	delete[] pNormals;
-	pNormals = 0;
-	delete[] pUVs;
-	pUVs = 0;
-	delete[] pFaces;
-	pFaces = 0;
+	delete[] pOrder;
+	delete[] pSorted;
+	delete[] pSortedNormals;
 
-	// Create the Vertex Buffer Object and fill it with vertex data
-	glGenBuffers(1, &unVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, unVBO);
-	glBufferData(GL_ARRAY_BUFFER,
-		sizeof(float) * (nNumFaces) * 24,
-		pVertexBuffer,
-		GL_STATIC_DRAW);
+	printf("Built %d clusters.\n", pMesh->numClusters);
+}
 
-	// Delete the clientside buffer, since it is no longer needed.
+///
+// Shader features for the attributes an OBJ file has.
+//
+int ShaderFlagsForOBJ(int nAttributes)
+{
+	int nFlags = 0;
 
-	if (pVertexArray != 0)
-	{
-		*pVertexArray = pVertexBuffer;
-	}
-	else
-	{
-		delete[] pVertexBuffer;
-		pVertexBuffer = 0;
-	}
+	if (nAttributes & OBJ_HAS_TEXCOORDS)
+		nFlags |= SHADER_TEXTURED;
+	if (nAttributes & OBJ_HAS_NORMALS)
+		nFlags |= SHADER_LIT;
 
-	return unVBO;
+	return nFlags;
 }
-void DrawTriangles()
-{
+
+///
+// Pick where a mesh with normals gets its lighting computed.
+//
+int ApplyLightingMode(int nFlags)
+{
+	if (!(nFlags & SHADER_LIT))
+		return nFlags;
+
+	if (lightingMode == LIGHTING_VERTEX)
+		return nFlags | SHADER_VERTEX_LIGHTING;
+
+	if (lightingMode == LIGHTING_BAKED)
+		return (nFlags & ~SHADER_LIT) | SHADER_BAKED;
+
+	return nFlags;
+}
+
+///
+// Upload an interleaved vertex buffer for a mesh, after working out its
+// winding and culling clusters. Small meshes also get a batch buffer
+// for pseudo-instancing.
+//
+unsigned int CreateMeshBuffer(Mesh* pMesh, float* pVertexBuffer)
+{
+	unsigned int unVBO = 0;
+
+	pMesh->shaderFlags = ApplyLightingMode(pMesh->shaderFlags);
+
+	TraceBegin("DetectWinding");
+	DetectWinding(pMesh, pVertexBuffer);
+	TraceEnd("DetectWinding", -1);
+
+	TraceBegin("BuildClusters");
+	BuildClusters(pMesh, pVertexBuffer);
+	TraceEnd("BuildClusters", -1);
+
+	// Create the Vertex Buffer Object and fill it with vertex data
+	TraceBegin("UploadVertices");
+	glGenBuffers(1, &unVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, unVBO);
+	glBufferData(GL_ARRAY_BUFFER,
+		sizeof(float) * (pMesh->faces) * 24,
+		pVertexBuffer,
+		GL_STATIC_DRAW);
+	TraceEnd("UploadVertices", sizeof(float) * (pMesh->faces) * 24);
+	MemoryTrack(MEMORY_BUFFER, unVBO, sizeof(float) * (pMesh->faces) * 24);
+
+	pMesh->batchVbo = 0;
+	pMesh->batchSize = 0;
+
+	if (pMesh->faces > 0 && pMesh->faces <= INSTANCE_MAX_MESH_FACES)
+	{
+		int nVerts = pMesh->faces * 3;
+		float* pBatch = new float[INSTANCE_BATCH_SIZE * nVerts * 9];
+		MemoryTrack(MEMORY_HEAP, (uintptr_t) pBatch, sizeof(float) * INSTANCE_BATCH_SIZE * nVerts * 9);
+		float* pDst = pBatch;
+
+		// Each copy is the mesh followed by the index of the copy
+		for (int i = 0; i < INSTANCE_BATCH_SIZE; i++)
+		{
+			for (int v = 0; v < nVerts; v++)
+			{
+				memcpy(pDst, &pVertexBuffer[v * 8], 8 * sizeof(float));
+				pDst[8] = (float) i;
+				pDst += 9;
+			}
+		}
+
+		TraceBegin("UploadBatch");
+		glGenBuffers(1, &pMesh->batchVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, pMesh->batchVbo);
+		glBufferData(GL_ARRAY_BUFFER,
+			sizeof(float) * INSTANCE_BATCH_SIZE * nVerts * 9,
+			pBatch,
+			GL_STATIC_DRAW);
+		TraceEnd("UploadBatch", sizeof(float) * INSTANCE_BATCH_SIZE * nVerts * 9);
+		MemoryTrack(MEMORY_BUFFER, pMesh->batchVbo, sizeof(float) * INSTANCE_BATCH_SIZE * nVerts * 9);
+
+		pMesh->batchSize = INSTANCE_BATCH_SIZE;
+
+		MemoryRelease(MEMORY_HEAP, (uintptr_t) pBatch);
+		delete[] pBatch;
+	}
+
+	pMesh->colorVbo = 0;
+
+	if (pMesh->shaderFlags & SHADER_BAKED)
+	{
+		int nVerts = pMesh->faces * 3;
+		int nCopies = (pMesh->batchSize > 0) ? pMesh->batchSize : 1;
+		unsigned char* pColors = new unsigned char[nCopies * nVerts * 4];
+		MemoryTrack(MEMORY_HEAP, (uintptr_t) pColors, nCopies * nVerts * 4);
+
+		BakeVertexLighting(pVertexBuffer, nVerts, pColors);
+
+		for (int i = 1; i < nCopies; i++)
+		{
+			memcpy(&pColors[i * nVerts * 4], pColors, nVerts * 4);
+		}
+
+		TraceBegin("UploadColors");
+		glGenBuffers(1, &pMesh->colorVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, pMesh->colorVbo);
+		glBufferData(GL_ARRAY_BUFFER,
+			nCopies * nVerts * 4,
+			pColors,
+			GL_STATIC_DRAW);
+		TraceEnd("UploadColors", nCopies * nVerts * 4);
+		MemoryTrack(MEMORY_BUFFER, pMesh->colorVbo, nCopies * nVerts * 4);
+
+		MemoryRelease(MEMORY_HEAP, (uintptr_t) pColors);
+		delete[] pColors;
+	}
+
+	// Compiling now keeps a model switch from stalling the next frame
+	if (s_pUserData != 0)
+	{
+		GetShaderVariant(s_pUserData, pMesh->shaderFlags);
+
+		if (pMesh->batchVbo != 0)
+			GetShaderVariant(s_pUserData, pMesh->shaderFlags | SHADER_INSTANCED);
+	}
+
+	return unVBO;
+}
+
+///
+// Load an OBJ file into a vertex buffer object, working out the
+// winding and culling clusters of the mesh on the way.
+//
+unsigned int LoadOBJ(const char*   pFileName,
+	Mesh*         pMesh,
+	float** pVertexArray)
+{
+	unsigned int unVBO = 0;
+	float* pVertexBuffer = 0;
+
+	ScopedTrace trace("LoadOBJ");
+	ScopedMemoryAsset asset(pFileName);
+
+	int nAttributes = 0;
+
+	pVertexBuffer = ParseOBJ(pFileName, pMesh->faces, nAttributes);
+	pMesh->shaderFlags = ShaderFlagsForOBJ(nAttributes);
+
+	unVBO = CreateMeshBuffer(pMesh, pVertexBuffer);
+
+	// Delete the clientside buffer, since it is no longer needed.
+
+	if (pVertexArray != 0)
+	{
+		*pVertexArray = pVertexBuffer;
+	}
+	else
+	{
+		MemoryRelease(MEMORY_HEAP, (uintptr_t) pVertexBuffer);
+		delete[] pVertexBuffer;
+		pVertexBuffer = 0;
+	}
+
+	return unVBO;
+}
+///
+// Free the buffers and texture of a mesh.
+//
+void ReleaseMesh(Mesh* pMesh)
+{
+	MemoryRelease(MEMORY_BUFFER, pMesh->vbo);
+	MemoryRelease(MEMORY_BUFFER, pMesh->batchVbo);
+	MemoryRelease(MEMORY_BUFFER, pMesh->colorVbo);
+	MemoryRelease(MEMORY_TEXTURE, pMesh->texture);
+
+	glDeleteBuffers(1, &pMesh->vbo);
+	glDeleteBuffers(1, &pMesh->batchVbo);
+	glDeleteBuffers(1, &pMesh->colorVbo);
+	glDeleteTextures(1, &pMesh->texture);
+}
+
+///
+// Replace the contents of a mesh with a model and texture from disk.
+//
+void LoadMesh(Mesh* pMesh, const char* pModelPath, const char* pTexturePath)
+{
+	ScopedTrace trace("LoadMesh");
+
+	ReleaseMesh(pMesh);
+
+	pMesh->vbo = LoadOBJ(pModelPath, pMesh, nullptr);
+	pMesh->texture = LoadBMP(pTexturePath);
+}
+
+///
+// Fill the scene with a grid of small spheres, to measure how well the
+// instanced path scales with the number of objects.
+//
+void BuildBenchmarkScene(int nNumInstances)
+{
+	GLfloat* pPositions = 0;
+	GLfloat* pNormals = 0;
+	GLfloat* pUVs = 0;
+	GLuint* pIndices = 0;
+
+	if (nNumInstances > MAX_INSTANCES)
+		nNumInstances = MAX_INSTANCES;
+
+	ScopedMemoryAsset asset("benchmark scene");
+
+	// Expand the indexed sphere into the interleaved layout of ParseOBJ
+	int nNumIndices = esGenSphere(SCENE_SPHERE_SLICES, 1.0f, &pPositions, &pNormals, &pUVs, &pIndices);
+	float* pVertexBuffer = new float[nNumIndices * 8];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) pVertexBuffer, nNumIndices * 8 * sizeof(float));
+
+	for (int i = 0; i < nNumIndices; i++)
+	{
+		GLuint unIndex = pIndices[i];
+		float* pDst = &pVertexBuffer[i * 8];
+
+		memcpy(&pDst[0], &pPositions[unIndex * 3], 3 * sizeof(float));
+		memcpy(&pDst[3], &pUVs[unIndex * 2], 2 * sizeof(float));
+		memcpy(&pDst[5], &pNormals[unIndex * 3], 3 * sizeof(float));
+	}
+
+	free(pPositions);
+	free(pNormals);
+	free(pUVs);
+	free(pIndices);
+
+	memset(&s_sceneMesh, 0, sizeof(Mesh));
+	s_sceneMesh.faces = nNumIndices / 3;
+	s_sceneMesh.shaderFlags = SHADER_TEXTURED | SHADER_LIT;
+	s_sceneMesh.vbo = CreateMeshBuffer(&s_sceneMesh, pVertexBuffer);
+	s_sceneMesh.texture = LoadBMP(SCENE_TEXTURE);
+
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pVertexBuffer);
+	delete[] pVertexBuffer;
+
+	// Square grid centered in front of the camera
+	int nSide = (int) ceilf(sqrtf((float) nNumInstances));
+	float fSpacing = SCENE_EXTENT / nSide;
+
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) s_pInstances);
+	delete[] s_pInstances;
+	s_pInstances = new Instance[nNumInstances];
+	MemoryTrack(MEMORY_HEAP, (uintptr_t) s_pInstances, nNumInstances * sizeof(Instance));
+	s_nNumInstances = nNumInstances;
+
+	for (int i = 0; i < nNumInstances; i++)
+	{
+		Instance* pInstance = &s_pInstances[i];
+
+		pInstance->pMesh = &s_sceneMesh;
+		pInstance->position[0] = ((i % nSide) + 0.5f) * fSpacing - SCENE_EXTENT * 0.5f;
+		pInstance->position[1] = ((i / nSide) + 0.5f) * fSpacing - SCENE_EXTENT * 0.5f;
+		pInstance->position[2] = 0.0f;
+		pInstance->yaw = (i * 37) % 360;
+		pInstance->scale = fSpacing * 0.4f;
+	}
+
+	printf("Benchmark scene: %d instances of %u triangles, %s.\n",
+		nNumInstances,
+		s_sceneMesh.faces,
+		(s_bBatchInstances && s_sceneMesh.batchVbo != 0) ? "batched" : "one call each");
+}
+
+void DrawTriangles()
+{
+	ScopedStageTimer timer(PROFILER_STAGE_OVERLAY);
+
 	if (colorShader == 0)
 		printf("Color shader not set.\n");
 
@@ -662,20 +1479,20 @@ void DrawTriangles()
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	int hColor = glGetUniformLocation(colorShader, "uColor");
-	int hPosition = glGetAttribLocation(colorShader, "aPosition");
-
 	float black[4] = {0.0f, 0.0f, 0.0f, 1.0f};
-	glUniform4fv(hColor, 1, black);
-	glVertexAttribPointer(hPosition, 2, GL_FLOAT, GL_FALSE, 0, triangleVerts);
-	glEnableVertexAttribArray(hPosition);
+	glUniform4fv(s_hOverlayColor, 1, black);
+	glVertexAttribPointer(s_hOverlayPosition, 2, GL_FLOAT, GL_FALSE, 0, triangleVerts);
+	glEnableVertexAttribArray(s_hOverlayPosition);
 
 	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
 	glDrawArrays(GL_TRIANGLES, 0, 3 * 2);
 }
 
 void DrawLines()
 {
+	ScopedStageTimer timer(PROFILER_STAGE_OVERLAY);
+
 	if (displayLines == 0)
 		return;
 
@@ -686,15 +1503,12 @@ void DrawLines()
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	int hColor = glGetUniformLocation(colorShader, "uColor");
-	int hPosition = glGetAttribLocation(colorShader, "aPosition");
-
 	float red[4] = {1.0f, 0.0f, 0.0f, 1.0f};
 
 	glLineWidth(10.0f);
-	glUniform4fv(hColor, 1, red);
-	glVertexAttribPointer(hPosition, 2, GL_FLOAT, GL_FALSE, 0, lineVerts);
-	glEnableVertexAttribArray(hPosition);
+	glUniform4fv(s_hOverlayColor, 1, red);
+	glVertexAttribPointer(s_hOverlayPosition, 2, GL_FLOAT, GL_FALSE, 0, lineVerts);
+	glEnableVertexAttribArray(s_hOverlayPosition);
 
 	glDisable(GL_DEPTH_TEST);
 	glEnable(GL_BLEND);
@@ -705,220 +1519,2251 @@ void DrawLines()
 
 
 ///
-// Draw a triangle using the shader pair created in Init()
+// Lay out the views for a chamber with 1, 2 or 4 sides. Each view
+// gets a square viewport facing its side of the pyramid, the camera
+// rotated around the model by the same amount.
 //
-void Draw ( ESContext *esContext )
+void SetupViews(int nNumViews, int nMirror, int nWidth, int nHeight)
 {
-   glEnable(GL_BLEND);
-   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (nNumViews != 1 &&
+	    nNumViews != 2 &&
+	    nNumViews != MAX_VIEWS)
+	{
+		printf("Unsupported view count %d, using 1.\n", nNumViews);
+		nNumViews = 1;
+	}
 
-   //rotation += ROTATE_SPEED;
-   UserData *userData = (UserData*) esContext->userData;
-   GLfloat vVertices[] = { 0.0f,  0.5f, 0.0f,
-						   -0.5f, -0.5f, 0.0f,
-							0.5f, -0.5f, 0.0f };
+	numViews = nNumViews;
+
+	if (numViews == 1)
+	{
+		View* pView = &s_arViews[0];
+		pView->x = 0;
+		pView->y = 0;
+		pView->width = nWidth;
+		pView->height = nHeight;
+		pView->cameraAngle = s_nFace * 90.0f;
+		pView->screenAngle = 0.0f;
+		pView->frustumHalfWidth = FRUSTUM_HALF_WIDTH;
+		pView->frustumHalfHeight = FRUSTUM_HALF_HEIGHT;
+		pView->mirror = nMirror;
+		return;
+	}
 
-   // Set the viewport
-   glViewport ( 0, 0, esContext->width, esContext->height );
+	// Two views are stacked top/bottom, four form a cross around
+	// the center of the screen.
+	int nSize = (numViews == 2) ? nHeight / 2 : nHeight / 3;
+	int nCenterX = nWidth / 2;
+	int nCenterY = nHeight / 2;
 
-   // Clear the color buffer
-   glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	for (int i = 0; i < numViews; i++)
+	{
+		View* pView = &s_arViews[i];
+		int nSide = (numViews == 2) ? i * 2 : i;
+
+		pView->width = nSize;
+		pView->height = nSize;
+		pView->cameraAngle = nSide * 90.0f;
+		pView->screenAngle = nSide * 90.0f;
+		pView->frustumHalfWidth = FRUSTUM_HALF_HEIGHT;
+		pView->frustumHalfHeight = FRUSTUM_HALF_HEIGHT;
+		pView->mirror = nMirror;
+
+		switch (nSide)
+		{
+		case 0: // Bottom
+			pView->x = nCenterX - nSize / 2;
+			pView->y = (numViews == 2) ? 0 : nCenterY - nSize / 2 - nSize;
+			break;
+		case 1: // Right
+			pView->x = nCenterX + nSize / 2;
+			pView->y = nCenterY - nSize / 2;
+			break;
+		case 2: // Top
+			pView->x = nCenterX - nSize / 2;
+			pView->y = (numViews == 2) ? nHeight - nSize : nCenterY + nSize / 2;
+			break;
+		case 3: // Left
+			pView->x = nCenterX - nSize / 2 - nSize;
+			pView->y = nCenterY - nSize / 2;
+			break;
+		}
+	}
 
-   // Use the program object
-   glUseProgram ( userData->programObject );
+	printf("Rendering %d views of %dx%d.\n", numViews, nSize, nSize);
+}
 
-   // Load VBO and attributes
-   GLint hPosition = glGetAttribLocation(userData->programObject, "vPosition");
-   if (hPosition == -1)
-   {
-	   printf("Failed to find position attribute\n");
-   }
+///
+// Create a framebuffer with a color texture and a 16 bit depth buffer.
+//
+int CreateRenderTarget(RenderTarget* pTarget, int nWidth, int nHeight)
+{
+	pTarget->width = nWidth;
+	pTarget->height = nHeight;
+
+	ScopedMemoryAsset asset("render targets");
+
+	// Color attachment is a texture so it can be sampled afterwards.
+	// Clamp and no mipmaps keep non power of two sizes legal in ES 2.
+	glGenTextures(1, &pTarget->colorTexture);
+	glBindTexture(GL_TEXTURE_2D, pTarget->colorTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D,
+		0,
+		GL_RGBA,
+		nWidth,
+		nHeight,
+		0,
+		GL_RGBA,
+		GL_UNSIGNED_BYTE,
+		NULL);
+	MemoryTrack(MEMORY_TEXTURE, pTarget->colorTexture, MemoryTextureBytes(nWidth, nHeight, 4, 0));
+
+	glGenRenderbuffers(1, &pTarget->depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, pTarget->depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, nWidth, nHeight);
+	MemoryTrack(MEMORY_RENDERBUFFER, pTarget->depthBuffer, (int64_t) nWidth * nHeight * 2);
+
+	glGenFramebuffers(1, &pTarget->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, pTarget->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pTarget->colorTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, pTarget->depthBuffer);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-   GLint hTexcoord = glGetAttribLocation(userData->programObject, "vTexcoord");
-   if (hTexcoord == -1)
-   {
-	printf("Failed to find texcoord attribute.\n ");
-   }
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Framebuffer incomplete: 0x%x\n", status);
+		return 0;
+	}
 
-   GLint hNormal = glGetAttribLocation(userData->programObject, "vNormal");
-   if (hNormal == -1)
-   {
-	printf("Failed to find normal attribute\n");
-   }
+	return 1;
+}
 
-   GLint hTexture = glGetUniformLocation(userData->programObject, "sTexture");
-   if (hTexture == -1)
-   {
-	printf("Texture sampler uniform not found.\n");
-   }
+void DestroyRenderTarget(RenderTarget* pTarget)
+{
+	MemoryRelease(MEMORY_RENDERBUFFER, pTarget->depthBuffer);
+	MemoryRelease(MEMORY_TEXTURE, pTarget->colorTexture);
 
-   GLint hViewMatrix = glGetUniformLocation(userData->programObject, "mMVPMatrix");
-   GLint hModelMatrix = glGetUniformLocation(userData->programObject, "mNormalMatrix");
-   ESMatrix viewMatrix;
-   ESMatrix modelMatrix;
-   esMatrixLoadIdentity(&viewMatrix);
-   esMatrixLoadIdentity(&modelMatrix);
-   esFrustum(&viewMatrix, -0.025f, 0.025f, -0.017f, 0.017f, 0.1f, 1024.0f);
-   esTranslate(&viewMatrix, 0.0f, VIEWING_OFFSET_Y, VIEWING_DISTANCE_Z);
-   esRotate(&viewMatrix, rotation, 0.0f, 1.0f, 0.0f);
-   esScale(&viewMatrix, scale, scale, scale);
-   esRotate(&modelMatrix, rotation, 0.0f, 1.0f, 0.0f);
+	glDeleteFramebuffers(1, &pTarget->framebuffer);
+	glDeleteRenderbuffers(1, &pTarget->depthBuffer);
+	glDeleteTextures(1, &pTarget->colorTexture);
+	memset(pTarget, 0, sizeof(RenderTarget));
+}
 
-   glUniformMatrix4fv(hViewMatrix, 1, GL_FALSE, &viewMatrix.m[0][0]);
-   glUniformMatrix4fv(hModelMatrix, 1, GL_FALSE, &modelMatrix.m[0][0]);
+///
+// Build the quads that copy the replicated image into every view.
+// The texcoords undo the same mirror and screen rotation ComputeProjection
+// applies, so both paths put the same image in the same place.
+//
+void SetupComposite(int nWidth, int nHeight)
+{
+	static const float arCorners[6][2] = { { -1.0f, -1.0f },
+					       {  1.0f, -1.0f },
+					       {  1.0f,  1.0f },
+					       { -1.0f, -1.0f },
+					       {  1.0f,  1.0f },
+					       { -1.0f,  1.0f } };
+	const float fDegToRad = 3.14159265f / 180.0f;
+	float* pDst = s_arCompositeVerts;
+
+	for (int i = 0; i < numViews; i++)
+	{
+		const View* pView = &s_arViews[i];
 
-   glBindTexture(GL_TEXTURE_2D, texture);
-   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		// Viewport rectangle in normalized device coordinates.
+		float fLeft = 2.0f * pView->x / nWidth - 1.0f;
+		float fRight = 2.0f * (pView->x + pView->width) / nWidth - 1.0f;
+		float fBottom = 2.0f * pView->y / nHeight - 1.0f;
+		float fTop = 2.0f * (pView->y + pView->height) / nHeight - 1.0f;
 
-   glUniform1i(hTexture, 0);
+		float fSin = sinf(pView->screenAngle * fDegToRad);
+		float fCos = cosf(pView->screenAngle * fDegToRad);
 
-   glVertexAttribPointer ( hPosition, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0 );
-   glVertexAttribPointer(hTexcoord, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*) (3 * sizeof(float)));
-   glVertexAttribPointer(hNormal, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*) (5 * sizeof(float)));
-   glEnableVertexAttribArray (hPosition);
-   glEnableVertexAttribArray(hTexcoord);
-   glEnableVertexAttribArray(hNormal);
+		for (int j = 0; j < 6; j++)
+		{
+			float fX = arCorners[j][0];
+			float fY = arCorners[j][1];
 
-   glEnable(GL_DEPTH_TEST);
-   glDrawArrays ( GL_TRIANGLES, 0, 3 * faces );
+			// Inverse of the clip space rotation in ComputeProjection.
+			float fImageX = fX * fCos - fY * fSin;
+			float fImageY = fX * fSin + fY * fCos;
 
-   UpdateServer();
+			if (pView->mirror)
+			{
+				fImageX = -fImageX;
+			}
 
-   //DrawTriangles();
-   //DrawLines();
+			pDst[0] = (fX < 0.0f) ? fLeft : fRight;
+			pDst[1] = (fY < 0.0f) ? fBottom : fTop;
+			pDst[2] = (fImageX > 0.0f) ? 1.0f : 0.0f;
+			pDst[3] = (fImageY > 0.0f) ? 1.0f : 0.0f;
+			pDst += 4;
+		}
+	}
 }
 
-
-int InitServer()
+///
+// Draw textured quads from a client side array of position (xy) and
+// texcoord (uv) pairs with a single draw call. The texcoords are scaled
+// so only the rendered part of an offscreen target is sampled.
+//
+void DrawTexturedQuads(GLuint unTexture,
+	const float* pVerts,
+	int nNumVerts,
+	float fTexScaleU,
+	float fTexScaleV)
 {
-	serverSocket = socket(AF_INET, SOCK_DGRAM, 0);
-	if (serverSocket < 0)
-	{
-		printf("Failed to create socket.\n");
-		return 0;
-	}
+	ScopedStageTimer timer(PROFILER_STAGE_COMPOSITE);
 
-	struct sockaddr_in serverAddr;
-	memset(&serverAddr, 0, sizeof(sockaddr_in));
-	serverAddr.sin_family = AF_INET;
-	serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	serverAddr.sin_port = htons(SERVER_PORT);
+	static GLint hPosition = -1;
+	static GLint hTexcoord = -1;
+	static GLint hTexture = -1;
+	static GLint hTexScale = -1;
 
-	if (bind(serverSocket, (struct sockaddr*) &serverAddr, sizeof(serverAddr)) < 0)
+	if (hPosition == -1)
 	{
-		printf("Failed to bind socket.\n");
-		return 0;
+		hPosition = glGetAttribLocation(blitShader, "aPosition");
+		hTexcoord = glGetAttribLocation(blitShader, "aTexcoord");
+		hTexture = glGetUniformLocation(blitShader, "sTexture");
+		hTexScale = glGetUniformLocation(blitShader, "uTexScale");
 	}
 
-	timeval timeoutLength;
-	timeoutLength.tv_sec = 0;
-	timeoutLength.tv_usec = 10;
-	setsockopt(serverSocket, SOL_SOCKET, SO_RCVTIMEO, &timeoutLength, sizeof(timeval));
+	glUseProgram(blitShader);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, unTexture);
+	glUniform1i(hTexture, 0);
+	glUniform2f(hTexScale, fTexScaleU, fTexScaleV);
+
+	glVertexAttribPointer(hPosition, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), pVerts);
+	glVertexAttribPointer(hTexcoord, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), pVerts + 2);
+	glEnableVertexAttribArray(hPosition);
+	glEnableVertexAttribArray(hTexcoord);
 
-	return 1;
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+	glDrawArrays(GL_TRIANGLES, 0, nNumVerts);
 }
 
-void FlipBlackTriangles()
+///
+// Feed one frame time into the resolution controller. Going over
+// budget shrinks the scale in proportion to the overshoot (fill cost
+// grows with the square of the scale). While within budget, the scale
+// is probed upwards in small steps, since a vsynced frame time can not
+// show how much headroom is left.
+//
+void UpdateDynamicResolution(float fFrameTime)
 {
-	for (int i = 1; i < 12; i += 2)
+	DynamicResolution* pDyn = &s_dynRes;
+
+	if (!pDyn->enabled)
+		return;
+
+	pDyn->smoothedFrameTime += DYNRES_SMOOTHING * (fFrameTime - pDyn->smoothedFrameTime);
+
+	if (pDyn->settleFrames > 0)
 	{
-		triangleVerts[i] *= -1.0f;
+		pDyn->settleFrames--;
+		return;
 	}
 
-	for (int i = 1; i < 8; i += 2)
+	float fScale = pDyn->scale;
+
+	if (pDyn->smoothedFrameTime > pDyn->targetFrameTime * DYNRES_OVER_BUDGET)
 	{
-		lineVerts[i] *= -1.0f;
+		fScale *= sqrtf(pDyn->targetFrameTime / pDyn->smoothedFrameTime);
+		pDyn->state = DYNRES_DOWN;
+		pDyn->stableFrames = 0;
 	}
+	else if (pDyn->smoothedFrameTime < pDyn->targetFrameTime * DYNRES_UNDER_BUDGET)
+	{
+		if (++pDyn->stableFrames < DYNRES_PROBE_FRAMES)
+			return;
 
-	printf("Flipped black triangle.\n");
+		fScale += DYNRES_STEP_UP;
+		pDyn->state = DYNRES_UP;
+		pDyn->stableFrames = 0;
+	}
+	else
+	{
+		pDyn->state = DYNRES_HOLD;
+		pDyn->stableFrames = 0;
+		return;
+	}
+
+	if (fScale < pDyn->minScale)
+		fScale = pDyn->minScale;
+	if (fScale > pDyn->maxScale)
+		fScale = pDyn->maxScale;
+
+	if (fScale == pDyn->scale)
+	{
+		pDyn->state = DYNRES_HOLD;
+		return;
+	}
+
+	pDyn->scale = fScale;
+	pDyn->settleFrames = DYNRES_SETTLE_FRAMES;
 }
 
-void UpdateServer()
+void PrintDynamicResolution(int nWidth, int nHeight)
+{
+	static const char* arStateNames[] = { "hold", "down", "up" };
+	const DynamicResolution* pDyn = &s_dynRes;
+
+	if (!pDyn->enabled)
+		return;
+
+	printf("Resolution scale %1.3f (%dx%d) frame %2.3f ms target %2.3f ms state %s\n",
+		pDyn->scale,
+		(int) (nWidth * pDyn->scale),
+		(int) (nHeight * pDyn->scale),
+		pDyn->smoothedFrameTime * 1000.0f,
+		pDyn->targetFrameTime * 1000.0f,
+		arStateNames[pDyn->state]);
+}
+
+///
+// Position of the eye in model space, for a model view matrix made of
+// a rotation, a uniform scale and a translation.
+//
+void ComputeEyePosition(const ESMatrix* pModelView, float* pEye)
 {
-	struct sockaddr_in remoteAddr;
-	socklen_t addrlen = sizeof(remoteAddr);
+	const float* pT = pModelView->m[3];
+	float fScale2 = pModelView->m[0][0] * pModelView->m[0][0] +
+			pModelView->m[0][1] * pModelView->m[0][1] +
+			pModelView->m[0][2] * pModelView->m[0][2];
+
+	for (int i = 0; i < 3; i++)
+	{
+		const float* pRow = pModelView->m[i];
+		pEye[i] = -(pT[0] * pRow[0] + pT[1] * pRow[1] + pT[2] * pRow[2]) / fScale2;
+	}
+}
 
-	if (serverSocket < 0)
+///
+// Draw the faces of a mesh, skipping clusters that face away from the
+// eye. Neighbouring visible clusters are merged into one draw call.
+//
+void DrawMesh(const Mesh* pMesh, const float* pEye)
+{
+	if (!pMesh->closed || pMesh->numClusters == 0)
 	{
+		glDrawArrays(GL_TRIANGLES, 0, 3 * pMesh->faces);
+		s_nDrawCalls++;
+		s_nDrawnFaces += pMesh->faces;
 		return;
 	}
 
-	int recvLen = recvfrom(serverSocket, s_arRecvBuffer, RECV_BUFFER_SIZE, 0, (struct sockaddr*) &remoteAddr, &addrlen);
+	int nRunStart = 0;
+	int nRunFaces = 0;
 
-	if (recvLen > 0)
+	for (int i = 0; i < pMesh->numClusters; i++)
 	{
-		if (recvLen == 1 &&
-		    s_arRecvBuffer[0] == 'F')
+		const Cluster* pCluster = &pMesh->pClusters[i];
+		float arDir[3] = { pCluster->center[0] - pEye[0],
+				   pCluster->center[1] - pEye[1],
+				   pCluster->center[2] - pEye[2] };
+		float fDistance = sqrtf(arDir[0] * arDir[0] + arDir[1] * arDir[1] + arDir[2] * arDir[2]);
+		float fDot = arDir[0] * pCluster->axis[0] + arDir[1] * pCluster->axis[1] + arDir[2] * pCluster->axis[2];
+
+		if (fDot >= pCluster->cutoff * fDistance + pCluster->radius)
 		{
-			FlipBlackTriangles();
-			return;
+			s_nCulledFaces += pCluster->numFaces;
+			continue;
 		}
 
-		if (recvLen == 1 &&
-		    s_arRecvBuffer[0] == 'L')
+		if (nRunFaces > 0 && nRunStart + nRunFaces == pCluster->firstFace)
 		{
-			displayLines = !displayLines;
-			return;
+			nRunFaces += pCluster->numFaces;
+			continue;
 		}
 
-		if (s_arRecvBuffer[0] == 'M')
+		if (nRunFaces > 0)
 		{
-			sscanf(s_arRecvBuffer+1, "%d", &currentModel);
-
-			if (currentModel >= numModels)
-				currentModel = numModels - 1;
-			if (currentModel < 0)
-				currentModel = 0;
+			glDrawArrays(GL_TRIANGLES, 3 * nRunStart, 3 * nRunFaces);
+			s_nDrawCalls++;
+			s_nDrawnFaces += nRunFaces;
+		}
 
-			glDeleteBuffers(1, &vbo);
-			glDeleteTextures(1, &texture);
+		nRunStart = pCluster->firstFace;
+		nRunFaces = pCluster->numFaces;
+	}
 
-			vbo = LoadOBJ(modelPaths[currentModel], faces, nullptr);
-			texture = LoadBMP(texturePaths[currentModel]);
-		}
+	if (nRunFaces > 0)
+	{
+		glDrawArrays(GL_TRIANGLES, 3 * nRunStart, 3 * nRunFaces);
+		s_nDrawCalls++;
+		s_nDrawnFaces += nRunFaces;
+	}
+}
 
-		if (s_arRecvBuffer[0] == 'T')
-		{
-			float pitch = 0.0f;
-			float yaw = 0.0f;
-			float roll = 0.0f;
-			float uniScale = 1.0f;
+///
+// Projection of a view: frustum, then mirror and rotation on screen.
+//
+void ComputeProjection(const View* pView, ESMatrix* pProjection)
+{
+   esMatrixLoadIdentity(pProjection);
+   esRotate(pProjection, pView->screenAngle, 0.0f, 0.0f, 1.0f);
+   if (pView->mirror)
+   {
+      esScale(pProjection, -1.0f, 1.0f, 1.0f);
+   }
+   esFrustum(pProjection,
+	     -pView->frustumHalfWidth, pView->frustumHalfWidth,
+	     -pView->frustumHalfHeight, pView->frustumHalfHeight,
+	     FRUSTUM_NEAR, FRUSTUM_FAR);
+}
 
-			sscanf(s_arRecvBuffer+1, "%f %f %f %f", &pitch, &yaw, &roll, &uniScale);
+///
+// Model view of the chamber contents as seen from a view.
+//
+void ComputeModelView(const View* pView, ESMatrix* pModelView)
+{
+   esMatrixLoadIdentity(pModelView);
+   esTranslate(pModelView, 0.0f, VIEWING_OFFSET_Y, VIEWING_DISTANCE_Z);
+   esRotate(pModelView, rotation + pView->cameraAngle, 0.0f, 1.0f, 0.0f);
+   esScale(pModelView, scale, scale, scale);
+}
 
-			rotation = yaw;
-			scale = uniScale;
+///
+// Bind the texture and vertex attributes of a mesh for a program,
+// either the plain buffer or the replicated batch buffer.
+//
+void BindMesh(const ShaderProgram* pProgram, const Mesh* pMesh, int bBatched)
+{
+   // Baked color array left enabled by an earlier mesh, -1 if none. It
+   // must not outlive that mesh's buffer or leak into other programs.
+   static GLint s_hEnabledColor = -1;
 
-			return;
-		}
+   int nStride = (bBatched ? 9 : 8) * sizeof(float);
+   GLint hColor = (pMesh->colorVbo != 0) ? pProgram->hColor : -1;
 
-		printf("Message Received: %d bytes \n", recvLen);
+   glBindTexture(GL_TEXTURE_2D, pMesh->texture);
 
-	}
-}
+   if (s_hEnabledColor != -1 && s_hEnabledColor != hColor)
+   {
+      glDisableVertexAttribArray(s_hEnabledColor);
+   }
 
+   s_hEnabledColor = hColor;
+
+   if (hColor != -1)
+   {
+      glBindBuffer(GL_ARRAY_BUFFER, pMesh->colorVbo);
+      glVertexAttribPointer(hColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+      glEnableVertexAttribArray(hColor);
+   }
+
+   glBindBuffer(GL_ARRAY_BUFFER, bBatched ? pMesh->batchVbo : pMesh->vbo);
+
+   glVertexAttribPointer(pProgram->hPosition, 3, GL_FLOAT, GL_FALSE, nStride, 0);
+   glEnableVertexAttribArray(pProgram->hPosition);
+
+   if (pProgram->hTexture != -1)
+   {
+      glUniform1i(pProgram->hTexture, 0);
+      glVertexAttribPointer(pProgram->hTexcoord, 2, GL_FLOAT, GL_FALSE, nStride, (void*) (3 * sizeof(float)));
+      glEnableVertexAttribArray(pProgram->hTexcoord);
+   }
+
+   if (pProgram->hNormal != -1)
+   {
+      glVertexAttribPointer(pProgram->hNormal, 3, GL_FLOAT, GL_FALSE, nStride, (void*) (5 * sizeof(float)));
+      glEnableVertexAttribArray(pProgram->hNormal);
+   }
+
+   if (bBatched)
+   {
+      glVertexAttribPointer(pProgram->hInstance, 1, GL_FLOAT, GL_FALSE, nStride, (void*) (8 * sizeof(float)));
+      glEnableVertexAttribArray(pProgram->hInstance);
+   }
+
+   if (pMesh->closed)
+   {
+      glEnable(GL_CULL_FACE);
+      glCullFace(GL_BACK);
+   }
+   else
+   {
+      glDisable(GL_CULL_FACE);
+   }
+}
+
+///
+// Matrices and winding for one view of the current model, the same
+// for every backend.
+//
+typedef struct
+{
+   ESMatrix mvp;
+   ESMatrix normal;
+   float eye[3];
+   int frontFaceCW;
+} ViewTransform;
+
+///
+// A way of drawing the current model. DrawModelViews owns the views and
+// their matrices, a backend only turns one of them into pixels.
+//
+typedef struct
+{
+   void (*drawView)(void* pContext, const View* pView, const ViewTransform* pTransform);
+   void* pContext;
+} ModelBackend;
+
+void ComputeViewTransform(const View* pView, const Mesh* pMesh, ViewTransform* pTransform)
+{
+   ScopedStageTimer timer(PROFILER_STAGE_MATRICES);
+   ESMatrix modelViewMatrix;
+
+   ComputeModelView(pView, &modelViewMatrix);
+   ComputeProjection(pView, &pTransform->mvp);
+   esMatrixMultiply(&pTransform->mvp, &modelViewMatrix, &pTransform->mvp);
+
+   esMatrixLoadIdentity(&pTransform->normal);
+   esRotate(&pTransform->normal, rotation + pView->cameraAngle, 0.0f, 1.0f, 0.0f);
+
+   ComputeEyePosition(&modelViewMatrix, pTransform->eye);
+
+   // Mirroring flips the winding on screen
+   pTransform->frontFaceCW = (pMesh->clockwise != pView->mirror);
+}
+
+///
+// Draw a mesh once per view through a backend.
+//
+void DrawModelViews(const ModelBackend* pBackend, const Mesh* pMesh, const View* pViews, int nViews)
+{
+   for (int i = 0; i < nViews; i++)
+   {
+      ViewTransform transform;
+
+      ComputeViewTransform(&pViews[i], pMesh, &transform);
+      pBackend->drawView(pBackend->pContext, &pViews[i], &transform);
+   }
+}
+
+///
+// GL backend: set the viewport and matrices, then draw the current
+// model. Program, buffer, texture and attribute state is left to the
+// caller. The context is the UserData.
+//
+void DrawView(void* pContext, const View* pView, const ViewTransform* pTransform)
+{
+   UserData* userData = (UserData*) pContext;
+   const ShaderProgram* pProgram = GetShaderVariant(userData, s_currentMesh.shaderFlags);
+
+   // The variant failed to build
+   if (pProgram->programObject == 0)
+      return;
+
+   glViewport(pView->x, pView->y, pView->width, pView->height);
+
+   glUniformMatrix4fv(pProgram->hMVPMatrix, 1, GL_FALSE, &pTransform->mvp.m[0][0]);
+   glUniformMatrix4fv(pProgram->hNormalMatrix, 1, GL_FALSE, &pTransform->normal.m[0][0]);
+
+   glFrontFace(pTransform->frontFaceCW ? GL_CW : GL_CCW);
+
+   DrawMesh(&s_currentMesh, pTransform->eye);
+}
+
+///
+// Draw the instances of the scene for one view. Meshes with a batch
+// buffer are drawn INSTANCE_BATCH_SIZE instances per call, with their
+// transforms in uniform arrays. Bigger meshes take a call per instance.
+//
+void DrawSceneView(UserData* userData, const View* pView)
+{
+   ESMatrix projection;
+   ESMatrix sceneModelView;
+   GLfloat arInstanceMVP[INSTANCE_BATCH_SIZE * 16];
+   GLfloat arInstanceYaw[INSTANCE_BATCH_SIZE * 2];
+   const float fDegToRad = 3.14159265f / 180.0f;
+
+   glViewport(pView->x, pView->y, pView->width, pView->height);
+
+   {
+      ScopedStageTimer timer(PROFILER_STAGE_MATRICES);
+
+      ComputeProjection(pView, &projection);
+      ComputeModelView(pView, &sceneModelView);
+   }
+
+   int nFirst = 0;
+   while (nFirst < s_nNumInstances)
+   {
+      Mesh* pMesh = s_pInstances[nFirst].pMesh;
+      int nEnd = nFirst;
+
+      while (nEnd < s_nNumInstances && s_pInstances[nEnd].pMesh == pMesh)
+      {
+         nEnd++;
+      }
+
+      int bBatched = s_bBatchInstances && pMesh->batchVbo != 0;
+      const ShaderProgram* pProgram = GetShaderVariant(userData, pMesh->shaderFlags | (bBatched ? SHADER_INSTANCED : 0));
+
+      if (pProgram->programObject == 0)
+      {
+         nFirst = nEnd;
+         continue;
+      }
+
+      glUseProgram(pProgram->programObject);
+      BindMesh(pProgram, pMesh, bBatched);
+      glFrontFace((pMesh->clockwise != pView->mirror) ? GL_CW : GL_CCW);
+
+      int nCount = 0;
+      for (int i = nFirst; i < nEnd; i++)
+      {
+         const Instance* pInstance = &s_pInstances[i];
+         ESMatrix modelView = sceneModelView;
+         ESMatrix mvpMatrix;
+         float fYaw = (rotation + pView->cameraAngle + pInstance->yaw) * fDegToRad;
+
+         {
+            ScopedStageTimer timer(PROFILER_STAGE_MATRICES);
+
+            esTranslate(&modelView, pInstance->position[0], pInstance->position[1], pInstance->position[2]);
+            esRotate(&modelView, pInstance->yaw, 0.0f, 1.0f, 0.0f);
+            esScale(&modelView, pInstance->scale, pInstance->scale, pInstance->scale);
+            esMatrixMultiply(&mvpMatrix, &modelView, &projection);
+         }
+
+         if (!bBatched)
+         {
+            ESMatrix normalMatrix;
+            float arEye[3];
+
+            {
+               ScopedStageTimer timer(PROFILER_STAGE_MATRICES);
+
+               esMatrixLoadIdentity(&normalMatrix);
+               esRotate(&normalMatrix, fYaw / fDegToRad, 0.0f, 1.0f, 0.0f);
+               ComputeEyePosition(&modelView, arEye);
+            }
+
+            glUniformMatrix4fv(pProgram->hMVPMatrix, 1, GL_FALSE, &mvpMatrix.m[0][0]);
+            glUniformMatrix4fv(pProgram->hNormalMatrix, 1, GL_FALSE, &normalMatrix.m[0][0]);
+
+            DrawMesh(pMesh, arEye);
+            continue;
+         }
+
+         memcpy(&arInstanceMVP[nCount * 16], &mvpMatrix.m[0][0], 16 * sizeof(GLfloat));
+         arInstanceYaw[nCount * 2 + 0] = cosf(fYaw);
+         arInstanceYaw[nCount * 2 + 1] = sinf(fYaw);
+         nCount++;
+
+         if (nCount == pMesh->batchSize || i == nEnd - 1)
+         {
+            glUniformMatrix4fv(pProgram->hInstanceMVP, nCount, GL_FALSE, arInstanceMVP);
+            glUniform2fv(pProgram->hInstanceYaw, nCount, arInstanceYaw);
+            glDrawArrays(GL_TRIANGLES, 0, 3 * pMesh->faces * nCount);
+
+            s_nDrawCalls++;
+            s_nDrawnFaces += pMesh->faces * nCount;
+            nCount = 0;
+         }
+      }
+
+      if (bBatched)
+      {
+         glDisableVertexAttribArray(pProgram->hInstance);
+      }
+
+      nFirst = nEnd;
+   }
+}
+
+///
+// Draw the loaded model once per view using the shader pair created in Init()
+//
+void Draw ( ESContext *esContext )
+{
+   // Everything not claimed by a nested stage is draw submission
+   ScopedStageTimer timer(PROFILER_STAGE_SUBMIT);
+
+   // Benchmarks follow their script, not the network. The sync master
+   // has already applied the commands before publishing the frame.
+   if (s_bench.path == 0 && s_nSyncMode != SYNC_MASTER)
+   {
+      UpdateServer();
+   }
+
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+   //rotation += ROTATE_SPEED;
+   UserData *userData = (UserData*) esContext->userData;
+
+   float fScale = s_dynRes.enabled ? s_dynRes.scale : 1.0f;
+   RenderTarget* pTarget = 0;
+   int nRegionWidth = esContext->width;
+   int nRegionHeight = esContext->height;
+
+   if (replicateViews)
+   {
+      // Draw the model once at view resolution, the views are
+      // copied from it afterwards
+      pTarget = &s_replicaTarget;
+      nRegionWidth = (int) (s_arViews[0].width * fScale);
+      nRegionHeight = (int) (s_arViews[0].height * fScale);
+   }
+   else if (s_dynRes.enabled)
+   {
+      pTarget = &s_sceneTarget;
+      nRegionWidth = (int) (esContext->width * fScale);
+      nRegionHeight = (int) (esContext->height * fScale);
+   }
+
+   if (pTarget != 0)
+   {
+      glBindFramebuffer(GL_FRAMEBUFFER, pTarget->framebuffer);
+   }
+
+   // Clear the whole region, views only cover part of it
+   glViewport ( 0, 0, nRegionWidth, nRegionHeight );
+   glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+   glEnable(GL_DEPTH_TEST);
+
+   // Bind the program, mesh and texture once for all views
+   if (s_nNumInstances == 0)
+   {
+      const ShaderProgram* pProgram = GetShaderVariant(userData, s_currentMesh.shaderFlags);
+
+      if (pProgram->programObject != 0)
+      {
+         glUseProgram ( pProgram->programObject );
+         BindMesh(pProgram, &s_currentMesh, 0);
+      }
+   }
+
+   View arViews[MAX_VIEWS];
+   int nViews = 0;
+
+   if (replicateViews)
+   {
+      View* pView = &arViews[nViews++];
+      *pView = s_arViews[0];
+      pView->x = 0;
+      pView->y = 0;
+      pView->width = nRegionWidth;
+      pView->height = nRegionHeight;
+      pView->screenAngle = 0.0f;
+      pView->mirror = 0;
+   }
+   else
+   {
+      for (int i = 0; i < numViews; i++)
+      {
+         View* pView = &arViews[nViews++];
+         *pView = s_arViews[i];
+         pView->x = (int) (pView->x * fScale);
+         pView->y = (int) (pView->y * fScale);
+         pView->width = (int) (pView->width * fScale);
+         pView->height = (int) (pView->height * fScale);
+      }
+   }
+
+   if (s_nNumInstances > 0)
+   {
+      for (int i = 0; i < nViews; i++)
+      {
+         DrawSceneView(userData, &arViews[i]);
+      }
+   }
+   else
+   {
+      ModelBackend backend = { DrawView, userData };
+      DrawModelViews(&backend, &s_currentMesh, arViews, nViews);
+   }
+
+   if (pTarget != 0)
+   {
+      float fTexScaleU = (float) nRegionWidth / pTarget->width;
+      float fTexScaleV = (float) nRegionHeight / pTarget->height;
+
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      glViewport(0, 0, esContext->width, esContext->height);
+      glClear(GL_COLOR_BUFFER_BIT);
+
+      if (replicateViews)
+      {
+         DrawTexturedQuads(pTarget->colorTexture, s_arCompositeVerts, 6 * numViews, fTexScaleU, fTexScaleV);
+      }
+      else
+      {
+         DrawTexturedQuads(pTarget->colorTexture, s_arFullscreenVerts, 6, fTexScaleU, fTexScaleV);
+      }
+   }
+
+   //DrawTriangles();
+   //DrawLines();
+}
+
+///
+// Monotonic time in seconds, for timing work inside a frame.
+//
+double GetSeconds()
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+///
+// Frame readback for headless runs.
+//
+static GLubyte* s_pReadback = 0;
+static const char* s_pDumpPath = 0;
+static unsigned int s_nHeadlessFrame = 0;
+
+///
+// Draw, then read the frame back like a capture would. The dump path
+// is written every frame if it holds a printf pattern for the frame
+// number, otherwise only the last frame is kept.
+//
+void DrawHeadless ( ESContext *esContext )
+{
+   Draw(esContext);
+
+   glReadPixels(0, 0, esContext->width, esContext->height, GL_RGBA, GL_UNSIGNED_BYTE, s_pReadback);
+
+   s_nHeadlessFrame++;
+
+   if (s_pDumpPath == 0)
+      return;
+
+   if (strchr(s_pDumpPath, '%') != 0)
+   {
+      char arPath[512];
+
+      snprintf(arPath, sizeof(arPath), s_pDumpPath, s_nHeadlessFrame);
+      esWritePPM(arPath, s_pReadback, esContext->width, esContext->height);
+   }
+   else if (s_nHeadlessFrame == esContext->maxFrames)
+   {
+      esWritePPM(s_pDumpPath, s_pReadback, esContext->width, esContext->height);
+      printf("Wrote %s\n", s_pDumpPath);
+   }
+}
+
+void PrintCullingStats()
+{
+	unsigned int nTotal = s_nDrawnFaces + s_nCulledFaces;
+
+	if (s_nStatsFrames == 0 || nTotal == 0)
+		return;
+
+	printf("Culled %u of %u triangles per frame (%2.1f%%), %u draw calls per frame\n",
+		s_nCulledFaces / s_nStatsFrames,
+		nTotal / s_nStatsFrames,
+		100.0f * s_nCulledFaces / nTotal,
+		s_nDrawCalls / s_nStatsFrames);
+
+	s_nDrawCalls = 0;
+	s_nDrawnFaces = 0;
+	s_nCulledFaces = 0;
+	s_nStatsFrames = 0;
+}
+
+///
+// Move the camera of --bench-render along its path. The path depends
+// only on the frame number, so every run draws the same frames. The
+// delta of each frame is the time the previous frame took.
+//
+void UpdateRenderBench(float deltaTime)
+{
+   RenderBench* pBench = &s_bench;
+   int nFrame = pBench->frame;
+
+   if (nFrame == 1)
+   {
+      // Forget the warm-up frame, it pays for first use of the mesh
+      ProfilerReset();
+      s_nDrawCalls = 0;
+      s_nDrawnFaces = 0;
+      s_nCulledFaces = 0;
+   }
+   else if (nFrame > 1)
+   {
+      pBench->frameTimes[nFrame - 2] = deltaTime;
+   }
+
+   float fPhase = (float) nFrame / pBench->frames;
+
+   rotation = 360.0f * BENCH_RENDER_TURNS * fPhase;
+   scale = 1.0f + BENCH_RENDER_SCALE_SWING * sinf(2.0f * 3.14159265f * fPhase);
+
+   pBench->frame++;
+   pBench->frameStart = ProfilerNow();
+}
+
+void PrintNetworkStats()
+{
+	NetStats stats;
+
+	NetGetStats(&stats);
+
+	if (stats.datagrams == 0 && stats.depth == 0)
+		return;
+
+	printf("Network: %llu datagrams in %llu batches, %llu commands, %llu transforms coalesced, queue depth %u (max %u), %llu dropped, %llu unknown, %llu malformed, %llu duplicates, %llu stale\n",
+		(unsigned long long) stats.datagrams,
+		(unsigned long long) stats.batches,
+		(unsigned long long) stats.commands,
+		(unsigned long long) stats.coalesced,
+		stats.depth,
+		stats.maxDepth,
+		(unsigned long long) stats.dropped,
+		(unsigned long long) stats.unknown,
+		(unsigned long long) stats.malformed,
+		(unsigned long long) stats.duplicates,
+		(unsigned long long) stats.stale);
+
+	if (stats.discoveries != 0)
+	{
+		printf("Discovery: %llu requests, %llu answered\n",
+			(unsigned long long) stats.discoveries,
+			(unsigned long long) stats.replies);
+	}
+
+	if (stats.acks != 0)
+		printf("Acks: %llu sent\n", (unsigned long long) stats.acks);
+}
+
+void PrintSyncStats()
+{
+	SyncStats stats;
+
+	if (s_nSyncMode == SYNC_OFF)
+		return;
+
+	SyncGetStats(&stats);
+
+	printf("Sync: %llu frames, %llu late, swap %.2f ms after schedule (max %.2f)",
+		(unsigned long long) stats.frames,
+		(unsigned long long) stats.late,
+		stats.swapMean,
+		stats.swapMax);
+
+	if (stats.mode == SYNC_MASTER)
+	{
+		printf(", %d nodes, skew over %llu frames p50 %.3f ms p95 %.3f ms max %.3f ms\n",
+			stats.nodes,
+			(unsigned long long) stats.skewFrames,
+			stats.skewP50,
+			stats.skewP95,
+			stats.skewMax);
+	}
+	else if (stats.synced)
+	{
+		printf(", %llu skipped, %llu timeouts, clock offset %.3f ms (round trip %.3f ms)\n",
+			(unsigned long long) stats.skipped,
+			(unsigned long long) stats.timeouts,
+			stats.offset,
+			stats.roundTrip);
+	}
+	else
+	{
+		printf(", %llu timeouts, no clock estimate yet\n", (unsigned long long) stats.timeouts);
+	}
+}
+
+///
+// Refresh what discovery replies advertise. fFrameTime is the mean
+// frame time in seconds, 0 before there is one.
+//
+void PublishStatus(ESContext *esContext, float fFrameTime)
+{
+	NetStatus status;
+
+	status.models = modelPaths;
+	status.numModels = numModels;
+	status.width = esContext->width;
+	status.height = esContext->height;
+	status.views = numViews;
+	status.load = fFrameTime / s_dynRes.targetFrameTime;
+
+	NetSetStatus(&status);
+}
+
+///
+// Refresh the render thread's part of stats query answers, from the
+// interval just reported.
+//
+void PublishRenderStats(float fFrameTime)
+{
+	ProtocolStats stats;
+	ProfilerSummary frame;
+	ProfilerSummary input;
+	AssetPushStats push;
+	int nHits = 0;
+	int nMisses = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	ProfilerGetIntervalSummary(PROFILER_STAGE_FRAME, &frame);
+	ProfilerGetIntervalSummary(PROFILER_STAGE_INPUT, &input);
+	AssetPushGetStats(&push);
+	GetShaderCacheStats(&nHits, &nMisses);
+
+	stats.fps = 1.0f / fFrameTime;
+	stats.frameP50 = frame.p50 * 1e-6f;
+	stats.frameP95 = frame.p95 * 1e-6f;
+	stats.frameP99 = frame.p99 * 1e-6f;
+	stats.frameMax = frame.max * 1e-6f;
+	stats.load = fFrameTime / s_dynRes.targetFrameTime;
+	stats.latency = s_uCommandLatency * 1e-6f;
+	stats.inputP50 = input.p50 * 1e-6f;
+	stats.inputP95 = input.p95 * 1e-6f;
+	stats.inputP99 = input.p99 * 1e-6f;
+	stats.models = (uint16_t) numModels;
+	stats.pushing = (uint8_t) push.pushing;
+	stats.pushProgress = (push.size > 0) ? (uint8_t) (100 * push.received / push.size) : 0;
+	stats.assetsWaiting = (uint8_t) push.waiting;
+	stats.shaderHits = (uint16_t) nHits;
+	stats.shaderMisses = (uint16_t) nMisses;
+
+	NetSetRenderStats(&stats);
+}
+
+void PrintMotionStats()
+{
+	MotionStats stats;
+
+	if (s_fInterpDelay <= 0.0f)
+		return;
+
+	MotionGetStats(&s_motion, &stats);
+
+	// Nothing to report while the controller is idle
+	if (stats.held == stats.frames)
+		return;
+
+	printf("Motion: %.0f ms delay, buffer depth %.1f (min %d, max %d), %llu of %llu frames extrapolated, %llu held, prediction error %.2f deg (max %.2f)\n",
+		s_fInterpDelay,
+		stats.meanDepth,
+		stats.minDepth,
+		stats.maxDepth,
+		(unsigned long long) stats.extrapolated,
+		(unsigned long long) stats.frames,
+		(unsigned long long) stats.held,
+		stats.meanError,
+		stats.maxError);
+}
+
+///
+// Per frame bookkeeping that does not touch GL state.
+//
+void Update ( ESContext *esContext, float deltaTime )
+{
+   static int bFirstFrame = 1;
+
+   UpdateDynamicResolution(deltaTime);
+
+   // The delta, swap and stage timers all belong to the previous frame
+   if (!bFirstFrame)
+   {
+      uint64_t uFrame = (uint64_t) (deltaTime * 1e9);
+      uint64_t uSwap = (uint64_t) (esContext->swapTime * 1e9);
+      uint64_t uNow = ProfilerNow();
+
+      ProfilerRecord(PROFILER_STAGE_FRAME, uFrame);
+      ProfilerRecord(PROFILER_STAGE_SWAP, uSwap);
+
+      // Both ended just before this call
+      TraceComplete("frame", uNow - uFrame, uFrame);
+      TraceComplete("swap", uNow - uSwap, uSwap);
+
+      if (s_nSyncMode != SYNC_OFF)
+      {
+         SyncReportSwap(&s_syncFrame, uNow);
+      }
+
+      // The frame that showed the newest transform just ended
+      if (s_inputCommand.received != 0)
+      {
+         ProfilerRecord(PROFILER_STAGE_INPUT, uNow - s_inputCommand.received);
+         ProfilerRecord(PROFILER_STAGE_APPLY, s_uInputApplied - s_inputCommand.received);
+         ProfilerRecord(PROFILER_STAGE_PRESENT, uNow - s_uInputApplied);
+
+         if (s_bAck)
+            NetAcknowledge(&s_inputCommand, s_uInputApplied, uNow);
+
+         s_inputCommand.received = 0;
+      }
+
+      if (s_uCommandReceived != 0)
+      {
+         s_uCommandLatency = uNow - s_uCommandReceived;
+         s_uCommandReceived = 0;
+      }
+   }
+
+   ProfilerEndFrame();
+   bFirstFrame = 0;
+
+   // Benchmarks report once at the end, over the whole run
+   if (s_bench.path != 0)
+   {
+      UpdateRenderBench(deltaTime);
+      return;
+   }
+
+   s_nStatsFrames++;
+   s_fStatsTime += deltaTime;
+
+   // A pushed model is advertised right away
+   if (s_bStatusChanged)
+   {
+      PublishStatus(esContext, s_fStatsTime / s_nStatsFrames);
+      s_bStatusChanged = 0;
+   }
+
+   if (s_fStatsTime > s_fStatsInterval)
+   {
+      float fFrameTime = s_fStatsTime / s_nStatsFrames;
+
+      PublishStatus(esContext, fFrameTime);
+
+      s_fStatsTime -= s_fStatsInterval;
+      PrintDynamicResolution(esContext->width, esContext->height);
+      PrintCullingStats();
+      PrintNetworkStats();
+      PrintMotionStats();
+      PrintSyncStats();
+      ProfilerReportInterval();
+      PublishRenderStats(fFrameTime);
+   }
+}
+
+
+///
+// The current model kept on the CPU for the software backend. Only the
+// face count, winding and shader flags of the mesh are used.
+//
+typedef struct
+{
+	Mesh mesh;
+	float* pVertexBuffer;
+	unsigned char* pColors;
+	unsigned char* pTextureData;
+	SoftTexture texture;
+} SoftMesh;
+
+static SoftMesh s_softMesh;
+
+void LoadSoftMesh(SoftMesh* pSoftMesh, const char* pModelPath, const char* pTexturePath)
+{
+	Mesh* pMesh = &pSoftMesh->mesh;
+
+	memset(pSoftMesh, 0, sizeof(SoftMesh));
+
+	ScopedMemoryAsset modelAsset(pModelPath);
+
+	int nAttributes = 0;
+
+	pSoftMesh->pVertexBuffer = ParseOBJ(pModelPath, pMesh->faces, nAttributes);
+	pMesh->shaderFlags = ApplyLightingMode(ShaderFlagsForOBJ(nAttributes));
+
+	DetectWinding(pMesh, pSoftMesh->pVertexBuffer);
+
+	if (pMesh->shaderFlags & SHADER_BAKED)
+	{
+		pSoftMesh->pColors = new unsigned char[pMesh->faces * 3 * 4];
+		MemoryTrack(MEMORY_HEAP, (uintptr_t) pSoftMesh->pColors, pMesh->faces * 3 * 4);
+		BakeVertexLighting(pSoftMesh->pVertexBuffer, pMesh->faces * 3, pSoftMesh->pColors);
+	}
+
+	ScopedMemoryAsset textureAsset(pTexturePath);
+
+	pSoftMesh->pTextureData = DecodeBMP(pTexturePath,
+		&pSoftMesh->texture.width,
+		&pSoftMesh->texture.height);
+	pSoftMesh->texture.pData = pSoftMesh->pTextureData;
+}
+
+void FreeSoftMesh(SoftMesh* pSoftMesh)
+{
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pSoftMesh->pVertexBuffer);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pSoftMesh->pColors);
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pSoftMesh->pTextureData);
+
+	delete[] pSoftMesh->pVertexBuffer;
+	delete[] pSoftMesh->pColors;
+	delete[] pSoftMesh->pTextureData;
+
+	memset(pSoftMesh, 0, sizeof(SoftMesh));
+}
+
+///
+// Software lighting mode matching the shader variant of a mesh.
+//
+int SoftLighting(int nFlags)
+{
+	if (nFlags & SHADER_BAKED)
+		return SOFT_LIGHT_BAKED;
+
+	if (nFlags & SHADER_LIT)
+		return (nFlags & SHADER_VERTEX_LIGHTING) ? SOFT_LIGHT_VERTEX : SOFT_LIGHT_PIXEL;
+
+	return SOFT_LIGHT_NONE;
+}
+
+///
+// Software backend: bin one view of the model into the target passed
+// as the context. The tiles are shaded later by its workers.
+//
+void DrawSoftView(void* pContext, const View* pView, const ViewTransform* pTransform)
+{
+   SoftTarget* pTarget = (SoftTarget*) pContext;
+   const Mesh* pMesh = &s_softMesh.mesh;
+   SoftDraw draw;
+
+   draw.pMVPMatrix = &pTransform->mvp.m[0][0];
+   draw.pNormalMatrix = &pTransform->normal.m[0][0];
+   draw.pVertexBuffer = s_softMesh.pVertexBuffer;
+   draw.numFaces = pMesh->faces;
+   draw.pColors = s_softMesh.pColors;
+   draw.pTexture = ((pMesh->shaderFlags & SHADER_TEXTURED) && s_softMesh.texture.pData) ? &s_softMesh.texture : 0;
+   draw.lighting = SoftLighting(pMesh->shaderFlags);
+   draw.cullBackFaces = pMesh->closed;
+   draw.frontFaceCW = pTransform->frontFaceCW;
+   draw.viewport[0] = pView->x;
+   draw.viewport[1] = pView->y;
+   draw.viewport[2] = pView->width;
+   draw.viewport[3] = pView->height;
+
+   SoftDrawTriangles(pTarget, &draw);
+}
+
+///
+// Software counterpart of Draw: the model once per view through the
+// same DrawModelViews. Binning happens on this thread, the tiles are
+// shaded by the workers of the target.
+//
+void DrawSoftware(SoftTarget* pTarget, double* pBinTime, double* pTileTime)
+{
+   ModelBackend backend = { DrawSoftView, pTarget };
+   double fStart = GetSeconds();
+
+   SoftClear(pTarget);
+   DrawModelViews(&backend, &s_softMesh.mesh, s_arViews, numViews);
+
+   double fBinned = GetSeconds();
+
+   SoftFinish(pTarget);
+
+   *pBinTime += fBinned - fStart;
+   *pTileTime += GetSeconds() - fBinned;
+}
+
+///
+// Render frames without a GPU or window and optionally keep the last
+// one as a PPM.
+//
+void RunSoftware(const char* pOutput, int nFrames, int nThreads)
+{
+   SoftTarget target;
+   double fBinTime = 0.0;
+   double fTileTime = 0.0;
+
+   if (!CreateSoftTarget(&target, SCREEN_WIDTH, SCREEN_HEIGHT, nThreads))
+      return;
+
+   for (int i = 0; i < nFrames; i++)
+   {
+      DrawSoftware(&target, &fBinTime, &fTileTime);
+   }
+
+   printf("Software: %d frames on %d threads, %2.3f ms/frame (%2.3f binning, %2.3f tiles)\n",
+      nFrames,
+      target.numThreads,
+      1000.0 * (fBinTime + fTileTime) / nFrames,
+      1000.0 * fBinTime / nFrames,
+      1000.0 * fTileTime / nFrames);
+
+   if (pOutput != 0 && SoftWritePPM(&target, pOutput))
+   {
+      printf("Wrote %s\n", pOutput);
+   }
+
+   DestroySoftTarget(&target);
+}
+
+///
+// Time the tile stage with 1, 2, 4... workers up to the number of
+// hardware threads. Binning is single threaded and reported separately.
+//
+void RunSoftBenchmark(int nFrames)
+{
+   int nMaxThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+   double fBaseTime = 0.0;
+
+   if (nMaxThreads < 1)
+      nMaxThreads = 1;
+
+   for (int nThreads = 1; ; nThreads *= 2)
+   {
+      if (nThreads > nMaxThreads)
+         nThreads = nMaxThreads;
+
+      SoftTarget target;
+      double fBinTime = 0.0;
+      double fTileTime = 0.0;
+
+      if (!CreateSoftTarget(&target, SCREEN_WIDTH, SCREEN_HEIGHT, nThreads))
+         return;
+
+      // One untimed frame to size the bins
+      DrawSoftware(&target, &fBinTime, &fTileTime);
+      fBinTime = 0.0;
+      fTileTime = 0.0;
+
+      for (int i = 0; i < nFrames; i++)
+      {
+         DrawSoftware(&target, &fBinTime, &fTileTime);
+      }
+
+      DestroySoftTarget(&target);
+
+      if (nThreads == 1)
+         fBaseTime = fTileTime;
+
+      printf("%2d threads: %7.3f ms/frame tiles, %7.3f ms/frame binning, %5.2fx\n",
+         nThreads,
+         1000.0 * fTileTime / nFrames,
+         1000.0 * fBinTime / nFrames,
+         fBaseTime / fTileTime);
+
+      if (nThreads == nMaxThreads)
+         break;
+   }
+}
+
+void FlipBlackTriangles()
+{
+	for (int i = 1; i < 12; i += 2)
+	{
+		triangleVerts[i] *= -1.0f;
+	}
+
+	for (int i = 1; i < 8; i += 2)
+	{
+		lineVerts[i] *= -1.0f;
+	}
+
+	s_bFlipped = !s_bFlipped;
+	printf("Flipped black triangle.\n");
+}
+
+// Paths of pushed models and of textures pushed for them, and the
+// parsed buffer of a pushed model until it is first shown.
+typedef struct
+{
+	char modelPath[128];
+	char texturePath[128];
+
+	float* vertices;
+	unsigned int faces;
+	int attributes;
+} PushedModel;
+
+static PushedModel s_arPushed[MAX_MODELS];
+
+///
+// Show model nModel. A pushed model not shown yet uses the buffer the
+// asset thread parsed, anything else is loaded from disk.
+//
+void LoadModel(int nModel)
+{
+	PushedModel* pPushed = &s_arPushed[nModel];
+
+	if (pPushed->vertices == 0)
+	{
+		LoadMesh(&s_currentMesh, modelPaths[nModel], texturePaths[nModel]);
+		return;
+	}
+
+	ScopedTrace trace("LoadMesh");
+
+	ReleaseMesh(&s_currentMesh);
+
+	{
+		ScopedMemoryAsset asset(modelPaths[nModel]);
+
+		s_currentMesh.faces = pPushed->faces;
+		s_currentMesh.shaderFlags = ShaderFlagsForOBJ(pPushed->attributes);
+		s_currentMesh.vbo = CreateMeshBuffer(&s_currentMesh, pPushed->vertices);
+
+		MemoryRelease(MEMORY_HEAP, (uintptr_t) pPushed->vertices);
+		delete[] pPushed->vertices;
+		pPushed->vertices = 0;
+	}
+
+	s_currentMesh.texture = LoadBMP(texturePaths[nModel]);
+}
+
+///
+// Length of a path without its extension.
+//
+static int StemLength(const char* pPath)
+{
+	const char* pDot = strrchr(pPath, '.');
+
+	return (pDot != 0) ? (int) (pDot - pPath) : (int) strlen(pPath);
+}
+
+///
+// Add a pushed model to the model list, or replace the one pushed
+// under the same name. It is textured with the pushed texture of the
+// same name if there is one.
+// \return The model index, or -1 if the list is full.
+//
+int RegisterModel(AssetReady* pAsset)
+{
+	int nModel = -1;
+
+	for (int i = 0; i < numModels; i++)
+	{
+		if (strcmp(modelPaths[i], pAsset->path) == 0)
+			nModel = i;
+	}
+
+	if (nModel < 0)
+	{
+		if (numModels == MAX_MODELS)
+		{
+			printf("Model list full, %s not added.\n", pAsset->path);
+			MemoryRelease(MEMORY_HEAP, (uintptr_t) pAsset->vertices);
+			delete[] pAsset->vertices;
+			return -1;
+		}
+
+		nModel = numModels++;
+	}
+
+	PushedModel* pPushed = &s_arPushed[nModel];
+
+	snprintf(pPushed->modelPath, sizeof(pPushed->modelPath), "%s", pAsset->path);
+	snprintf(pPushed->texturePath, sizeof(pPushed->texturePath), "%.*s.bmp",
+		StemLength(pAsset->path), pAsset->path);
+
+	if (access(pPushed->texturePath, R_OK) != 0)
+		snprintf(pPushed->texturePath, sizeof(pPushed->texturePath), "%s", SCENE_TEXTURE);
+
+	modelPaths[nModel] = pPushed->modelPath;
+	texturePaths[nModel] = pPushed->texturePath;
+
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pPushed->vertices);
+	delete[] pPushed->vertices;
+	pPushed->vertices = pAsset->vertices;
+	pPushed->faces = pAsset->faces;
+	pPushed->attributes = pAsset->attributes;
+
+	printf("Pushed model %d: %s, %u faces.\n", nModel, pPushed->modelPath, pPushed->faces);
+
+	if (nModel == currentModel)
+		LoadModel(nModel);
+
+	s_bStatusChanged = 1;
+	return nModel;
+}
+
+///
+// Use a pushed texture for the pushed model of the same name.
+// \return The index of that model, or -1 if it is not pushed yet.
+//
+int RegisterTexture(AssetReady* pAsset)
+{
+	int nStem = StemLength(pAsset->path);
+	int nModel = -1;
+
+	for (int i = 0; i < numModels; i++)
+	{
+		if (StemLength(modelPaths[i]) == nStem && strncmp(modelPaths[i], pAsset->path, nStem) == 0)
+			nModel = i;
+	}
+
+	if (nModel >= 0)
+	{
+		PushedModel* pPushed = &s_arPushed[nModel];
+
+		snprintf(pPushed->texturePath, sizeof(pPushed->texturePath), "%s", pAsset->path);
+		texturePaths[nModel] = pPushed->texturePath;
+
+		// Already decoded, only the upload is left
+		if (nModel == currentModel)
+		{
+			ScopedMemoryAsset asset(pAsset->path);
+
+			MemoryRelease(MEMORY_TEXTURE, s_currentMesh.texture);
+			glDeleteTextures(1, &s_currentMesh.texture);
+			s_currentMesh.texture = UploadTexture(pAsset->pixels, pAsset->width, pAsset->height);
+		}
+
+		printf("Pushed texture for model %d: %s.\n", nModel, pAsset->path);
+	}
+
+	MemoryRelease(MEMORY_HEAP, (uintptr_t) pAsset->pixels);
+	delete[] pAsset->pixels;
+
+	return nModel;
+}
+
+///
+// Take a model or texture the asset thread finished, if any. Parsing
+// happened there; only the upload is left for this thread.
+//
+void UpdateAssets()
+{
+	AssetReady asset;
+
+	if (!AssetPushPoll(&asset))
+		return;
+
+	ScopedTrace trace("RegisterAsset");
+
+	if (asset.kind == PROTOCOL_ASSET_MODEL)
+		AssetPushDone(RegisterModel(&asset));
+	else
+		AssetPushDone(RegisterTexture(&asset));
+}
+
+void ApplyCommand(const NetCommand* pCommand)
+{
+	ScopedTrace trace("NetworkCommand");
+
+	switch (pCommand->type)
+	{
+	case NET_CMD_FLIP:
+		FlipBlackTriangles();
+		break;
+
+	case NET_CMD_LINES:
+		displayLines = !displayLines;
+		break;
+
+	case NET_CMD_MODEL:
+		currentModel = pCommand->model;
+
+		if (currentModel >= numModels)
+			currentModel = numModels - 1;
+		if (currentModel < 0)
+			currentModel = 0;
+
+		LoadModel(currentModel);
+		break;
+
+	case NET_CMD_TRANSFORM:
+		if (s_fInterpDelay > 0.0f)
+		{
+			float arValues[MOTION_VALUES] = { pCommand->pitch, pCommand->yaw, pCommand->roll, pCommand->scale };
+
+			// 0 is no tag
+			if (++s_uMotionTag == 0)
+				s_uMotionTag = 1;
+
+			MotionInput* pInput = &s_arMotionInputs[s_uMotionTag % MOTION_MAX_SAMPLES];
+			pInput->tag = s_uMotionTag;
+			pInput->command = *pCommand;
+
+			// Timed in UpdateServer once the buffer shows it
+			MotionAdd(&s_motion, pCommand->received, pCommand->sent, arValues, s_uMotionTag);
+		}
+		else
+		{
+			rotation = pCommand->yaw;
+			scale = pCommand->scale;
+
+			s_inputCommand = *pCommand;
+			s_uInputApplied = ProfilerNow();
+		}
+		break;
+	}
+
+	s_uCommandReceived = pCommand->received;
+}
+
+///
+// Apply everything the network thread received since the last frame.
+// Reading the ring makes no system calls. Transforms go through the
+// jitter buffer, and the pose for this frame is read back from it.
+// Called before the frame is drawn, so its swap shows what this applied.
+//
+void UpdateServer()
+{
+	ScopedStageTimer timer(PROFILER_STAGE_NETWORK);
+	NetCommand command;
+	float arValues[MOTION_VALUES];
+	uint32_t uShown = 0;
+
+	while (NetPoll(&command))
+	{
+		ApplyCommand(&command);
+	}
+
+	UpdateAssets();
+
+	uint64_t uNow = ProfilerNow();
+
+	if (s_fInterpDelay > 0.0f && MotionEvaluate(&s_motion, uNow, arValues, &uShown))
+	{
+		rotation = arValues[1];
+		scale = arValues[3];
+	}
+
+	// The input ring holds as many as the buffer, but a sample can
+	// outlive its slot when older ones arrive after it
+	const MotionInput* pInput = &s_arMotionInputs[uShown % MOTION_MAX_SAMPLES];
+
+	if (uShown != 0 && pInput->tag == uShown)
+	{
+		s_inputCommand = pInput->command;
+		s_uInputApplied = uNow;
+	}
+}
+
+
+///
+// Take over the frame state of the sync master.
+//
+void ApplySyncState(const SyncState* pState)
+{
+	rotation = pState->yaw;
+	scale = pState->scale;
+	displayLines = (pState->flags & SYNC_FLAG_LINES) != 0;
+
+	if (((pState->flags & SYNC_FLAG_FLIPPED) != 0) != (s_bFlipped != 0))
+		FlipBlackTriangles();
+
+	if (pState->model != currentModel && pState->model >= 0 && pState->model < numModels)
+	{
+		currentModel = pState->model;
+		LoadModel(currentModel);
+	}
+}
+
+///
+// Draw the frame the sync group agreed on and hold the swap until it
+// is due. The master publishes the state the controller left it with;
+// a follower that hears nothing draws its last state unscheduled.
+//
+void DrawSynced ( ESContext *esContext )
+{
+	SyncState* pFrame = &s_syncFrame;
+
+	if (s_nSyncMode == SYNC_MASTER)
+	{
+		// Followers draw what is published, so this frame's commands
+		// have to be in it
+		if (s_bench.path == 0)
+			UpdateServer();
+
+		pFrame->model = currentModel;
+		pFrame->flags = (displayLines ? SYNC_FLAG_LINES : 0) | (s_bFlipped ? SYNC_FLAG_FLIPPED : 0);
+		pFrame->pitch = 0.0f;
+		pFrame->yaw = rotation;
+		pFrame->roll = 0.0f;
+		pFrame->scale = scale;
+
+		SyncPublish(pFrame);
+	}
+	else if (SyncWaitState(pFrame, SYNC_WAIT_MS * 1000000ull))
+	{
+		ApplySyncState(pFrame);
+	}
+	else
+	{
+		pFrame->present = 0;
+	}
+
+	s_pDrawFrame(esContext);
+
+	SyncWaitPresent(pFrame->present);
+}
+
+///
+// Charge the fixed size buffers to their own asset, so the totals start
+// from what the binary holds before any model is loaded.
+//
+void TrackStaticMemory()
+{
+   ScopedMemoryAsset asset("static");
+
+   MemoryTrack(MEMORY_HEAP, (uintptr_t) s_arViews, sizeof(s_arViews));
+   MemoryTrack(MEMORY_HEAP, (uintptr_t) s_arCompositeVerts, sizeof(s_arCompositeVerts));
+}
+
+///
+// Close the last frame of --bench-render, which ends with the swap
+// after the main loop has stopped calling Update. Call right after the
+// loop returns; does nothing for other runs.
+//
+void FinishRenderBench(ESContext* esContext)
+{
+   RenderBench* pBench = &s_bench;
+   int nMeasured = pBench->frame - 1;
+
+   if (pBench->path == 0 || nMeasured < 1)
+      return;
+
+   uint64_t uFrame = ProfilerNow() - pBench->frameStart;
+
+   pBench->frameTimes[nMeasured - 1] = uFrame * 1e-9f;
+
+   ProfilerRecord(PROFILER_STAGE_FRAME, uFrame);
+   ProfilerRecord(PROFILER_STAGE_SWAP, (uint64_t) (esContext->swapTime * 1e9));
+   ProfilerEndFrame();
+}
+
+static void WriteJSONString(FILE* pFile, const char* pValue)
+{
+   fputc('"', pFile);
+
+   for (; *pValue != 0; pValue++)
+   {
+      if (*pValue == '"' || *pValue == '\\')
+         fputc('\\', pFile);
+      fputc(*pValue, pFile);
+   }
+
+   fputc('"', pFile);
+}
+
+///
+// Write the results of --bench-render: exact frame time percentiles and
+// every frame time, the stage percentiles of the profiler, renderer
+// counters per frame and, in the recording build, the GL call totals.
+// Call after ProfilerReportTotal so the stages cover the whole run.
+//
+int WriteRenderBench(const ESContext* esContext, const char* pModelPath, int nHeadless)
+{
+   RenderBench* pBench = &s_bench;
+   int nMeasured = pBench->frame - 1;
+   FILE* pFile = 0;
+
+   if (nMeasured < 1)
+   {
+      printf("Benchmark stopped before any frame was measured.\n");
+      return 0;
+   }
+
+   pFile = fopen(pBench->path, "w");
+   if (pFile == 0)
+   {
+      printf("Could not create %s\n", pBench->path);
+      return 0;
+   }
+
+   float* pSorted = new float[nMeasured];
+   double fSum = 0.0;
+
+   for (int i = 0; i < nMeasured; i++)
+   {
+      pSorted[i] = pBench->frameTimes[i];
+      fSum += pBench->frameTimes[i];
+   }
+
+   std::sort(pSorted, pSorted + nMeasured);
+
+   fprintf(pFile, "{\n  \"model\": ");
+   WriteJSONString(pFile, pModelPath);
+   fprintf(pFile, ",\n  \"backend\": \"%s\", \"renderer\": ", nHeadless ? "headless" : "window");
+   WriteJSONString(pFile, (const char*) glGetString(GL_RENDERER));
+   fprintf(pFile, ",\n  \"width\": %d, \"height\": %d, \"views\": %d, \"frames\": %d,\n",
+      esContext->width, esContext->height, numViews, nMeasured);
+
+   fprintf(pFile, "  \"frame_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+      1e3 * fSum / nMeasured,
+      1e3 * pSorted[(nMeasured - 1) * 50 / 100],
+      1e3 * pSorted[(nMeasured - 1) * 95 / 100],
+      1e3 * pSorted[(nMeasured - 1) * 99 / 100],
+      1e3 * pSorted[nMeasured - 1]);
+
+   fprintf(pFile, "  \"stages\": [");
+   for (int i = 0, n = 0; i < PROFILER_STAGE_COUNT; i++)
+   {
+      ProfilerSummary summary;
+
+      ProfilerGetSummary(i, &summary);
+      if (summary.samples == 0)
+         continue;
+
+      fprintf(pFile, "%s\n    { \"name\": \"%s\", \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"samples\": %llu }",
+         n++ ? "," : "",
+         ProfilerStageName(i),
+         summary.p50 * 1e-6,
+         summary.p95 * 1e-6,
+         summary.p99 * 1e-6,
+         summary.max * 1e-6,
+         (unsigned long long) summary.samples);
+   }
+   fprintf(pFile, "\n  ],\n");
+
+   fprintf(pFile, "  \"per_frame\": { \"draw_calls\": %.1f, \"triangles\": %.1f, \"culled_triangles\": %.1f }",
+      (double) s_nDrawCalls / nMeasured,
+      (double) s_nDrawnFaces / nMeasured,
+      (double) s_nCulledFaces / nMeasured);
+
+   // Only the recording stand-in counts GL calls
+   if (GLRecordGetTotals != 0)
+   {
+      GLRecordTotals totals;
+
+      GLRecordGetTotals(&totals);
+
+      fprintf(pFile, ",\n  \"gl\": { \"frames\": %u, \"calls\": %u, \"draws\": %u, \"vertices\": %u, \"state_changes\": %u, \"redundant_changes\": %u,\n"
+                     "          \"upload_bytes\": %u, \"uniform_bytes\": %u, \"client_bytes\": %u }",
+         totals.frames,
+         totals.calls,
+         totals.draws,
+         totals.vertices,
+         totals.stateChanges,
+         totals.redundantChanges,
+         totals.uploadBytes,
+         totals.uniformBytes,
+         totals.clientBytes);
+   }
+
+   fprintf(pFile, ",\n  \"frame_times_ms\": [");
+   for (int i = 0; i < nMeasured; i++)
+      fprintf(pFile, "%s%s%.4f", i ? "," : "", (i % 10) ? " " : "\n    ", 1e3 * pBench->frameTimes[i]);
+   fprintf(pFile, "\n  ]\n}\n");
+
+   fclose(pFile);
+   delete[] pSorted;
+
+   printf("Wrote %s\n", pBench->path);
+   return 1;
+}
+
+static ESContext* s_pMainContext = 0;
+
+///
+// Leave the main loop on Ctrl-C so the run totals still get printed.
+//
+static void HandleQuitSignal(int nSignal)
+{
+   (void) nSignal;
+
+   if (s_pMainContext != 0)
+      s_pMainContext->quit = 1;
+}
 
 int main ( int argc, char *argv[] )
 {
    ESContext esContext;
    UserData  userData;
+   int nNumViews = 1;
+   int nMirror = 0;
+   int nSceneInstances = 0;
+   const char* pSoftOutput = 0;
+   int nSoftware = 0;
+   int nSoftBench = 0;
+   int nFrames = 0;
+   int nThreads = 0;
+   int nHeadless = 0;
+   const char* pTracePath = 0;
+   const char* pModelPath = modelPaths[0];
+   const char* pTexturePath = texturePaths[0];
+   const char* pSyncGroup = SYNC_DEFAULT_GROUP;
+   int nSyncPort = SYNC_DEFAULT_PORT;
+   // Pushed files are written to disk, so listening is opt-in
+   int nAssetPort = 0;
+   const char* pAssetAddress = 0;
+   const char* pCapturePath = 0;
+   const char* pSyncInterface = 0;
+   float fTargetFps = DYNRES_TARGET_FPS;
+
+   for (int i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--views") == 0 && i + 1 < argc)
+      {
+         nNumViews = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--replicate") == 0)
+      {
+         replicateViews = 1;
+      }
+      else if (strcmp(argv[i], "--mirror") == 0)
+      {
+         nMirror = 1;
+      }
+      else if (strcmp(argv[i], "--dynamic-res") == 0)
+      {
+         s_dynRes.enabled = 1;
+      }
+      else if (strcmp(argv[i], "--min-scale") == 0 && i + 1 < argc)
+      {
+         s_dynRes.minScale = (float) atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--max-scale") == 0 && i + 1 < argc)
+      {
+         s_dynRes.maxScale = (float) atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--target-fps") == 0 && i + 1 < argc)
+      {
+         fTargetFps = (float) atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--scene-bench") == 0 && i + 1 < argc)
+      {
+         nSceneInstances = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--no-batching") == 0)
+      {
+         s_bBatchInstances = 0;
+      }
+      else if (strcmp(argv[i], "--software") == 0 && i + 1 < argc)
+      {
+         nSoftware = 1;
+         pSoftOutput = argv[++i];
+      }
+      else if (strcmp(argv[i], "--soft-bench") == 0)
+      {
+         nSoftware = 1;
+         nSoftBench = 1;
+      }
+      else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc)
+      {
+         s_fStatsInterval = (float) atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      {
+         pTracePath = argv[++i];
+      }
+      else if (strcmp(argv[i], "--bench-render") == 0 && i + 1 < argc)
+      {
+         s_bench.path = argv[++i];
+      }
+      else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc)
+      {
+         i++;
+         if (strcmp(argv[i], "master") == 0)
+            s_nSyncMode = SYNC_MASTER;
+         else if (strcmp(argv[i], "follower") == 0)
+            s_nSyncMode = SYNC_FOLLOWER;
+         else
+            s_nSyncMode = SYNC_OFF;
+      }
+      else if (strcmp(argv[i], "--sync-group") == 0 && i + 1 < argc)
+      {
+         pSyncGroup = argv[++i];
+      }
+      else if (strcmp(argv[i], "--sync-port") == 0 && i + 1 < argc)
+      {
+         nSyncPort = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--sync-interface") == 0 && i + 1 < argc)
+      {
+         pSyncInterface = argv[++i];
+      }
+      else if (strcmp(argv[i], "--face") == 0 && i + 1 < argc)
+      {
+         s_nFace = atoi(argv[++i]) % MAX_VIEWS;
+      }
+      else if (strcmp(argv[i], "--interp-delay") == 0 && i + 1 < argc)
+      {
+         s_fInterpDelay = (float) atof(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--asset-port") == 0 && i + 1 < argc)
+      {
+         nAssetPort = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--asset-bind") == 0 && i + 1 < argc)
+      {
+         pAssetAddress = argv[++i];
+      }
+      else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+      {
+         pCapturePath = argv[++i];
+      }
+      else if (strcmp(argv[i], "--ack") == 0)
+      {
+         s_bAck = 1;
+      }
+      else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+      {
+         pModelPath = argv[++i];
+      }
+      else if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+      {
+         pTexturePath = argv[++i];
+      }
+      else if (strcmp(argv[i], "--headless") == 0)
+      {
+         nHeadless = 1;
+      }
+      else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+      {
+         s_pDumpPath = argv[++i];
+      }
+      else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+      {
+         nFrames = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      {
+         nThreads = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "--lighting") == 0 && i + 1 < argc)
+      {
+         i++;
+         if (strcmp(argv[i], "vertex") == 0)
+            lightingMode = LIGHTING_VERTEX;
+         else if (strcmp(argv[i], "baked") == 0)
+            lightingMode = LIGHTING_BAKED;
+         else
+            lightingMode = LIGHTING_PIXEL;
+      }
+      else
+      {
+         printf("Usage: %s [--views 1|2|4] [--replicate] [--mirror]\n"
+                "       [--dynamic-res] [--min-scale s] [--max-scale s] [--target-fps f]\n"
+                "       [--scene-bench instances] [--no-batching]\n"
+                "       [--lighting pixel|vertex|baked]\n"
+                "       [--software out.ppm | --soft-bench] [--frames n] [--threads n]\n"
+                "       [--headless] [--dump out.ppm|out%%04d.ppm] [--stats-interval s]\n"
+                "       [--trace out.json] [--model file.obj] [--texture file.bmp]\n"
+                "       [--bench-render out.json] [--interp-delay ms]\n"
+                "       [--sync master|follower] [--sync-group addr] [--sync-port n]\n"
+                "       [--sync-interface addr] [--face 0-3]\n"
+                "       [--asset-port n] [--asset-bind addr] [--capture out.cap] [--ack]\n", argv[0]);
+         return 0;
+      }
+   }
+
+   // Written so that NaN fails too. A scale of 0 leaves nothing to draw
+   // into and an inverted range fights the controller
+   if (!(s_dynRes.minScale > 0.0f && s_dynRes.minScale <= s_dynRes.maxScale && s_dynRes.maxScale <= 1.0f))
+   {
+      printf("--min-scale and --max-scale need 0 < min <= max <= 1.\n");
+      return 1;
+   }
+
+   if (!(fTargetFps > 0.0f && isfinite(fTargetFps)))
+   {
+      printf("--target-fps needs a positive rate.\n");
+      return 1;
+   }
+
+   s_dynRes.targetFrameTime = 1.0f / fTargetFps;
+
+   // Closed from atexit so that every way out of main ends the file
+   if (pTracePath != 0 && TraceStart(pTracePath))
+   {
+      TraceThreadName("main");
+      atexit(TraceStop);
+   }
+
+   TrackStaticMemory();
+
+   // The software backend needs no window, context or GPU
+   if (nSoftware)
+   {
+      SetupViews(nNumViews, nMirror, SCREEN_WIDTH, SCREEN_HEIGHT);
+      LoadSoftMesh(&s_softMesh, pModelPath, pTexturePath);
+
+      if (nSoftBench)
+      {
+         RunSoftBenchmark((nFrames > 0) ? nFrames : 50);
+      }
+      else
+      {
+         RunSoftware(pSoftOutput, (nFrames > 0) ? nFrames : 1, nThreads);
+      }
+
+      MemoryReport();
+      FreeSoftMesh(&s_softMesh);
+      return 0;
+   }
 
    esInitContext ( &esContext );
    esContext.userData = &userData;
 
-   esCreateWindow ( &esContext, "Ghost Renderer", SCREEN_WIDTH, SCREEN_HEIGHT, ES_WINDOW_RGB | ES_WINDOW_DEPTH);
+   GLuint uWindowFlags = ES_WINDOW_RGB | ES_WINDOW_DEPTH;
+
+   if (nHeadless)
+   {
+      uWindowFlags |= ES_WINDOW_HEADLESS;
+      esContext.maxFrames = (nFrames > 0) ? nFrames : 1;
+   }
+
+   if (s_bench.path != 0)
+   {
+      // The warm-up frame comes on top of the measured ones
+      if (nFrames > 0)
+         s_bench.frames = nFrames;
+
+      s_bench.frameTimes = new float[s_bench.frames];
+      esContext.maxFrames = s_bench.frames + 1;
+   }
+
+   GLboolean bCreated = esCreateWindow ( &esContext, "Ghost Renderer", SCREEN_WIDTH, SCREEN_HEIGHT, uWindowFlags);
+
+   // Benchmarks run on whatever there is, without a display that is
+   // a headless context
+   if (!bCreated && s_bench.path != 0 && !nHeadless)
+   {
+      printf("No window, running the benchmark headless.\n");
+
+      nHeadless = 1;
+      uWindowFlags |= ES_WINDOW_HEADLESS;
+      bCreated = esCreateWindow ( &esContext, "Ghost Renderer", SCREEN_WIDTH, SCREEN_HEIGHT, uWindowFlags);
+   }
+
+   if ( !bCreated )
+   {
+      printf("Could not create a %s.\n", nHeadless ? "headless EGL context" : "window");
+      return 0;
+   }
 
    if ( !Init ( &esContext ) )
       return 0;
 
-   vbo = LoadOBJ(modelPaths[0], faces, nullptr);
-   texture = LoadBMP(texturePaths[0]);
+   SetupViews(nNumViews, nMirror, esContext.width, esContext.height);
+
+   if (s_dynRes.enabled)
+   {
+      s_dynRes.scale = s_dynRes.maxScale;
+      s_dynRes.smoothedFrameTime = s_dynRes.targetFrameTime;
+   }
+
+   // Offscreen targets are sized for the largest scale, lower scales
+   // render into a corner of them.
+   float fMaxScale = s_dynRes.enabled ? s_dynRes.maxScale : 1.0f;
+
+   if (replicateViews && numViews > 1)
+   {
+      SetupComposite(esContext.width, esContext.height);
+
+      if (!CreateRenderTarget(&s_replicaTarget,
+                              (int) (s_arViews[0].width * fMaxScale),
+                              (int) (s_arViews[0].height * fMaxScale)))
+      {
+         replicateViews = 0;
+      }
+   }
+   else
+   {
+      replicateViews = 0;
+   }
+
+   if (s_dynRes.enabled && !replicateViews)
+   {
+      if (!CreateRenderTarget(&s_sceneTarget,
+                              (int) (esContext.width * fMaxScale),
+                              (int) (esContext.height * fMaxScale)))
+      {
+         s_dynRes.enabled = 0;
+      }
+   }
+
+   LoadMesh(&s_currentMesh, pModelPath, pTexturePath);
+
+   if (nSceneInstances > 0)
+   {
+      BuildBenchmarkScene(nSceneInstances);
+   }
+
+   MotionInit(&s_motion,
+              (uint64_t) (s_fInterpDelay * 1e6f),
+              (uint64_t) (INTERP_MAX_EXTRAPOLATION_MS * 1e6f));
+
+   PublishStatus(&esContext, 0.0f);
+
+   // Followers take their state from the master, not a controller
+   if (s_bench.path == 0 && s_nSyncMode != SYNC_FOLLOWER)
+   {
+      // Without the file the renderer still runs, only uncaptured
+      if (pCapturePath != 0)
+         NetStartCapture(pCapturePath);
+
+      // Interpolation needs every sample, not only the newest
+      NetSetCoalescing(s_fInterpDelay <= 0.0f);
+
+      // Stopped from atexit like the trace, the thread must be joined
+      // before exit on every path
+      if (NetStart(SERVER_PORT))
+         atexit(NetStop);
+   }
+
+   // Every node given a port takes pushes, followers included, so each
+   // can be sent the models it is to show
+   if (s_bench.path == 0 && nAssetPort != 0 &&
+       AssetPushStart(nAssetPort, pAssetAddress, ASSET_PUSH_DIR))
+   {
+      atexit(AssetPushStop);
+   }
+
+   s_pDrawFrame = nHeadless ? DrawHeadless : Draw;
+
+   if (s_bench.path != 0 || s_nSyncMode == SYNC_OFF)
+   {
+      s_nSyncMode = SYNC_OFF;
+   }
+   else if (SyncStart(s_nSyncMode, pSyncGroup, nSyncPort, pSyncInterface,
+                      (uint64_t) (s_dynRes.targetFrameTime * 1e9f)))
+   {
+      atexit(SyncStop);
+   }
+   else
+   {
+      s_nSyncMode = SYNC_OFF;
+   }
+
+   esRegisterDrawFunc ( &esContext, (s_nSyncMode != SYNC_OFF) ? DrawSynced : s_pDrawFrame );
+   esRegisterUpdateFunc ( &esContext, Update );
+
+   s_pMainContext = &esContext;
+   signal(SIGINT, HandleQuitSignal);
+   signal(SIGTERM, HandleQuitSignal);
+
+   if (nHeadless)
+   {
+      s_pReadback = new GLubyte[esContext.width * esContext.height * 4];
 
-   InitServer();
+      ScopedMemoryAsset asset("readback");
+      MemoryTrack(MEMORY_HEAP, (uintptr_t) s_pReadback, esContext.width * esContext.height * 4);
 
-   esRegisterDrawFunc ( &esContext, Draw );
+      printf("Headless: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
 
-   esMainLoop ( &esContext );
+      double fStart = GetSeconds();
+      esMainLoop ( &esContext );
+      FinishRenderBench(&esContext);
+      double fElapsed = GetSeconds() - fStart;
 
-   close(serverSocket);
+      printf("Headless: %u frames, %2.3f ms/frame including readback\n",
+         s_nHeadlessFrame,
+         1000.0 * fElapsed / (s_nHeadlessFrame > 0 ? s_nHeadlessFrame : 1));
+
+      MemoryRelease(MEMORY_HEAP, (uintptr_t) s_pReadback);
+      delete[] s_pReadback;
+   }
+   else
+   {
+      esMainLoop ( &esContext );
+      FinishRenderBench(&esContext);
+   }
+
+   ProfilerReportTotal();
+   MemoryReport();
+
+   if (s_bench.path != 0)
+   {
+      WriteRenderBench(&esContext, pModelPath, nHeadless);
+      delete[] s_bench.frameTimes;
+   }
 }